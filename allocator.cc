@@ -0,0 +1,258 @@
+#include "allocator.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+static const u64 FRAME_ARENA_BLOCK_SIZE = 256 * KiB; // First block of every thread
+
+struct alignas(16) ArenaBlock {
+  ArenaBlock *previous;
+  u64 size; // Usable bytes, following the header
+  u64 used;
+};
+
+struct FrameArena {
+  ArenaBlock *current = nullptr;
+  u64 chainedBytes = 0; // Used bytes of the blocks behind `current`
+  u64 allocations = 0;  // Since the counters were last flushed
+  u64 peakBytes = 0;
+
+  ~FrameArena();
+};
+
+static std::atomic<u64> arenaAllocations{0};
+static std::atomic<u64> arenaPeakBytes{0};
+static std::atomic<u64> poolAllocations{0};
+static std::atomic<u64> poolLiveObjects{0};
+static std::atomic<u64> heapAllocations{0};
+
+static thread_local FrameArena arena;
+
+static ArenaBlock *arena_block_create(u64 size, ArenaBlock *previous) {
+  auto block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + size);
+  block->previous = previous;
+  block->size = size;
+  block->used = 0;
+  memory_stats_allocate(MEMORY_TAG_FRAME, MEMORY_DOMAIN_CPU, sizeof(ArenaBlock) + size);
+  heapAllocations.fetch_add(1, std::memory_order_relaxed);
+  return block;
+}
+
+static void arena_block_destroy(ArenaBlock *block) {
+  memory_stats_free(MEMORY_TAG_FRAME, MEMORY_DOMAIN_CPU, sizeof(ArenaBlock) + block->size);
+  free(block);
+}
+
+static void arena_note_peak(FrameArena *a) {
+  if (a->current) { a->peakBytes = std::max(a->peakBytes, a->chainedBytes + a->current->used); }
+}
+
+// Publishes the thread's counters, so the totals do not need an atomic per allocation
+static void arena_flush_stats(FrameArena *a) {
+  arenaAllocations.fetch_add(a->allocations, std::memory_order_relaxed);
+  a->allocations = 0;
+  auto peak = arenaPeakBytes.load(std::memory_order_relaxed);
+  while (peak < a->peakBytes &&
+         !arenaPeakBytes.compare_exchange_weak(peak, a->peakBytes, std::memory_order_relaxed)) {
+  }
+}
+
+FrameArena::~FrameArena() {
+  arena_note_peak(this);
+  arena_flush_stats(this);
+  while (current) {
+    auto previous = current->previous;
+    arena_block_destroy(current);
+    current = previous;
+  }
+}
+
+void *frame_arena_allocate(u64 size, u64 alignment) {
+  auto a = &arena;
+  if (auto block = a->current; block) {
+    // Aligned as an address, block data only starts at malloc's alignment
+    auto base = (u64)(block + 1);
+    auto offset = ((base + block->used + alignment - 1) & ~(alignment - 1)) - base;
+    if (offset + size <= block->size) {
+      block->used = offset + size;
+      ++a->allocations;
+      return (u8 *)(block + 1) + offset;
+    }
+  }
+  // Chain a larger block; the next reset merges the chain so this frame's size fits in one
+  u64 blockSize = FRAME_ARENA_BLOCK_SIZE;
+  if (a->current) {
+    blockSize = std::max(blockSize, a->current->size * 2);
+    a->chainedBytes += a->current->used;
+  }
+  a->current = arena_block_create(std::max(blockSize, size + alignment), a->current);
+  return frame_arena_allocate(size, alignment);
+}
+
+FrameArenaMark frame_arena_mark() {
+  auto a = &arena;
+  return {a->current, a->current ? a->current->used : 0};
+}
+
+void frame_arena_release(FrameArenaMark mark) {
+  auto a = &arena;
+  arena_note_peak(a);
+  while (a->current && a->current != mark.block) { // Blocks chained since the mark
+    auto previous = a->current->previous;
+    if (!previous) { // Marked before the thread's first block, which stays for reuse
+      a->current->used = 0;
+      return;
+    }
+    arena_block_destroy(a->current);
+    a->current = previous;
+    a->chainedBytes -= previous->used;
+  }
+  if (a->current) { a->current->used = mark.used; }
+}
+
+void frame_arena_reset() {
+  auto a = &arena;
+  if (!a->current) { return; }
+  arena_note_peak(a);
+  if (a->current->previous) {
+    u64 size = 0;
+    while (a->current) {
+      auto previous = a->current->previous;
+      size += a->current->size;
+      arena_block_destroy(a->current);
+      a->current = previous;
+    }
+    a->current = arena_block_create(size, nullptr);
+  }
+  a->current->used = 0;
+  a->chainedBytes = 0;
+  arena_flush_stats(a);
+}
+
+void allocator_get_stats(AllocatorStats *outStats) {
+  outStats->arenaAllocations = arenaAllocations.load(std::memory_order_relaxed);
+  outStats->arenaPeakBytes = arenaPeakBytes.load(std::memory_order_relaxed);
+  outStats->poolAllocations = poolAllocations.load(std::memory_order_relaxed);
+  outStats->poolLiveObjects = poolLiveObjects.load(std::memory_order_relaxed);
+  outStats->heapAllocations = heapAllocations.load(std::memory_order_relaxed);
+}
+
+void allocator_print_stats() {
+  AllocatorStats stats{};
+  allocator_get_stats(&stats);
+  printf("allocators: %llu arena allocations, peak %.1f KiB per frame; %llu pool allocations, "
+         "%llu live; %llu heap blocks\n",
+         (unsigned long long)stats.arenaAllocations, (f64)stats.arenaPeakBytes / KiB,
+         (unsigned long long)stats.poolAllocations, (unsigned long long)stats.poolLiveObjects,
+         (unsigned long long)stats.heapAllocations);
+}
+
+// Objects start one alignment unit into their block, after the link to the previous block
+static const u64 POOL_ALIGNMENT = alignof(std::max_align_t);
+
+MemoryPool::MemoryPool(const char *name, MemoryTag tag, u64 objectSize, u32 objectsPerBlock)
+    : _name{name}, _tag{tag}, _objectSize{(std::max(objectSize, (u64)sizeof(Node)) + POOL_ALIGNMENT - 1) &
+                               ~(POOL_ALIGNMENT - 1)},
+      _objectsPerBlock{objectsPerBlock} {}
+
+// Objects still alive go with their blocks, pools are meant to outlive their users
+MemoryPool::~MemoryPool() {
+  while (_blocks) {
+    auto previous = _blocks->next;
+    ::free(_blocks);
+    _blocks = previous;
+  }
+}
+
+void MemoryPool::grow() {
+  auto block = (u8 *)malloc(POOL_ALIGNMENT + _objectSize * _objectsPerBlock);
+  ((Node *)block)->next = _blocks;
+  _blocks = (Node *)block;
+  for (u32 i = _objectsPerBlock; i-- > 0;) { // Hand out the lowest addresses first
+    auto node = (Node *)(block + POOL_ALIGNMENT + i * _objectSize);
+    node->next = _freeList;
+    _freeList = node;
+  }
+  heapAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void *MemoryPool::allocate() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!_freeList) { grow(); }
+  auto node = _freeList;
+  _freeList = node->next;
+  ++_liveObjects;
+  poolAllocations.fetch_add(1, std::memory_order_relaxed);
+  poolLiveObjects.fetch_add(1, std::memory_order_relaxed);
+  memory_stats_allocate(_tag, MEMORY_DOMAIN_CPU, _objectSize);
+  return node;
+}
+
+void MemoryPool::free(void *object) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto node = (Node *)object;
+  node->next = _freeList;
+  _freeList = node;
+  --_liveObjects;
+  poolLiveObjects.fetch_sub(1, std::memory_order_relaxed);
+  memory_stats_free(_tag, MEMORY_DOMAIN_CPU, _objectSize);
+}
+
+RangeAllocator::RangeAllocator(u64 capacity) { reset(capacity); }
+
+bool RangeAllocator::allocate(u64 size, u64 *outOffset) {
+  if (size == 0) {
+    *outOffset = 0;
+    return true;
+  }
+  for (auto it = _free.begin(); it != _free.end(); ++it) {
+    if (it->size < size) { continue; }
+    *outOffset = it->offset;
+    it->offset += size;
+    it->size -= size;
+    if (it->size == 0) { _free.erase(it); }
+    _freeSize -= size;
+    return true;
+  }
+  return false;
+}
+
+void RangeAllocator::free(u64 offset, u64 size) {
+  if (size == 0) { return; }
+  auto next = std::lower_bound(_free.begin(), _free.end(), offset,
+                               [](const Range &range, u64 offset) { return range.offset < offset; });
+  _freeSize += size;
+  auto previous = next == _free.begin() ? _free.end() : std::prev(next);
+  auto mergesPrevious = previous != _free.end() && previous->offset + previous->size == offset;
+  auto mergesNext = next != _free.end() && offset + size == next->offset;
+  if (mergesPrevious && mergesNext) {
+    previous->size += size + next->size;
+    _free.erase(next);
+  } else if (mergesPrevious) {
+    previous->size += size;
+  } else if (mergesNext) {
+    next->offset = offset;
+    next->size += size;
+  } else {
+    _free.insert(next, {offset, size});
+  }
+}
+
+void RangeAllocator::reset(u64 capacity, u64 used) {
+  _capacity = capacity;
+  _freeSize = capacity - std::min(used, capacity);
+  _free.clear();
+  if (_freeSize > 0) { _free.push_back({capacity - _freeSize, _freeSize}); }
+}
+
+u64 RangeAllocator::largest_free_range() const {
+  u64 largest = 0;
+  for (const auto &range : _free) {
+    largest = std::max(largest, range.size);
+  }
+  return largest;
+}
+
+bool RangeAllocator::is_packed() const {
+  return _free.empty() || (_free.size() == 1 && _free[0].offset + _free[0].size == _capacity);
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "defines.h"
+#include "memory_stats.h"
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * Allocators for data that would otherwise hit malloc every frame.
+ *
+ * Every thread owns a frame arena: allocations bump a pointer and are all released together by
+ * `frame_arena_reset` once the thread's frame retires. When a frame outgrows the arena it chains
+ * another block, and the next reset folds the blocks into one of the combined size, so after a few
+ * frames the arena stops allocating. Nothing allocated from it may outlive the reset, and no
+ * destructors run.
+ *
+ * Pools hand out fixed-size objects from free lists, growing a block at a time. Their live objects
+ * are accounted under the pool's memory tag, arena blocks under MEMORY_TAG_FRAME.
+ *
+ * Range allocators hand out offsets into a resource they do not own, such as a GPU buffer.
+ */
+
+struct FrameArenaMark {
+  void *block;
+  u64 used;
+};
+
+void *frame_arena_allocate(u64 size, u64 alignment = 16);
+// Uninitialized storage for `count` objects
+template <typename T> T *frame_arena_allocate_array(u64 count) {
+  return (T *)frame_arena_allocate(count * sizeof(T), alignof(T));
+}
+// Scratch space: everything allocated after `frame_arena_mark` is released by the matching
+// `frame_arena_release`, which must run before the next reset
+FrameArenaMark frame_arena_mark();
+void frame_arena_release(FrameArenaMark mark);
+// Releases everything the calling thread allocated from its arena since the last reset
+void frame_arena_reset();
+
+struct AllocatorStats {
+  u64 arenaAllocations;
+  u64 arenaPeakBytes; // Most bytes one thread used between two resets
+  u64 poolAllocations;
+  u64 poolLiveObjects;
+  u64 heapAllocations; // Blocks the arenas and pools took from malloc
+};
+
+// Arena counts of running threads are included up to their last reset
+void allocator_get_stats(AllocatorStats *outStats);
+void allocator_print_stats();
+
+class MemoryPool {
+public:
+  MemoryPool(const char *name, MemoryTag tag, u64 objectSize, u32 objectsPerBlock);
+  ~MemoryPool();
+
+  MemoryPool(const MemoryPool &) = delete;
+  MemoryPool &operator=(const MemoryPool &) = delete;
+
+  void *allocate();
+  void free(void *object);
+
+private:
+  struct Node {
+    Node *next;
+  };
+
+  void grow();
+
+  const char *_name;
+  MemoryTag _tag;
+  u64 _objectSize;
+  u32 _objectsPerBlock;
+  std::mutex _mutex;
+  Node *_freeList = nullptr;
+  Node *_blocks = nullptr; // Each block starts with the link to the previous one
+  u64 _liveObjects = 0;
+};
+
+template <typename T> class ObjectPool {
+public:
+  ObjectPool(const char *name, MemoryTag tag, u32 objectsPerBlock = 64)
+      : _pool{name, tag, sizeof(T), objectsPerBlock} {
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned pool object");
+  }
+
+  template <typename... Args> T *create(Args &&...args) {
+    return new (_pool.allocate()) T(std::forward<Args>(args)...);
+  }
+
+  void destroy(T *object) {
+    object->~T();
+    _pool.free(object);
+  }
+
+private:
+  MemoryPool _pool;
+};
+
+// First fit over the free ranges, which are kept sorted and merged with their neighbours on free.
+// Sizes and offsets are in whatever unit the caller uses. Not thread-safe.
+class RangeAllocator {
+public:
+  explicit RangeAllocator(u64 capacity = 0);
+
+  bool allocate(u64 size, u64 *outOffset);
+  void free(u64 offset, u64 size);
+  // Forgets every range: [0, used) is taken, the rest up to `capacity` is free
+  void reset(u64 capacity, u64 used = 0);
+
+  u64 capacity() const { return _capacity; }
+  u64 free_size() const { return _freeSize; }
+  u64 largest_free_range() const;
+  u32 free_range_count() const { return (u32)_free.size(); }
+  // Whether everything allocated lies before all the free space
+  bool is_packed() const;
+
+private:
+  struct Range {
+    u64 offset;
+    u64 size;
+  };
+
+  std::vector<Range> _free; // By offset, never adjacent
+  u64 _capacity = 0;
+  u64 _freeSize = 0;
+};
@@ -0,0 +1,401 @@
+#include "animation.h"
+#include "allocator.h"
+#include "job_system.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const u32 ANIMATION_INSTANCES_PER_JOB = 8;
+static const f32 ANIMATION_ROTATION_SCALE = 32767.0f;
+
+// ANIMATION_LANES joints of one pose row
+#if defined(__AVX2__)
+typedef __m256 Lanes;
+static inline Lanes lanes_set(f32 a) { return _mm256_set1_ps(a); }
+static inline Lanes lanes_load(const f32 *p) { return _mm256_load_ps(p); }
+static inline void lanes_store(f32 *p, Lanes a) { _mm256_store_ps(p, a); }
+static inline Lanes lanes_load_i16(const i16 *p) {
+  return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)p)));
+}
+static inline Lanes lanes_load_u16(const u16 *p) {
+  return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p)));
+}
+static inline Lanes lanes_add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+static inline Lanes lanes_sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+static inline Lanes lanes_mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+static inline Lanes lanes_div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+static inline Lanes lanes_sqrt(Lanes a) { return _mm256_sqrt_ps(a); }
+// `a` with its sign flipped in the lanes where `b` is negative
+static inline Lanes lanes_flip_sign(Lanes a, Lanes b) {
+  return _mm256_xor_ps(a, _mm256_and_ps(b, _mm256_set1_ps(-0.0f)));
+}
+#elif defined(__SSE2__)
+typedef __m128 Lanes;
+static inline Lanes lanes_set(f32 a) { return _mm_set1_ps(a); }
+static inline Lanes lanes_load(const f32 *p) { return _mm_load_ps(p); }
+static inline void lanes_store(f32 *p, Lanes a) { _mm_store_ps(p, a); }
+static inline Lanes lanes_load_i16(const i16 *p) {
+  auto v = _mm_loadl_epi64((const __m128i *)p);
+  return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)); // Sign-extends
+}
+static inline Lanes lanes_load_u16(const u16 *p) {
+  auto v = _mm_loadl_epi64((const __m128i *)p);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, _mm_setzero_si128()));
+}
+static inline Lanes lanes_add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes lanes_sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes lanes_mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes lanes_div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+static inline Lanes lanes_sqrt(Lanes a) { return _mm_sqrt_ps(a); }
+static inline Lanes lanes_flip_sign(Lanes a, Lanes b) {
+  return _mm_xor_ps(a, _mm_and_ps(b, _mm_set1_ps(-0.0f)));
+}
+#else
+struct Lanes {
+  f32 v[ANIMATION_LANES];
+};
+static inline Lanes lanes_set(f32 a) {
+  Lanes r;
+  std::fill(r.v, r.v + ANIMATION_LANES, a);
+  return r;
+}
+static inline Lanes lanes_load(const f32 *p) {
+  Lanes r;
+  memcpy(r.v, p, sizeof(r.v));
+  return r;
+}
+static inline void lanes_store(f32 *p, Lanes a) { memcpy(p, a.v, sizeof(a.v)); }
+template <typename T> static inline Lanes lanes_convert(const T *p) {
+  Lanes r;
+  for (u32 i = 0; i < ANIMATION_LANES; ++i) {
+    r.v[i] = (f32)p[i];
+  }
+  return r;
+}
+static inline Lanes lanes_load_i16(const i16 *p) { return lanes_convert(p); }
+static inline Lanes lanes_load_u16(const u16 *p) { return lanes_convert(p); }
+#define LANES_OP(name, expression)                                                                 \
+  static inline Lanes name(Lanes a, Lanes b) {                                                     \
+    Lanes r;                                                                                       \
+    for (u32 i = 0; i < ANIMATION_LANES; ++i) {                                                    \
+      r.v[i] = expression;                                                                         \
+    }                                                                                              \
+    return r;                                                                                      \
+  }
+LANES_OP(lanes_add, a.v[i] + b.v[i])
+LANES_OP(lanes_sub, a.v[i] - b.v[i])
+LANES_OP(lanes_mul, a.v[i] * b.v[i])
+LANES_OP(lanes_div, a.v[i] / b.v[i])
+LANES_OP(lanes_flip_sign, std::signbit(b.v[i]) ? -a.v[i] : a.v[i])
+#undef LANES_OP
+static inline Lanes lanes_sqrt(Lanes a) {
+  for (auto &v : a.v) {
+    v = sqrtf(v);
+  }
+  return a;
+}
+#endif
+
+static inline Lanes lanes_lerp(Lanes a, Lanes b, Lanes t) {
+  return lanes_add(a, lanes_mul(lanes_sub(b, a), t));
+}
+
+static inline Lanes lanes_dot4(const Lanes a[4], const Lanes b[4]) {
+  return lanes_add(lanes_add(lanes_mul(a[0], b[0]), lanes_mul(a[1], b[1])),
+                   lanes_add(lanes_mul(a[2], b[2]), lanes_mul(a[3], b[3])));
+}
+
+// Interpolates quaternions along the shorter arc and renormalizes them (nlerp), which needs no
+// trigonometry and is close enough to slerp between nearby keys
+static inline void lanes_nlerp(const Lanes a[4], Lanes b[4], Lanes t, Lanes out[4]) {
+  auto dot = lanes_dot4(a, b);
+  for (u32 c = 0; c < 4; ++c) {
+    out[c] = lanes_lerp(a[c], lanes_flip_sign(b[c], dot), t);
+  }
+  auto inverseLength = lanes_div(lanes_set(1.0f), lanes_sqrt(lanes_dot4(out, out)));
+  for (u32 c = 0; c < 4; ++c) {
+    out[c] = lanes_mul(out[c], inverseLength);
+  }
+}
+
+// Affine transform as four columns, the last one the translation; w is ignored
+#if defined(__SSE2__)
+struct Affine {
+  __m128 columns[4];
+};
+
+static inline Affine affine_load(const f32 *m) { // Column-major 4x4
+  return {{_mm_loadu_ps(m), _mm_loadu_ps(m + 4), _mm_loadu_ps(m + 8), _mm_loadu_ps(m + 12)}};
+}
+
+static inline Affine affine_mul(const Affine &a, const f32 b[4][3]) {
+  Affine r;
+  for (u32 i = 0; i < 3; ++i) {
+    r.columns[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.columns[0], _mm_set1_ps(b[i][0])),
+                                         _mm_mul_ps(a.columns[1], _mm_set1_ps(b[i][1]))),
+                              _mm_mul_ps(a.columns[2], _mm_set1_ps(b[i][2])));
+  }
+  r.columns[3] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.columns[0], _mm_set1_ps(b[3][0])),
+                                       _mm_mul_ps(a.columns[1], _mm_set1_ps(b[3][1]))),
+                            _mm_add_ps(_mm_mul_ps(a.columns[2], _mm_set1_ps(b[3][2])),
+                                       a.columns[3]));
+  return r;
+}
+
+static inline void affine_store_rows(const Affine &a, f32 *out) {
+  auto c0 = a.columns[0], c1 = a.columns[1], c2 = a.columns[2], c3 = a.columns[3];
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+  _mm_storeu_ps(out, c0);
+  _mm_storeu_ps(out + 4, c1);
+  _mm_storeu_ps(out + 8, c2);
+}
+#else
+struct Affine {
+  f32 columns[4][4];
+};
+
+static inline Affine affine_load(const f32 *m) {
+  Affine r;
+  memcpy(r.columns, m, sizeof(r.columns));
+  return r;
+}
+
+static inline Affine affine_mul(const Affine &a, const f32 b[4][3]) {
+  Affine r;
+  for (u32 i = 0; i < 4; ++i) {
+    for (u32 row = 0; row < 4; ++row) {
+      r.columns[i][row] = a.columns[0][row] * b[i][0] + a.columns[1][row] * b[i][1] +
+                          a.columns[2][row] * b[i][2] + (i == 3 ? a.columns[3][row] : 0.0f);
+    }
+  }
+  return r;
+}
+
+static inline void affine_store_rows(const Affine &a, f32 *out) {
+  for (u32 row = 0; row < 3; ++row) {
+    for (u32 i = 0; i < 4; ++i) {
+      out[row * 4 + i] = a.columns[i][row];
+    }
+  }
+}
+#endif
+
+static u32 lane_count(u32 jointCount) {
+  return (jointCount + ANIMATION_LANES - 1) / ANIMATION_LANES * ANIMATION_LANES;
+}
+
+void skeleton_create(Skeleton *skeleton, const i32 *parents, const f32 *inverseBind,
+                     u32 jointCount) {
+  skeleton->jointCount = jointCount;
+  skeleton->laneCount = lane_count(jointCount);
+  skeleton->parents.assign(parents, parents + jointCount);
+  skeleton->inverseBind.assign(inverseBind, inverseBind + jointCount * 16);
+}
+
+void animation_clip_create(AnimationClip *clip, const Skeleton &skeleton, const f32 *rotations,
+                           const f32 *translations, u32 frameCount, f32 frameRate) {
+  auto jointCount = skeleton.jointCount;
+  auto n = skeleton.laneCount;
+  clip->laneCount = n;
+  clip->frameCount = frameCount;
+  clip->frameRate = frameRate;
+
+  for (u32 c = 0; c < 3; ++c) {
+    auto low = INFINITY, high = -INFINITY;
+    for (u32 i = 0; i < frameCount * jointCount; ++i) {
+      low = std::min(low, translations[i * 3 + c]);
+      high = std::max(high, translations[i * 3 + c]);
+    }
+    if (frameCount * jointCount == 0) { low = high = 0.0f; }
+    clip->translationMin[c] = low;
+    clip->translationStep[c] = (high - low) / 65535.0f;
+  }
+
+  // Padding lanes hold the identity, so normalizing them stays finite
+  clip->rotations.assign((u64)frameCount * 4 * n, 0);
+  clip->translations.assign((u64)frameCount * 3 * n, 0);
+  for (u32 frame = 0; frame < frameCount; ++frame) {
+    auto rotationRows = &clip->rotations[(u64)frame * 4 * n];
+    auto translationRows = &clip->translations[(u64)frame * 3 * n];
+    for (u32 joint = 0; joint < n; ++joint) {
+      if (joint >= jointCount) {
+        rotationRows[3 * n + joint] = (i16)ANIMATION_ROTATION_SCALE;
+        continue;
+      }
+      auto key = (u64)frame * jointCount + joint;
+      for (u32 c = 0; c < 4; ++c) {
+        auto value = rotations[key * 4 + c] * ANIMATION_ROTATION_SCALE;
+        rotationRows[c * n + joint] = (i16)std::clamp(lroundf(value), -32767l, 32767l);
+      }
+      for (u32 c = 0; c < 3; ++c) {
+        auto step = clip->translationStep[c];
+        auto q = step > 0.0f ? (translations[key * 3 + c] - clip->translationMin[c]) / step : 0.0f;
+        translationRows[c * n + joint] = (u16)std::clamp(lroundf(q), 0l, 65535l);
+      }
+    }
+  }
+}
+
+f32 animation_clip_duration(const AnimationClip &clip) {
+  return (f32)clip.frameCount / clip.frameRate;
+}
+
+u64 animation_clip_bytes(const AnimationClip &clip) {
+  return clip.rotations.size() * sizeof(i16) + clip.translations.size() * sizeof(u16);
+}
+
+void animation_sample(const AnimationClip &clip, f32 time, f32 *outPose) {
+  auto position = time * clip.frameRate;
+  position -= floorf(position / (f32)clip.frameCount) * (f32)clip.frameCount;
+  auto frame = std::min((u32)position, clip.frameCount - 1);
+  auto next = frame + 1 < clip.frameCount ? frame + 1 : 0;
+  auto t = lanes_set(position - (f32)frame);
+  auto n = clip.laneCount;
+  auto rotationsA = &clip.rotations[(u64)frame * 4 * n];
+  auto rotationsB = &clip.rotations[(u64)next * 4 * n];
+  auto translationsA = &clip.translations[(u64)frame * 3 * n];
+  auto translationsB = &clip.translations[(u64)next * 3 * n];
+  Lanes translationMin[3], translationStep[3];
+  for (u32 c = 0; c < 3; ++c) {
+    translationMin[c] = lanes_set(clip.translationMin[c]);
+    translationStep[c] = lanes_set(clip.translationStep[c]);
+  }
+
+  for (u32 i = 0; i < n; i += ANIMATION_LANES) {
+    // Still scaled by 32767, which the normalization takes out
+    Lanes a[4], b[4], q[4];
+    for (u32 c = 0; c < 4; ++c) {
+      a[c] = lanes_load_i16(rotationsA + c * n + i);
+      b[c] = lanes_load_i16(rotationsB + c * n + i);
+    }
+    lanes_nlerp(a, b, t, q);
+    for (u32 c = 0; c < 4; ++c) {
+      lanes_store(outPose + c * n + i, q[c]);
+    }
+    for (u32 c = 0; c < 3; ++c) {
+      auto steps = lanes_lerp(lanes_load_u16(translationsA + c * n + i),
+                              lanes_load_u16(translationsB + c * n + i), t);
+      lanes_store(outPose + (4 + c) * n + i,
+                  lanes_add(translationMin[c], lanes_mul(steps, translationStep[c])));
+    }
+  }
+}
+
+void animation_blend(const f32 *poseA, const f32 *poseB, f32 weight, u32 laneCount,
+                     f32 *outPose) {
+  auto n = laneCount;
+  auto t = lanes_set(weight);
+  for (u32 i = 0; i < n; i += ANIMATION_LANES) {
+    Lanes a[4], b[4], q[4];
+    for (u32 c = 0; c < 4; ++c) {
+      a[c] = lanes_load(poseA + c * n + i);
+      b[c] = lanes_load(poseB + c * n + i);
+    }
+    lanes_nlerp(a, b, t, q);
+    for (u32 c = 0; c < 4; ++c) {
+      lanes_store(outPose + c * n + i, q[c]);
+    }
+    for (u32 c = 4; c < ANIMATION_POSE_ROWS; ++c) {
+      lanes_store(outPose + c * n + i,
+                  lanes_lerp(lanes_load(poseA + c * n + i), lanes_load(poseB + c * n + i), t));
+    }
+  }
+}
+
+void animation_skin(const Skeleton &skeleton, const f32 *pose, const f32 *model,
+                    f32 *outMatrices) {
+  auto n = skeleton.laneCount;
+  auto mark = frame_arena_mark();
+  // Local transforms, 12 rows: the columns of the rotation matrices, then the translations
+  auto local = (f32 *)frame_arena_allocate(12 * n * sizeof(f32), 32);
+  auto one = lanes_set(1.0f), two = lanes_set(2.0f);
+  for (u32 i = 0; i < n; i += ANIMATION_LANES) {
+    auto x = lanes_load(pose + i), y = lanes_load(pose + n + i);
+    auto z = lanes_load(pose + 2 * n + i), w = lanes_load(pose + 3 * n + i);
+    auto x2 = lanes_mul(x, two), y2 = lanes_mul(y, two), z2 = lanes_mul(z, two);
+    auto xx = lanes_mul(x, x2), yy = lanes_mul(y, y2), zz = lanes_mul(z, z2);
+    auto xy = lanes_mul(x, y2), xz = lanes_mul(x, z2), yz = lanes_mul(y, z2);
+    auto wx = lanes_mul(w, x2), wy = lanes_mul(w, y2), wz = lanes_mul(w, z2);
+    const Lanes rows[9] = {
+        lanes_sub(one, lanes_add(yy, zz)), lanes_add(xy, wz), lanes_sub(xz, wy),
+        lanes_sub(xy, wz), lanes_sub(one, lanes_add(xx, zz)), lanes_add(yz, wx),
+        lanes_add(xz, wy), lanes_sub(yz, wx), lanes_sub(one, lanes_add(xx, yy)),
+    };
+    for (u32 row = 0; row < 9; ++row) {
+      lanes_store(local + row * n + i, rows[row]);
+    }
+    for (u32 row = 0; row < 3; ++row) {
+      lanes_store(local + (9 + row) * n + i, lanes_load(pose + (4 + row) * n + i));
+    }
+  }
+
+  // Parents come first, so one pass composes the hierarchy
+  auto world = frame_arena_allocate_array<Affine>(skeleton.jointCount);
+  auto root = affine_load(model);
+  for (u32 joint = 0; joint < skeleton.jointCount; ++joint) {
+    f32 columns[4][3];
+    for (u32 row = 0; row < 12; ++row) {
+      columns[row / 3][row % 3] = local[row * n + joint];
+    }
+    auto parent = skeleton.parents[joint];
+    world[joint] = affine_mul(parent < 0 ? root : world[parent], columns);
+
+    auto inverseBind = &skeleton.inverseBind[joint * 16];
+    for (u32 column = 0; column < 4; ++column) {
+      memcpy(columns[column], inverseBind + column * 4, sizeof(columns[column]));
+    }
+    affine_store_rows(affine_mul(world[joint], columns),
+                      outMatrices + joint * ANIMATION_MATRIX_FLOATS);
+  }
+  frame_arena_release(mark);
+}
+
+struct AnimationJob {
+  const Skeleton *skeleton;
+  const AnimationClip *clips;
+  const AnimationInstance *instances;
+  u32 instanceCount;
+  f32 *outMatrices;
+};
+
+static void animate_instances(u32 index, u32 worker, void *userData) {
+  auto job = (const AnimationJob *)userData;
+  const auto &skeleton = *job->skeleton;
+  auto poseFloats = ANIMATION_POSE_ROWS * skeleton.laneCount;
+  auto mark = frame_arena_mark();
+  auto poses = (f32 *)frame_arena_allocate(3 * poseFloats * sizeof(f32), 32);
+  auto last = std::min((index + 1) * ANIMATION_INSTANCES_PER_JOB, job->instanceCount);
+  for (auto i = index * ANIMATION_INSTANCES_PER_JOB; i < last; ++i) {
+    const auto &instance = job->instances[i];
+    auto pose = poses;
+    animation_sample(job->clips[instance.clips[0]], instance.times[0], pose);
+    if (instance.blend > 0.0f) {
+      animation_sample(job->clips[instance.clips[1]], instance.times[1], poses + poseFloats);
+      pose = poses + 2 * poseFloats;
+      animation_blend(poses, poses + poseFloats, instance.blend, skeleton.laneCount, pose);
+    }
+    animation_skin(skeleton, pose, instance.model,
+                   job->outMatrices + (u64)i * skeleton.jointCount * ANIMATION_MATRIX_FLOATS);
+  }
+  frame_arena_release(mark);
+}
+
+void animation_update(void *jobSystemState, const Skeleton &skeleton, const AnimationClip *clips,
+                      const AnimationInstance *instances, u32 instanceCount, f32 *outMatrices) {
+  PROFILE_ZONE("animation/update");
+  AnimationJob job{&skeleton, clips, instances, instanceCount, outMatrices};
+  auto jobCount = (instanceCount + ANIMATION_INSTANCES_PER_JOB - 1) / ANIMATION_INSTANCES_PER_JOB;
+  if (jobSystemState) {
+    job_system_parallel_for(jobSystemState, jobCount, animate_instances, &job);
+  } else {
+    for (u32 i = 0; i < jobCount; ++i) {
+      animate_instances(i, 0, &job);
+    }
+  }
+}
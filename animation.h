@@ -0,0 +1,74 @@
+#pragma once
+
+#include "defines.h"
+#include <vector>
+
+/**
+ * Skeletal animation. Clips hold keyframes at a fixed rate, quantized to 16 bits and stored as
+ * structures of arrays: each keyframe is one row per rotation and translation component, with that
+ * component of every joint side by side. Sampling, blending and building the joint matrices then
+ * process ANIMATION_LANES joints per instruction. Poses use the same rows in floats: the rotation
+ * quaternion's x, y, z and w followed by the translation's x, y and z, relative to the parent.
+ *
+ * Skinning matrices come out as the three rows of an affine 3x4 matrix per joint, placing the
+ * bind-pose mesh in the world, for a vertex shader to fetch per instance.
+ */
+
+#if defined(__AVX2__)
+static const u32 ANIMATION_LANES = 8;
+#else
+static const u32 ANIMATION_LANES = 4;
+#endif
+static const u32 ANIMATION_POSE_ROWS = 7;
+static const u32 ANIMATION_MATRIX_FLOATS = 12; // Per joint
+
+struct Skeleton {
+  u32 jointCount;
+  u32 laneCount; // Joints rounded up to ANIMATION_LANES, the length of a row
+  std::vector<i32> parents; // -1 for roots; parents come before their children
+  std::vector<f32> inverseBind; // Column-major 4x4 per joint, model space to joint space
+};
+
+struct AnimationClip {
+  u32 laneCount;
+  u32 frameCount; // Looping clips blend the last keyframe back into the first
+  f32 frameRate;
+  f32 translationMin[3]; // Translations are quantized over this box
+  f32 translationStep[3];
+  std::vector<i16> rotations;    // 4 rows per keyframe, unit quaternions times 32767
+  std::vector<u16> translations; // 3 rows per keyframe
+};
+
+// An animated skeleton, e.g. one character of a crowd
+struct AnimationInstance {
+  f32 model[16]; // Column-major, placing the skeleton in the world
+  u32 clips[2];
+  f32 times[2]; // Seconds into each clip
+  f32 blend;    // Weight of the second clip, 0 to sample only the first
+};
+
+// `parents` and `inverseBind` as in Skeleton, for `jointCount` joints
+void skeleton_create(Skeleton *skeleton, const i32 *parents, const f32 *inverseBind,
+                     u32 jointCount);
+// Quantizes keyframes given per frame and joint: a unit quaternion (x, y, z, w) and a translation
+void animation_clip_create(AnimationClip *clip, const Skeleton &skeleton, const f32 *rotations,
+                           const f32 *translations, u32 frameCount, f32 frameRate);
+f32 animation_clip_duration(const AnimationClip &clip);
+// Bytes of the quantized keyframes
+u64 animation_clip_bytes(const AnimationClip &clip);
+
+// Poses are ANIMATION_POSE_ROWS rows of the skeleton's `laneCount` floats, 32-byte aligned
+void animation_sample(const AnimationClip &clip, f32 time, f32 *outPose); // Loops
+void animation_blend(const f32 *poseA, const f32 *poseB, f32 weight, u32 laneCount, f32 *outPose);
+// ANIMATION_MATRIX_FLOATS per joint: `model` times the joint's model-space transform times its
+// inverse bind matrix
+void animation_skin(const Skeleton &skeleton, const f32 *pose, const f32 *model,
+                    f32 *outMatrices);
+
+/**
+ * Samples, blends and skins every instance, spread over the job system's threads, or inline when
+ * `jobSystemState` is null. Instance `i` writes the `jointCount` matrices at
+ * `outMatrices + i * jointCount * ANIMATION_MATRIX_FLOATS`.
+ */
+void animation_update(void *jobSystemState, const Skeleton &skeleton, const AnimationClip *clips,
+                      const AnimationInstance *instances, u32 instanceCount, f32 *outMatrices);
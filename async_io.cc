@@ -0,0 +1,445 @@
+#include "async_io.h"
+#include "logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ASYNC_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+static const u32 ASYNC_IO_WORKERS = 4;           // Of the fallback, one request in flight each
+static const u64 ASYNC_IO_MAX_TRANSFER = 1 << 30; // Per operation, larger requests take several
+static const u32 ASYNC_IO_BUSY_RETRIES = 8;       // Of a refused submit, 1 ms apart, before failing
+
+enum AsyncIoOp : u8 {
+  ASYNC_IO_OP_READ = 0x0,
+  ASYNC_IO_OP_WRITE,
+};
+
+struct AsyncIoRequest {
+  AsyncIoOp op;
+  i32 handle;
+  u64 offset;
+  u64 size;
+  u64 done; // Bytes transferred so far
+  u8 *buffer;
+  PFN_on_io_complete onComplete;
+  void *userData;
+};
+
+#if defined(ASYNC_IO_URING)
+// The rings shared with the kernel, as io_uring_setup(2) lays them out
+struct IoUring {
+  i32 fd;
+  void *sqRing;
+  u64 sqRingSize;
+  void *cqRing; // Same mapping as `sqRing` with IORING_FEAT_SINGLE_MMAP
+  u64 cqRingSize;
+  io_uring_sqe *sqes;
+  u64 sqesSize;
+  u32 *sqTail;
+  u32 sqMask;
+  u32 *sqArray;
+  u32 *cqHead;
+  u32 *cqTail;
+  u32 cqMask;
+  io_uring_cqe *cqes;
+  u32 unsubmitted; // Entries pushed that the kernel did not consume yet, under the mutex
+  u32 submitted;   // Consumed by the kernel, completion not yet reaped, under the mutex
+};
+#endif
+
+struct AsyncIoState {
+  u32 queueDepth;
+  bool ioUring;
+  std::mutex mutex;
+  std::condition_variable wake; // Requests were submitted, or shutdown
+  std::condition_variable idle; // A request completed
+  std::deque<AsyncIoRequest> queued;  // Until the next submit
+  std::deque<AsyncIoRequest> waiting; // Submitted, for a ring slot or a worker
+  u32 inFlight;                       // Taken out of `waiting`, callback not yet returned
+  bool quit;
+  std::vector<std::thread> workers;
+#if defined(ASYNC_IO_URING)
+  IoUring ring;
+  i32 ringError;                     // Negative errno once io_uring_enter failed, 0 until then
+  std::vector<AsyncIoRequest> slots; // In the ring, by user_data - 1
+  std::vector<u32> freeSlots;
+  std::thread reaper;
+#endif
+};
+
+static void finish_request(AsyncIoState *s, const AsyncIoRequest &request, i64 result) {
+  request.onComplete(request.userData, result);
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    --s->inFlight;
+  }
+  s->idle.notify_all();
+}
+
+static void worker_main(AsyncIoState *s) {
+  for (;;) {
+    AsyncIoRequest request;
+    {
+      std::unique_lock<std::mutex> lock(s->mutex);
+      s->wake.wait(lock, [s] { return s->quit || !s->waiting.empty(); });
+      if (s->waiting.empty()) { return; }
+      request = s->waiting.front();
+      s->waiting.pop_front();
+      ++s->inFlight;
+    }
+    i64 result = 0;
+    while (request.done < request.size) {
+      auto size = request.size - request.done;
+      auto offset = (off_t)(request.offset + request.done);
+      auto bytes = request.op == ASYNC_IO_OP_READ
+                       ? pread(request.handle, request.buffer + request.done, size, offset)
+                       : pwrite(request.handle, request.buffer + request.done, size, offset);
+      if (bytes < 0 && errno == EINTR) { continue; }
+      if (bytes <= 0) {
+        result = bytes < 0 ? -errno : 0;
+        break;
+      }
+      request.done += bytes;
+    }
+    finish_request(s, request, result < 0 ? result : (i64)request.done);
+  }
+}
+
+#if defined(ASYNC_IO_URING)
+static void ring_unmap(IoUring *r) {
+  if (r->sqes) { munmap(r->sqes, r->sqesSize); }
+  if (r->cqRing && r->cqRing != r->sqRing) { munmap(r->cqRing, r->cqRingSize); }
+  if (r->sqRing) { munmap(r->sqRing, r->sqRingSize); }
+  close(r->fd);
+}
+
+static void *ring_map(i32 fd, u64 size, u64 offset) {
+  auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  return memory == MAP_FAILED ? nullptr : memory;
+}
+
+static bool ring_initialize(IoUring *r, u32 entries) {
+  io_uring_params params{};
+  *r = {};
+  r->fd = (i32)syscall(__NR_io_uring_setup, entries, &params);
+  if (r->fd < 0) { return false; }
+  // IORING_OP_READ and IORING_OP_WRITE came in the same kernel, 5.6, as this feature
+  if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+    close(r->fd);
+    return false;
+  }
+  r->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(u32);
+  r->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  auto singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMap) { r->sqRingSize = r->cqRingSize = std::max(r->sqRingSize, r->cqRingSize); }
+  r->sqRing = ring_map(r->fd, r->sqRingSize, IORING_OFF_SQ_RING);
+  r->cqRing = singleMap ? r->sqRing : ring_map(r->fd, r->cqRingSize, IORING_OFF_CQ_RING);
+  r->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  r->sqes = (io_uring_sqe *)ring_map(r->fd, r->sqesSize, IORING_OFF_SQES);
+  if (!r->sqRing || !r->cqRing || !r->sqes) {
+    ring_unmap(r);
+    return false;
+  }
+  auto sq = (u8 *)r->sqRing, cq = (u8 *)r->cqRing;
+  r->sqTail = (u32 *)(sq + params.sq_off.tail);
+  r->sqMask = *(u32 *)(sq + params.sq_off.ring_mask);
+  r->sqArray = (u32 *)(sq + params.sq_off.array);
+  r->cqHead = (u32 *)(cq + params.cq_off.head);
+  r->cqTail = (u32 *)(cq + params.cq_off.tail);
+  r->cqMask = *(u32 *)(cq + params.cq_off.ring_mask);
+  r->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+  return true;
+}
+
+// Returns how many entries the kernel consumed, or a negative errno
+static i32 ring_enter(IoUring *r, u32 submit, u32 waitFor) {
+  auto flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0u;
+  for (;;) {
+    auto result = syscall(__NR_io_uring_enter, r->fd, submit, waitFor, flags, nullptr, 0);
+    if (result >= 0) { return (i32)result; }
+    if (errno != EINTR) { return -errno; }
+  }
+}
+
+// Writes the next operation of the request into the submission queue, the mutex held
+static void ring_push(IoUring *r, u32 *tail, const AsyncIoRequest &request, u64 userData) {
+  auto index = *tail & r->sqMask;
+  auto sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = userData;
+  sqe->opcode = request.op == ASYNC_IO_OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+  sqe->fd = request.handle;
+  sqe->off = request.offset + request.done;
+  sqe->addr = (u64)(uintptr_t)(request.buffer + request.done);
+  sqe->len = (u32)std::min(request.size - request.done, ASYNC_IO_MAX_TRANSFER);
+  r->sqArray[index] = index;
+  ++*tail;
+}
+
+/**
+ * Stops using the ring once io_uring_enter failed: the entries the kernel did not consume are
+ * taken back and, with the waiting requests, moved to `outFailed`; the mutex held
+ * @param abandon also give up on the requests in the kernel, whose completions cannot be reaped
+ */
+static void ring_fail(AsyncIoState *s, i32 error, bool abandon,
+                      std::vector<AsyncIoRequest> *outFailed) {
+  auto r = &s->ring;
+  if (s->ringError == 0) {
+    LOG_ERROR("io_uring_enter failed: %d", -error);
+    s->ringError = error;
+  }
+  auto tail = *r->sqTail; // The kernel only reads it when entered
+  for (; r->unsubmitted > 0; --r->unsubmitted) {
+    auto slot = (u32)r->sqes[--tail & r->sqMask].user_data - 1;
+    outFailed->push_back(s->slots[slot]);
+    s->freeSlots.push_back(slot);
+  }
+  __atomic_store_n(r->sqTail, tail, __ATOMIC_RELEASE);
+  if (abandon) {
+    std::vector<bool> free(s->slots.size());
+    for (auto slot : s->freeSlots) { free[slot] = true; }
+    for (u32 slot = 0; slot < s->slots.size(); ++slot) {
+      if (free[slot]) { continue; }
+      outFailed->push_back(s->slots[slot]);
+      s->freeSlots.push_back(slot);
+    }
+    r->submitted = 0;
+  }
+  for (; !s->waiting.empty(); s->waiting.pop_front()) {
+    outFailed->push_back(s->waiting.front());
+    ++s->inFlight;
+  }
+}
+
+/**
+ * Moves waiting requests into free slots of the ring and hands them to the kernel as one batch,
+ * along with the entries it did not consume before; the mutex held. Once the ring failed, the
+ * requests go to `outFailed` instead, to be finished with `ringError` after the mutex is released.
+ */
+static void ring_submit(AsyncIoState *s, std::vector<AsyncIoRequest> *outFailed) {
+  auto r = &s->ring;
+  if (s->ringError != 0) {
+    ring_fail(s, s->ringError, false, outFailed);
+    return;
+  }
+  auto tail = *r->sqTail; // Only ever written under the mutex
+  while (!s->waiting.empty() && !s->freeSlots.empty()) {
+    auto slot = s->freeSlots.back();
+    s->freeSlots.pop_back();
+    s->slots[slot] = s->waiting.front();
+    s->waiting.pop_front();
+    ring_push(r, &tail, s->slots[slot], slot + 1);
+    ++s->inFlight;
+    ++r->unsubmitted;
+  }
+  __atomic_store_n(r->sqTail, tail, __ATOMIC_RELEASE);
+  u32 retries = 0;
+  while (r->unsubmitted > 0) {
+    auto result = ring_enter(r, r->unsubmitted, 0);
+    if (result > 0) {
+      r->unsubmitted -= result;
+      r->submitted += result;
+      continue;
+    }
+    // Short of resources, the rest goes in with the submit that follows the next completion
+    auto busy = result == 0 || result == -EAGAIN || result == -EBUSY;
+    if (busy && r->submitted > 0) { return; }
+    if (busy && retries++ < ASYNC_IO_BUSY_RETRIES) { // No completion to wait for, but time may do
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    ring_fail(s, busy ? -EAGAIN : result, false, outFailed);
+    return;
+  }
+}
+
+static void finish_failed(AsyncIoState *s, std::vector<AsyncIoRequest> *failed, i64 error) {
+  for (const auto &request : *failed) {
+    finish_request(s, request, error);
+  }
+  failed->clear();
+}
+
+static void reaper_main(AsyncIoState *s) {
+  auto r = &s->ring;
+  std::vector<AsyncIoRequest> failed;
+  for (;;) {
+    {
+      // Waits in the kernel only for requests there, whose completions are sure to come
+      std::unique_lock<std::mutex> lock(s->mutex);
+      s->wake.wait(lock, [s, r] { return s->quit || s->ringError != 0 || r->submitted > 0; });
+      if (r->submitted == 0) { return; } // Shutdown, or the ring failed and is empty
+    }
+    auto entered = ring_enter(r, 0, 1);
+    if (entered < 0) {
+      std::unique_lock<std::mutex> lock(s->mutex);
+      ring_fail(s, entered, true, &failed);
+      auto error = s->ringError;
+      lock.unlock();
+      finish_failed(s, &failed, error);
+      return;
+    }
+    auto head = *r->cqHead;
+    auto tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      auto cqe = r->cqes[head & r->cqMask];
+      auto slot = (u32)cqe.user_data - 1;
+      std::unique_lock<std::mutex> lock(s->mutex);
+      --r->submitted;
+      auto request = s->slots[slot];
+      s->freeSlots.push_back(slot);
+      auto partial = cqe.res > 0 && request.done + cqe.res < request.size;
+      if (partial) {
+        request.done += cqe.res; // Short transfer, the rest goes next
+        --s->inFlight;
+        s->waiting.push_front(request);
+      }
+      ring_submit(s, &failed); // The request stays in flight until its callback returned
+      auto error = s->ringError;
+      lock.unlock();
+      if (!partial) {
+        finish_request(s, request, cqe.res < 0 ? cqe.res : (i64)(request.done + cqe.res));
+      }
+      finish_failed(s, &failed, error);
+    }
+    __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+  }
+}
+#endif
+
+void async_io_initialize(void **state, u32 queueDepth, bool allowIoUring) {
+  auto s = new AsyncIoState();
+  s->queueDepth = std::max(queueDepth, 1u);
+#if defined(ASYNC_IO_URING)
+  s->ioUring = allowIoUring && ring_initialize(&s->ring, s->queueDepth);
+  if (s->ioUring) {
+    s->slots.resize(s->queueDepth);
+    for (u32 slot = s->queueDepth; slot-- > 0;) {
+      s->freeSlots.push_back(slot);
+    }
+    s->reaper = std::thread(reaper_main, s);
+  }
+#endif
+  if (!s->ioUring) {
+    for (u32 i = 0; i < std::min(ASYNC_IO_WORKERS, s->queueDepth); ++i) {
+      s->workers.emplace_back(worker_main, s);
+    }
+  }
+  *state = s;
+}
+
+void async_io_shutdown(void **state) {
+  auto s = (AsyncIoState *)*state;
+  async_io_wait_idle(s);
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->quit = true;
+  }
+  s->wake.notify_all();
+  for (auto &worker : s->workers) {
+    worker.join();
+  }
+#if defined(ASYNC_IO_URING)
+  if (s->ioUring) {
+    s->reaper.join();
+    ring_unmap(&s->ring);
+  }
+#endif
+  DELETE(s);
+  *state = nullptr;
+}
+
+bool async_io_uses_io_uring(void *state) { return ((AsyncIoState *)state)->ioUring; }
+
+bool async_io_open(AsyncFile *outFile, const char *path, FileMode mode) {
+  i32 flags;
+  if ((mode & FILE_MODE_READ) != 0 && (mode & FILE_MODE_WRITE) != 0) {
+    flags = O_RDWR | O_CREAT | O_TRUNC;
+  } else if ((mode & FILE_MODE_WRITE) != 0) {
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+  } else {
+    flags = O_RDONLY;
+  }
+  auto handle = open(path, flags | O_CLOEXEC, 0644);
+  if (handle < 0) {
+    LOG_ERROR("error opening file: '%s'", path);
+    return false;
+  }
+  struct stat st {};
+  if (fstat(handle, &st) != 0) {
+    LOG_ERROR("error reading the size of file: '%s'", path);
+    close(handle);
+    return false;
+  }
+  *outFile = {handle, (u64)st.st_size};
+  return true;
+}
+
+void async_io_close(AsyncFile *file) {
+  close(file->handle);
+  file->handle = -1;
+}
+
+static void enqueue(AsyncIoState *s, AsyncIoOp op, const AsyncFile *file, u64 offset, u64 size,
+                    const void *buffer, PFN_on_io_complete onComplete, void *userData) {
+  std::lock_guard<std::mutex> lock(s->mutex);
+  s->queued.push_back({op, file->handle, offset, size, 0, (u8 *)buffer, onComplete, userData});
+}
+
+void async_io_read(void *state, const AsyncFile *file, u64 offset, u64 size, void *buffer,
+                   PFN_on_io_complete onComplete, void *userData) {
+  enqueue((AsyncIoState *)state, ASYNC_IO_OP_READ, file, offset, size, buffer, onComplete,
+          userData);
+}
+
+void async_io_write(void *state, const AsyncFile *file, u64 offset, u64 size, const void *buffer,
+                    PFN_on_io_complete onComplete, void *userData) {
+  enqueue((AsyncIoState *)state, ASYNC_IO_OP_WRITE, file, offset, size, buffer, onComplete,
+          userData);
+}
+
+void async_io_submit(void *state) {
+  auto s = (AsyncIoState *)state;
+#if defined(ASYNC_IO_URING)
+  std::vector<AsyncIoRequest> failed;
+  i64 error = 0;
+#endif
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (s->queued.empty()) { return; }
+    s->waiting.insert(s->waiting.end(), s->queued.begin(), s->queued.end());
+    s->queued.clear();
+#if defined(ASYNC_IO_URING)
+    if (s->ioUring) {
+      ring_submit(s, &failed);
+      error = s->ringError;
+    }
+#endif
+  }
+  s->wake.notify_all(); // The workers, or the reaper to wait for the requests now in the kernel
+#if defined(ASYNC_IO_URING)
+  finish_failed(s, &failed, error);
+#endif
+}
+
+void async_io_wait_idle(void *state) {
+  auto s = (AsyncIoState *)state;
+  async_io_submit(s);
+  std::unique_lock<std::mutex> lock(s->mutex);
+  s->idle.wait(lock, [s] { return s->queued.empty() && s->waiting.empty() && s->inFlight == 0; });
+}
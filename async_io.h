@@ -0,0 +1,51 @@
+#pragma once
+
+#include "defines.h"
+#include "filesystem.h"
+
+/**
+ * Asynchronous reads and writes at file offsets. Requests queue up until `async_io_submit`, which
+ * hands them to the kernel as one batch through io_uring on Linux; where io_uring is unavailable,
+ * e.g. other systems or kernels and sandboxes that refuse it, worker threads carry them out with
+ * pread/pwrite instead. Either way the submitting thread never waits on the disk, and many
+ * requests can be in flight at once.
+ *
+ * Completion callbacks run on an I/O thread, in no particular order, and must not block. Should
+ * io_uring fail, the requests it had not finished fail with its error, as do those submitted
+ * later, whose callbacks then run within `async_io_submit`.
+ */
+
+struct AsyncFile {
+  i32 handle;
+  u64 size; // When opened
+};
+
+// Bytes transferred, or a negative errno
+typedef void (*PFN_on_io_complete)(void *userData, i64 result);
+
+/**
+ * @param queueDepth requests in flight at most, further ones wait for a slot
+ * @param allowIoUring false to use the worker threads regardless, e.g. to compare the two
+ */
+void async_io_initialize(void **state, u32 queueDepth, bool allowIoUring = true);
+// Waits for the requests in flight
+void async_io_shutdown(void **state);
+// Whether requests go through io_uring rather than the worker threads
+bool async_io_uses_io_uring(void *state);
+
+// Opening and closing are synchronous, they rarely touch the disk
+bool async_io_open(AsyncFile *outFile, const char *path, FileMode mode);
+void async_io_close(AsyncFile *file);
+
+/**
+ * Queues a read of `size` bytes at `offset` into `buffer`, which must stay valid until the
+ * callback. Short reads are retried, so the result falls short of `size` only at the end of file.
+ */
+void async_io_read(void *state, const AsyncFile *file, u64 offset, u64 size, void *buffer,
+                   PFN_on_io_complete onComplete, void *userData);
+void async_io_write(void *state, const AsyncFile *file, u64 offset, u64 size, const void *buffer,
+                    PFN_on_io_complete onComplete, void *userData);
+// Starts the requests queued so far, from any thread
+void async_io_submit(void *state);
+// Submits, then returns once every request completed and its callback returned
+void async_io_wait_idle(void *state);
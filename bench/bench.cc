@@ -0,0 +1,238 @@
+#include "bench.h"
+#include "filesystem.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(NEON_HEADLESS)
+#include "headless.h"
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct RegisteredBench {
+  const char *name;
+  PFN_bench fn;
+  u64 arg;
+  BenchRequirement requirement;
+};
+
+struct BenchResult {
+  const char *name;
+  u64 iterations;
+  f64 nsPerOp; // Median of all repetitions
+  f64 minNsPerOp;
+  bool skipped;
+};
+
+struct BaselineEntry {
+  std::string name;
+  f64 nsPerOp;
+};
+
+struct BenchOptions {
+  const char *filter = nullptr;
+  const char *jsonPath = nullptr;
+  const char *baselinePath = nullptr;
+  f64 minTime = 0.1; // Seconds per repetition
+  u32 repetitions = 5;
+  f64 threshold = 0.10; // Tolerated slowdown against the baseline
+};
+
+static std::vector<RegisteredBench> &registry() {
+  static std::vector<RegisteredBench> benches;
+  return benches;
+}
+
+bool bench_register(const char *name, PFN_bench fn, u64 arg, BenchRequirement requirement) {
+  registry().push_back({name, fn, arg, requirement});
+  return true;
+}
+
+void bench_pause(BenchContext *context) { context->pausedAt = Clock::now(); }
+
+void bench_resume(BenchContext *context) { context->excluded += Clock::now() - context->pausedAt; }
+
+void bench_reset_timer(BenchContext *context) {
+  context->start = Clock::now();
+  context->excluded = {};
+}
+
+void bench_skip(BenchContext *context, const char *reason) {
+  fprintf(stderr, "skipped: %s\n", reason);
+  context->skipped = true;
+}
+
+// Runs the benchmark once, returns the measured nanoseconds
+static f64 run_once(const RegisteredBench &bench, u64 iterations, bool *skipped) {
+  BenchContext context{};
+  context.iterations = iterations;
+  context.arg = bench.arg;
+  context.start = Clock::now();
+  bench.fn(&context);
+  auto elapsed = Clock::now() - context.start - context.excluded;
+  *skipped = context.skipped;
+  return (f64)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+static BenchResult run_bench(const RegisteredBench &bench, const BenchOptions &options) {
+  BenchResult result{};
+  result.name = bench.name;
+
+  // Grow the iteration count until one run lasts at least the minimum time
+  u64 iterations = 1;
+  for (;;) {
+    auto ns = run_once(bench, iterations, &result.skipped);
+    if (result.skipped) { return result; }
+    if (ns >= options.minTime * 1e9 || iterations >= 1000000000) { break; }
+    auto scale = ns > 0 ? options.minTime * 1e9 * 1.4 / ns : 100.0;
+    iterations = std::max(iterations + 1, (u64)((f64)iterations * std::min(scale, 100.0)));
+  }
+
+  std::vector<f64> samples;
+  for (u32 i = 0; i < options.repetitions; ++i) {
+    samples.emplace_back(run_once(bench, iterations, &result.skipped) / (f64)iterations);
+  }
+  std::sort(samples.begin(), samples.end());
+  result.iterations = iterations;
+  result.nsPerOp = samples[samples.size() / 2];
+  result.minNsPerOp = samples.front();
+  return result;
+}
+
+static bool write_json(const char *path, const std::vector<BenchResult> &results) {
+  File *file = nullptr;
+  if (!filesystem_open(&file, path, FILE_MODE_WRITE, false)) { return false; }
+  auto ok = filesystem_write_line(file, "{\n  \"benchmarks\": [");
+  char line[512];
+  for (size_t i = 0; ok && i < results.size(); ++i) {
+    const auto &result = results[i];
+    snprintf(line, sizeof(line),
+             "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, "
+             "\"min_ns_per_op\": %.3f}%s",
+             result.name, (unsigned long long)result.iterations, result.nsPerOp,
+             result.minNsPerOp, i + 1 < results.size() ? "," : "");
+    ok = filesystem_write_line(file, line);
+  }
+  ok = ok && filesystem_write_line(file, "  ]\n}");
+  filesystem_close(&file);
+  return ok;
+}
+
+// Reads back the files written by `write_json`, this is not a general JSON parser
+static bool read_baseline(const char *path, std::vector<BaselineEntry> *entries) {
+  File *file = nullptr;
+  if (!filesystem_open(&file, path, FILE_MODE_READ, false)) { return false; }
+  u64 size = 0;
+  if (!filesystem_size(file, &size)) {
+    filesystem_close(&file);
+    return false;
+  }
+  std::string text(size, '\0');
+  u64 read = 0;
+  auto ok = filesystem_read(file, text.data(), &read);
+  filesystem_close(&file);
+  if (!ok) { return false; }
+
+  static const char kName[] = "\"name\": \"";
+  static const char kNsPerOp[] = "\"ns_per_op\": ";
+  for (auto at = text.find(kName); at != std::string::npos; at = text.find(kName, at)) {
+    at += sizeof(kName) - 1;
+    auto end = text.find('"', at);
+    auto value = text.find(kNsPerOp, end);
+    if (end == std::string::npos || value == std::string::npos) { break; }
+    entries->push_back({text.substr(at, end - at), strtod(&text[value + sizeof(kNsPerOp) - 1],
+                                                         nullptr)});
+  }
+  return true;
+}
+
+static void print_usage() {
+  printf("usage: neon_bench [--filter SUBSTRING] [--json OUT] [--baseline IN] [--threshold F]\n"
+         "                  [--min-time SECONDS] [--repetitions N]\n"
+         "run from the repository root so shaders and images resolve\n");
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options{};
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      options.jsonPath = argv[++i];
+    } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      options.baselinePath = argv[++i];
+    } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+      options.threshold = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+      options.minTime = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+      options.repetitions = std::max(1, atoi(argv[++i]));
+    } else {
+      print_usage();
+      return strcmp(argv[i], "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  std::vector<BaselineEntry> baseline;
+  if (options.baselinePath && !read_baseline(options.baselinePath, &baseline)) {
+    fprintf(stderr, "error reading baseline: '%s'\n", options.baselinePath);
+    return EXIT_FAILURE;
+  }
+
+  std::vector<const RegisteredBench *> selected;
+  bool needsGl = false;
+  for (const auto &bench : registry()) {
+    if (options.filter && !strstr(bench.name, options.filter)) { continue; }
+    selected.emplace_back(&bench);
+    needsGl |= bench.requirement == BENCH_REQUIREMENT_GL;
+  }
+
+  bool glAvailable = false;
+#if defined(NEON_HEADLESS)
+  HeadlessContext *headless = nullptr;
+  if (needsGl) { glAvailable = headless_context_create(&headless, 256, 256); }
+#endif
+
+  printf("%-40s %14s %14s %14s\n", "benchmark", "iterations", "ns/op", "baseline");
+  std::vector<BenchResult> results;
+  u32 regressions = 0;
+  for (auto bench : selected) {
+    if (bench->requirement == BENCH_REQUIREMENT_GL && !glAvailable) {
+      printf("%-40s %14s\n", bench->name, "no gl context");
+      continue;
+    }
+    auto result = run_bench(*bench, options);
+    if (result.skipped) { continue; }
+    results.emplace_back(result);
+
+    char comparison[64] = "-";
+    for (const auto &entry : baseline) {
+      if (entry.name != result.name || entry.nsPerOp <= 0) { continue; }
+      auto change = result.nsPerOp / entry.nsPerOp - 1.0;
+      auto regressed = change > options.threshold;
+      regressions += regressed;
+      snprintf(comparison, sizeof(comparison), "%+.1f%%%s", change * 100.0,
+               regressed ? " REGRESSION" : "");
+    }
+    printf("%-40s %14llu %14.2f %14s\n", result.name, (unsigned long long)result.iterations,
+           result.nsPerOp, comparison);
+  }
+
+#if defined(NEON_HEADLESS)
+  if (headless) { headless_context_destroy(&headless); }
+#endif
+
+  if (options.jsonPath && !write_json(options.jsonPath, results)) {
+    fprintf(stderr, "error writing results: '%s'\n", options.jsonPath);
+    return EXIT_FAILURE;
+  }
+  if (regressions > 0) {
+    fprintf(stderr, "%u benchmark(s) slower than the baseline by more than %.0f%%\n", regressions,
+            options.threshold * 100.0);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "defines.h"
+#include <chrono>
+
+struct BenchContext {
+  u64 iterations; // Number of operations the benchmark must perform
+  u64 arg;        // Parameter the benchmark was registered with
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::duration excluded; // Time spent paused, not counted
+  std::chrono::steady_clock::time_point pausedAt;
+  bool skipped;
+};
+
+typedef void (*PFN_bench)(BenchContext *context);
+
+enum BenchRequirement {
+  BENCH_REQUIREMENT_NONE = 0x0,
+  BENCH_REQUIREMENT_GL, // Runs only when a headless GL context could be created
+};
+
+bool bench_register(const char *name, PFN_bench fn, u64 arg = 0,
+                    BenchRequirement requirement = BENCH_REQUIREMENT_NONE);
+
+// Excludes setup or teardown inside the measured loop from the result
+void bench_pause(BenchContext *context);
+void bench_resume(BenchContext *context);
+// Restarts timing, for benchmarks with expensive setup before their loop
+void bench_reset_timer(BenchContext *context);
+void bench_skip(BenchContext *context, const char *reason);
+
+// Keeps the compiler from optimizing away a result the benchmark does not otherwise use
+template <typename T> inline void bench_do_not_optimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#define BENCH_CONCAT_INNER(a, b) a##b
+#define BENCH_CONCAT(a, b) BENCH_CONCAT_INNER(a, b)
+#define BENCH(...)                                                                                 \
+  [[maybe_unused]] static bool BENCH_CONCAT(benchRegistered, __LINE__) =                           \
+      bench_register(__VA_ARGS__);
@@ -0,0 +1,24 @@
+#include "bench.h"
+#include "camera.h"
+
+static void bench_camera_view_matrix(BenchContext *context) {
+  Camera camera{};
+  camera.rotate_to(12.0f, 34.0f);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    auto view = camera.get_view_matrix();
+    bench_do_not_optimize(view);
+  }
+}
+
+static void bench_camera_basis(BenchContext *context) {
+  Camera camera{};
+  camera.rotate_to(12.0f, 34.0f);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    auto basis = camera.get_front() + camera.get_back() + camera.get_up() + camera.get_down() +
+                 camera.get_right() + camera.get_left();
+    bench_do_not_optimize(basis);
+  }
+}
+
+BENCH("camera/get_view_matrix", bench_camera_view_matrix)
+BENCH("camera/basis_getters", bench_camera_basis)
@@ -0,0 +1,505 @@
+#include "bench.h"
+#include "allocator.h"
+#include "animation.h"
+#include "async_io.h"
+#include "bvh.h"
+#include "event.h"
+#include "input.h"
+#include "job_system.h"
+#include "logger.h"
+#include "message_queue.h"
+#include "particles.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+static void bench_message_queue_push_pop(BenchContext *context) {
+  MessageQueue queue;
+  Message message{};
+  for (u64 i = 0; i < context->iterations; ++i) {
+    message.u64 = i;
+    queue.push(message);
+    queue.pop(&message);
+  }
+  bench_do_not_optimize(message.u64);
+}
+
+// `arg` producer threads push while the benchmark thread pops, one iteration per message
+static void bench_message_queue_contention(BenchContext *context) {
+  auto producers = (u32)context->arg;
+  auto perProducer = context->iterations / producers + 1;
+  MessageQueue queue;
+  std::vector<std::thread> threads;
+  for (u32 i = 0; i < producers; ++i) {
+    threads.emplace_back([&queue, perProducer]() {
+      Message message{};
+      for (u64 j = 0; j < perProducer; ++j) {
+        while (!queue.push(message)) { std::this_thread::yield(); } // Full, pushes do not wait
+      }
+    });
+  }
+  Message message{};
+  for (u64 i = 0; i < perProducer * producers; ++i) {
+    queue.pop(&message);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+static bool on_event_count(EventCode eventCode, EventContext eventContext, void *sender,
+                           void *listener) {
+  ++*(u64 *)listener;
+  return false; // Keep going so every listener runs
+}
+
+static void bench_event_fire(BenchContext *context) {
+  void *state = nullptr;
+  event_system_initialize(&state);
+  std::vector<u64> listeners(context->arg);
+  for (auto &listener : listeners) {
+    event_register(state, EVENT_CODE_DEBUG_0, &listener, on_event_count);
+  }
+  bench_reset_timer(context);
+  EventContext eventContext{};
+  for (u64 i = 0; i < context->iterations; ++i) {
+    eventContext.u64[0] = i;
+    event_fire(state, EVENT_CODE_DEBUG_0, nullptr, eventContext);
+  }
+  bench_pause(context);
+  bench_do_not_optimize(listeners[0]);
+  event_system_shutdown(&state);
+  bench_resume(context);
+}
+
+// Posts in batches of `arg` events and dispatches each batch, one iteration per event
+static void bench_event_post_dispatch(BenchContext *context) {
+  void *state = nullptr;
+  event_system_initialize(&state);
+  u64 listener = 0;
+  event_register(state, EVENT_CODE_DEBUG_0, &listener, on_event_count);
+  bench_reset_timer(context);
+  EventContext eventContext{};
+  for (u64 i = 0; i < context->iterations;) {
+    for (u64 j = 0; j < context->arg && i < context->iterations; ++j, ++i) {
+      eventContext.u64[0] = i;
+      event_post(state, EVENT_CODE_DEBUG_0, nullptr, eventContext);
+    }
+    event_dispatch_deferred(state);
+  }
+  bench_pause(context);
+  bench_do_not_optimize(listener);
+  event_system_shutdown(&state);
+  bench_resume(context);
+}
+
+// One update tick with `arg` keys held, including dispatching the repeats it posts
+static void bench_input_system_update(BenchContext *context) {
+  void *eventSystemState = nullptr;
+  event_system_initialize(&eventSystemState);
+  void *inputSystemState = nullptr;
+  input_system_initialize(&inputSystemState, eventSystemState);
+  for (u16 key = 0; key < context->arg; ++key) {
+    input_system_process_key(inputSystemState, 4 + key * 7, true);
+  }
+  input_system_update(inputSystemState);
+  event_dispatch_deferred(eventSystemState);
+  bench_reset_timer(context);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    input_system_update(inputSystemState);
+    event_dispatch_deferred(eventSystemState);
+  }
+  bench_pause(context);
+  input_system_shutdown(&inputSystemState);
+  event_system_shutdown(&eventSystemState);
+  bench_resume(context);
+}
+
+static void bench_input_publish_acquire(BenchContext *context) {
+  void *eventSystemState = nullptr;
+  event_system_initialize(&eventSystemState);
+  void *inputSystemState = nullptr;
+  input_system_initialize(&inputSystemState, eventSystemState);
+  bench_reset_timer(context);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    input_system_process_mouse_wheel(inputSystemState, 0, 1, 0.0f, 1.0f);
+    input_system_publish(inputSystemState);
+    bench_do_not_optimize(input_acquire_snapshot(inputSystemState)->wheelY);
+  }
+  bench_pause(context);
+  input_system_shutdown(&inputSystemState);
+  event_system_shutdown(&eventSystemState);
+  bench_resume(context);
+}
+
+// A frame of `arg` small allocations followed by the reset, one iteration per allocation
+static void bench_frame_arena(BenchContext *context) {
+  frame_arena_reset();
+  for (u64 i = 0; i < context->iterations;) {
+    for (u64 j = 0; j < context->arg && i < context->iterations; ++j, ++i) {
+      bench_do_not_optimize(frame_arena_allocate(64));
+    }
+    frame_arena_reset();
+  }
+}
+
+// The same frames through malloc, for comparison
+static void bench_frame_malloc(BenchContext *context) {
+  std::vector<void *> allocations(context->arg);
+  bench_reset_timer(context);
+  for (u64 i = 0; i < context->iterations;) {
+    u64 count = 0;
+    for (; count < context->arg && i < context->iterations; ++count, ++i) {
+      allocations[count] = malloc(64);
+      bench_do_not_optimize(allocations[count]);
+    }
+    for (u64 j = 0; j < count; ++j) {
+      free(allocations[j]);
+    }
+  }
+}
+
+struct BenchPoolObject {
+  u64 payload[8];
+};
+
+static void bench_object_pool(BenchContext *context) {
+  ObjectPool<BenchPoolObject> pool("BenchPoolObject", MEMORY_TAG_FRAME);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    auto object = pool.create();
+    bench_do_not_optimize(object);
+    pool.destroy(object);
+  }
+}
+
+// One allocation and free against a free list fragmented into `arg` holes
+static void bench_range_allocator(BenchContext *context) {
+  RangeAllocator ranges(context->arg * 2 * 64);
+  for (u64 i = 0; i < context->arg * 2; ++i) {
+    u64 offset;
+    ranges.allocate(64, &offset);
+  }
+  for (u64 i = 0; i < context->arg; ++i) {
+    ranges.free(i * 2 * 64, 64);
+  }
+  bench_reset_timer(context);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    u64 offset;
+    ranges.allocate(64, &offset);
+    bench_do_not_optimize(offset);
+    ranges.free(offset, 64);
+  }
+}
+
+static const u32 BENCH_SKELETON_JOINTS = 24;
+static const u32 BENCH_CROWD_SIZE = 256; // Characters per update
+
+// One iteration per character: two clips sampled, blended and skinned, over a crowd updated
+// `BENCH_CROWD_SIZE` at a time with `arg` workers besides the benchmark thread. Characters per
+// millisecond are 1e6 over the ns/op.
+static void bench_animation(BenchContext *context) {
+  i32 parents[BENCH_SKELETON_JOINTS];
+  std::vector<f32> inverseBind(BENCH_SKELETON_JOINTS * 16, 0.0f);
+  for (u32 joint = 0; joint < BENCH_SKELETON_JOINTS; ++joint) {
+    parents[joint] = joint == 0 ? -1 : (i32)(joint - 1) / 2;
+    for (u32 i = 0; i < 4; ++i) {
+      inverseBind[joint * 16 + i * 5] = 1.0f;
+    }
+  }
+  Skeleton skeleton;
+  skeleton_create(&skeleton, parents, inverseBind.data(), BENCH_SKELETON_JOINTS);
+
+  u32 seed = 1;
+  auto random = [&seed]() {
+    seed = seed * 1664525u + 1013904223u;
+    return (f32)(seed >> 8) / (f32)(1 << 24) * 2.0f - 1.0f;
+  };
+  AnimationClip clips[2];
+  for (u32 i = 0; i < 2; ++i) {
+    const u32 frames = 30;
+    std::vector<f32> rotations(frames * BENCH_SKELETON_JOINTS * 4);
+    std::vector<f32> translations(frames * BENCH_SKELETON_JOINTS * 3);
+    for (u32 key = 0; key < frames * BENCH_SKELETON_JOINTS; ++key) {
+      f32 q[4] = {random(), random(), random(), random()};
+      auto length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+      for (u32 c = 0; c < 4; ++c) {
+        rotations[key * 4 + c] = q[c] / length;
+      }
+      for (u32 c = 0; c < 3; ++c) {
+        translations[key * 3 + c] = random();
+      }
+    }
+    animation_clip_create(&clips[i], skeleton, rotations.data(), translations.data(), frames,
+                          30.0f);
+  }
+
+  std::vector<AnimationInstance> instances(BENCH_CROWD_SIZE);
+  for (u32 i = 0; i < BENCH_CROWD_SIZE; ++i) {
+    auto &instance = instances[i];
+    instance = {};
+    for (u32 c = 0; c < 4; ++c) {
+      instance.model[c * 5] = 1.0f;
+    }
+    instance.clips[0] = 0;
+    instance.clips[1] = 1;
+    instance.times[0] = instance.times[1] = (f32)i * 0.01f;
+    instance.blend = 0.5f;
+  }
+  std::vector<f32> matrices(BENCH_CROWD_SIZE * BENCH_SKELETON_JOINTS * ANIMATION_MATRIX_FLOATS);
+  void *jobSystemState = nullptr;
+  if (context->arg > 0) { job_system_initialize(&jobSystemState, (u32)context->arg); }
+
+  bench_reset_timer(context);
+  for (u64 done = 0; done < context->iterations; done += BENCH_CROWD_SIZE) {
+    auto count = (u32)std::min<u64>(BENCH_CROWD_SIZE, context->iterations - done);
+    for (auto &instance : instances) {
+      instance.times[0] += 1.0f / 60.0f;
+      instance.times[1] += 1.0f / 60.0f;
+    }
+    animation_update(jobSystemState, skeleton, clips, instances.data(), count, matrices.data());
+  }
+  bench_do_not_optimize(matrices[0]);
+  if (jobSystemState) { job_system_shutdown(&jobSystemState); }
+}
+
+static const u32 BENCH_PARTICLES = 1u << 20;
+
+// One iteration per particle simulated, in updates of a system kept near `BENCH_PARTICLES` by
+// emitters spawning at the rate their particles die, with `arg` workers besides the benchmark
+// thread. Milliseconds per update of a million particles are about the ns/op.
+static void bench_particles(BenchContext *context) {
+  const f32 gravity[3] = {0.0f, -9.8f, 0.0f};
+  const u32 emitterCount = 4;
+  void *particleState;
+  particle_system_initialize(&particleState, gravity);
+  for (u32 i = 0; i < emitterCount; ++i) {
+    ParticleEmitterDesc desc{};
+    desc.position[0] = (f32)i;
+    desc.velocity[1] = 6.0f;
+    desc.spread = 1.5f;
+    desc.life[0] = 1.0f;
+    desc.life[1] = 1.4f;
+    desc.drag = 0.1f;
+    desc.size = 0.05f;
+    desc.capacity = BENCH_PARTICLES / emitterCount;
+    desc.rate = (f32)desc.capacity / 1.2f;
+    desc.material = i % 2;
+    particle_emitter_create(particleState, desc);
+  }
+  void *jobSystemState = nullptr;
+  if (context->arg > 0) { job_system_initialize(&jobSystemState, (u32)context->arg); }
+  for (u32 i = 0; i < 90; ++i) { // Until as many die as are spawned
+    particle_system_update(particleState, jobSystemState, 1.0f / 60.0f);
+  }
+
+  bench_reset_timer(context);
+  ParticleStats stats{};
+  for (u64 done = 0; done < context->iterations; done += std::max(stats.particles, 1u)) {
+    particle_system_update(particleState, jobSystemState, 1.0f / 60.0f);
+    particle_system_get_stats(particleState, &stats);
+  }
+  u32 instanceCount;
+  bench_do_not_optimize(particle_system_instances(particleState, &instanceCount)[0]);
+  if (jobSystemState) { job_system_shutdown(&jobSystemState); }
+  particle_system_shutdown(&particleState);
+}
+
+static const u32 BENCH_BVH_GRID = 316; // Edge of a grid of about 100k objects
+
+// Unit boxes on a jittered grid, the size of a dense scene of 100k objects
+static std::vector<BvhBounds> bench_bvh_scene(f32 jitter) {
+  std::vector<BvhBounds> bounds;
+  u32 seed = 1;
+  for (u32 x = 0; x < BENCH_BVH_GRID; ++x) {
+    for (u32 z = 0; z < BENCH_BVH_GRID; ++z) {
+      seed = seed * 1664525u + 1013904223u;
+      auto offset = ((f32)(seed >> 8) / (f32)(1 << 24) - 0.5f) * jitter;
+      f32 center[3] = {(f32)x * 2.0f + offset, offset, -(f32)z * 2.0f - offset};
+      BvhBounds box;
+      for (u32 axis = 0; axis < 3; ++axis) {
+        box.min[axis] = center[axis] - 0.5f;
+        box.max[axis] = center[axis] + 0.5f;
+      }
+      bounds.push_back(box);
+    }
+  }
+  return bounds;
+}
+
+// One iteration per object
+static void bench_bvh_build(BenchContext *context) {
+  auto bounds = bench_bvh_scene(1.0f);
+  bench_reset_timer(context);
+  for (u64 done = 0; done < context->iterations; done += bounds.size()) {
+    void *bvhState;
+    bvh_build(&bvhState, bounds.data(), (u32)bounds.size());
+    bvh_destroy(&bvhState);
+  }
+}
+
+// One iteration per object, refitted to boxes moving back and forth
+static void bench_bvh_refit(BenchContext *context) {
+  auto bounds = bench_bvh_scene(1.0f);
+  void *bvhState;
+  bvh_build(&bvhState, bounds.data(), (u32)bounds.size());
+  bench_reset_timer(context);
+  for (u64 done = 0; done < context->iterations; done += bounds.size()) {
+    auto offset = done / bounds.size() % 2 ? 0.25f : -0.25f;
+    for (auto &box : bounds) {
+      box.min[1] += offset;
+      box.max[1] += offset;
+    }
+    bvh_refit(bvhState, bounds.data());
+  }
+  bvh_destroy(&bvhState);
+}
+
+// One iteration per picking ray, from above one corner of the grid to random points on it, in
+// batches spread over `arg` workers besides the benchmark thread
+static void bench_bvh_rays(BenchContext *context) {
+  auto bounds = bench_bvh_scene(1.0f);
+  void *bvhState;
+  bvh_build(&bvhState, bounds.data(), (u32)bounds.size());
+  const u32 batchSize = 1024;
+  std::vector<BvhRay> rays(batchSize);
+  u32 seed = 1;
+  for (auto &ray : rays) {
+    f32 target[2];
+    for (auto &coordinate : target) {
+      seed = seed * 1664525u + 1013904223u;
+      coordinate = (f32)(seed >> 8) / (f32)(1 << 24) * (f32)BENCH_BVH_GRID * 2.0f;
+    }
+    ray = {{-2.0f, 10.0f, 2.0f}, {target[0] + 2.0f, -10.0f, -target[1] - 2.0f}, 1.0f};
+  }
+  std::vector<BvhHit> hits(batchSize);
+  void *jobSystemState = nullptr;
+  if (context->arg > 0) { job_system_initialize(&jobSystemState, (u32)context->arg); }
+
+  bench_reset_timer(context);
+  for (u64 done = 0; done < context->iterations; done += batchSize) {
+    auto count = (u32)std::min<u64>(batchSize, context->iterations - done);
+    bvh_intersect_rays(bvhState, jobSystemState, rays.data(), count, hits.data());
+  }
+  bench_do_not_optimize(hits[0]);
+  if (jobSystemState) { job_system_shutdown(&jobSystemState); }
+  bvh_destroy(&bvhState);
+}
+
+// One iteration per query of the objects within 3 units of a random point of the grid
+static void bench_bvh_sphere(BenchContext *context) {
+  auto bounds = bench_bvh_scene(1.0f);
+  void *bvhState;
+  bvh_build(&bvhState, bounds.data(), (u32)bounds.size());
+  std::vector<u32> objects;
+  u32 seed = 1;
+  bench_reset_timer(context);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    f32 center[3] = {};
+    for (u32 axis : {0, 2}) {
+      seed = seed * 1664525u + 1013904223u;
+      center[axis] = (f32)(seed >> 8) / (f32)(1 << 24) * (f32)BENCH_BVH_GRID * 2.0f;
+    }
+    center[2] = -center[2];
+    objects.clear();
+    bvh_query_sphere(bvhState, center, 3.0f, &objects);
+  }
+  bench_do_not_optimize(objects.size());
+  bvh_destroy(&bvhState);
+}
+
+// One iteration per record logged, `arg` at a time, with the writer formatting them into a
+// temporary file. Between batches the rings are flushed and the writer left to park, so no record
+// is dropped and the first of each batch pays for waking it
+static void bench_logger_record(BenchContext *context) {
+  bench_pause(context);
+  auto output = std::tmpfile();
+  logger_system_initialize(output);
+  bench_resume(context);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    logger_log(LOG_LEVEL_INFO, "frame %llu took %.3f ms on the %s thread", i, (f64)i * 0.001,
+               "render");
+    if ((i + 1) % context->arg == 0) {
+      bench_pause(context);
+      logger_flush();
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+      bench_resume(context);
+    }
+  }
+  bench_pause(context);
+  auto dropped = logger_dropped_records();
+  logger_system_shutdown();
+  fclose(output);
+  bench_resume(context);
+  if (dropped > 0) { bench_skip(context, "logger records dropped"); }
+}
+
+static const u64 BENCH_IO_BLOCK = 64 * KiB;
+static const u32 BENCH_IO_BLOCKS = 256; // Of a file the page cache holds after the first pass
+static const u32 BENCH_IO_DEPTH = 32;
+
+static void on_bench_read(void *userData, i64 result) {
+  ((std::atomic<u64> *)userData)->fetch_add(result, std::memory_order_relaxed);
+}
+
+// One iteration per block read, submitted a file at a time with `BENCH_IO_DEPTH` in flight; `arg`
+// 1 goes through io_uring, 0 through the worker threads
+static void bench_async_io_read(BenchContext *context) {
+  bench_pause(context);
+  auto tmp = std::tmpfile();
+  std::vector<u8> buffer(BENCH_IO_BLOCKS * BENCH_IO_BLOCK, 0x5a);
+  fwrite(buffer.data(), 1, buffer.size(), tmp);
+  fflush(tmp);
+  AsyncFile file{fileno(tmp), buffer.size()};
+  void *state = nullptr;
+  async_io_initialize(&state, BENCH_IO_DEPTH, context->arg != 0);
+  if (context->arg != 0 && !async_io_uses_io_uring(state)) {
+    bench_skip(context, "io_uring unavailable");
+  } else {
+    bench_resume(context);
+    std::atomic<u64> bytes{0};
+    for (u64 i = 0; i < context->iterations; ++i) {
+      auto block = i % BENCH_IO_BLOCKS;
+      async_io_read(state, &file, block * BENCH_IO_BLOCK, BENCH_IO_BLOCK,
+                    buffer.data() + block * BENCH_IO_BLOCK, on_bench_read, &bytes);
+      if (block == BENCH_IO_BLOCKS - 1 || i + 1 == context->iterations) {
+        async_io_wait_idle(state);
+      }
+    }
+    bench_do_not_optimize(bytes.load());
+    bench_pause(context);
+  }
+  async_io_shutdown(&state);
+  fclose(tmp);
+  bench_resume(context);
+}
+
+BENCH("message_queue/push_pop", bench_message_queue_push_pop)
+BENCH("message_queue/contention:1", bench_message_queue_contention, 1)
+BENCH("message_queue/contention:2", bench_message_queue_contention, 2)
+BENCH("message_queue/contention:4", bench_message_queue_contention, 4)
+BENCH("event_fire/listeners:1", bench_event_fire, 1)
+BENCH("event_fire/listeners:8", bench_event_fire, 8)
+BENCH("event_fire/listeners:64", bench_event_fire, 64)
+BENCH("event_post_dispatch/batch:64", bench_event_post_dispatch, 64)
+BENCH("input_system_update/held:0", bench_input_system_update, 0)
+BENCH("input_system_update/held:8", bench_input_system_update, 8)
+BENCH("input/publish_acquire", bench_input_publish_acquire)
+BENCH("frame_arena/allocations:1024", bench_frame_arena, 1024)
+BENCH("frame_malloc/allocations:1024", bench_frame_malloc, 1024)
+BENCH("range_allocator/holes:1024", bench_range_allocator, 1024)
+BENCH("object_pool/create_destroy", bench_object_pool)
+BENCH("animation/characters:workers_0", bench_animation, 0)
+BENCH("animation/characters:workers_3", bench_animation, 3)
+BENCH("particles/update:workers_0", bench_particles, 0)
+BENCH("particles/update:workers_3", bench_particles, 3)
+BENCH("bvh/build:100k", bench_bvh_build)
+BENCH("bvh/refit:100k", bench_bvh_refit)
+BENCH("bvh/rays:100k:workers_0", bench_bvh_rays, 0)
+BENCH("bvh/rays:100k:workers_3", bench_bvh_rays, 3)
+BENCH("bvh/sphere:100k", bench_bvh_sphere)
+BENCH("logger/record:batch_1", bench_logger_record, 1)
+BENCH("logger/record:batch_64", bench_logger_record, 64)
+BENCH("async_io/read:threads", bench_async_io_read, 0)
+BENCH("async_io/read:io_uring", bench_async_io_read, 1)
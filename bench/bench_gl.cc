@@ -0,0 +1,200 @@
+#include "bench.h"
+#include "material.h"
+#include "memory_stats.h"
+#include "program.h"
+#include "render_graph.h"
+#include "texture.h"
+#include "texture_streamer.h"
+#include <vector>
+
+// Internal to program.cc
+bool shader_create(GLuint *shader, GLuint type, const char *path);
+void shader_destroy(GLuint shader);
+
+static void bench_texture_create(BenchContext *context) {
+  for (u64 i = 0; i < context->iterations; ++i) {
+    Texture *texture = nullptr;
+    if (!texture_create(&texture, "images/container2.png")) {
+      bench_skip(context, "images/container2.png not found");
+      return;
+    }
+    texture_destroy(&texture);
+  }
+  glFinish();
+}
+
+static void bench_shader_create(BenchContext *context) {
+  for (u64 i = 0; i < context->iterations; ++i) {
+    GLuint shader;
+    if (!shader_create(&shader, GL_FRAGMENT_SHADER, "shaders/materials.frag")) {
+      bench_skip(context, "shaders/materials.frag not found");
+      return;
+    }
+    shader_destroy(shader);
+  }
+  glFinish();
+}
+
+enum UniformKind {
+  UNIFORM_KIND_I32,
+  UNIFORM_KIND_F32,
+  UNIFORM_KIND_VEC3,
+  UNIFORM_KIND_MAT4F,
+};
+
+static void bench_program_set(BenchContext *context) {
+  GLuint program;
+  if (!program_create(&program, {{GL_VERTEX_SHADER, "shaders/materials.vert"},
+                                 {GL_FRAGMENT_SHADER, "shaders/materials.frag"}})) {
+    bench_skip(context, "materials program could not be built");
+    return;
+  }
+  program_use(program);
+  const f32 matrix[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+  bench_reset_timer(context);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    switch (context->arg) {
+    case UNIFORM_KIND_I32: program_set_i32(program, "materialDiffuse", 0); break;
+    case UNIFORM_KIND_F32: program_set_f32(program, "spotLight.cutOff", 0.9f); break;
+    case UNIFORM_KIND_VEC3:
+      program_set_vec3(program, "pointLights[0].ambient", 0.05f, 0.05f, 0.05f);
+      break;
+    case UNIFORM_KIND_MAT4F: program_set_mat4f(program, "model", matrix); break;
+    default: break;
+    }
+  }
+  glFinish();
+  bench_pause(context);
+  program_destroy(program);
+  bench_resume(context);
+}
+
+// Alternating between two materials, as a draw list switching material on every draw would
+static void bench_material_bind(BenchContext *context) {
+  void *materials = nullptr;
+  if (!material_system_initialize(&materials)) {
+    bench_skip(context, "material programs could not be built");
+    return;
+  }
+  MaterialDesc desc{MATERIAL_SHADING_LIT,
+                    {"images/container2.png", "images/container2_specular.png"},
+                    {1.0f, 1.0f, 1.0f, 1.0f},
+                    32.0f};
+  u32 ids[2];
+  if (!material_create(materials, desc, &ids[0]) || !material_create(materials, desc, &ids[1])) {
+    bench_skip(context, "images/container2.png not found");
+    material_system_shutdown(&materials);
+    return;
+  }
+  program_use(material_system_program(materials, MATERIAL_SHADING_LIT));
+  bench_reset_timer(context);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    material_bind(materials, ids[i & 1]);
+  }
+  glFinish();
+  bench_pause(context);
+  material_system_shutdown(&materials);
+  bench_resume(context);
+}
+
+// What a frame pays to stream `arg` textures in a budget that holds a quarter of them in full. The
+// four asked for in full detail move on every 16 frames, so levels keep being evicted and loaded.
+static void bench_texture_streamer(BenchContext *context) {
+  const char *path = "images/container2.png";
+  Texture *probe = nullptr;
+  if (!texture_create(&probe, path)) {
+    bench_skip(context, "images/container2.png not found");
+    return;
+  }
+  auto fullBytes = memory_stats_image_size(probe->width, probe->height, 4, true);
+  auto pixelsPerUv = (f32)std::max(probe->width, probe->height);
+  texture_destroy(&probe);
+
+  auto count = (u32)context->arg;
+  void *streamer = nullptr;
+  texture_streamer_initialize(&streamer, fullBytes * count / 4, 4 * MiB);
+  std::vector<Texture *> textures(count);
+  for (auto &texture : textures) {
+    texture_streamer_create(streamer, path, &texture);
+  }
+  bench_reset_timer(context);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    for (u32 j = 0; j < 4; ++j) {
+      texture_streamer_request(streamer, textures[(i / 16 * 4 + j) % count], pixelsPerUv);
+    }
+    texture_streamer_update(streamer);
+  }
+  glFinish();
+  bench_pause(context);
+  for (auto &texture : textures) {
+    texture_streamer_destroy(streamer, &texture);
+  }
+  texture_streamer_shutdown(&streamer);
+  bench_resume(context);
+}
+
+static void empty_pass(void *graph, void *userData) {}
+
+// Recording and running a deferred-style frame, passes left empty so only the graph is timed
+static void bench_render_graph(BenchContext *context) {
+  void *graph = nullptr;
+  render_graph_create(&graph, context->arg != 0);
+  for (u64 i = 0; i < context->iterations; ++i) {
+    render_graph_begin(graph);
+    auto output = render_graph_import(graph, "output", 0, 1280, 720);
+    auto shadows =
+        render_graph_create_texture(graph, "shadows", {2048, 2048, GL_DEPTH_COMPONENT32F});
+    auto albedo = render_graph_create_texture(graph, "albedo", {1280, 720, GL_RGBA8});
+    auto normals = render_graph_create_texture(graph, "normals", {1280, 720, GL_RGBA16F});
+    auto depth = render_graph_create_texture(graph, "depth", {1280, 720, GL_DEPTH_COMPONENT24});
+    auto hdr = render_graph_create_texture(graph, "hdr", {1280, 720, GL_RGBA16F});
+    auto bloomHalf = render_graph_create_texture(graph, "bloom_half", {640, 360, GL_RGBA16F});
+    auto bloom = render_graph_create_texture(graph, "bloom", {1280, 720, GL_RGBA16F});
+    auto ldr = render_graph_create_texture(graph, "ldr", {1280, 720, GL_RGBA8});
+    auto debug = render_graph_create_texture(graph, "debug", {1280, 720, GL_RGBA8});
+
+    auto pass = render_graph_add_pass(graph, "shadows", empty_pass, nullptr);
+    render_graph_write(graph, pass, shadows);
+    pass = render_graph_add_pass(graph, "gbuffer", empty_pass, nullptr);
+    render_graph_write(graph, pass, albedo);
+    render_graph_write(graph, pass, normals);
+    render_graph_write(graph, pass, depth);
+    pass = render_graph_add_pass(graph, "lighting", empty_pass, nullptr);
+    for (auto input : {shadows, albedo, normals, depth}) {
+      render_graph_read(graph, pass, input);
+    }
+    render_graph_write(graph, pass, hdr);
+    pass = render_graph_add_pass(graph, "debug", empty_pass, nullptr); // Culled, nothing reads it
+    render_graph_read(graph, pass, normals);
+    render_graph_write(graph, pass, debug);
+    pass = render_graph_add_pass(graph, "bloom_down", empty_pass, nullptr);
+    render_graph_read(graph, pass, hdr);
+    render_graph_write(graph, pass, bloomHalf);
+    pass = render_graph_add_pass(graph, "bloom_up", empty_pass, nullptr);
+    render_graph_read(graph, pass, bloomHalf);
+    render_graph_write(graph, pass, bloom);
+    pass = render_graph_add_pass(graph, "tonemap", empty_pass, nullptr);
+    render_graph_read(graph, pass, hdr);
+    render_graph_read(graph, pass, bloom);
+    render_graph_write(graph, pass, ldr);
+    pass = render_graph_add_pass(graph, "present", empty_pass, nullptr);
+    render_graph_read(graph, pass, ldr);
+    render_graph_write(graph, pass, output);
+    render_graph_execute(graph);
+  }
+  glFinish();
+  bench_pause(context);
+  render_graph_destroy(&graph);
+  bench_resume(context);
+}
+
+BENCH("texture_create/container2", bench_texture_create, 0, BENCH_REQUIREMENT_GL)
+BENCH("shader_create/materials_frag", bench_shader_create, 0, BENCH_REQUIREMENT_GL)
+BENCH("program_set/i32", bench_program_set, UNIFORM_KIND_I32, BENCH_REQUIREMENT_GL)
+BENCH("program_set/f32", bench_program_set, UNIFORM_KIND_F32, BENCH_REQUIREMENT_GL)
+BENCH("program_set/vec3", bench_program_set, UNIFORM_KIND_VEC3, BENCH_REQUIREMENT_GL)
+BENCH("program_set/mat4f", bench_program_set, UNIFORM_KIND_MAT4F, BENCH_REQUIREMENT_GL)
+BENCH("material_bind/switch", bench_material_bind, 0, BENCH_REQUIREMENT_GL)
+BENCH("texture_streamer/update:16", bench_texture_streamer, 16, BENCH_REQUIREMENT_GL)
+BENCH("render_graph/deferred", bench_render_graph, 0, BENCH_REQUIREMENT_GL)
+BENCH("render_graph/deferred_aliased", bench_render_graph, 1, BENCH_REQUIREMENT_GL)
@@ -0,0 +1,557 @@
+#include "bvh.h"
+#include "job_system.h"
+#include "memory_stats.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const u32 BVH_WIDTH = 4;       // Children per node, the lanes of a query's box tests
+static const u32 BVH_LEAF_SIZE = 4;   // Objects per leaf at most
+static const u32 BVH_BINS = 16;       // Candidate splits per axis, fewer for fewer objects
+static const f32 BVH_TRAVERSAL_COST = 1.0f; // Of visiting a node, against testing an object's box
+static const u32 BVH_MEDIAN_DEPTH = 40; // Past it splits halve the objects, which bounds the depth
+static const u32 BVH_STACK_SIZE = 256; // Three entries per level at most
+static const u32 BVH_RAYS_PER_JOB = 64;
+
+struct alignas(16) BvhNode {
+  f32 bounds[6][BVH_WIDTH]; // Min x, y, z then max x, y, z of each child
+  u32 children[BVH_WIDTH];  // Node index of an inner child, first leaf slot of a leaf one
+  u32 counts[BVH_WIDTH];    // Objects of a leaf child, 0 for an inner one
+  u32 childCount;           // Children fill the first lanes
+};
+
+struct BvhState {
+  std::vector<BvhNode> nodes;   // Root first, every node before its children
+  std::vector<u32> objects;     // Ids by leaf slot, the objects of a leaf next to each other
+  std::vector<BvhBounds> boxes; // By leaf slot, so leaves read contiguous boxes
+  u32 depth;
+};
+
+// Binary tree of the build, collapsed into four-wide nodes afterwards
+struct BvhBuildNode {
+  BvhBounds bounds;
+  u32 children[2];
+  u32 first; // Leaf slots, when `count` is not 0
+  u32 count;
+};
+
+// An object as the build moves it around, everything a split reads in one place
+struct BvhBuildRef {
+  BvhBounds bounds;
+  f32 centroid[3];
+  u32 id;
+};
+
+struct BvhBuilder {
+  std::vector<BvhBuildRef> refs; // Reordered by the splits into leaf slot order
+  std::vector<BvhBuildNode> nodes;
+};
+
+static BvhBounds empty_bounds() {
+  return {{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+}
+
+static void grow(BvhBounds *bounds, const BvhBounds &other) {
+  for (u32 axis = 0; axis < 3; ++axis) {
+    bounds->min[axis] = std::min(bounds->min[axis], other.min[axis]);
+    bounds->max[axis] = std::max(bounds->max[axis], other.max[axis]);
+  }
+}
+
+// Half the surface area, as only ratios of them are used; 0 for empty bounds
+static f32 half_area(const BvhBounds &bounds) {
+  f32 extent[3];
+  for (u32 axis = 0; axis < 3; ++axis) {
+    extent[axis] = std::max(0.0f, bounds.max[axis] - bounds.min[axis]);
+  }
+  return extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+}
+
+static u64 state_bytes(const BvhState *s) {
+  return s->nodes.size() * sizeof(BvhNode) + s->objects.size() * sizeof(u32) +
+         s->boxes.size() * sizeof(BvhBounds);
+}
+
+static void set_lane(BvhNode *node, u32 lane, const BvhBounds &bounds) {
+  for (u32 axis = 0; axis < 3; ++axis) {
+    node->bounds[axis][lane] = bounds.min[axis];
+    node->bounds[axis + 3][lane] = bounds.max[axis];
+  }
+}
+
+static BvhBounds get_lane(const BvhNode &node, u32 lane) {
+  BvhBounds bounds;
+  for (u32 axis = 0; axis < 3; ++axis) {
+    bounds.min[axis] = node.bounds[axis][lane];
+    bounds.max[axis] = node.bounds[axis + 3][lane];
+  }
+  return bounds;
+}
+
+static BvhBounds node_bounds(const BvhNode &node) {
+  auto bounds = empty_bounds();
+  for (u32 lane = 0; lane < node.childCount; ++lane) {
+    grow(&bounds, get_lane(node, lane));
+  }
+  return bounds;
+}
+
+static u32 centroid_bin(const BvhBuildRef &ref, u32 axis, f32 axisMin, f32 scale, u32 binCount) {
+  return std::min(binCount - 1, (u32)((ref.centroid[axis] - axisMin) * scale));
+}
+
+// Splits the objects at [first, first + count) where the surface area heuristic finds it cheapest
+// to, among the bin boundaries of each axis, or keeps them in a leaf when that is cheaper still
+static u32 build_node(BvhBuilder *b, u32 first, u32 count, u32 depth) {
+  auto index = (u32)b->nodes.size();
+  b->nodes.emplace_back();
+  auto bounds = empty_bounds(), centroidBounds = empty_bounds();
+  for (auto i = first; i < first + count; ++i) {
+    const auto &ref = b->refs[i];
+    grow(&bounds, ref.bounds);
+    const auto *centroid = ref.centroid;
+    grow(&centroidBounds, {{centroid[0], centroid[1], centroid[2]},
+                           {centroid[0], centroid[1], centroid[2]}});
+  }
+  b->nodes[index].bounds = bounds;
+
+  // Bins of every axis filled in one pass over the objects
+  auto binCount = std::min(BVH_BINS, std::max(count, 2u));
+  f32 binScale[3];
+  bool splittable[3];
+  u32 binCounts[3][BVH_BINS] = {};
+  BvhBounds binBounds[3][BVH_BINS];
+  for (u32 axis = 0; axis < 3; ++axis) {
+    auto extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+    splittable[axis] = extent > 0.0f && depth < BVH_MEDIAN_DEPTH;
+    binScale[axis] = splittable[axis] ? (f32)binCount / extent : 0.0f;
+    std::fill(binBounds[axis], binBounds[axis] + binCount, empty_bounds());
+  }
+  for (auto i = first; i < first + count; ++i) {
+    const auto &ref = b->refs[i];
+    for (u32 axis = 0; axis < 3; ++axis) {
+      auto bin = centroid_bin(ref, axis, centroidBounds.min[axis], binScale[axis], binCount);
+      ++binCounts[axis][bin];
+      grow(&binBounds[axis][bin], ref.bounds);
+    }
+  }
+
+  auto bestCost = FLT_MAX;
+  u32 bestAxis = 0, bestBin = 0;
+  for (u32 axis = 0; axis < 3; ++axis) {
+    if (!splittable[axis]) { continue; }
+    // Areas right of each boundary, then the sweep from the left
+    f32 rightAreas[BVH_BINS];
+    u32 rightCounts[BVH_BINS];
+    auto right = empty_bounds();
+    u32 rightCount = 0;
+    for (auto bin = binCount - 1; bin > 0; --bin) {
+      grow(&right, binBounds[axis][bin]);
+      rightCount += binCounts[axis][bin];
+      rightAreas[bin] = half_area(right);
+      rightCounts[bin] = rightCount;
+    }
+    auto left = empty_bounds();
+    u32 leftCount = 0;
+    for (u32 bin = 1; bin < binCount; ++bin) {
+      grow(&left, binBounds[axis][bin - 1]);
+      leftCount += binCounts[axis][bin - 1];
+      if (leftCount == 0 || rightCounts[bin] == 0) { continue; }
+      auto cost = half_area(left) * (f32)leftCount + rightAreas[bin] * (f32)rightCounts[bin];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = bin;
+      }
+    }
+  }
+
+  u32 middle;
+  if (bestCost < FLT_MAX) {
+    auto area = half_area(bounds);
+    auto splitCost = BVH_TRAVERSAL_COST + (area > 0.0f ? bestCost / area : 0.0f);
+    if (count <= BVH_LEAF_SIZE && splitCost >= (f32)count) {
+      b->nodes[index].first = first;
+      b->nodes[index].count = count;
+      return index;
+    }
+    auto isLeft = [&](const BvhBuildRef &ref) {
+      return centroid_bin(ref, bestAxis, centroidBounds.min[bestAxis], binScale[bestAxis],
+                          binCount) < bestBin;
+    };
+    auto begin = b->refs.begin() + first;
+    middle = first + (u32)(std::partition(begin, begin + count, isLeft) - begin);
+  } else if (count <= BVH_LEAF_SIZE) {
+    b->nodes[index].first = first;
+    b->nodes[index].count = count;
+    return index;
+  } else { // Too deep, or the centroids coincide: halve along the longest centroid extent
+    u32 axis = 0;
+    for (u32 i = 1; i < 3; ++i) {
+      if (centroidBounds.max[i] - centroidBounds.min[i] >
+          centroidBounds.max[axis] - centroidBounds.min[axis]) {
+        axis = i;
+      }
+    }
+    middle = first + count / 2;
+    auto begin = b->refs.begin() + first;
+    std::nth_element(begin, begin + count / 2, begin + count,
+                     [axis](const BvhBuildRef &a, const BvhBuildRef &c) {
+                       return a.centroid[axis] < c.centroid[axis];
+                     });
+  }
+  auto left = build_node(b, first, middle - first, depth + 1);
+  auto right = build_node(b, middle, first + count - middle, depth + 1);
+  b->nodes[index].children[0] = left;
+  b->nodes[index].children[1] = right;
+  return index;
+}
+
+// Turns a binary node and up to three levels below it into a node of four children, opening the
+// largest inner child first
+static u32 collapse(const BvhBuilder &b, u32 buildIndex, u32 depth, BvhState *s) {
+  s->depth = std::max(s->depth, depth + 1);
+  u32 kids[BVH_WIDTH];
+  u32 kidCount = 0;
+  const auto &top = b.nodes[buildIndex];
+  if (top.count) {
+    kids[kidCount++] = buildIndex; // A root leaf
+  } else {
+    kids[kidCount++] = top.children[0];
+    kids[kidCount++] = top.children[1];
+  }
+  while (kidCount < BVH_WIDTH) {
+    u32 widest = BVH_WIDTH;
+    auto widestArea = -1.0f;
+    for (u32 i = 0; i < kidCount; ++i) {
+      const auto &kid = b.nodes[kids[i]];
+      if (!kid.count && half_area(kid.bounds) > widestArea) {
+        widest = i;
+        widestArea = half_area(kid.bounds);
+      }
+    }
+    if (widest == BVH_WIDTH) { break; }
+    const auto &opened = b.nodes[kids[widest]];
+    kids[widest] = opened.children[0];
+    kids[kidCount++] = opened.children[1];
+  }
+
+  auto index = (u32)s->nodes.size();
+  s->nodes.emplace_back();
+  auto &node = s->nodes.back();
+  for (u32 lane = 0; lane < BVH_WIDTH; ++lane) {
+    set_lane(&node, lane, empty_bounds());
+    node.children[lane] = BVH_NONE;
+  }
+  node.childCount = kidCount;
+  for (u32 i = 0; i < kidCount; ++i) {
+    const auto &kid = b.nodes[kids[i]];
+    set_lane(&node, i, kid.bounds);
+    node.counts[i] = kid.count;
+    if (kid.count) { node.children[i] = kid.first; }
+  }
+  for (u32 i = 0; i < kidCount; ++i) {
+    if (b.nodes[kids[i]].count) { continue; }
+    auto child = collapse(b, kids[i], depth + 1, s);
+    s->nodes[index].children[i] = child; // The recursion may have moved the nodes
+  }
+  return index;
+}
+
+void bvh_build(void **state, const BvhBounds *bounds, u32 count) {
+  PROFILE_ZONE("bvh/build");
+  auto s = new BvhState();
+  BvhBuilder builder;
+  builder.refs.resize(count);
+  for (u32 i = 0; i < count; ++i) {
+    auto &ref = builder.refs[i];
+    ref.bounds = bounds[i];
+    for (u32 axis = 0; axis < 3; ++axis) {
+      ref.centroid[axis] = (bounds[i].min[axis] + bounds[i].max[axis]) * 0.5f;
+    }
+    ref.id = i;
+  }
+  if (count > 0) {
+    builder.nodes.reserve(2 * (count / BVH_LEAF_SIZE + 1));
+    build_node(&builder, 0, count, 0);
+    s->nodes.reserve(builder.nodes.size() / 2 + 1);
+    collapse(builder, 0, 0, s);
+  } else {
+    s->nodes.emplace_back(); // A root without children
+  }
+  s->objects.resize(count);
+  s->boxes.resize(count);
+  for (u32 slot = 0; slot < count; ++slot) {
+    s->objects[slot] = builder.refs[slot].id;
+    s->boxes[slot] = builder.refs[slot].bounds;
+  }
+  memory_stats_allocate(MEMORY_TAG_BVH, MEMORY_DOMAIN_CPU, state_bytes(s));
+  *state = s;
+}
+
+void bvh_destroy(void **state) {
+  auto s = (BvhState *)*state;
+  memory_stats_free(MEMORY_TAG_BVH, MEMORY_DOMAIN_CPU, state_bytes(s));
+  DELETE(s);
+  *state = nullptr;
+}
+
+void bvh_refit(void *state, const BvhBounds *bounds) {
+  PROFILE_ZONE("bvh/refit");
+  auto s = (BvhState *)state;
+  for (u32 slot = 0; slot < s->objects.size(); ++slot) {
+    s->boxes[slot] = bounds[s->objects[slot]];
+  }
+  // Children come after their parent, so walking back reaches them first
+  for (auto i = s->nodes.size(); i-- > 0;) {
+    auto &node = s->nodes[i];
+    for (u32 lane = 0; lane < node.childCount; ++lane) {
+      auto box = empty_bounds();
+      if (node.counts[lane]) {
+        auto first = node.children[lane];
+        for (auto slot = first; slot < first + node.counts[lane]; ++slot) {
+          grow(&box, s->boxes[slot]);
+        }
+      } else {
+        box = node_bounds(s->nodes[node.children[lane]]);
+      }
+      set_lane(&node, lane, box);
+    }
+  }
+}
+
+// Lanes of the children the ray enters before `maxDistance`, with the distances it enters them at
+static u32 ray_node_mask(const BvhNode &node, const f32 *origin, const f32 *inverse,
+                         f32 maxDistance, f32 *outEntries) {
+#if defined(__SSE2__)
+  auto enter = _mm_setzero_ps(), exit = _mm_set1_ps(maxDistance);
+  for (u32 axis = 0; axis < 3; ++axis) {
+    auto o = _mm_set1_ps(origin[axis]), inv = _mm_set1_ps(inverse[axis]);
+    auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[axis]), o), inv);
+    auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[axis + 3]), o), inv);
+    enter = _mm_max_ps(enter, _mm_min_ps(t0, t1));
+    exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+  }
+  _mm_storeu_ps(outEntries, enter);
+  return (u32)_mm_movemask_ps(_mm_cmple_ps(enter, exit)) & ((1u << node.childCount) - 1);
+#else
+  u32 mask = 0;
+  for (u32 lane = 0; lane < node.childCount; ++lane) {
+    f32 enter = 0.0f, exit = maxDistance;
+    for (u32 axis = 0; axis < 3; ++axis) {
+      auto t0 = (node.bounds[axis][lane] - origin[axis]) * inverse[axis];
+      auto t1 = (node.bounds[axis + 3][lane] - origin[axis]) * inverse[axis];
+      enter = std::max(enter, std::min(t0, t1));
+      exit = std::min(exit, std::max(t0, t1));
+    }
+    outEntries[lane] = enter;
+    mask |= (u32)(enter <= exit) << lane;
+  }
+  return mask;
+#endif
+}
+
+static bool ray_box(const BvhBounds &box, const f32 *origin, const f32 *inverse, f32 maxDistance,
+                    f32 *outDistance) {
+  f32 enter = 0.0f, exit = maxDistance;
+  for (u32 axis = 0; axis < 3; ++axis) {
+    auto t0 = (box.min[axis] - origin[axis]) * inverse[axis];
+    auto t1 = (box.max[axis] - origin[axis]) * inverse[axis];
+    enter = std::max(enter, std::min(t0, t1));
+    exit = std::min(exit, std::max(t0, t1));
+  }
+  *outDistance = enter;
+  return enter <= exit;
+}
+
+BvhHit bvh_intersect_ray(void *state, const BvhRay &ray) {
+  auto s = (BvhState *)state;
+  f32 inverse[3];
+  for (u32 axis = 0; axis < 3; ++axis) {
+    inverse[axis] = 1.0f / ray.direction[axis]; // Infinite along an axis the ray is parallel to
+  }
+  BvhHit hit{BVH_NONE, ray.maxDistance};
+  struct {
+    u32 node;
+    f32 distance;
+  } stack[BVH_STACK_SIZE];
+  u32 top = 0;
+  stack[top++] = {0, 0.0f};
+  while (top > 0) {
+    auto entry = stack[--top];
+    if (entry.distance > hit.distance) { continue; } // A nearer hit was found since the push
+    const auto &node = s->nodes[entry.node];
+    f32 entries[BVH_WIDTH];
+    auto mask = ray_node_mask(node, ray.origin, inverse, hit.distance, entries);
+    // Leaves are tested right away, inner children pushed farthest first to pop the nearest next
+    u32 lanes[BVH_WIDTH];
+    u32 laneCount = 0;
+    for (; mask; mask &= mask - 1) {
+      auto lane = (u32)__builtin_ctz(mask);
+      if (!node.counts[lane]) {
+        lanes[laneCount++] = lane;
+        continue;
+      }
+      auto first = node.children[lane];
+      for (auto slot = first; slot < first + node.counts[lane]; ++slot) {
+        f32 distance;
+        if (ray_box(s->boxes[slot], ray.origin, inverse, hit.distance, &distance)) {
+          hit = {s->objects[slot], distance};
+        }
+      }
+    }
+    std::sort(lanes, lanes + laneCount, [&](u32 a, u32 b) { return entries[a] > entries[b]; });
+    for (u32 i = 0; i < laneCount; ++i) {
+      stack[top++] = {node.children[lanes[i]], entries[lanes[i]]};
+    }
+  }
+  return hit;
+}
+
+struct BvhRayBatch {
+  void *state;
+  const BvhRay *rays;
+  u32 count;
+  BvhHit *hits;
+};
+
+static void intersect_rays_job(u32 index, u32 worker, void *userData) {
+  auto batch = (BvhRayBatch *)userData;
+  auto end = std::min(batch->count, (index + 1) * BVH_RAYS_PER_JOB);
+  for (auto i = index * BVH_RAYS_PER_JOB; i < end; ++i) {
+    batch->hits[i] = bvh_intersect_ray(batch->state, batch->rays[i]);
+  }
+}
+
+void bvh_intersect_rays(void *state, void *jobSystemState, const BvhRay *rays, u32 count,
+                        BvhHit *outHits) {
+  PROFILE_ZONE("bvh/rays");
+  BvhRayBatch batch{state, rays, count, outHits};
+  auto jobCount = (count + BVH_RAYS_PER_JOB - 1) / BVH_RAYS_PER_JOB;
+  if (jobSystemState && jobCount > 1) {
+    job_system_parallel_for(jobSystemState, jobCount, intersect_rays_job, &batch);
+  } else {
+    for (u32 i = 0; i < jobCount; ++i) {
+      intersect_rays_job(i, 0, &batch);
+    }
+  }
+}
+
+// Depth-first walk of the children `nodeMask` keeps, appending the objects `boxTest` keeps
+template <typename NodeMask, typename BoxTest>
+static u32 query(BvhState *s, NodeMask nodeMask, BoxTest boxTest, std::vector<u32> *outObjects) {
+  auto startSize = outObjects->size();
+  u32 stack[BVH_STACK_SIZE];
+  u32 top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const auto &node = s->nodes[stack[--top]];
+    for (auto mask = nodeMask(node); mask; mask &= mask - 1) {
+      auto lane = (u32)__builtin_ctz(mask);
+      if (!node.counts[lane]) {
+        stack[top++] = node.children[lane];
+        continue;
+      }
+      auto first = node.children[lane];
+      for (auto slot = first; slot < first + node.counts[lane]; ++slot) {
+        if (boxTest(s->boxes[slot])) { outObjects->push_back(s->objects[slot]); }
+      }
+    }
+  }
+  return (u32)(outObjects->size() - startSize);
+}
+
+u32 bvh_query_aabb(void *state, const BvhBounds &box, std::vector<u32> *outObjects) {
+  auto nodeMask = [&box](const BvhNode &node) {
+#if defined(__SSE2__)
+    auto overlap = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (u32 axis = 0; axis < 3; ++axis) {
+      overlap = _mm_and_ps(overlap, _mm_cmple_ps(_mm_load_ps(node.bounds[axis]),
+                                                 _mm_set1_ps(box.max[axis])));
+      overlap = _mm_and_ps(overlap, _mm_cmpge_ps(_mm_load_ps(node.bounds[axis + 3]),
+                                                 _mm_set1_ps(box.min[axis])));
+    }
+    return (u32)_mm_movemask_ps(overlap) & ((1u << node.childCount) - 1);
+#else
+    u32 mask = 0;
+    for (u32 lane = 0; lane < node.childCount; ++lane) {
+      auto overlap = true;
+      for (u32 axis = 0; axis < 3; ++axis) {
+        overlap = overlap && node.bounds[axis][lane] <= box.max[axis] &&
+                  node.bounds[axis + 3][lane] >= box.min[axis];
+      }
+      mask |= (u32)overlap << lane;
+    }
+    return mask;
+#endif
+  };
+  auto boxTest = [&box](const BvhBounds &other) {
+    for (u32 axis = 0; axis < 3; ++axis) {
+      if (other.min[axis] > box.max[axis] || other.max[axis] < box.min[axis]) { return false; }
+    }
+    return true;
+  };
+  return query((BvhState *)state, nodeMask, boxTest, outObjects);
+}
+
+u32 bvh_query_sphere(void *state, const f32 *center, f32 radius, std::vector<u32> *outObjects) {
+  auto radiusSquared = radius * radius;
+  // Squared distances from the center to the boxes, 0 inside them
+  auto nodeMask = [&](const BvhNode &node) {
+#if defined(__SSE2__)
+    auto zero = _mm_setzero_ps(), distance = _mm_setzero_ps();
+    for (u32 axis = 0; axis < 3; ++axis) {
+      auto c = _mm_set1_ps(center[axis]);
+      auto d = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(node.bounds[axis]), c), zero),
+                          _mm_max_ps(_mm_sub_ps(c, _mm_load_ps(node.bounds[axis + 3])), zero));
+      distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+    }
+    return (u32)_mm_movemask_ps(_mm_cmple_ps(distance, _mm_set1_ps(radiusSquared))) &
+           ((1u << node.childCount) - 1);
+#else
+    u32 mask = 0;
+    for (u32 lane = 0; lane < node.childCount; ++lane) {
+      f32 distance = 0.0f;
+      for (u32 axis = 0; axis < 3; ++axis) {
+        auto d = std::max(node.bounds[axis][lane] - center[axis], 0.0f) +
+                 std::max(center[axis] - node.bounds[axis + 3][lane], 0.0f);
+        distance += d * d;
+      }
+      mask |= (u32)(distance <= radiusSquared) << lane;
+    }
+    return mask;
+#endif
+  };
+  auto boxTest = [&](const BvhBounds &box) {
+    f32 distance = 0.0f;
+    for (u32 axis = 0; axis < 3; ++axis) {
+      auto d = std::max(box.min[axis] - center[axis], 0.0f) +
+               std::max(center[axis] - box.max[axis], 0.0f);
+      distance += d * d;
+    }
+    return distance <= radiusSquared;
+  };
+  return query((BvhState *)state, nodeMask, boxTest, outObjects);
+}
+
+void bvh_get_stats(void *state, BvhStats *outStats) {
+  auto s = (BvhState *)state;
+  auto rootArea = half_area(node_bounds(s->nodes[0]));
+  // A ray through the root box enters a box about in proportion to its surface area
+  f32 cost = 0.0f;
+  if (rootArea > 0.0f) {
+    for (const auto &node : s->nodes) {
+      cost += BVH_TRAVERSAL_COST * half_area(node_bounds(node)) / rootArea;
+      for (u32 lane = 0; lane < node.childCount; ++lane) {
+        if (node.counts[lane]) {
+          cost += (f32)node.counts[lane] * half_area(get_lane(node, lane)) / rootArea;
+        }
+      }
+    }
+  }
+  *outStats = {(u32)s->objects.size(), (u32)s->nodes.size(), s->depth, cost};
+}
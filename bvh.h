@@ -0,0 +1,52 @@
+#pragma once
+
+#include "defines.h"
+#include <vector>
+
+/**
+ * Bounding volume hierarchy over object boxes, for picking and proximity queries. Built top-down
+ * with a binned surface area heuristic, then collapsed into nodes of four children whose boxes are
+ * stored as structures of arrays, so a query tests the four at once with SIMD. Moving objects are
+ * handled by refitting the boxes bottom-up without changing the tree; once the objects have moved
+ * far from where they were built, see `BvhStats::cost`, a rebuild pays off again.
+ */
+
+static const u32 BVH_NONE = 0xffffffff;
+
+struct BvhBounds {
+  f32 min[3];
+  f32 max[3];
+};
+
+struct BvhRay {
+  f32 origin[3];
+  f32 direction[3]; // Distances are in lengths of it
+  f32 maxDistance;
+};
+
+struct BvhHit {
+  u32 object; // Id of the nearest box the ray enters, BVH_NONE when it enters none
+  f32 distance;
+};
+
+struct BvhStats {
+  u32 objects;
+  u32 nodes;
+  u32 depth;
+  // Expected node and box tests of a ray through the root box; grows as refits loosen the tree
+  f32 cost;
+};
+
+// Object ids are indices into `bounds`
+void bvh_build(void **state, const BvhBounds *bounds, u32 count);
+void bvh_destroy(void **state);
+// Takes new boxes of the objects the tree was built with, by id
+void bvh_refit(void *state, const BvhBounds *bounds);
+BvhHit bvh_intersect_ray(void *state, const BvhRay &ray);
+// `bvh_intersect_ray` of each ray, spread over the job system when `jobSystemState` is not null
+void bvh_intersect_rays(void *state, void *jobSystemState, const BvhRay *rays, u32 count,
+                        BvhHit *outHits);
+// Appends the ids of the objects whose boxes overlap the query, returns how many
+u32 bvh_query_aabb(void *state, const BvhBounds &box, std::vector<u32> *outObjects);
+u32 bvh_query_sphere(void *state, const f32 *center, f32 radius, std::vector<u32> *outObjects);
+void bvh_get_stats(void *state, BvhStats *outStats);
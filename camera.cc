@@ -28,19 +28,35 @@ void Camera::reset() {
   update_orientation();
 }
 
-glm::mat4 Camera::get_view_matrix() {
+glm::mat4 camera_pose_view_matrix(const CameraPose &pose) {
   // auto rotation = glm::mat4_cast(orientation);
   // auto translation = glm::translate(glm::mat4(1.0), cameraPos);
   //
   // view = glm::inverse(rotation * translation);
 
-  auto rotation = glm::mat4_cast(glm::conjugate(_orientation));
-  auto translation = glm::translate(glm::mat4(1.0), -_position);
+  auto rotation = glm::mat4_cast(glm::conjugate(pose.orientation));
+  auto translation = glm::translate(glm::mat4(1.0), -pose.position);
   auto view = rotation * translation;
   return view;
 }
 
-glm::vec3 Camera::get_front() { return _orientation * glm::vec3(0.0, 0.0, -1.0); }
+glm::vec3 camera_pose_front(const CameraPose &pose) {
+  return pose.orientation * glm::vec3(0.0, 0.0, -1.0);
+}
+
+glm::vec3 camera_pose_ray_direction(const CameraPose &pose, f32 fov, f32 aspect, f32 x, f32 y) {
+  auto tanHalfFov = tanf(glm::radians(fov) * 0.5f);
+  return pose.orientation * glm::vec3(x * tanHalfFov * aspect, y * tanHalfFov, -1.0f);
+}
+
+CameraPose camera_pose_interpolate(const CameraPose &from, const CameraPose &to, f32 t) {
+  // slerp takes the short way around, the two orientations are at most a step apart
+  return {glm::mix(from.position, to.position, t), glm::slerp(from.orientation, to.orientation, t)};
+}
+
+glm::mat4 Camera::get_view_matrix() { return camera_pose_view_matrix(get_pose()); }
+
+glm::vec3 Camera::get_front() { return camera_pose_front(get_pose()); }
 
 glm::vec3 Camera::get_back() { return -get_front(); }
 
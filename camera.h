@@ -3,8 +3,26 @@
 #include "defines.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// Where the camera is at the end of a simulation step, what the renderer interpolates between
+struct CameraPose {
+  glm::vec3 position;
+  glm::quat orientation;
+};
+
+glm::mat4 camera_pose_view_matrix(const CameraPose &pose);
+glm::vec3 camera_pose_front(const CameraPose &pose);
+/**
+ * Direction of the ray from the camera through a point of the view, not normalized
+ * @param fov vertical field of view in degrees
+ * @param x, y the point in normalized device coordinates, -1 to 1 with y up
+ */
+glm::vec3 camera_pose_ray_direction(const CameraPose &pose, f32 fov, f32 aspect, f32 x, f32 y);
+// Linear in position, spherical in orientation
+CameraPose camera_pose_interpolate(const CameraPose &from, const CameraPose &to, f32 t);
+
 class Camera {
 public:
   Camera(const glm::vec3 &position = {0.0, 0.0, 3.0});
@@ -22,6 +40,8 @@ public:
 
   const glm::quat &get_orientation() const { return _orientation; }
 
+  CameraPose get_pose() const { return {_position, _orientation}; }
+
   f32 get_pitch() const { return _pitch; }
   f32 get_yaw() const { return _yaw; }
 
@@ -0,0 +1,377 @@
+#include "crowd.h"
+#include "animation.h"
+#include "geometry_pool.h"
+#include "logger.h"
+#include "material.h"
+#include "memory_stats.h"
+#include "profiler.h"
+#include "program.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cmath>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <vector>
+
+static const f32 CROWD_SPACING = 1.0f; // Between neighbours on the grid
+static const f32 CROWD_FRAME_RATE = 30.0f;
+static const f32 CROWD_HIP_HEIGHT = 0.94f;
+static const f32 TAU = 6.28318531f;
+
+enum {
+  JOINT_HIPS,
+  JOINT_SPINE,
+  JOINT_CHEST,
+  JOINT_NECK,
+  JOINT_HEAD,
+  JOINT_LEFT_SHOULDER,
+  JOINT_LEFT_ELBOW,
+  JOINT_LEFT_HAND,
+  JOINT_RIGHT_SHOULDER,
+  JOINT_RIGHT_ELBOW,
+  JOINT_RIGHT_HAND,
+  JOINT_LEFT_HIP,
+  JOINT_LEFT_KNEE,
+  JOINT_LEFT_ANKLE,
+  JOINT_LEFT_TOE,
+  JOINT_RIGHT_HIP,
+  JOINT_RIGHT_KNEE,
+  JOINT_RIGHT_ANKLE,
+  JOINT_RIGHT_TOE,
+  JOINT_COUNT,
+};
+
+struct CrowdJoint {
+  i32 parent;
+  f32 offset[3]; // From the parent in the bind pose, facing +z
+  f32 width;     // Of the box between the parent and this joint
+};
+
+static const CrowdJoint CROWD_JOINTS[JOINT_COUNT] = {
+    {-1, {0.0f, CROWD_HIP_HEIGHT, 0.0f}, 0.0f},
+    {JOINT_HIPS, {0.0f, 0.18f, 0.0f}, 0.28f},
+    {JOINT_SPINE, {0.0f, 0.2f, 0.0f}, 0.32f},
+    {JOINT_CHEST, {0.0f, 0.18f, 0.0f}, 0.1f},
+    {JOINT_NECK, {0.0f, 0.24f, 0.0f}, 0.2f},
+    {JOINT_CHEST, {0.2f, 0.12f, 0.0f}, 0.12f},
+    {JOINT_LEFT_SHOULDER, {0.0f, -0.3f, 0.0f}, 0.09f},
+    {JOINT_LEFT_ELBOW, {0.0f, -0.27f, 0.0f}, 0.08f},
+    {JOINT_CHEST, {-0.2f, 0.12f, 0.0f}, 0.12f},
+    {JOINT_RIGHT_SHOULDER, {0.0f, -0.3f, 0.0f}, 0.09f},
+    {JOINT_RIGHT_ELBOW, {0.0f, -0.27f, 0.0f}, 0.08f},
+    {JOINT_HIPS, {0.1f, -0.06f, 0.0f}, 0.14f},
+    {JOINT_LEFT_HIP, {0.0f, -0.42f, 0.0f}, 0.12f},
+    {JOINT_LEFT_KNEE, {0.0f, -0.42f, 0.0f}, 0.1f},
+    {JOINT_LEFT_ANKLE, {0.0f, -0.04f, 0.14f}, 0.09f},
+    {JOINT_HIPS, {-0.1f, -0.06f, 0.0f}, 0.14f},
+    {JOINT_RIGHT_HIP, {0.0f, -0.42f, 0.0f}, 0.12f},
+    {JOINT_RIGHT_KNEE, {0.0f, -0.42f, 0.0f}, 0.1f},
+    {JOINT_RIGHT_ANKLE, {0.0f, -0.04f, 0.14f}, 0.09f},
+};
+
+enum { CLIP_WALK, CLIP_RUN, CLIP_COUNT };
+
+// Amplitudes of a gait cycle, in radians unless noted
+struct Gait {
+  u32 frames; // Keyframes per cycle
+  f32 stride; // Swing of the thighs
+  f32 knee;
+  f32 arm;
+  f32 elbow;
+  f32 bob; // Units the hips rise and fall
+  f32 lean;
+};
+
+static const Gait CROWD_GAITS[CLIP_COUNT] = {
+    {32, 0.45f, 0.7f, 0.35f, 0.25f, 0.03f, 0.05f},
+    {20, 0.75f, 1.4f, 0.6f, 1.4f, 0.07f, 0.25f},
+};
+
+struct CrowdVertex {
+  f32 position[3];
+  f32 normal[3];
+  f32 texCoord[2];
+  u8 joints[4];
+  f32 weights[4];
+};
+
+struct CrowdState {
+  Skeleton skeleton;
+  AnimationClip clips[CLIP_COUNT];
+  std::vector<AnimationInstance> instances;
+  std::vector<f32> phases; // Per character, cycles its walk is offset by
+  std::vector<f32> matrices;
+  void *geometryPoolState;
+  u32 mesh;
+  void *materialSystemState;
+  u32 material;
+  GLuint buffer;
+  GLuint texture;
+  f64 updateMs;
+};
+
+static u64 cpu_bytes(const CrowdState *s) {
+  u64 bytes = s->matrices.size() * sizeof(f32);
+  for (const auto &clip : s->clips) {
+    bytes += animation_clip_bytes(clip);
+  }
+  return bytes;
+}
+
+static u64 gpu_bytes(const CrowdState *s) { return s->matrices.size() * sizeof(f32); }
+
+static glm::vec3 bind_position(u32 joint) {
+  glm::vec3 position(0.0f);
+  for (auto j = (i32)joint; j >= 0; j = CROWD_JOINTS[j].parent) {
+    position += glm::make_vec3(CROWD_JOINTS[j].offset);
+  }
+  return position;
+}
+
+// Box from the parent of `joint` to the joint, moved by the parent and blended into the joint at
+// the far end
+static void add_bone(u32 joint, std::vector<CrowdVertex> *vertices, std::vector<u32> *indices) {
+  auto parent = (u32)CROWD_JOINTS[joint].parent;
+  auto a = bind_position(parent), b = bind_position(joint);
+  auto center = (a + b) * 0.5f;
+  glm::vec3 axes[3];
+  axes[2] = glm::normalize(b - a);
+  auto reference = fabsf(axes[2].y) > 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+  axes[0] = glm::normalize(glm::cross(axes[2], reference));
+  axes[1] = glm::cross(axes[2], axes[0]); // Right-handed, so faces wind counter-clockwise
+  auto width = CROWD_JOINTS[joint].width;
+  f32 halfExtents[3] = {width * 0.5f, width * 0.5f, glm::length(b - a) * 0.5f};
+
+  const f32 corners[4][2] = {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+  for (u32 axis = 0; axis < 3; ++axis) {
+    for (f32 sign : {1.0f, -1.0f}) {
+      auto s = (axis + 1) % 3, t = (axis + 2) % 3;
+      if (sign < 0) { std::swap(s, t); }
+      auto normal = axes[axis] * sign;
+      auto faceCenter = center + normal * halfExtents[axis];
+      auto first = (u32)vertices->size();
+      for (const auto &corner : corners) {
+        auto position = faceCenter + axes[s] * (corner[0] * halfExtents[s]) +
+                        axes[t] * (corner[1] * halfExtents[t]);
+        CrowdVertex vertex{};
+        memcpy(vertex.position, glm::value_ptr(position), sizeof(vertex.position));
+        memcpy(vertex.normal, glm::value_ptr(normal), sizeof(vertex.normal));
+        vertex.texCoord[0] = corner[0] * 0.5f + 0.5f;
+        vertex.texCoord[1] = corner[1] * 0.5f + 0.5f;
+        vertex.joints[0] = (u8)parent;
+        vertex.joints[1] = (u8)joint;
+        auto farEnd = glm::dot(position - center, axes[2]) > 0.0f;
+        vertex.weights[0] = farEnd ? 0.5f : 1.0f;
+        vertex.weights[1] = farEnd ? 0.5f : 0.0f;
+        vertices->push_back(vertex);
+      }
+      for (u32 index : {0, 1, 2, 0, 2, 3}) {
+        indices->push_back(first + index);
+      }
+    }
+  }
+}
+
+static glm::quat rotation(f32 angle, const glm::vec3 &axis) { return glm::angleAxis(angle, axis); }
+
+// One cycle of `gait`, keyframes looping back to the first
+static void build_clip(const Skeleton &skeleton, const Gait &gait, AnimationClip *clip) {
+  std::vector<f32> rotations(gait.frames * JOINT_COUNT * 4);
+  std::vector<f32> translations(gait.frames * JOINT_COUNT * 3);
+  const glm::vec3 x(1, 0, 0), y(0, 1, 0), z(0, 0, 1);
+  for (u32 frame = 0; frame < gait.frames; ++frame) {
+    auto phase = TAU * (f32)frame / (f32)gait.frames;
+    glm::quat joints[JOINT_COUNT];
+    std::fill(joints, joints + JOINT_COUNT, glm::quat(1, 0, 0, 0));
+    joints[JOINT_HIPS] = rotation(0.1f * sinf(phase), y);
+    joints[JOINT_SPINE] = rotation(gait.lean, x);
+    joints[JOINT_CHEST] = rotation(-0.15f * sinf(phase), y);
+    joints[JOINT_NECK] = rotation(-gait.lean, x);
+    // Legs swing a half cycle apart, arms against the leg on their side; positive angles about x
+    // move a hanging limb backwards
+    for (u32 side = 0; side < 2; ++side) {
+      auto legPhase = phase + (f32)side * TAU * 0.5f;
+      auto hip = side ? JOINT_RIGHT_HIP : JOINT_LEFT_HIP;
+      auto shoulder = side ? JOINT_RIGHT_SHOULDER : JOINT_LEFT_SHOULDER;
+      joints[hip] = rotation(-gait.stride * sinf(legPhase), x);
+      joints[hip + 1] = rotation(0.1f + gait.knee * std::max(0.0f, cosf(legPhase)), x);
+      joints[shoulder] =
+          rotation(side ? -0.08f : 0.08f, z) * rotation(gait.arm * sinf(legPhase), x);
+      joints[shoulder + 1] = rotation(-gait.elbow, x);
+    }
+    for (u32 joint = 0; joint < JOINT_COUNT; ++joint) {
+      auto key = frame * JOINT_COUNT + joint;
+      const auto &q = joints[joint];
+      f32 components[4] = {q.x, q.y, q.z, q.w};
+      memcpy(&rotations[key * 4], components, sizeof(components));
+      memcpy(&translations[key * 3], CROWD_JOINTS[joint].offset, sizeof(f32) * 3);
+    }
+    translations[frame * JOINT_COUNT * 3 + 1] += gait.bob * cosf(2.0f * phase);
+  }
+  animation_clip_create(clip, skeleton, rotations.data(), translations.data(), gait.frames,
+                        CROWD_FRAME_RATE);
+}
+
+// Deterministic scatter in [0, 1), so every run places and times the crowd the same
+static f32 scatter(u32 i, u32 salt) {
+  auto h = i * 2654435761u ^ salt * 2246822519u;
+  h ^= h >> 15;
+  h *= 2246822519u;
+  h ^= h >> 13;
+  return (f32)(h & 0xffffff) / (f32)0x1000000;
+}
+
+bool crowd_initialize(void **state, void *materialSystemState, u32 characterCount,
+                      const f32 *center) {
+  GLint maxTexels = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+  auto maxCharacters = (u32)maxTexels / (JOINT_COUNT * 3);
+  if (characterCount > maxCharacters) {
+    LOG_WARN("%u characters do not fit a buffer texture, drawing %u", characterCount,
+             maxCharacters);
+    characterCount = maxCharacters;
+  }
+
+  auto s = new CrowdState();
+  MaterialDesc materialDesc{MATERIAL_SHADING_LIT, {}, {0.85f, 0.55f, 0.35f, 1.0f}, 16.0f};
+  if (!material_create(materialSystemState, materialDesc, &s->material)) {
+    DELETE(s);
+    return false;
+  }
+  s->materialSystemState = materialSystemState;
+
+  { // Skeleton, bound with every rotation at identity
+    i32 parents[JOINT_COUNT];
+    std::vector<f32> inverseBind(JOINT_COUNT * 16);
+    for (u32 joint = 0; joint < JOINT_COUNT; ++joint) {
+      parents[joint] = CROWD_JOINTS[joint].parent;
+      auto matrix = glm::translate(glm::mat4(1.0f), -bind_position(joint));
+      memcpy(&inverseBind[joint * 16], glm::value_ptr(matrix), sizeof(matrix));
+    }
+    skeleton_create(&s->skeleton, parents, inverseBind.data(), JOINT_COUNT);
+    for (u32 i = 0; i < CLIP_COUNT; ++i) {
+      build_clip(s->skeleton, CROWD_GAITS[i], &s->clips[i]);
+    }
+  }
+
+  { // Mesh
+    std::vector<CrowdVertex> vertices;
+    std::vector<u32> indices;
+    for (u32 joint = JOINT_HIPS + 1; joint < JOINT_COUNT; ++joint) {
+      add_bone(joint, &vertices, &indices);
+    }
+    const VertexAttribute attributes[] = {
+        {0, 3, GL_FLOAT, false, offsetof(CrowdVertex, position)},
+        {1, 3, GL_FLOAT, false, offsetof(CrowdVertex, normal)},
+        {2, 2, GL_FLOAT, false, offsetof(CrowdVertex, texCoord)},
+        {3, 4, GL_UNSIGNED_BYTE, false, offsetof(CrowdVertex, joints)},
+        {4, 4, GL_FLOAT, false, offsetof(CrowdVertex, weights)},
+    };
+    if (!geometry_pool_create(&s->geometryPoolState, {attributes, 5, sizeof(CrowdVertex)},
+                              (u32)vertices.size(), (u32)indices.size())) {
+      material_destroy(materialSystemState, s->material);
+      DELETE(s);
+      return false;
+    }
+    s->mesh = geometry_pool_add(s->geometryPoolState, vertices.data(), (u32)vertices.size(),
+                                indices.data(), (u32)indices.size());
+  }
+
+  auto columns = (u32)ceilf(sqrtf((f32)characterCount));
+  auto rows = columns ? (characterCount + columns - 1) / columns : 0;
+  s->instances.resize(characterCount);
+  s->phases.resize(characterCount);
+  for (u32 i = 0; i < characterCount; ++i) {
+    auto column = i % columns, row = i / columns;
+    glm::vec3 position = glm::make_vec3(center);
+    position.x += ((f32)column - (f32)(columns - 1) * 0.5f) * CROWD_SPACING;
+    position.z -= ((f32)row - (f32)(rows - 1) * 0.5f) * CROWD_SPACING;
+    auto model = glm::translate(glm::mat4(1.0f), position);
+    model = glm::rotate(model, TAU * scatter(i, 1), glm::vec3(0, 1, 0));
+    auto &instance = s->instances[i];
+    memcpy(instance.model, glm::value_ptr(model), sizeof(instance.model));
+    instance.clips[0] = CLIP_WALK;
+    instance.clips[1] = CLIP_RUN;
+    instance.blend = scatter(i, 2);
+    s->phases[i] = scatter(i, 3);
+  }
+  s->matrices.resize((u64)characterCount * JOINT_COUNT * ANIMATION_MATRIX_FLOATS);
+
+  glGenBuffers(1, &s->buffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, s->buffer);
+  glBufferData(GL_TEXTURE_BUFFER, gpu_bytes(s), nullptr, GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glGenTextures(1, &s->texture);
+  glBindTexture(GL_TEXTURE_BUFFER, s->texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, s->buffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  memory_stats_allocate(MEMORY_TAG_ANIMATION, MEMORY_DOMAIN_CPU, cpu_bytes(s));
+  memory_stats_allocate(MEMORY_TAG_ANIMATION, MEMORY_DOMAIN_GPU, gpu_bytes(s));
+  *state = s;
+  return true;
+}
+
+void crowd_shutdown(void **state) {
+  auto s = (CrowdState *)*state;
+  memory_stats_free(MEMORY_TAG_ANIMATION, MEMORY_DOMAIN_CPU, cpu_bytes(s));
+  memory_stats_free(MEMORY_TAG_ANIMATION, MEMORY_DOMAIN_GPU, gpu_bytes(s));
+  glDeleteTextures(1, &s->texture);
+  glDeleteBuffers(1, &s->buffer);
+  geometry_pool_destroy(&s->geometryPoolState);
+  material_destroy(s->materialSystemState, s->material);
+  DELETE(s);
+  *state = nullptr;
+}
+
+void crowd_update(void *state, void *jobSystemState, f32 time) {
+  PROFILE_ZONE("crowd/update");
+  auto s = (CrowdState *)state;
+  if (s->instances.empty()) { return; }
+  auto startTime = std::chrono::steady_clock::now();
+  // Both clips keep the same phase, so the feet of a blend land together
+  auto walkDuration = animation_clip_duration(s->clips[CLIP_WALK]);
+  auto runDuration = animation_clip_duration(s->clips[CLIP_RUN]);
+  for (u32 i = 0; i < s->instances.size(); ++i) {
+    auto &instance = s->instances[i];
+    auto cycles = time / (walkDuration + (runDuration - walkDuration) * instance.blend);
+    cycles += s->phases[i];
+    instance.times[0] = cycles * walkDuration;
+    instance.times[1] = cycles * runDuration;
+  }
+  animation_update(jobSystemState, s->skeleton, s->clips, s->instances.data(),
+                   (u32)s->instances.size(), s->matrices.data());
+
+  glBindBuffer(GL_TEXTURE_BUFFER, s->buffer);
+  glBufferData(GL_TEXTURE_BUFFER, gpu_bytes(s), s->matrices.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  s->updateMs = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() -
+                                                       startTime)
+                    .count();
+}
+
+void crowd_draw(void *state, GLuint program) {
+  auto s = (CrowdState *)state;
+  if (s->instances.empty()) { return; }
+  material_bind(s->materialSystemState, s->material);
+  program_set_i32(program, "jointMatrices", MATERIAL_TEXTURE_COUNT);
+  program_set_i32(program, "jointCount", (i32)s->skeleton.jointCount);
+  glActiveTexture(GL_TEXTURE0 + MATERIAL_TEXTURE_COUNT);
+  glBindTexture(GL_TEXTURE_BUFFER, s->texture);
+  geometry_pool_bind(s->geometryPoolState);
+  geometry_pool_draw_instanced(s->geometryPoolState, s->mesh, (u32)s->instances.size());
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void crowd_get_stats(void *state, CrowdStats *outStats) {
+  auto s = (CrowdState *)state;
+  outStats->characters = (u32)s->instances.size();
+  outStats->joints = s->skeleton.jointCount;
+  auto mesh = geometry_pool_get(s->geometryPoolState, s->mesh);
+  outStats->triangles = mesh.indexCount / 3 * outStats->characters;
+  outStats->updateMs = s->updateMs;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "defines.h"
+#include "opengl.h"
+
+/**
+ * A crowd of animated characters: a procedural humanoid skeleton with a walk and a run clip, each
+ * character blending the two by its own weight. Every frame the characters are animated on the job
+ * system, see animation.h, and their skinning matrices uploaded to a buffer texture that
+ * shaders/materials_skinned.vert reads per instance, so one instanced draw submits the crowd.
+ */
+
+struct CrowdStats {
+  u32 characters;
+  u32 joints; // Per character
+  u32 triangles; // Of the whole crowd
+  f64 updateMs; // CPU time of the last update, sampling to upload
+};
+
+/**
+ * Needs a current GL context, as do all the other calls. Characters stand on a grid centered at
+ * `center`, which is where their feet are; the crowd creates its own material.
+ */
+bool crowd_initialize(void **state, void *materialSystemState, u32 characterCount,
+                      const f32 *center);
+void crowd_shutdown(void **state);
+// Poses every character `time` seconds into the animation; `jobSystemState` may be null
+void crowd_update(void *state, void *jobSystemState, f32 time);
+// Draws the crowd with `program`, the skinned stage of a lit shading, in use
+void crowd_draw(void *state, GLuint program);
+void crowd_get_stats(void *state, CrowdStats *outStats);
@@ -1,26 +1,62 @@
 #include "event.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include "mpsc_queue.h"
+#include <algorithm>
 #include <vector>
 
+static const u32 EVENT_QUEUE_CAPACITY = 4096;
+
 struct RegisteredEvent {
   void *listener;
   PFN_on_event fn;
 };
 
 struct EventCodeEntry {
-  std::vector<RegisteredEvent> events;
+  std::vector<RegisteredEvent> events; // In registration order, only registration allocates
+};
+
+struct PostedEvent {
+  EventCode code;
+  void *sender;
+  EventContext context;
 };
 
 struct EventSystemState {
   EventCodeEntry entries[EVENT_CODE_COUNT]; // Lookup table for event codes
+  bool coalescing[EVENT_CODE_COUNT];
+  MpscQueue<PostedEvent, EVENT_QUEUE_CAPACITY> posted;
+  std::vector<PostedEvent> batch; // Reused by every dispatch
 };
 
-void event_system_initialize(void **state) { *state = new EventSystemState(); }
+static u64 event_system_size(const EventSystemState *s) {
+  return sizeof(EventSystemState) + s->batch.capacity() * sizeof(PostedEvent);
+}
+
+void event_system_initialize(void **state) {
+  auto s = new EventSystemState();
+  s->batch.reserve(EVENT_QUEUE_CAPACITY);
+  memory_stats_allocate(MEMORY_TAG_EVENT, MEMORY_DOMAIN_CPU, event_system_size(s));
+  *state = s;
+}
+
+// Listener arrays are counted one allocation each, like the heap blocks they are
+static void count_listeners(const EventCodeEntry &entry, bool allocate) {
+  auto bytes = entry.events.capacity() * sizeof(RegisteredEvent);
+  if (bytes == 0) { return; }
+  if (allocate) {
+    memory_stats_allocate(MEMORY_TAG_EVENT, MEMORY_DOMAIN_CPU, bytes);
+  } else {
+    memory_stats_free(MEMORY_TAG_EVENT, MEMORY_DOMAIN_CPU, bytes);
+  }
+}
 
 void event_system_shutdown(void **state) {
   auto s = (EventSystemState *)*state;
-  for (auto &entry : s->entries) {
-    entry.events.clear();
+  for (const auto &entry : s->entries) {
+    count_listeners(entry, false);
   }
+  memory_stats_free(MEMORY_TAG_EVENT, MEMORY_DOMAIN_CPU, event_system_size(s));
   DELETE(s)
 }
 
@@ -29,15 +65,19 @@ bool event_register(void *state, EventCode code, void *listener, PFN_on_event fn
   auto &entry = s->entries[code];
   for (const auto &event : entry.events) {
     if (event.listener == listener && event.fn == fn) {
-      fprintf(stderr,
-              "[error] event has already been registered with the code %u and the callback %p\n",
-              code, fn);
+      LOG_ERROR("event has already been registered with the code %u and the callback %p", code,
+                fn);
       return false;
     }
   }
   RegisteredEvent event{};
   event.listener = listener;
   event.fn = fn;
+  if (entry.events.size() == entry.events.capacity()) {
+    count_listeners(entry, false);
+    entry.events.reserve(std::max<size_t>(entry.events.capacity() * 2, 4));
+    count_listeners(entry, true);
+  }
   entry.events.emplace_back(event);
   return true;
 }
@@ -47,7 +87,7 @@ bool event_deregister(void *state, EventCode code, const void *listener, PFN_on_
   auto &entry = s->entries[code];
   for (auto it = entry.events.begin(); it != entry.events.end(); ++it) {
     if ((*it).listener == listener && (*it).fn == fn) {
-      entry.events.erase(it);
+      entry.events.erase(it); // Keeps its capacity, and the rest in registration order
       return true;
     }
   }
@@ -64,3 +104,39 @@ bool event_fire(void *state, EventCode code, void *sender, EventContext context)
   }
   return false;
 }
+
+bool event_post(void *state, EventCode code, void *sender, EventContext context) {
+  auto s = (EventSystemState *)state;
+  PostedEvent event{};
+  event.code = code;
+  event.sender = sender;
+  event.context = context;
+  return s->posted.push(event);
+}
+
+u32 event_dispatch_deferred(void *state) {
+  auto s = (EventSystemState *)state;
+
+  // Drain first so events posted by listeners wait for the next dispatch
+  u32 latest[EVENT_CODE_COUNT];
+  s->batch.clear();
+  PostedEvent event;
+  while (s->posted.pop(&event)) {
+    latest[event.code] = (u32)s->batch.size();
+    s->batch.emplace_back(event);
+  }
+
+  u32 dispatched = 0;
+  for (u32 i = 0; i < s->batch.size(); ++i) {
+    const auto &it = s->batch[i];
+    if (s->coalescing[it.code] && latest[it.code] != i) { continue; }
+    event_fire(state, it.code, it.sender, it.context);
+    ++dispatched;
+  }
+  return dispatched;
+}
+
+void event_set_coalescing(void *state, EventCode code, bool coalesce) {
+  auto s = (EventSystemState *)state;
+  s->coalescing[code] = coalesce;
+}
@@ -52,3 +52,20 @@ void event_system_shutdown(void **state);
 bool event_register(void *state, EventCode code, void *listener, PFN_on_event fn);
 bool event_deregister(void *state, EventCode code, const void *listener, PFN_on_event fn);
 bool event_fire(void *state, EventCode code, void *sender, EventContext context);
+
+/**
+ * Queues an event for the next `event_dispatch_deferred`. Unlike `event_fire` this is safe to call
+ * from any thread; listeners always run on the thread owning the event system.
+ * @return false if the deferred queue is full and the event was dropped
+ */
+bool event_post(void *state, EventCode code, void *sender, EventContext context);
+
+/**
+ * Dispatches every event posted so far, in posting order. Must be called from the owning thread.
+ * @return number of events delivered to listeners
+ */
+u32 event_dispatch_deferred(void *state);
+
+// Only the most recent posted event of a coalesced code is delivered per dispatch. Suitable for
+// events carrying absolute state, such as a window size or a cursor position
+void event_set_coalescing(void *state, EventCode code, bool coalesce);
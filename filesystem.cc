@@ -1,8 +1,12 @@
 #include "filesystem.h"
+#include "allocator.h"
+#include "logger.h"
 #include <cstdio>
 #include <cstring>
 #include <sys/stat.h>
 
+static ObjectPool<File> filePool("File", MEMORY_TAG_FILE);
+
 bool filesystem_exists(const char *path) {
   struct stat st {};
   return stat(path, &st) == 0;
@@ -17,16 +21,16 @@ bool filesystem_open(File **file, const char *path, FileMode mode, bool binary)
   } else if ((mode & FILE_MODE_READ) == 0 && (mode & FILE_MODE_WRITE) != 0) {
     flags = binary ? "wb" : "w";
   } else {
-    fprintf(stderr, "invalid mode passed while opening file: '%s'\n", path);
+    LOG_ERROR("invalid mode passed while opening file: '%s'", path);
     return false;
   }
   FILE *handle = fopen(path, flags);
   if (!handle) {
-    fprintf(stderr, "error opening file: '%s'\n", path);
+    LOG_ERROR("error opening file: '%s'", path);
     return false;
   }
 
-  auto f = new File();
+  auto f = filePool.create();
   f->handle = handle;
   f->valid = true;
   *file = f;
@@ -36,7 +40,8 @@ bool filesystem_open(File **file, const char *path, FileMode mode, bool binary)
 void filesystem_close(File **file) {
   if (auto f = *file; f->valid) {
     fclose((FILE *)f->handle);
-    DELETE(f)
+    filePool.destroy(f);
+    *file = nullptr;
   }
 }
 
@@ -64,7 +69,6 @@ bool filesystem_write_line(File *file, const char *buffer) {
   if (file->valid) {
     auto result = fputs(buffer, (FILE *)file->handle);
     if (result != EOF) { result = fputc('\n', (FILE *)file->handle); }
-    fflush((FILE *)file->handle);
     return result != EOF;
   }
   return false;
@@ -91,9 +95,7 @@ bool filesystem_read(File *file, void *outBuffer, u64 *outBytesRead) {
 bool filesystem_write(File *file, u64 size, const void *buffer, u64 *outBytesWritten) {
   if (file->valid) {
     *outBytesWritten = fwrite(buffer, 1, size, (FILE *)file->handle);
-    if (*outBytesWritten != size) { return false; }
-    fflush((FILE *)file->handle);
-    return true;
+    return *outBytesWritten == size;
   }
   return false;
 }
@@ -0,0 +1,269 @@
+#include "frame_stats.h"
+#include "filesystem.h"
+#include "logger.h"
+#include "opengl.h"
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+
+static const u32 FRAME_STATS_BUCKETS = 256;
+static const f64 FRAME_STATS_MIN_MS = 0.01; // Upper edge of the first bucket
+static const f64 FRAME_STATS_GROWTH = 1.05; // Each bucket is 5% wider than the previous one
+static const u32 FRAME_STATS_WINDOW = 512;  // Samples in the rolling statistics
+static const f64 FRAME_STATS_HITCH_FACTOR = 1.5;
+static const u32 FRAME_STATS_PENDING_ROWS = 16; // Frames a CSV row waits for late timings
+static const u32 FRAME_STATS_GPU_LATENCY = 4;
+
+struct StatTrack {
+  u32 window[FRAME_STATS_BUCKETS];
+  u64 lifetime[FRAME_STATS_BUCKETS];
+  f32 samples[FRAME_STATS_WINDOW]; // Ring of the values counted in `window`
+  u64 count;
+  f64 lifetimeMax;
+};
+
+struct PendingRow {
+  bool used;
+  u64 frame;
+  u32 mask; // Stats recorded so far
+  f64 values[FRAME_STAT_COUNT];
+};
+
+struct FrameStatsState {
+  std::mutex mutex;
+  f64 budget;
+  StatTrack tracks[FRAME_STAT_COUNT];
+  u64 windowHitches;
+  u64 lifetimeHitches;
+
+  File *csv;
+  PendingRow rows[FRAME_STATS_PENDING_ROWS];
+
+  GLuint queries[FRAME_STATS_GPU_LATENCY];
+  u64 queryFrames[FRAME_STATS_GPU_LATENCY];
+  bool queryPending[FRAME_STATS_GPU_LATENCY];
+  u32 currentQuery;
+  bool gpuInitialized;
+};
+
+static const char *statNames[FRAME_STAT_COUNT] = {"update", "submit", "gpu", "present",
+                                                  "interval"};
+
+const char *frame_stat_name(FrameStat stat) { return statNames[stat]; }
+
+static u32 bucket_index(f64 ms) {
+  if (ms <= FRAME_STATS_MIN_MS) { return 0; }
+  auto index = ceil(log(ms / FRAME_STATS_MIN_MS) / log(FRAME_STATS_GROWTH));
+  return (u32)std::min(index, (f64)(FRAME_STATS_BUCKETS - 1));
+}
+
+static f64 bucket_upper_edge(u32 index) {
+  return FRAME_STATS_MIN_MS * pow(FRAME_STATS_GROWTH, (f64)index);
+}
+
+// Nearest-rank percentile, reported as the upper edge of the bucket holding it
+template <typename T> static f64 percentile(const T *buckets, u64 count, f64 p, f64 max) {
+  auto rank = (u64)ceil(p * (f64)count);
+  u64 seen = 0;
+  for (u32 i = 0; i < FRAME_STATS_BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) { return std::min(bucket_upper_edge(i), max); }
+  }
+  return max;
+}
+
+static void write_row(FrameStatsState *s, const PendingRow &row) {
+  char line[256];
+  auto length = snprintf(line, sizeof(line), "%llu", (unsigned long long)row.frame);
+  for (u32 i = 0; i < FRAME_STAT_COUNT && length < (i32)sizeof(line); ++i) {
+    if (row.mask & (1u << i)) {
+      length += snprintf(line + length, sizeof(line) - length, ",%.4f", row.values[i]);
+    } else {
+      length += snprintf(line + length, sizeof(line) - length, ",");
+    }
+  }
+  filesystem_write_line(s->csv, line);
+}
+
+// Rows leave the ring when a frame FRAME_STATS_PENDING_ROWS newer claims their slot, which keeps
+// them in frame order and gives late GPU timings time to arrive
+static void csv_record(FrameStatsState *s, u64 frame, FrameStat stat, f64 ms) {
+  auto &row = s->rows[frame % FRAME_STATS_PENDING_ROWS];
+  if (row.used && row.frame != frame) {
+    if (frame < row.frame) { return; } // Its row was already written
+    write_row(s, row);
+    row = {};
+  }
+  row.used = true;
+  row.frame = frame;
+  row.mask |= 1u << stat;
+  row.values[stat] = ms;
+}
+
+static void csv_flush(FrameStatsState *s) {
+  std::sort(std::begin(s->rows), std::end(s->rows), [](const auto &a, const auto &b) {
+    return a.used != b.used ? a.used : a.frame < b.frame;
+  });
+  for (auto &row : s->rows) {
+    if (row.used) { write_row(s, row); }
+    row = {};
+  }
+}
+
+void frame_stats_initialize(void **state, f64 budgetMs) {
+  auto s = new FrameStatsState();
+  s->budget = budgetMs;
+  *state = s;
+}
+
+void frame_stats_shutdown(void **state) {
+  auto s = (FrameStatsState *)*state;
+  if (s->csv) {
+    csv_flush(s);
+    filesystem_close(&s->csv);
+  }
+  DELETE(s);
+  *state = nullptr;
+}
+
+bool frame_stats_open_csv(void *state, const char *path) {
+  auto s = (FrameStatsState *)state;
+  std::lock_guard<std::mutex> lock(s->mutex);
+  if (!filesystem_open(&s->csv, path, FILE_MODE_WRITE, false)) {
+    LOG_ERROR("error creating frame stats file: '%s'", path);
+    return false;
+  }
+  return filesystem_write_line(s->csv, "frame,update_ms,submit_ms,gpu_ms,present_ms,interval_ms");
+}
+
+void frame_stats_record(void *state, u64 frame, FrameStat stat, f64 ms) {
+  auto s = (FrameStatsState *)state;
+  std::lock_guard<std::mutex> lock(s->mutex);
+  auto &track = s->tracks[stat];
+  auto hitch = s->budget * FRAME_STATS_HITCH_FACTOR;
+
+  auto &slot = track.samples[track.count % FRAME_STATS_WINDOW];
+  if (track.count >= FRAME_STATS_WINDOW) { // Evict the oldest sample from the window
+    track.window[bucket_index(slot)] -= 1;
+    if (stat == FRAME_STAT_INTERVAL && slot > hitch) { s->windowHitches -= 1; }
+  }
+  slot = (f32)ms;
+  track.count += 1;
+
+  auto bucket = bucket_index(ms);
+  track.window[bucket] += 1;
+  track.lifetime[bucket] += 1;
+  track.lifetimeMax = std::max(track.lifetimeMax, ms);
+  if (stat == FRAME_STAT_INTERVAL && (f32)ms > hitch) {
+    s->windowHitches += 1;
+    s->lifetimeHitches += 1;
+  }
+
+  if (s->csv && frame != FRAME_STATS_NO_FRAME) { csv_record(s, frame, stat, ms); }
+}
+
+void frame_stats_record_csv(void *state, u64 frame, FrameStat stat, f64 ms) {
+  auto s = (FrameStatsState *)state;
+  std::lock_guard<std::mutex> lock(s->mutex);
+  if (s->csv) { csv_record(s, frame, stat, ms); }
+}
+
+void frame_stats_report(void *state, bool lifetime, FrameStatsReport *outReport) {
+  auto s = (FrameStatsState *)state;
+  std::lock_guard<std::mutex> lock(s->mutex);
+  for (u32 i = 0; i < FRAME_STAT_COUNT; ++i) {
+    const auto &track = s->tracks[i];
+    auto &summary = outReport->stats[i];
+    if (lifetime) {
+      summary.count = track.count;
+      summary.max = track.lifetimeMax;
+    } else {
+      summary.count = std::min(track.count, (u64)FRAME_STATS_WINDOW);
+      summary.max = 0;
+      for (u64 j = 0; j < summary.count; ++j) {
+        summary.max = std::max(summary.max, (f64)track.samples[j]);
+      }
+    }
+    if (summary.count == 0) {
+      summary = {};
+      continue;
+    }
+    if (lifetime) {
+      summary.p50 = percentile(track.lifetime, summary.count, 0.50, summary.max);
+      summary.p95 = percentile(track.lifetime, summary.count, 0.95, summary.max);
+      summary.p99 = percentile(track.lifetime, summary.count, 0.99, summary.max);
+    } else {
+      summary.p50 = percentile(track.window, summary.count, 0.50, summary.max);
+      summary.p95 = percentile(track.window, summary.count, 0.95, summary.max);
+      summary.p99 = percentile(track.window, summary.count, 0.99, summary.max);
+    }
+  }
+  outReport->hitches = lifetime ? s->lifetimeHitches : s->windowHitches;
+}
+
+u32 frame_stats_history(void *state, FrameStat stat, f32 *outSamples, u32 maxSamples) {
+  auto s = (FrameStatsState *)state;
+  std::lock_guard<std::mutex> lock(s->mutex);
+  const auto &track = s->tracks[stat];
+  auto count = (u32)std::min({track.count, (u64)FRAME_STATS_WINDOW, (u64)maxSamples});
+  for (u32 i = 0; i < count; ++i) {
+    outSamples[i] = track.samples[(track.count - count + i) % FRAME_STATS_WINDOW];
+  }
+  return count;
+}
+
+void frame_stats_print(void *state) {
+  auto s = (FrameStatsState *)state;
+  FrameStatsReport report{};
+  frame_stats_report(state, true, &report);
+  printf("frame stats over %llu frames, budget %.2f ms, %llu hitches\n",
+         (unsigned long long)report.stats[FRAME_STAT_INTERVAL].count, s->budget,
+         (unsigned long long)report.hitches);
+  printf("%-10s %10s %10s %10s %10s\n", "ms", "p50", "p95", "p99", "max");
+  for (u32 i = 0; i < FRAME_STAT_COUNT; ++i) {
+    const auto &summary = report.stats[i];
+    if (summary.count == 0) { continue; }
+    printf("%-10s %10.3f %10.3f %10.3f %10.3f\n", statNames[i], summary.p50, summary.p95,
+           summary.p99, summary.max);
+  }
+}
+
+void frame_stats_gpu_initialize(void *state) {
+  auto s = (FrameStatsState *)state;
+  glGenQueries(FRAME_STATS_GPU_LATENCY, s->queries);
+  s->gpuInitialized = true;
+}
+
+void frame_stats_gpu_shutdown(void *state) {
+  auto s = (FrameStatsState *)state;
+  if (!s->gpuInitialized) { return; }
+  glDeleteQueries(FRAME_STATS_GPU_LATENCY, s->queries);
+  s->gpuInitialized = false;
+}
+
+void frame_stats_gpu_begin(void *state, u64 frame) {
+  auto s = (FrameStatsState *)state;
+  if (!s->gpuInitialized) { return; }
+  auto slot = s->currentQuery;
+  if (s->queryPending[slot]) {
+    // Issued FRAME_STATS_GPU_LATENCY frames ago; if it is still not done, drop it rather than stall
+    GLint available = 0;
+    glGetQueryObjectiv(s->queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      GLuint64 elapsed = 0; // Nanoseconds
+      glGetQueryObjectui64v(s->queries[slot], GL_QUERY_RESULT, &elapsed);
+      frame_stats_record(state, s->queryFrames[slot], FRAME_STAT_GPU, (f64)elapsed / 1e6);
+    }
+    s->queryPending[slot] = false;
+  }
+  s->queryFrames[slot] = frame;
+  glBeginQuery(GL_TIME_ELAPSED, s->queries[slot]);
+}
+
+void frame_stats_gpu_end(void *state) {
+  auto s = (FrameStatsState *)state;
+  if (!s->gpuInitialized) { return; }
+  glEndQuery(GL_TIME_ELAPSED);
+  s->queryPending[s->currentQuery] = true;
+  s->currentQuery = (s->currentQuery + 1) % FRAME_STATS_GPU_LATENCY;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "defines.h"
+
+/**
+ * Per-frame timings kept in log-spaced histograms, both over a rolling window and over the whole
+ * run, so percentiles cost a walk over a fixed number of buckets whatever the frame count.
+ * Percentiles are accurate to one bucket (5%); maxima are exact. Recording is thread-safe, the
+ * update and render threads feed it concurrently.
+ */
+
+enum FrameStat {
+  FRAME_STAT_UPDATE = 0x0, // One simulation step; in the CSV, the steps the frame draws first
+  FRAME_STAT_SUBMIT,       // CPU time issuing the frame's GL commands
+  FRAME_STAT_GPU,          // GPU time of the frame, from a query read back a few frames later
+  FRAME_STAT_PRESENT,      // Time spent in the buffer swap
+  FRAME_STAT_INTERVAL,     // Present to present
+
+  FRAME_STAT_COUNT,
+};
+
+struct FrameStatSummary {
+  u64 count;
+  f64 p50; // Milliseconds
+  f64 p95;
+  f64 p99;
+  f64 max;
+};
+
+struct FrameStatsReport {
+  FrameStatSummary stats[FRAME_STAT_COUNT];
+  u64 hitches; // Intervals longer than 1.5 frame budgets
+};
+
+// Frame of the samples that belong to none, e.g. the steps of the update thread
+static const u64 FRAME_STATS_NO_FRAME = UINT64_MAX;
+
+const char *frame_stat_name(FrameStat stat);
+
+void frame_stats_initialize(void **state, f64 budgetMs);
+void frame_stats_shutdown(void **state);
+/**
+ * Streams one CSV row per frame, written once every timing of that frame arrived
+ * @return false if the file cannot be created
+ */
+bool frame_stats_open_csv(void *state, const char *path);
+
+// Samples of FRAME_STATS_NO_FRAME are left out of the CSV
+void frame_stats_record(void *state, u64 frame, FrameStat stat, f64 ms);
+// Adds to the CSV row of the frame without counting a sample, e.g. the time of the steps it draws
+void frame_stats_record_csv(void *state, u64 frame, FrameStat stat, f64 ms);
+// Statistics over the last few seconds, or over the whole run when `lifetime` is set
+void frame_stats_report(void *state, bool lifetime, FrameStatsReport *outReport);
+// Copies the most recent samples of one stat, oldest first, returns how many were written
+u32 frame_stats_history(void *state, FrameStat stat, f32 *outSamples, u32 maxSamples);
+void frame_stats_print(void *state);
+
+// GPU timing, render thread only, with its GL context current
+void frame_stats_gpu_initialize(void *state);
+void frame_stats_gpu_shutdown(void *state);
+void frame_stats_gpu_begin(void *state, u64 frame);
+void frame_stats_gpu_end(void *state);
@@ -0,0 +1,237 @@
+#include "geometry_pool.h"
+#include "allocator.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include <algorithm>
+#include <vector>
+
+static const u32 GEOMETRY_POOL_MAX_ATTRIBUTES = 8;
+
+struct GeometryPoolEntry {
+  GeometryMesh mesh;
+  bool live;
+};
+
+struct GeometryPoolState {
+  VertexAttribute attributes[GEOMETRY_POOL_MAX_ATTRIBUTES];
+  u32 attributeCount;
+  u32 stride;
+  GLuint vao;
+  GLuint vbo;
+  GLuint ebo;
+  RangeAllocator vertexRanges; // In vertices
+  RangeAllocator indexRanges;  // In indices
+  std::vector<GeometryPoolEntry> meshes; // By id
+  std::vector<u32> freeIds;
+  u32 liveMeshes;
+  u64 usedVertices;
+  u64 usedIndices;
+  u32 rebuilds;
+};
+
+static u64 buffer_bytes(const GeometryPoolState *s) {
+  return s->vertexRanges.capacity() * s->stride + s->indexRanges.capacity() * sizeof(u32);
+}
+
+static void attach_buffers(GeometryPoolState *s) {
+  glBindVertexArray(s->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, s->vbo);
+  for (u32 i = 0; i < s->attributeCount; ++i) {
+    const auto &attribute = s->attributes[i];
+    glVertexAttribPointer(attribute.location, attribute.components, attribute.type,
+                          attribute.normalized ? GL_TRUE : GL_FALSE, s->stride,
+                          (any)(u64)attribute.offset);
+    glEnableVertexAttribArray(attribute.location);
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s->ebo); // Recorded in the VAO
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Moves every live mesh into new buffers of the given capacities, packed from the start. The
+// copies stay on the GPU.
+static void rebuild(GeometryPoolState *s, u64 vertexCapacity, u64 indexCapacity) {
+  GLuint vbo, ebo;
+  glGenBuffers(1, &vbo);
+  glGenBuffers(1, &ebo);
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+  glBufferData(GL_COPY_WRITE_BUFFER, vertexCapacity * s->stride, nullptr, GL_STATIC_DRAW);
+  glBindBuffer(GL_COPY_READ_BUFFER, s->vbo);
+  u64 vertexOffset = 0;
+  for (auto &entry : s->meshes) {
+    if (!entry.live || entry.mesh.vertexCount == 0) { continue; }
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                        (u64)entry.mesh.baseVertex * s->stride, vertexOffset * s->stride,
+                        (u64)entry.mesh.vertexCount * s->stride);
+    entry.mesh.baseVertex = (u32)vertexOffset;
+    vertexOffset += entry.mesh.vertexCount;
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+  glBufferData(GL_COPY_WRITE_BUFFER, indexCapacity * sizeof(u32), nullptr, GL_STATIC_DRAW);
+  glBindBuffer(GL_COPY_READ_BUFFER, s->ebo);
+  u64 indexOffset = 0;
+  for (auto &entry : s->meshes) {
+    if (!entry.live || entry.mesh.indexCount == 0) { continue; }
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                        (u64)entry.mesh.firstIndex * sizeof(u32), indexOffset * sizeof(u32),
+                        (u64)entry.mesh.indexCount * sizeof(u32));
+    entry.mesh.firstIndex = (u32)indexOffset;
+    indexOffset += entry.mesh.indexCount;
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  if (s->vbo) {
+    memory_stats_free(MEMORY_TAG_MESH, MEMORY_DOMAIN_GPU, buffer_bytes(s));
+    GLuint buffers[] = {s->vbo, s->ebo};
+    glDeleteBuffers(2, buffers);
+  }
+  s->vbo = vbo;
+  s->ebo = ebo;
+  s->vertexRanges.reset(vertexCapacity, vertexOffset);
+  s->indexRanges.reset(indexCapacity, indexOffset);
+  memory_stats_allocate(MEMORY_TAG_MESH, MEMORY_DOMAIN_GPU, buffer_bytes(s));
+  attach_buffers(s);
+  ++s->rebuilds;
+}
+
+bool geometry_pool_create(void **state, const VertexFormat &format, u32 vertexCapacity,
+                          u32 indexCapacity) {
+  if (format.attributeCount > GEOMETRY_POOL_MAX_ATTRIBUTES) {
+    LOG_ERROR("too many vertex attributes for a geometry pool: %u", format.attributeCount);
+    return false;
+  }
+  auto s = new GeometryPoolState();
+  std::copy(format.attributes, format.attributes + format.attributeCount, s->attributes);
+  s->attributeCount = format.attributeCount;
+  s->stride = format.stride;
+  glGenVertexArrays(1, &s->vao);
+  rebuild(s, std::max(vertexCapacity, 1u), std::max(indexCapacity, 1u));
+  s->rebuilds = 0;
+  *state = s;
+  return true;
+}
+
+void geometry_pool_destroy(void **state) {
+  auto s = (GeometryPoolState *)*state;
+  memory_stats_free(MEMORY_TAG_MESH, MEMORY_DOMAIN_GPU, buffer_bytes(s));
+  GLuint buffers[] = {s->vbo, s->ebo};
+  glDeleteBuffers(2, buffers);
+  glDeleteVertexArrays(1, &s->vao);
+  DELETE(s);
+  *state = nullptr;
+}
+
+u32 geometry_pool_add(void *state, const void *vertices, u32 vertexCount, const u32 *indices,
+                      u32 indexCount) {
+  auto s = (GeometryPoolState *)state;
+  u64 baseVertex, firstIndex;
+  auto fits = s->vertexRanges.allocate(vertexCount, &baseVertex);
+  if (fits && !s->indexRanges.allocate(indexCount, &firstIndex)) {
+    s->vertexRanges.free(baseVertex, vertexCount);
+    fits = false;
+  }
+  if (!fits) {
+    // Compacting is enough when the free space is only fragmented, otherwise grow geometrically
+    auto vertexCapacity = s->vertexRanges.capacity();
+    if (s->vertexRanges.free_size() < vertexCount) {
+      vertexCapacity = std::max(vertexCapacity * 2, s->usedVertices + vertexCount);
+    }
+    auto indexCapacity = s->indexRanges.capacity();
+    if (s->indexRanges.free_size() < indexCount) {
+      indexCapacity = std::max(indexCapacity * 2, s->usedIndices + indexCount);
+    }
+    rebuild(s, vertexCapacity, indexCapacity);
+    s->vertexRanges.allocate(vertexCount, &baseVertex);
+    s->indexRanges.allocate(indexCount, &firstIndex);
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, s->vbo);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, baseVertex * s->stride, (u64)vertexCount * s->stride,
+                  vertices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, s->ebo);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, firstIndex * sizeof(u32), indexCount * sizeof(u32),
+                  indices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  u32 id;
+  if (!s->freeIds.empty()) {
+    id = s->freeIds.back();
+    s->freeIds.pop_back();
+  } else {
+    id = (u32)s->meshes.size();
+    s->meshes.emplace_back();
+  }
+  s->meshes[id] = {{(u32)baseVertex, vertexCount, (u32)firstIndex, indexCount}, true};
+  ++s->liveMeshes;
+  s->usedVertices += vertexCount;
+  s->usedIndices += indexCount;
+  return id;
+}
+
+void geometry_pool_remove(void *state, u32 mesh) {
+  auto s = (GeometryPoolState *)state;
+  auto &entry = s->meshes[mesh];
+  s->vertexRanges.free(entry.mesh.baseVertex, entry.mesh.vertexCount);
+  s->indexRanges.free(entry.mesh.firstIndex, entry.mesh.indexCount);
+  --s->liveMeshes;
+  s->usedVertices -= entry.mesh.vertexCount;
+  s->usedIndices -= entry.mesh.indexCount;
+  entry = {};
+  s->freeIds.push_back(mesh);
+}
+
+GeometryMesh geometry_pool_get(void *state, u32 mesh) {
+  return ((GeometryPoolState *)state)->meshes[mesh].mesh;
+}
+
+void geometry_pool_defragment(void *state) {
+  auto s = (GeometryPoolState *)state;
+  if (s->vertexRanges.is_packed() && s->indexRanges.is_packed()) { return; }
+  rebuild(s, s->vertexRanges.capacity(), s->indexRanges.capacity());
+}
+
+void geometry_pool_get_stats(void *state, GeometryPoolStats *outStats) {
+  auto s = (GeometryPoolState *)state;
+  outStats->meshes = s->liveMeshes;
+  outStats->vertexBytes = s->usedVertices * s->stride;
+  outStats->vertexCapacityBytes = s->vertexRanges.capacity() * s->stride;
+  outStats->indexBytes = s->usedIndices * sizeof(u32);
+  outStats->indexCapacityBytes = s->indexRanges.capacity() * sizeof(u32);
+  outStats->freeRanges = s->vertexRanges.free_range_count() + s->indexRanges.free_range_count();
+  outStats->rebuilds = s->rebuilds;
+}
+
+// Lives in the VAO next to the pool's own attributes, which rebuilds do not touch
+void geometry_pool_set_instance_attribute(void *state, u32 location, GLuint buffer) {
+  glBindVertexArray(((GeometryPoolState *)state)->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glVertexAttribIPointer(location, 1, GL_UNSIGNED_INT, sizeof(u32), nullptr);
+  glVertexAttribDivisor(location, 1);
+  glEnableVertexAttribArray(location);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void geometry_pool_bind(void *state) { glBindVertexArray(((GeometryPoolState *)state)->vao); }
+
+void geometry_pool_draw(void *state, u32 mesh, u32 indexOffset, u32 indexCount) {
+  const auto &m = ((GeometryPoolState *)state)->meshes[mesh].mesh;
+  if (indexOffset + indexCount > m.indexCount) {
+    LOG_ERROR("draw of indices [%u, %u) out of range (%u indices)", indexOffset,
+              indexOffset + indexCount, m.indexCount);
+    return;
+  }
+  glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT,
+                           (any)((u64)(m.firstIndex + indexOffset) * sizeof(u32)),
+                           (GLint)m.baseVertex);
+}
+
+void geometry_pool_draw_instanced(void *state, u32 mesh, u32 instanceCount) {
+  const auto &m = ((GeometryPoolState *)state)->meshes[mesh].mesh;
+  glDrawElementsInstancedBaseVertex(GL_TRIANGLES, m.indexCount, GL_UNSIGNED_INT,
+                                    (any)((u64)m.firstIndex * sizeof(u32)), instanceCount,
+                                    (GLint)m.baseVertex);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "defines.h"
+#include "opengl.h"
+
+/**
+ * Meshes of one vertex format packed into a shared vertex buffer and a shared 32-bit index buffer
+ * behind a single VAO, so drawing any of them needs one bind. Index values stay relative to their
+ * mesh and draws add its base vertex. Ranges come from free lists; when none fits, the pool
+ * compacts its meshes into new buffers, growing them if the free space is short. Meshes move when
+ * that happens, so they are addressed by id and looked up at draw time.
+ */
+
+struct VertexAttribute {
+  u32 location;
+  u32 components;
+  GLenum type;
+  bool normalized;
+  u32 offset; // Bytes into the vertex
+};
+
+struct VertexFormat {
+  const VertexAttribute *attributes;
+  u32 attributeCount;
+  u32 stride; // Bytes per vertex
+};
+
+struct GeometryMesh {
+  u32 baseVertex;
+  u32 vertexCount;
+  u32 firstIndex;
+  u32 indexCount;
+};
+
+struct GeometryPoolStats {
+  u32 meshes;
+  u64 vertexBytes; // In use, out of the capacity
+  u64 vertexCapacityBytes;
+  u64 indexBytes;
+  u64 indexCapacityBytes;
+  u32 freeRanges; // Vertex and index free lists together, 2 when unfragmented
+  u32 rebuilds;   // Compactions and growths so far
+};
+
+// Needs a current GL context, as do all the other calls; capacities are in vertices and indices
+bool geometry_pool_create(void **state, const VertexFormat &format, u32 vertexCapacity,
+                          u32 indexCapacity);
+void geometry_pool_destroy(void **state);
+// Copies the mesh into the pool and returns its id
+u32 geometry_pool_add(void *state, const void *vertices, u32 vertexCount, const u32 *indices,
+                      u32 indexCount);
+void geometry_pool_remove(void *state, u32 mesh);
+GeometryMesh geometry_pool_get(void *state, u32 mesh);
+// Packs the meshes to the start of the buffers, leaving one free range in each
+void geometry_pool_defragment(void *state);
+void geometry_pool_get_stats(void *state, GeometryPoolStats *outStats);
+
+// Feeds `location` one u32 per instance from `buffer`. Indirect draws offset it with their base
+// instance, which gives each draw an index into per-draw data.
+void geometry_pool_set_instance_attribute(void *state, u32 location, GLuint buffer);
+
+void geometry_pool_bind(void *state);
+// Draws `indexCount` of the mesh's indices starting at `indexOffset`; the pool must be bound
+void geometry_pool_draw(void *state, u32 mesh, u32 indexOffset, u32 indexCount);
+// Draws `instanceCount` instances of the whole mesh; the pool must be bound
+void geometry_pool_draw_instanced(void *state, u32 mesh, u32 instanceCount);
@@ -0,0 +1,220 @@
+#include "gpu_cull.h"
+#include "memory_stats.h"
+#include "program.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__APPLE__) // Stuck at GL 4.1, without compute shaders or indirect multi-draws
+
+bool gpu_cull_supported() { return false; }
+bool gpu_cull_initialize(void **state, const GpuCullMesh *meshes, u32 meshCount,
+                         const GpuCullObject *objects, u32 objectCount) {
+  return false;
+}
+void gpu_cull_shutdown(void **state) {}
+GLuint gpu_cull_instance_buffer(void *state) { return 0; }
+void gpu_cull_dispatch(void *state, const GpuCullView &view) {}
+void gpu_cull_draw(void *state) {}
+void gpu_cull_get_stats(void *state, GpuCullStats *outStats) { *outStats = {}; }
+
+#else
+
+static const u32 GPU_CULL_GROUP_SIZE = 64; // local_size_x in cull.comp
+static const u32 GPU_CULL_STATS_LATENCY = 3; // Frames before reading a dispatch's counts back
+
+// std430 layouts of cull.comp
+struct GpuObject {
+  f32 model[16];
+  f32 sphere[4];
+  u32 mesh;
+  u32 lod;
+  u32 pad[2];
+};
+
+struct GpuLod {
+  u32 firstIndex;
+  u32 indexCount;
+  f32 error;
+  u32 pad;
+};
+
+struct GpuMesh {
+  i32 baseVertex;
+  u32 lodCount;
+  u32 pad[2];
+  GpuLod lods[MESH_LOD_MAX];
+};
+
+struct GpuDrawCommand { // DrawElementsIndirectCommand
+  u32 count;
+  u32 instanceCount;
+  u32 firstIndex;
+  i32 baseVertex;
+  u32 baseInstance;
+};
+
+enum {
+  GPU_CULL_BUFFER_OBJECTS,
+  GPU_CULL_BUFFER_MESHES,
+  GPU_CULL_BUFFER_COMMANDS,
+  GPU_CULL_BUFFER_INSTANCES,
+  GPU_CULL_BUFFER_COUNT,
+};
+
+struct GpuCullState {
+  GLuint program;
+  GLuint buffers[GPU_CULL_BUFFER_COUNT];
+  GLuint statsBuffers[GPU_CULL_STATS_LATENCY];
+  u32 objectCount;
+  u64 bufferBytes;
+  u64 dispatches;
+  GpuCullStats stats;
+};
+
+bool gpu_cull_supported() {
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  return major > 4 || (major == 4 && minor >= 3);
+}
+
+static void buffer_upload(GpuCullState *s, GLuint buffer, u64 size, const void *data,
+                          GLenum usage) {
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, size, data, usage);
+  s->bufferBytes += size;
+}
+
+bool gpu_cull_initialize(void **state, const GpuCullMesh *meshes, u32 meshCount,
+                         const GpuCullObject *objects, u32 objectCount) {
+  if (!gpu_cull_supported()) { return false; }
+  auto s = new GpuCullState();
+  if (!program_create(&s->program, {{GL_COMPUTE_SHADER, "shaders/cull.comp"}})) {
+    DELETE(s);
+    return false;
+  }
+  s->objectCount = objectCount;
+  glGenBuffers(GPU_CULL_BUFFER_COUNT, s->buffers);
+  glGenBuffers(GPU_CULL_STATS_LATENCY, s->statsBuffers);
+
+  std::vector<GpuObject> gpuObjects(objectCount);
+  std::vector<u32> instances(objectCount);
+  for (u32 i = 0; i < objectCount; ++i) {
+    auto &object = gpuObjects[i];
+    memcpy(object.model, objects[i].model, sizeof(object.model));
+    memcpy(object.sphere, objects[i].center, sizeof(objects[i].center));
+    object.sphere[3] = objects[i].radius;
+    object.mesh = objects[i].mesh;
+    instances[i] = i;
+  }
+  std::vector<GpuMesh> gpuMeshes(meshCount);
+  for (u32 i = 0; i < meshCount; ++i) {
+    gpuMeshes[i].baseVertex = meshes[i].baseVertex;
+    gpuMeshes[i].lodCount = meshes[i].lodCount;
+    for (u32 j = 0; j < meshes[i].lodCount; ++j) {
+      const auto &lod = meshes[i].lods[j];
+      gpuMeshes[i].lods[j] = {lod.firstIndex, lod.indexCount, lod.error, 0};
+    }
+  }
+  buffer_upload(s, s->buffers[GPU_CULL_BUFFER_OBJECTS], objectCount * sizeof(GpuObject),
+                gpuObjects.data(), GL_DYNAMIC_COPY); // The shader keeps each object's LOD
+  buffer_upload(s, s->buffers[GPU_CULL_BUFFER_MESHES], meshCount * sizeof(GpuMesh),
+                gpuMeshes.data(), GL_STATIC_DRAW);
+  buffer_upload(s, s->buffers[GPU_CULL_BUFFER_COMMANDS], objectCount * sizeof(GpuDrawCommand),
+                nullptr, GL_DYNAMIC_COPY);
+  buffer_upload(s, s->buffers[GPU_CULL_BUFFER_INSTANCES], objectCount * sizeof(u32),
+                instances.data(), GL_STATIC_DRAW);
+  for (auto buffer : s->statsBuffers) {
+    buffer_upload(s, buffer, 2 * sizeof(u32), nullptr, GL_DYNAMIC_READ);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  memory_stats_allocate(MEMORY_TAG_MESH, MEMORY_DOMAIN_GPU, s->bufferBytes);
+  *state = s;
+  return true;
+}
+
+void gpu_cull_shutdown(void **state) {
+  auto s = (GpuCullState *)*state;
+  memory_stats_free(MEMORY_TAG_MESH, MEMORY_DOMAIN_GPU, s->bufferBytes);
+  glDeleteBuffers(GPU_CULL_STATS_LATENCY, s->statsBuffers);
+  glDeleteBuffers(GPU_CULL_BUFFER_COUNT, s->buffers);
+  program_destroy(s->program);
+  DELETE(s);
+  *state = nullptr;
+}
+
+GLuint gpu_cull_instance_buffer(void *state) {
+  return ((GpuCullState *)state)->buffers[GPU_CULL_BUFFER_INSTANCES];
+}
+
+// Planes of a clip-space frustum in world space (Gribb and Hartmann), normals pointing inwards
+static void extract_frustum_planes(const f32 *m, f32 planes[6][4]) {
+  for (u32 i = 0; i < 6; ++i) {
+    auto row = i / 2;
+    auto sign = i % 2 ? -1.0f : 1.0f;
+    for (u32 j = 0; j < 4; ++j) {
+      planes[i][j] = m[j * 4 + 3] + sign * m[j * 4 + row];
+    }
+    auto length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] +
+                        planes[i][2] * planes[i][2]);
+    for (u32 j = 0; j < 4; ++j) {
+      planes[i][j] /= length;
+    }
+  }
+}
+
+void gpu_cull_dispatch(void *state, const GpuCullView &view) {
+  auto s = (GpuCullState *)state;
+  if (s->dispatches >= GPU_CULL_STATS_LATENCY - 1) {
+    // Written GPU_CULL_STATS_LATENCY - 1 dispatches ago, and about to be reused
+    auto statsBuffer = s->statsBuffers[(s->dispatches + 1) % GPU_CULL_STATS_LATENCY];
+    u32 counts[2];
+    glBindBuffer(GL_COPY_READ_BUFFER, statsBuffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counts), counts);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    s->stats = {s->objectCount, counts[0], counts[1]};
+  }
+  auto statsBuffer = s->statsBuffers[s->dispatches % GPU_CULL_STATS_LATENCY];
+  const u32 zeros[2] = {};
+  glBindBuffer(GL_COPY_WRITE_BUFFER, statsBuffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(zeros), zeros);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  f32 planes[6][4];
+  extract_frustum_planes(view.viewProjection, planes);
+  program_use(s->program);
+  program_set_vec4(s->program, "frustumPlanes", planes[0], 6);
+  program_set_vec3(s->program, "cameraPosition", view.cameraPosition);
+  program_set_i32(s->program, "objectCount", (i32)s->objectCount);
+  auto lodScale = view.lodThreshold > 0.0f
+                      ? (f32)view.viewportHeight * 0.5f / tanf(view.fov * PI / 180.0f * 0.5f)
+                      : 0.0f;
+  program_set_f32(s->program, "lodScale", lodScale);
+  program_set_f32(s->program, "lodThreshold", view.lodThreshold);
+  program_set_f32(s->program, "lodHysteresis", 0.25f); // lod_select's default
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, s->buffers[GPU_CULL_BUFFER_OBJECTS]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, s->buffers[GPU_CULL_BUFFER_MESHES]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, s->buffers[GPU_CULL_BUFFER_COMMANDS]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, statsBuffer);
+  glDispatchCompute((s->objectCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+  // The commands feed the draw, the stats a later readback
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT |
+                  GL_BUFFER_UPDATE_BARRIER_BIT);
+  ++s->dispatches;
+}
+
+void gpu_cull_draw(void *state) {
+  auto s = (GpuCullState *)state;
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, s->buffers[GPU_CULL_BUFFER_OBJECTS]);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, s->buffers[GPU_CULL_BUFFER_COMMANDS]);
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, s->objectCount, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void gpu_cull_get_stats(void *state, GpuCullStats *outStats) {
+  *outStats = ((GpuCullState *)state)->stats;
+}
+
+#endif
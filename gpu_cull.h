@@ -0,0 +1,61 @@
+#pragma once
+
+#include "defines.h"
+#include "lod.h"
+#include "opengl.h"
+
+/**
+ * GPU-driven submission for GL 4.3 and later. Objects and their meshes' LOD chains live in storage
+ * buffers; each frame a compute shader culls the objects against the view frustum, picks their LOD
+ * and writes one indirect command per object, with no instances when culled, and a single
+ * glMultiDrawElementsIndirect submits them all. CPU cost no longer grows with the object count.
+ *
+ * Draws need a program reading the objects from storage buffer binding 0 and the object index from
+ * a per-instance attribute, see shaders/materials_indirect.vert.
+ */
+
+struct GpuCullLod {
+  u32 firstIndex; // Into the shared index buffer, the mesh's offset included
+  u32 indexCount;
+  f32 error; // Object-space, as in MeshLod
+};
+
+struct GpuCullMesh {
+  i32 baseVertex;
+  u32 lodCount;
+  GpuCullLod lods[MESH_LOD_MAX];
+};
+
+struct GpuCullObject {
+  f32 model[16];
+  f32 center[3]; // World-space bounding sphere
+  f32 radius;
+  u32 mesh; // Index into the meshes
+};
+
+struct GpuCullView {
+  f32 viewProjection[16];
+  f32 cameraPosition[3];
+  f32 fov; // Vertical, degrees
+  u32 viewportHeight;
+  f32 lodThreshold; // Pixels, 0 to always draw LOD 0
+};
+
+struct GpuCullStats {
+  u32 objects;
+  u32 visibleObjects;
+  u32 visibleTriangles;
+};
+
+// Whether the current context is recent enough
+bool gpu_cull_supported();
+bool gpu_cull_initialize(void **state, const GpuCullMesh *meshes, u32 meshCount,
+                         const GpuCullObject *objects, u32 objectCount);
+void gpu_cull_shutdown(void **state);
+// Buffer of object indices to feed the draw program's per-instance attribute from
+GLuint gpu_cull_instance_buffer(void *state);
+void gpu_cull_dispatch(void *state, const GpuCullView &view);
+// Submits the last dispatch with the bound program and vertex array
+void gpu_cull_draw(void *state);
+// Counts of the latest dispatch the GPU finished, a few frames old
+void gpu_cull_get_stats(void *state, GpuCullStats *outStats);
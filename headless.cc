@@ -0,0 +1,146 @@
+#include "headless.h"
+#include "image.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include "opengl.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstdio>
+#include <vector>
+
+struct HeadlessContext {
+  EGLDisplay display;
+  EGLContext context;
+  GLuint framebuffer;
+  GLuint colorbuffer;
+  GLuint depthbuffer;
+  u32 width;
+  u32 height;
+};
+
+static EGLDisplay get_display() {
+  // Prefer the surfaceless platform so no X11 or Wayland server is needed
+  auto getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay) {
+    auto display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display != EGL_NO_DISPLAY) { return display; }
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool headless_context_create(HeadlessContext **context, u32 width, u32 height) {
+  auto display = get_display();
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+    LOG_ERROR("error initializing egl display: 0x%x", eglGetError());
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    LOG_ERROR("error binding opengl api: 0x%x", eglGetError());
+    eglTerminate(display);
+    return false;
+  }
+
+  // The default surface type is EGL_WINDOW_BIT, which surfaceless displays never offer
+  const EGLint configAttributes[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE,
+  };
+  EGLConfig config;
+  EGLint configCount = 0;
+  if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+    LOG_ERROR("error choosing egl config: 0x%x", eglGetError());
+    eglTerminate(display);
+    return false;
+  }
+
+  // 4.3 enables GPU culling, 4.1 is all the renderer needs
+  auto eglContext = EGL_NO_CONTEXT;
+  for (EGLint minorVersion : {3, 1}) {
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION,
+        4,
+        EGL_CONTEXT_MINOR_VERSION,
+        minorVersion,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK,
+        EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+    eglContext = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if (eglContext != EGL_NO_CONTEXT) { break; }
+  }
+  if (eglContext == EGL_NO_CONTEXT) {
+    LOG_ERROR("error creating egl context: 0x%x", eglGetError());
+    eglTerminate(display);
+    return false;
+  }
+  // Without a surface everything goes through our own framebuffer (EGL_KHR_surfaceless_context)
+  if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+    LOG_ERROR("error making egl context current: 0x%x", eglGetError());
+    eglDestroyContext(display, eglContext);
+    eglTerminate(display);
+    return false;
+  }
+
+  auto handle = new HeadlessContext();
+  handle->display = display;
+  handle->context = eglContext;
+  handle->width = width;
+  handle->height = height;
+
+  glGenRenderbuffers(1, &handle->colorbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, handle->colorbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glGenRenderbuffers(1, &handle->depthbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, handle->depthbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  // RGBA8 color and a depth buffer, which drivers store in 32 bits
+  memory_stats_allocate(MEMORY_TAG_RENDER_TARGET, MEMORY_DOMAIN_GPU,
+                        memory_stats_image_size(width, height, 4, false) * 2);
+
+  glGenFramebuffers(1, &handle->framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, handle->framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+                            handle->colorbuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+                            handle->depthbuffer);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    LOG_ERROR("error creating offscreen framebuffer %ux%u", width, height);
+    headless_context_destroy(&handle);
+    return false;
+  }
+
+  printf("OpenGL Renderer: %s\n", glGetString(GL_RENDERER));
+  printf("OpenGL Version: %s\n", glGetString(GL_VERSION));
+
+  *context = handle;
+  return true;
+}
+
+void headless_context_destroy(HeadlessContext **context) {
+  auto c = *context;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &c->framebuffer);
+  glDeleteRenderbuffers(1, &c->colorbuffer);
+  glDeleteRenderbuffers(1, &c->depthbuffer);
+  memory_stats_free(MEMORY_TAG_RENDER_TARGET, MEMORY_DOMAIN_GPU,
+                    memory_stats_image_size(c->width, c->height, 4, false) * 2);
+  eglMakeCurrent(c->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(c->display, c->context);
+  eglTerminate(c->display);
+  DELETE(*context)
+}
+
+void headless_context_bind(HeadlessContext *context) {
+  glBindFramebuffer(GL_FRAMEBUFFER, context->framebuffer);
+}
+
+bool headless_capture_png(HeadlessContext *context, const char *path) {
+  std::vector<u8> pixels((size_t)context->width * context->height * 4);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, context->framebuffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, context->width, context->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+  glPixelStorei(GL_PACK_ALIGNMENT, 4); // Restore
+  return image_write_png(path, context->width, context->height, 4, pixels.data(),
+                         context->width * 4, true);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "defines.h"
+
+struct HeadlessContext;
+
+/**
+ * Creates a surfaceless EGL context (e.g. Mesa llvmpipe, no display required) and makes it current
+ * on the calling thread, together with an offscreen framebuffer of the requested size.
+ */
+bool headless_context_create(HeadlessContext **context, u32 width, u32 height);
+void headless_context_destroy(HeadlessContext **context);
+// Binds the offscreen framebuffer as the draw target
+void headless_context_bind(HeadlessContext *context);
+bool headless_capture_png(HeadlessContext *context, const char *path);
@@ -0,0 +1,15 @@
+#include "image.h"
+#include "logger.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+bool image_write_png(const char *path, u32 width, u32 height, u32 channels, const void *pixels,
+                     u32 stride, bool bottomUp) {
+  stbi_flip_vertically_on_write(bottomUp ? 1 : 0);
+  if (!stbi_write_png(path, width, height, channels, pixels, stride)) {
+    LOG_ERROR("error writing image: '%s'", path);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "defines.h"
+
+/**
+ * Writes 8-bit pixels to a PNG file
+ * @param stride distance in bytes between two rows
+ * @param bottomUp rows start at the bottom of the image, as GL reads them back
+ */
+bool image_write_png(const char *path, u32 width, u32 height, u32 channels, const void *pixels,
+                     u32 stride, bool bottomUp);
@@ -1,39 +1,28 @@
 #include "input.h"
 #include "event.h"
+#include "memory_stats.h"
+#include "triple_buffer.h"
+#include <chrono>
 #include <cstdio>
 #include <cstring>
-#include <mutex>
-#include <queue>
-
-static const u16 KEY_COUNT = 512;
-
-struct KeyboardState {
-  bool keys[KEY_COUNT];
-};
-
-struct Wheeling {
-  i32 ix;
-  i32 iy;
-  f32 fx;
-  f32 fy;
-};
 
 struct InputSystemState {
-  KeyboardState keyboardCurrent;
-  KeyboardState keyboardPrevious;
+  InputSnapshot pending;                 // Written by the producer as events arrive
+  u64 keyboardPrevious[INPUT_KEY_WORDS]; // Keys at the previous update, for held-key repeats
   void *eventSystemState;
-  std::queue<Wheeling> wheeling;
-  std::mutex wheeling_mutex;
+  TripleBuffer<InputSnapshot> snapshots; // Neither the producer nor the consumer ever waits
 };
 
 void input_system_initialize(void **state, void *eventSystemState) {
   auto s = new InputSystemState();
   s->eventSystemState = eventSystemState;
+  memory_stats_allocate(MEMORY_TAG_INPUT, MEMORY_DOMAIN_CPU, sizeof(InputSystemState));
   *state = s;
 }
 
 void input_system_shutdown(void **state) {
   auto s = (InputSystemState *)*state;
+  memory_stats_free(MEMORY_TAG_INPUT, MEMORY_DOMAIN_CPU, sizeof(InputSystemState));
   DELETE(s);
 }
 
@@ -41,25 +30,33 @@ void input_system_update(void *state) {
   auto s = (InputSystemState *)state;
 
   // Handle holding keys
-  for (u16 i = 0; i < KEY_COUNT; ++i) {
-    if (input_was_key_down(state, i) && input_is_key_down(state, i)) {
+  for (u16 i = 0; i < INPUT_KEY_WORDS; ++i) {
+    auto held = s->pending.keys[i] & s->keyboardPrevious[i];
+    while (held) {
       EventContext context{};
-      context.u16[0] = i;
-      event_fire(s->eventSystemState, EVENT_CODE_KEYBOARD_PRESSED, nullptr, context);
+      context.u16[0] = i * 64 + __builtin_ctzll(held);
+      event_post(s->eventSystemState, EVENT_CODE_KEYBOARD_PRESSED, nullptr, context);
+      held &= held - 1;
     }
   }
 
   // Copy current states to previous states
-  memcpy(&s->keyboardPrevious, &s->keyboardCurrent, sizeof(KeyboardState));
+  memcpy(s->keyboardPrevious, s->pending.keys, sizeof(s->keyboardPrevious));
 }
 
 bool input_system_process_key(void *state, u16 key, bool pressed) {
   auto s = (InputSystemState *)state;
-  if (s->keyboardCurrent.keys[key] != pressed) {
-    s->keyboardCurrent.keys[key] = pressed;
+  if (key >= INPUT_KEY_COUNT) { return false; }
+  if (input_is_key_down(state, key) != pressed) {
+    auto mask = (u64)1 << (key & 63);
+    if (pressed) {
+      s->pending.keys[key >> 6] |= mask;
+    } else {
+      s->pending.keys[key >> 6] &= ~mask;
+    }
     EventContext context{};
     context.u16[0] = key;
-    event_fire(s->eventSystemState,
+    event_post(s->eventSystemState,
                pressed ? EVENT_CODE_KEYBOARD_PRESSED : EVENT_CODE_KEYBOARD_RELEASED, nullptr,
                context);
     return true;
@@ -69,39 +66,53 @@ bool input_system_process_key(void *state, u16 key, bool pressed) {
 
 bool input_system_process_mouse_wheel(void *state, i32 ix, i32 iy, f32 fx, f32 fy) {
   auto s = (InputSystemState *)state;
-  std::lock_guard<std::mutex> lock(s->wheeling_mutex);
-  if (s->wheeling.size() > 2000) { return false; }
-  // printf("mouse wheeling %d %d %f %f\n", ix, iy, fx, fy);
-  Wheeling wheeling{};
-  wheeling.ix = ix;
-  wheeling.iy = iy;
-  wheeling.fx = fx;
-  wheeling.fy = fy;
-  s->wheeling.emplace(wheeling);
+  s->pending.wheelX += ix;
+  s->pending.wheelY += iy;
+  s->pending.preciseWheelX += fx;
+  s->pending.preciseWheelY += fy;
   return true;
 }
 
-bool input_is_key_down(void *state, u16 key) {
+void input_system_process_mouse_motion(void *state, i32 x, i32 y, i32 dx, i32 dy) {
   auto s = (InputSystemState *)state;
-  return s->keyboardCurrent.keys[key];
+  s->pending.mouseX = x;
+  s->pending.mouseY = y;
+  s->pending.mouseMotionX += dx;
+  s->pending.mouseMotionY += dy;
 }
 
-bool input_is_key_up(void *state, u16 key) { return !input_is_key_down(state, key); }
+void input_system_publish(void *state) {
+  auto s = (InputSystemState *)state;
+  s->pending.sequence += 1;
+  s->pending.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now().time_since_epoch())
+                             .count();
+  s->snapshots.back() = s->pending;
+  s->snapshots.publish();
+}
 
-bool input_was_key_down(void *state, u16 key) {
+const InputSnapshot *input_acquire_snapshot(void *state) {
   auto s = (InputSystemState *)state;
-  return s->keyboardPrevious.keys[key];
+  return &s->snapshots.acquire();
 }
 
-bool input_get_mouse_wheel(void *state, i32 *ix, i32 *iy, f32 *fx, f32 *fy) {
+void input_snapshot_diff(const InputSnapshot *previous, const InputSnapshot *current,
+                         InputKeyChanges *outChanges) {
+  for (u16 i = 0; i < INPUT_KEY_WORDS; ++i) {
+    outChanges->pressed[i] = current->keys[i] & ~previous->keys[i];
+    outChanges->released[i] = ~current->keys[i] & previous->keys[i];
+    outChanges->held[i] = current->keys[i] & previous->keys[i];
+  }
+}
+
+bool input_is_key_down(void *state, u16 key) {
   auto s = (InputSystemState *)state;
-  std::lock_guard<std::mutex> lock(s->wheeling_mutex);
-  if (s->wheeling.empty()) { return false; }
-  auto &front = s->wheeling.front();
-  if (ix) { *ix = front.ix; }
-  if (iy) { *iy = front.iy; }
-  if (fx) { *fx = front.fx; }
-  if (fy) { *fy = front.fy; }
-  s->wheeling.pop();
-  return true;
+  return input_key_bit(s->pending.keys, key);
+}
+
+bool input_is_key_up(void *state, u16 key) { return !input_is_key_down(state, key); }
+
+bool input_was_key_down(void *state, u16 key) {
+  auto s = (InputSystemState *)state;
+  return input_key_bit(s->keyboardPrevious, key);
 }
@@ -27,13 +27,57 @@ enum KeyCode {
   KEY_CODE_COUNT,
 };
 
+static const u16 INPUT_KEY_COUNT = 512;
+static const u16 INPUT_KEY_WORDS = INPUT_KEY_COUNT / 64;
+
+/**
+ * Input state as published by the thread pumping OS events. Wheel and motion values are running
+ * totals since startup: consumers subtract the snapshot they saw last, so nothing is lost when the
+ * producer publishes several times between two reads.
+ */
+struct InputSnapshot {
+  u64 keys[INPUT_KEY_WORDS]; // One bit per scancode
+  i64 wheelX;
+  i64 wheelY;
+  f64 preciseWheelX;
+  f64 preciseWheelY;
+  i32 mouseX;
+  i32 mouseY;
+  i64 mouseMotionX;
+  i64 mouseMotionY;
+  u64 sequence;  // Incremented by every publish
+  u64 timestamp; // Nanoseconds, steady clock, taken when published
+};
+
+struct InputKeyChanges {
+  u64 pressed[INPUT_KEY_WORDS];
+  u64 released[INPUT_KEY_WORDS];
+  u64 held[INPUT_KEY_WORDS];
+};
+
 void input_system_initialize(void **state, void *eventSystemState);
 void input_system_shutdown(void **state);
 void input_system_update(void *state);
 bool input_system_process_key(void *state, u16 key, bool pressed);
 bool input_system_process_mouse_wheel(void *state, i32 ix, i32 iy, f32 fx, f32 fy);
+void input_system_process_mouse_motion(void *state, i32 x, i32 y, i32 dx, i32 dy);
+// Makes the input processed so far visible to `input_acquire_snapshot`, producer thread only
+void input_system_publish(void *state);
+/**
+ * Returns the most recently published snapshot without blocking the producer. The pointer stays
+ * valid until the next call, which must come from the same consumer thread.
+ */
+const InputSnapshot *input_acquire_snapshot(void *state);
+void input_snapshot_diff(const InputSnapshot *previous, const InputSnapshot *current,
+                         InputKeyChanges *outChanges);
+
+inline bool input_key_bit(const u64 *keys, u16 key) { return (keys[key >> 6] >> (key & 63)) & 1; }
+
+inline bool input_snapshot_key_down(const InputSnapshot *snapshot, u16 key) {
+  return input_key_bit(snapshot->keys, key);
+}
+
+// Producer thread only
 bool input_is_key_down(void *state, u16 key);
 bool input_is_key_up(void *state, u16 key);
 bool input_was_key_down(void *state, u16 key);
-bool input_get_mouse_wheel(void *state, i32 *ix = nullptr, i32 *iy = nullptr, f32 *fx = nullptr,
-                           f32 *fy = nullptr);
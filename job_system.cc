@@ -0,0 +1,121 @@
+#include "job_system.h"
+#include "profiler.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct JobBatch {
+  PFN_job fn;
+  void *userData;
+  u32 count;
+  std::atomic<u32> next;
+  std::atomic<u32> remaining;
+};
+
+struct JobSystemState {
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake; // A new batch was posted, or shutdown
+  std::condition_variable done; // The current batch finished
+  u64 generation;               // Bumped for every batch, workers compare it to their last one
+  u32 active;                   // Workers inside the batch, which is not reused before they leave
+  bool quit;
+  JobBatch batch;
+};
+
+// Claims indices until the batch runs dry, returns how many this thread ran
+static u32 run_batch(JobBatch *batch, u32 worker) {
+  u32 ran = 0;
+  for (;;) {
+    auto index = batch->next.fetch_add(1, std::memory_order_relaxed);
+    if (index >= batch->count) { return ran; }
+    batch->fn(index, worker, batch->userData);
+    ++ran;
+  }
+}
+
+static void worker_main(JobSystemState *s, u32 worker) {
+  char name[32];
+  snprintf(name, sizeof(name), "worker %u", worker);
+  profiler_set_thread_name(name);
+  u64 seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(s->mutex);
+      s->wake.wait(lock, [&]() { return s->quit || s->generation != seen; });
+      if (s->quit) { return; }
+      seen = s->generation;
+      ++s->active;
+    }
+    auto ran = run_batch(&s->batch, worker);
+    if (ran > 0) { s->batch.remaining.fetch_sub(ran, std::memory_order_acq_rel); }
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (--s->active == 0) { s->done.notify_one(); }
+  }
+}
+
+void job_system_initialize(void **state, u32 workerCount) {
+  auto s = new JobSystemState();
+  if (workerCount == 0) {
+    auto cores = std::thread::hardware_concurrency();
+    workerCount = cores > 1 ? cores - 1 : 0;
+  }
+  for (u32 i = 0; i < workerCount; ++i) {
+    s->workers.emplace_back(worker_main, s, i + 1);
+  }
+  *state = s;
+}
+
+void job_system_shutdown(void **state) {
+  auto s = (JobSystemState *)*state;
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->quit = true;
+  }
+  s->wake.notify_all();
+  for (auto &worker : s->workers) {
+    worker.join();
+  }
+  DELETE(s);
+  *state = nullptr;
+}
+
+u32 job_system_thread_count(void *state) {
+  return (u32)((JobSystemState *)state)->workers.size() + 1;
+}
+
+void job_system_parallel_for(void *state, u32 count, PFN_job fn, void *userData) {
+  auto s = (JobSystemState *)state;
+  if (count == 0) { return; }
+  if (s->workers.empty() || count == 1) {
+    for (u32 i = 0; i < count; ++i) {
+      fn(i, 0, userData);
+    }
+    return;
+  }
+
+  {
+    // A worker that woke late may still be looking at the previous batch
+    std::unique_lock<std::mutex> lock(s->mutex);
+    s->done.wait(lock, [&]() { return s->active == 0; });
+    s->batch.fn = fn;
+    s->batch.userData = userData;
+    s->batch.count = count;
+    s->batch.next.store(0, std::memory_order_relaxed);
+    s->batch.remaining.store(count, std::memory_order_relaxed);
+    s->generation += 1;
+  }
+  s->wake.notify_all();
+
+  auto ran = run_batch(&s->batch, 0);
+  s->batch.remaining.fetch_sub(ran, std::memory_order_acq_rel);
+  // Workers may still hold indices, or be about to find none left; either way they read the batch,
+  // so it is only rewritten once the last of them left. They notify under the lock.
+  std::unique_lock<std::mutex> lock(s->mutex);
+  s->done.wait(lock, [&]() {
+    return s->active == 0 && s->batch.remaining.load(std::memory_order_acquire) == 0;
+  });
+}
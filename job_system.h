@@ -0,0 +1,22 @@
+#pragma once
+
+#include "defines.h"
+
+/**
+ * Fixed pool of worker threads running data-parallel loops. The dispatching thread takes part in
+ * the loop too, so a pool with no workers simply runs it inline.
+ */
+
+// `worker` is 0 for the dispatching thread and 1..N for the pool, e.g. to index per-worker scratch
+typedef void (*PFN_job)(u32 index, u32 worker, void *userData);
+
+// @param workerCount threads besides the dispatching one, or 0 for one per remaining core
+void job_system_initialize(void **state, u32 workerCount);
+void job_system_shutdown(void **state);
+// Workers plus the dispatching thread
+u32 job_system_thread_count(void *state);
+/**
+ * Calls `fn` for every index in [0, count) and returns once all calls finished. Indices are handed
+ * out one at a time, so uneven work balances itself. One dispatching thread at a time.
+ */
+void job_system_parallel_for(void *state, u32 count, PFN_job fn, void *userData);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "defines.h"
+#include <glm/glm.hpp>
+
+// The light setup of shaders/materials.frag, shared by the GL and the software renderer
+
+struct DirectionalLight {
+  glm::vec3 direction;
+  glm::vec3 ambient;
+  glm::vec3 diffuse;
+  glm::vec3 specular;
+};
+
+struct PointLight {
+  glm::vec3 position;
+  f32 constant;
+  f32 linear;
+  f32 quadratic;
+  glm::vec3 ambient;
+  glm::vec3 diffuse;
+  glm::vec3 specular;
+};
+
+struct SpotLight {
+  glm::vec3 position;
+  glm::vec3 direction;
+  f32 cutOff; // Cosines of the inner and outer cone angles
+  f32 outerCutOff;
+  f32 constant;
+  f32 linear;
+  f32 quadratic;
+  glm::vec3 ambient;
+  glm::vec3 diffuse;
+  glm::vec3 specular;
+};
+
+struct Lighting {
+  glm::vec3 viewPosition;
+  DirectionalLight directionalLight;
+  PointLight pointLight; // POINT_LIGHTS_NUM is 1
+  SpotLight spotLight;
+};
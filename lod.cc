@@ -0,0 +1,279 @@
+#include "lod.h"
+#include "logger.h"
+#include <algorithm>
+
+// Symmetric 4x4 error quadric, stored as the upper triangle of A, the vector b and the scalar c.
+// The squared distance of p to every accumulated plane is p^T A p + 2 b.p + c
+struct Quadric {
+  f64 a00, a01, a02, a11, a12, a22;
+  f64 b0, b1, b2;
+  f64 c;
+};
+
+struct Collapse {
+  u32 from;
+  u32 to;
+  f64 cost;
+};
+
+static const f32 *position_at(const f32 *positions, u32 stride, u32 index) {
+  return (const f32 *)((const u8 *)positions + (size_t)stride * index);
+}
+
+static void quadric_add_plane(Quadric *q, f64 nx, f64 ny, f64 nz, f64 d) {
+  q->a00 += nx * nx;
+  q->a01 += nx * ny;
+  q->a02 += nx * nz;
+  q->a11 += ny * ny;
+  q->a12 += ny * nz;
+  q->a22 += nz * nz;
+  q->b0 += nx * d;
+  q->b1 += ny * d;
+  q->b2 += nz * d;
+  q->c += d * d;
+}
+
+static void quadric_add(Quadric *q, const Quadric &other) {
+  q->a00 += other.a00;
+  q->a01 += other.a01;
+  q->a02 += other.a02;
+  q->a11 += other.a11;
+  q->a12 += other.a12;
+  q->a22 += other.a22;
+  q->b0 += other.b0;
+  q->b1 += other.b1;
+  q->b2 += other.b2;
+  q->c += other.c;
+}
+
+static f64 quadric_error(const Quadric &q, const f32 *p) {
+  f64 x = p[0], y = p[1], z = p[2];
+  f64 e = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z;
+  e += 2 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z);
+  e += 2 * (q.b0 * x + q.b1 * y + q.b2 * z);
+  e += q.c;
+  return e > 0 ? e : 0;
+}
+
+static void triangle_normal(const f32 *a, const f32 *b, const f32 *c, f64 *n) {
+  f64 e0[3] = {(f64)b[0] - a[0], (f64)b[1] - a[1], (f64)b[2] - a[2]};
+  f64 e1[3] = {(f64)c[0] - a[0], (f64)c[1] - a[1], (f64)c[2] - a[2]};
+  n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+  n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+  n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+}
+
+static u64 edge_key(u32 a, u32 b) { return a < b ? ((u64)a << 32) | b : ((u64)b << 32) | a; }
+
+// Vertices on an open edge are locked: they sit on the mesh border or on an attribute seam (a
+// position split into several vertices for different normals or UVs), and moving them would tear
+// the surface open
+static void find_locked_vertices(const u32 *indices, u32 indexCount, std::vector<bool> *locked) {
+  std::vector<u64> edges;
+  edges.reserve(indexCount);
+  for (u32 i = 0; i < indexCount; i += 3) {
+    edges.emplace_back(edge_key(indices[i + 0], indices[i + 1]));
+    edges.emplace_back(edge_key(indices[i + 1], indices[i + 2]));
+    edges.emplace_back(edge_key(indices[i + 2], indices[i + 0]));
+  }
+  std::sort(edges.begin(), edges.end());
+  for (size_t i = 0; i < edges.size();) {
+    size_t j = i + 1;
+    while (j < edges.size() && edges[j] == edges[i]) { ++j; }
+    if (j - i == 1) {
+      (*locked)[edges[i] >> 32] = true;
+      (*locked)[edges[i] & 0xffffffff] = true;
+    }
+    i = j;
+  }
+}
+
+// Rejects collapses that would turn a surviving triangle around `from` upside down
+static bool collapse_flips(const f32 *positions, u32 stride, const std::vector<u32> &triangles,
+                           const std::vector<u32> &adjacencyOffsets,
+                           const std::vector<u32> &adjacency, u32 from, u32 to) {
+  auto target = position_at(positions, stride, to);
+  for (u32 i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1]; ++i) {
+    auto triangle = &triangles[adjacency[i] * 3];
+    if (triangle[0] == to || triangle[1] == to || triangle[2] == to) { continue; }
+    const f32 *before[3], *after[3];
+    for (u32 k = 0; k < 3; ++k) {
+      before[k] = position_at(positions, stride, triangle[k]);
+      after[k] = triangle[k] == from ? target : before[k];
+    }
+    f64 n0[3], n1[3];
+    triangle_normal(before[0], before[1], before[2], n0);
+    triangle_normal(after[0], after[1], after[2], n1);
+    if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0) { return true; }
+  }
+  return false;
+}
+
+// Runs one round of independent half-edge collapses. Returns the number of collapses applied and
+// raises `maxError` to the largest quadric error accepted
+static u32 simplify_pass(const f32 *positions, u32 stride, u32 vertexCount,
+                         const std::vector<bool> &locked, std::vector<Quadric> *quadrics,
+                         std::vector<u32> *triangles, u32 targetTriangleCount, f64 *maxError) {
+  auto &indices = *triangles;
+  auto triangleCount = (u32)(indices.size() / 3);
+  if (triangleCount <= targetTriangleCount) { return 0; }
+
+  std::vector<u64> edges;
+  edges.reserve(indices.size());
+  for (u32 i = 0; i < indices.size(); i += 3) {
+    edges.emplace_back(edge_key(indices[i + 0], indices[i + 1]));
+    edges.emplace_back(edge_key(indices[i + 1], indices[i + 2]));
+    edges.emplace_back(edge_key(indices[i + 2], indices[i + 0]));
+  }
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  std::vector<Collapse> collapses;
+  collapses.reserve(edges.size());
+  for (auto edge : edges) {
+    auto a = (u32)(edge >> 32), b = (u32)(edge & 0xffffffff);
+    if (locked[a] && locked[b]) { continue; }
+    Quadric q = (*quadrics)[a];
+    quadric_add(&q, (*quadrics)[b]);
+    Collapse collapse{};
+    collapse.cost = -1;
+    if (!locked[a]) { collapse = {a, b, quadric_error(q, position_at(positions, stride, b))}; }
+    if (!locked[b]) {
+      auto cost = quadric_error(q, position_at(positions, stride, a));
+      if (collapse.cost < 0 || cost < collapse.cost) { collapse = {b, a, cost}; }
+    }
+    collapses.emplace_back(collapse);
+  }
+  std::sort(collapses.begin(), collapses.end(),
+            [](const Collapse &lhs, const Collapse &rhs) { return lhs.cost < rhs.cost; });
+
+  std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+  for (auto index : indices) {
+    ++adjacencyOffsets[index + 1];
+  }
+  for (u32 i = 0; i < vertexCount; ++i) {
+    adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+  }
+  std::vector<u32> adjacency(indices.size());
+  std::vector<u32> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+  for (u32 i = 0; i < indices.size(); ++i) {
+    adjacency[cursor[indices[i]]++] = i / 3;
+  }
+
+  std::vector<u32> remap(vertexCount);
+  for (u32 i = 0; i < vertexCount; ++i) {
+    remap[i] = i;
+  }
+  std::vector<bool> touched(vertexCount, false);
+  u32 removed = 0, applied = 0;
+  auto budget = triangleCount - targetTriangleCount;
+  for (const auto &collapse : collapses) {
+    if (removed >= budget) { break; }
+    if (touched[collapse.from] || touched[collapse.to]) { continue; }
+    if (collapse_flips(positions, stride, indices, adjacencyOffsets, adjacency, collapse.from,
+                       collapse.to)) {
+      continue;
+    }
+    remap[collapse.from] = collapse.to;
+    quadric_add(&(*quadrics)[collapse.to], (*quadrics)[collapse.from]);
+    // Freeze the whole one-ring so every triangle is changed by at most one collapse per pass,
+    // which keeps the flip test above exact
+    for (u32 i = adjacencyOffsets[collapse.from]; i < adjacencyOffsets[collapse.from + 1]; ++i) {
+      auto triangle = &indices[adjacency[i] * 3];
+      touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+    }
+    *maxError = std::max(*maxError, collapse.cost);
+    removed += 2; // An interior edge collapse removes its two incident triangles
+    ++applied;
+  }
+  if (applied == 0) { return 0; }
+
+  u32 count = 0;
+  for (u32 i = 0; i < indices.size(); i += 3) {
+    auto a = remap[indices[i + 0]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+    if (a == b || b == c || c == a) { continue; }
+    indices[count++] = a;
+    indices[count++] = b;
+    indices[count++] = c;
+  }
+  indices.resize(count);
+  return applied;
+}
+
+bool lod_build_chain(const f32 *positions, u32 stride, u32 vertexCount, const u32 *indices,
+                     u32 indexCount, f32 reduction, std::vector<u32> *outIndices,
+                     MeshLodChain *outChain) {
+  if (vertexCount == 0 || indexCount == 0 || indexCount % 3 != 0) { return false; }
+  if (reduction <= 0.0f || reduction >= 1.0f) {
+    LOG_ERROR("invalid lod reduction ratio %f", reduction);
+    return false;
+  }
+
+  std::vector<Quadric> quadrics(vertexCount, Quadric{});
+  for (u32 i = 0; i < indexCount; i += 3) {
+    auto a = position_at(positions, stride, indices[i + 0]);
+    auto b = position_at(positions, stride, indices[i + 1]);
+    auto c = position_at(positions, stride, indices[i + 2]);
+    f64 n[3];
+    triangle_normal(a, b, c, n);
+    auto length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0) { continue; }
+    n[0] /= length;
+    n[1] /= length;
+    n[2] /= length;
+    auto d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+    for (u32 k = 0; k < 3; ++k) {
+      quadric_add_plane(&quadrics[indices[i + k]], n[0], n[1], n[2], d);
+    }
+  }
+
+  std::vector<bool> locked(vertexCount, false);
+  find_locked_vertices(indices, indexCount, &locked);
+
+  MeshLodChain chain{};
+  chain.lods[0] = {(u32)outIndices->size(), indexCount, 0.0f};
+  chain.count = 1;
+  outIndices->insert(outIndices->end(), indices, indices + indexCount);
+
+  std::vector<u32> current(indices, indices + indexCount);
+  f64 maxError = 0;
+  while (chain.count < MESH_LOD_MAX) {
+    auto previousCount = (u32)(current.size() / 3);
+    auto targetCount = (u32)(previousCount * reduction);
+    if (targetCount < 4) { break; }
+    while (current.size() / 3 > targetCount) {
+      if (!simplify_pass(positions, stride, vertexCount, locked, &quadrics, &current, targetCount,
+                         &maxError)) {
+        break;
+      }
+    }
+    // Stop once the mesh no longer shrinks meaningfully, e.g. when everything left is locked
+    if (current.size() / 3 > previousCount - (previousCount - targetCount) / 2) { break; }
+
+    auto &lod = chain.lods[chain.count++];
+    lod.indexOffset = (u32)outIndices->size();
+    lod.indexCount = (u32)current.size();
+    lod.error = (f32)sqrt(maxError);
+    outIndices->insert(outIndices->end(), current.begin(), current.end());
+  }
+
+  *outChain = chain;
+  return true;
+}
+
+f32 lod_projected_error(f32 error, f32 distance, f32 fov, u32 viewportHeight) {
+  if (distance <= 0.0f) { return error > 0.0f ? INFINITY : 0.0f; }
+  auto halfHeight = distance * tanf(fov * PI / 180.0f * 0.5f);
+  return error / halfHeight * (f32)viewportHeight * 0.5f;
+}
+
+u32 lod_select(const MeshLodChain *chain, u32 current, f32 distance, f32 fov, u32 viewportHeight,
+               f32 threshold, f32 hysteresis) {
+  for (u32 i = chain->count; i-- > 1;) {
+    auto limit = i > current ? threshold * (1.0f - hysteresis) : threshold;
+    if (lod_projected_error(chain->lods[i].error, distance, fov, viewportHeight) <= limit) {
+      return i;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "defines.h"
+#include <vector>
+
+static const u32 MESH_LOD_MAX = 8;
+
+struct MeshLod {
+  u32 indexOffset; // First index of this level inside the shared index buffer
+  u32 indexCount;
+  f32 error; // Object-space geometric deviation from LOD 0
+};
+
+struct MeshLodChain {
+  MeshLod lods[MESH_LOD_MAX];
+  u32 count;
+};
+
+/**
+ * Builds a chain of simplified index lists with quadric error metrics. Every level references the
+ * original vertices and is appended to `outIndices`, LOD 0 (the input) first.
+ * @param positions first position, 3 floats
+ * @param stride distance in bytes between two positions
+ * @param reduction target triangle ratio between two consecutive levels
+ */
+bool lod_build_chain(const f32 *positions, u32 stride, u32 vertexCount, const u32 *indices,
+                     u32 indexCount, f32 reduction, std::vector<u32> *outIndices,
+                     MeshLodChain *outChain);
+
+// Size in pixels of an object-space error seen at `distance` with a vertical field of view in
+// degrees
+f32 lod_projected_error(f32 error, f32 distance, f32 fov, u32 viewportHeight);
+
+/**
+ * Picks the coarsest level whose projected error stays under `threshold` pixels. Coarsening needs
+ * the error to drop below `threshold * (1 - hysteresis)`, so objects sitting on a boundary do not
+ * flip between two levels every frame.
+ */
+u32 lod_select(const MeshLodChain *chain, u32 current, f32 distance, f32 fov, u32 viewportHeight,
+               f32 threshold, f32 hysteresis = 0.25f);
@@ -0,0 +1,306 @@
+#include "logger.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const u32 LOGGER_MAX_THREADS = 32;
+static const u32 LOGGER_RING_CAPACITY = 1 << 10; // Records per thread not yet written
+static const u32 LOGGER_BATCH_BYTES = 64 * KiB;  // Formatted text written at once, per stream
+static const u32 LOGGER_WAKE_MS = 100; // Longest wait of the writer, a fallback to the signals
+
+// Single-producer single-consumer ring: the owning thread appends, the writer consumes
+struct LoggerThread {
+  std::atomic<u64> head;
+  std::atomic<u64> tail;
+  std::atomic<u64> dropped;
+  LogRecord records[LOGGER_RING_CAPACITY];
+};
+
+struct LoggerState {
+  std::atomic<LoggerThread *> threads[LOGGER_MAX_THREADS]; // Null until published
+  std::atomic<u32> threadCount;
+  std::atomic<u64> droppedRecords; // Reported by the drains so far
+  std::thread writer;
+  std::atomic<bool> quit;
+  std::atomic<bool> writerSleeping; // Parked, or about to, so the next commit signals
+  std::mutex wakeMutex;
+  std::condition_variable wake; // A record was committed to a parked writer, or shutdown
+  bool pending;                 // Whether one was since the writer last woke, under `wakeMutex`
+  std::mutex drainMutex;        // One consumer at a time, the writer or a flush
+  std::vector<LogRecord> batch;
+  std::vector<char> text[2]; // Below warnings, then warnings and errors
+  FILE *output;
+};
+
+static LoggerState *logger = nullptr;
+static u32 loggerGeneration = 0; // Tells the rings of a previous logger from those of this one
+static thread_local LoggerThread *currentThread = nullptr;
+static thread_local u32 currentGeneration = 0;
+static thread_local LogRecord directRecord; // Of the calls that find no logger running
+
+static u64 logger_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static LoggerThread *get_current_thread() {
+  if (currentGeneration != loggerGeneration) {
+    currentThread = nullptr;
+    currentGeneration = loggerGeneration;
+    auto index = logger->threadCount.fetch_add(1);
+    if (index >= LOGGER_MAX_THREADS) { return nullptr; }
+    currentThread = new LoggerThread();
+    logger->threads[index].store(currentThread, std::memory_order_release);
+  }
+  return currentThread;
+}
+
+static FILE *level_stream(u8 level) {
+  if (logger && logger->output) { return logger->output; }
+  return level >= LOG_LEVEL_WARN ? stderr : stdout;
+}
+
+// Formats one conversion, `spec` being it without length modifiers, e.g. "%-8.3" for "%-8.3lf"
+static void format_argument(std::vector<char> *out, char *spec, char conversion,
+                            const u8 **arguments, const u8 *end) {
+  if (*arguments >= end) { return; }
+  auto type = (*arguments)[0];
+  u64 payload = 0;
+  const u8 *string = nullptr;
+  if (type == LOG_ARGUMENT_STRING) {
+    string = *arguments + 2;
+    *arguments += 2 + (*arguments)[1];
+  } else {
+    memcpy(&payload, *arguments + 1, 8);
+    *arguments += 9;
+  }
+  char buffer[LOG_RECORD_SIZE + 64];
+  auto length = strlen(spec);
+  auto written = 0;
+  switch (conversion) {
+  case 'd':
+  case 'i':
+  case 'u':
+  case 'x':
+  case 'X':
+  case 'o': {
+    memcpy(spec + length, "ll", 2);
+    spec[length + 2] = conversion;
+    spec[length + 3] = 0;
+    if (type == LOG_ARGUMENT_FLOAT) {
+      f64 value;
+      memcpy(&value, &payload, 8);
+      payload = (u64)(i64)value;
+    }
+    written = snprintf(buffer, sizeof(buffer), spec, (unsigned long long)payload);
+  } break;
+  case 'c': {
+    spec[length] = conversion;
+    spec[length + 1] = 0;
+    written = snprintf(buffer, sizeof(buffer), spec, (int)payload);
+  } break;
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A': {
+    spec[length] = conversion;
+    spec[length + 1] = 0;
+    f64 value;
+    if (type == LOG_ARGUMENT_FLOAT) {
+      memcpy(&value, &payload, 8);
+    } else {
+      value = type == LOG_ARGUMENT_SIGNED ? (f64)(i64)payload : (f64)payload;
+    }
+    written = snprintf(buffer, sizeof(buffer), spec, value);
+  } break;
+  case 's': {
+    spec[length] = conversion;
+    spec[length + 1] = 0;
+    char text[LOG_RECORD_SIZE];
+    auto textLength = string ? string[-1] : 0;
+    memcpy(text, string ? (const char *)string : "", textLength);
+    text[textLength] = 0;
+    written = snprintf(buffer, sizeof(buffer), spec, text);
+  } break;
+  case 'p': {
+    written = snprintf(buffer, sizeof(buffer), "%p", (void *)(uintptr_t)payload);
+  } break;
+  default: break;
+  }
+  written = std::clamp(written, 0, (int)sizeof(buffer) - 1);
+  out->insert(out->end(), buffer, buffer + written);
+}
+
+// Appends the formatted record and a newline
+static void format_record(const LogRecord &record, std::vector<char> *out) {
+  const u8 *arguments = record.arguments;
+  const u8 *end = record.arguments + record.size;
+  for (auto c = record.format; *c; ++c) {
+    if (*c != '%') {
+      out->push_back(*c);
+      continue;
+    }
+    if (c[1] == '%') {
+      out->push_back('%');
+      ++c;
+      continue;
+    }
+    // Flags, width and precision are kept, length modifiers dropped as the arguments carry types
+    char spec[32] = "%";
+    u32 length = 1;
+    ++c;
+    while (*c && strchr("-+ #0123456789.", *c) && length < sizeof(spec) - 4) {
+      spec[length++] = *c++;
+    }
+    while (*c && strchr("hljztL", *c)) { ++c; }
+    if (!*c) { break; }
+    spec[length] = 0;
+    format_argument(out, spec, *c, &arguments, end);
+  }
+  out->push_back('\n');
+}
+
+static void write_text(FILE *stream, std::vector<char> *text) {
+  if (text->empty()) { return; }
+  fwrite(text->data(), 1, text->size(), stream);
+  fflush(stream);
+  text->clear();
+}
+
+// Writes every record committed so far, in time order across threads; returns how many
+static u32 drain() {
+  std::lock_guard<std::mutex> lock(logger->drainMutex);
+  auto &batch = logger->batch;
+  batch.clear();
+  u64 dropped = 0;
+  auto count = std::min(logger->threadCount.load(), LOGGER_MAX_THREADS);
+  for (u32 i = 0; i < count; ++i) {
+    auto thread = logger->threads[i].load(std::memory_order_acquire);
+    if (!thread) { continue; }
+    // Sequentially consistent, as the writer parks then drains while a commit moves the head then
+    // checks for a parked writer: either the drain sees the record or the commit signals
+    auto tail = thread->tail.load(std::memory_order_relaxed);
+    auto head = thread->head.load();
+    for (; tail < head; ++tail) {
+      batch.push_back(thread->records[tail & (LOGGER_RING_CAPACITY - 1)]);
+    }
+    thread->tail.store(tail, std::memory_order_release);
+    dropped += thread->dropped.exchange(0, std::memory_order_relaxed);
+  }
+  std::stable_sort(batch.begin(), batch.end(),
+                   [](const LogRecord &a, const LogRecord &b) { return a.time < b.time; });
+  for (const auto &record : batch) {
+    auto &text = logger->text[record.level >= LOG_LEVEL_WARN];
+    format_record(record, &text);
+    if (text.size() >= LOGGER_BATCH_BYTES) { write_text(level_stream(record.level), &text); }
+  }
+  if (dropped > 0) {
+    logger->droppedRecords.fetch_add(dropped, std::memory_order_relaxed);
+    char line[64];
+    auto length = snprintf(line, sizeof(line), "logger: dropped %llu records\n",
+                           (unsigned long long)dropped);
+    logger->text[1].insert(logger->text[1].end(), line, line + length);
+  }
+  write_text(level_stream(LOG_LEVEL_INFO), &logger->text[0]);
+  write_text(level_stream(LOG_LEVEL_ERROR), &logger->text[1]);
+  return (u32)batch.size();
+}
+
+// Parks once a drain found nothing, then drains again before waiting for a commit to signal
+static void writer_main() {
+  while (!logger->quit.load(std::memory_order_acquire)) {
+    if (drain() > 0) { continue; }
+    logger->writerSleeping.store(true);
+    if (drain() == 0) {
+      std::unique_lock<std::mutex> lock(logger->wakeMutex);
+      logger->wake.wait_for(lock, std::chrono::milliseconds(LOGGER_WAKE_MS),
+                            [] { return logger->pending || logger->quit.load(); });
+      logger->pending = false;
+    }
+    logger->writerSleeping.store(false, std::memory_order_relaxed);
+  }
+}
+
+void logger_system_initialize(FILE *output) {
+  logger = new LoggerState();
+  logger->output = output;
+  ++loggerGeneration;
+  logger->writer = std::thread(writer_main);
+}
+
+void logger_system_shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(logger->wakeMutex);
+    logger->quit.store(true, std::memory_order_release);
+  }
+  logger->wake.notify_one();
+  logger->writer.join();
+  drain();
+  auto count = std::min(logger->threadCount.load(), LOGGER_MAX_THREADS);
+  for (u32 i = 0; i < count; ++i) {
+    auto thread = logger->threads[i].load();
+    DELETE(thread)
+  }
+  DELETE(logger)
+}
+
+void logger_flush() {
+  if (logger) { drain(); }
+}
+
+u64 logger_dropped_records() {
+  if (!logger) { return 0; }
+  auto dropped = logger->droppedRecords.load(std::memory_order_relaxed);
+  auto count = std::min(logger->threadCount.load(), LOGGER_MAX_THREADS);
+  for (u32 i = 0; i < count; ++i) { // Not yet reported
+    auto thread = logger->threads[i].load(std::memory_order_acquire);
+    if (thread) { dropped += thread->dropped.load(std::memory_order_relaxed); }
+  }
+  return dropped;
+}
+
+LogRecord *logger_record_begin(LogLevel level, const char *format) {
+  LogRecord *record = &directRecord;
+  if (logger) {
+    auto thread = get_current_thread();
+    if (!thread) { return nullptr; } // Past LOGGER_MAX_THREADS
+    auto head = thread->head.load(std::memory_order_relaxed);
+    if (head - thread->tail.load(std::memory_order_acquire) >= LOGGER_RING_CAPACITY) {
+      thread->dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    record = &thread->records[head & (LOGGER_RING_CAPACITY - 1)];
+  }
+  record->time = logger_now();
+  record->format = format;
+  record->level = level;
+  record->size = 0;
+  return record;
+}
+
+void logger_record_commit(LogRecord *record) {
+  if (record == &directRecord) {
+    std::vector<char> text;
+    format_record(*record, &text);
+    fwrite(text.data(), 1, text.size(), level_stream(record->level));
+    return;
+  }
+  currentThread->head.fetch_add(1);
+  // Lock-free unless the writer parked, then only the first commit to find it so signals
+  if (logger->writerSleeping.load() && logger->writerSleeping.exchange(false)) {
+    {
+      std::lock_guard<std::mutex> lock(logger->wakeMutex);
+      logger->pending = true;
+    }
+    logger->wake.notify_one();
+  }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "defines.h"
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * Asynchronous logging. A call site stores the format pointer and its arguments as a binary record
+ * in its thread's lock-free ring, strings copied inline; a writer thread formats the records of
+ * all threads in time order and writes them out in batches. Logging is thus a clock read and a few
+ * stores on any thread, and levels below NEON_LOG_LEVEL compile to nothing, arguments included.
+ * Warnings and errors go to stderr, the rest to stdout, with a newline appended.
+ *
+ * Formats must be string literals or otherwise outlive the logger. They take printf conversions
+ * without `*` widths. Without a running logger, e.g. before initialization or in tools, records are
+ * written out synchronously instead.
+ */
+
+enum LogLevel {
+  LOG_LEVEL_TRACE = 0x0, // Per-event detail, off by default
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+
+  LOG_LEVEL_COUNT,
+};
+
+#if !defined(NEON_LOG_LEVEL)
+#define NEON_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Writes every level to `output` when given, e.g. a log file, which the caller closes
+void logger_system_initialize(FILE *output = nullptr);
+// Writes what was logged so far, then stops the writer
+void logger_system_shutdown();
+// Returns once everything logged so far is written, e.g. before printing a report
+void logger_flush();
+// Records dropped so far by full rings, also reported in the log
+u64 logger_dropped_records();
+
+static const u32 LOG_RECORD_SIZE = 256;
+
+enum LogArgument : u8 {
+  LOG_ARGUMENT_SIGNED = 0x0,
+  LOG_ARGUMENT_UNSIGNED,
+  LOG_ARGUMENT_FLOAT,
+  LOG_ARGUMENT_STRING, // Length byte then the characters, cut to the space left
+  LOG_ARGUMENT_POINTER,
+};
+
+// Internal to the logging calls: a record as it sits in a ring
+struct LogRecord {
+  u64 time;
+  const char *format;
+  u8 level;
+  u8 size; // Bytes of `arguments` in use
+  u8 arguments[LOG_RECORD_SIZE - 18];
+};
+
+// A slot of the calling thread's ring to fill and commit, or one written out on commit
+LogRecord *logger_record_begin(LogLevel level, const char *format);
+void logger_record_commit(LogRecord *record);
+
+template <typename T> inline void logger_record_argument(LogRecord *record, T value) {
+  auto space = (u32)sizeof(record->arguments) - record->size;
+  auto out = record->arguments + record->size;
+  if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, char *>) {
+    if (space < 2) { return; }
+    const char *text = value ? value : "(null)";
+    u32 length = 0;
+    while (text[length] && length < space - 2) { ++length; }
+    out[0] = LOG_ARGUMENT_STRING;
+    out[1] = (u8)length;
+    memcpy(out + 2, text, length);
+    record->size += 2 + length;
+  } else {
+    if (space < 9) { return; }
+    if constexpr (std::is_floating_point_v<T>) {
+      out[0] = LOG_ARGUMENT_FLOAT;
+      f64 payload = value;
+      memcpy(out + 1, &payload, 8);
+    } else if constexpr (std::is_pointer_v<T>) {
+      out[0] = LOG_ARGUMENT_POINTER;
+      u64 payload = (u64)(uintptr_t)value;
+      memcpy(out + 1, &payload, 8);
+    } else {
+      static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "unsupported log argument");
+      constexpr bool isSigned = std::is_signed_v<T>;
+      out[0] = isSigned ? LOG_ARGUMENT_SIGNED : LOG_ARGUMENT_UNSIGNED;
+      u64 payload = isSigned ? (u64)(i64)value : (u64)value;
+      memcpy(out + 1, &payload, 8);
+    }
+    record->size += 9;
+  }
+}
+
+template <typename... Args>
+inline void logger_log(LogLevel level, const char *format, Args... args) {
+  auto record = logger_record_begin(level, format);
+  if (!record) { return; } // The ring is full, the writer counts the drop
+  (logger_record_argument(record, args), ...);
+  logger_record_commit(record);
+}
+
+#define LOG_AT(level, ...)                                                                         \
+  do {                                                                                             \
+    if constexpr (level >= NEON_LOG_LEVEL) { logger_log(level, __VA_ARGS__); }                     \
+  } while (0)
+
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
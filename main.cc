@@ -1,74 +1,182 @@
+#include "allocator.h"
+#include "async_io.h"
+#include "bvh.h"
 #include "camera.h"
+#include "crowd.h"
 #include "event.h"
+#include "frame_stats.h"
+#include "geometry_pool.h"
+#include "gpu_cull.h"
+#include "headless.h"
+#include "image.h"
 #include "input.h"
+#include "job_system.h"
+#include "lod.h"
+#include "logger.h"
+#include "material.h"
+#include "memory_stats.h"
 #include "message_queue.h"
+#include "occlusion.h"
+#include "overlay.h"
+#include "particles.h"
+#include "profiler.h"
+#include "rasterizer.h"
+#include "render_graph.h"
+#include "replay.h"
+#include "resolution.h"
 #include "program.h"
-#include "texture.h"
+#include "texture_streamer.h"
+#include "triple_buffer.h"
 #include <SDL.h>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cfloat>
 #include <chrono>
+#include <cstring>
 #include <pthread.h>
 #include <thread>
+#include <vector>
 
 using Clock = std::chrono::steady_clock;
 
+// Sleeps through most of the duration and only yields for the last stretch, where the OS timer is
+// too coarse to wake us on time
 static void sleep_for(double d) {
+  static constexpr std::chrono::duration<double> spinDuration(0.002);
   static constexpr std::chrono::duration<double> minSleepDuration(0);
-  Clock::time_point start = Clock::now();
-  while (std::chrono::duration<double>(Clock::now() - start).count() < d) {
+  Clock::time_point end =
+      Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(d));
+  if (auto remaining = end - Clock::now(); remaining > spinDuration) {
+    std::this_thread::sleep_for(remaining - spinDuration);
+  }
+  while (Clock::now() < end) {
     std::this_thread::sleep_for(minSleepDuration);
   }
 }
 
+struct SimulationState {
+  CameraPose camera;
+  f32 fov;
+  f32 time; // Seconds simulated, what the characters' animations play at
+};
+
+// The two latest simulation states, the renderer shows a blend of them
+struct SimulationFrame {
+  SimulationState previous;
+  SimulationState current;
+  Clock::time_point time; // When `current` is due on screen, `previous` was due a step earlier
+  u64 step;
+  f64 updateMs; // Of all the steps so far, differences give the time of the steps in between
+};
+
+enum WakeupCode {
+  WAKEUP_CODE_NONE = 0x0,
+  WAKEUP_CODE_TICK, // The update thread finished a tick
+};
+
 struct Context {
   bool quit;
   SDL_Window *window;
+  u32 wakeupEventType; // Custom SDL event used by engine threads to wake the main loop
   std::unique_ptr<MessageQueue> updateThreadMessageQueue;
   std::unique_ptr<MessageQueue> renderThreadMessageQueue;
   void *eventSystemState;
   void *inputSystemState;
+  void *frameStatsState;
+  void *replayState; // Recording or playing back the update thread's input, or null
+  void *resolutionState;
+  TripleBuffer<SimulationFrame> simulation; // Update thread to render thread
 };
 
-enum { VAO_CUBE, VAO_LIGHT, VAO_COUNT };
-
-enum { VBO_CUBE, VBO_LIGHT, VBO_COUNT };
-
-enum { EBO_CUBE, EBO_LIGHT, EBO_COUNT };
+// The lamp is drawn with the cube mesh, its shader only reads positions
+enum { MESH_CUBE, MESH_SPHERE, MESH_COUNT };
 
 enum {
   vPosition = 0,
   vTexCoord = 1,
 };
 
-GLuint VAOs[VAO_COUNT];
-GLuint VBOs[VBO_COUNT];
-GLuint EBOs[VBO_COUNT];
+void *geometryPoolState; // Every mesh, all in the `Vertex` format
+u32 meshIds[MESH_COUNT];  // Ids in the geometry pool
 const GLuint kNumVertices = 24;
 const GLuint kNumIndices = 36;
-GLuint lightingProgram;
-GLuint lightCubeProgram;
-Texture *diffuse_map;
-Texture *specular_map;
-
-enum FrameState {
-  FRAME_STATE_EMPTY = 0x0,
-  FRAME_STATE_PROCESSING,
-  FRAME_STATE_PROCESSED,
-  FRAME_STATE_UPDATING,
-  FRAME_STATE_UPDATED,
-  FRAME_STATE_RENDERING,
-  FRAME_STATE_RENDERED,
-  FRAME_STATE_PRESENTING,
-  FRAME_STATE_PRESENTED,
-};
 
-struct Frame {
-  FrameState state;
-  std::mutex mutex;
-  std::condition_variable condition;
+enum { MATERIAL_CONTAINER, MATERIAL_LAMP, MATERIAL_SPARK, MATERIAL_EMBER, MATERIAL_COUNT };
+
+// Shared by the GL and the software renderer
+const MaterialDesc kMaterials[MATERIAL_COUNT] = {
+    {MATERIAL_SHADING_LIT,
+     {"images/container2.png", "images/container2_specular.png"},
+     {1.0f, 1.0f, 1.0f, 1.0f},
+     32.0f},
+    {MATERIAL_SHADING_UNLIT, {}, {1.0f, 1.0f, 1.0f, 1.0f}, 0.0f},
+    {MATERIAL_SHADING_PARTICLE, {}, {1.0f, 1.0f, 1.0f, 1.0f}, 0.0f},
+    {MATERIAL_SHADING_PARTICLE, {}, {0.6f, 0.8f, 1.0f, 1.0f}, 0.0f},
+};
+void *materialSystemState;
+u32 materialIds[MATERIAL_COUNT]; // Ids in the material system
+u64 textureBudget = 256 * MiB; // GPU memory of streamed textures, 0 keeps them fully resident
+const u64 kTextureUploadBytes = 4 * MiB; // Per frame at most, so streaming never stalls one
+void *textureStreamerState = nullptr;
+const u32 kAsyncIoDepth = 64; // File requests in flight at most
+void *asyncIoState = nullptr;
+
+const u32 kSphereRings = 48;
+const u32 kSphereSegments = 96;
+const f32 kSphereRadius = 0.5f;
+const f32 kLodThreshold = 1.0f; // Pixels of tolerated screen-space error
+MeshLodChain sphereLods;
+
+struct SceneObject {
+  glm::vec3 position;
+  u32 lod;
 };
 
-Frame frames[3] = {};
+u32 denseSceneSize = 0; // Edge length of the sphere grid, 0 to disable
+bool lodEnabled = true;
+std::vector<SceneObject> sceneObjects;
+std::vector<glm::mat4> wallModels; // Unit cubes stretched into walls, also the occluders
+bool occlusionEnabled = true;
+void *jobSystemState = nullptr;
+void *occlusionState = nullptr; // Only with a dense scene
+const char *tracePath = nullptr; // Chrome trace written on F1 and at exit
+const char *statsCsvPath = nullptr;
+const char *recordPath = nullptr;
+const char *replayPath = nullptr;
+const f64 kFrameBudget = 1000.0 / 60.0; // Milliseconds
+f64 simulationStep = 1.0 / 60.0;        // Seconds
+// Steps run per wake-up at most; a slower simulation then falls behind instead of spiraling
+const u32 kMaxSimulationSteps = 8;
+std::atomic<bool> statsOverlayVisible{false};
+ResolutionOptions resolutionOptions{};
+u64 renderedTriangles = 0;
+u64 renderedFrames = 0;
+u64 testedObjects = 0;
+u64 culledObjects = 0;
+bool softwareRendering = false; // Rasterize on the CPU instead of through GL
+bool gpuCullingEnabled = true;   // Used when the context is 4.3 or later
+bool gpuCullingActive = false;
+void *gpuCullState = nullptr; // Culls and submits the dense scene, instead of the CPU
+bool renderGraphAliasing = true; // Transient targets with disjoint lifetimes share storage
+void *rasterizerState = nullptr;
+u32 crowdSize = 0; // Animated characters, 0 for none
+void *crowdState = nullptr;
+const f32 kCrowdCenter[3] = {0.0f, -2.0f, -4.0f}; // Where the feet of the middle character are
+f64 animationMs = 0; // Summed over the rendered frames
+u32 particleCapacity = 0; // Particles alive at once at most, 0 for none
+void *particleState = nullptr;
+f32 particleTime = 0; // Animation time of the last particle update
+f64 particleMs = 0; // Summed over the rendered frames
+void *sceneBvhState = nullptr; // Boxes of the scene's objects, for picking
+const f32 kPickRadius = 2.0f;  // Around a picked point, where objects count as near it
+
+// What the ids of the scene BVH stand for
+struct ScenePickable {
+  const char *kind;
+  u32 index; // Among the objects of its kind
+};
+std::vector<ScenePickable> scenePickables;
 
 struct Vertex {
   f32 position[3];
@@ -76,180 +184,374 @@ struct Vertex {
   f32 texCoord[2];
 };
 
+static const Vertex kCubeVertices[kNumVertices] = {
+    //
+    {{-0.5, -0.5, 0.5}, {0, 0, 1}, {0, 0}},
+    {{0.5, -0.5, 0.5}, {0, 0, 1}, {1, 0}},
+    {{-0.5, 0.5, 0.5}, {0, 0, 1}, {0, 1}},
+    {{0.5, 0.5, 0.5}, {0, 0, 1}, {1, 1}},
+
+    //
+    {{0.5, -0.5, 0.5}, {1, 0, 0}, {0, 0}},
+    {{0.5, -0.5, -0.5}, {1, 0, 0}, {1, 0}},
+    {{0.5, 0.5, 0.5}, {1, 0, 0}, {0, 1}},
+    {{0.5, 0.5, -0.5}, {1, 0, 0}, {1, 1}},
+
+    //
+    {{0.5, -0.5, -0.5}, {0, 0, -1}, {0, 0}},
+    {{-0.5, -0.5, -0.5}, {0, 0, -1}, {1, 0}},
+    {{0.5, 0.5, -0.5}, {0, 0, -1}, {0, 1}},
+    {{-0.5, 0.5, -0.5}, {0, 0, -1}, {1, 1}},
+
+    //
+    {{-0.5, -0.5, -0.5}, {-1, 0, 0}, {0, 0}},
+    {{-0.5, -0.5, 0.5}, {-1, 0, 0}, {1, 0}},
+    {{-0.5, 0.5, -0.5}, {-1, 0, 0}, {0, 1}},
+    {{-0.5, 0.5, 0.5}, {-1, 0, 0}, {1, 1}},
+
+    //
+    {{-0.5, 0.5, 0.5}, {0, 1, 0}, {0, 0}},
+    {{0.5, 0.5, 0.5}, {0, 1, 0}, {1, 0}},
+    {{-0.5, 0.5, -0.5}, {0, 1, 0}, {0, 1}},
+    {{0.5, 0.5, -0.5}, {0, 1, 0}, {1, 1}},
+
+    //
+    {{-0.5, -0.5, -0.5}, {0, -1, 0}, {0, 0}},
+    {{0.5, -0.5, -0.5}, {0, -1, 0}, {1, 0}},
+    {{-0.5, -0.5, 0.5}, {0, -1, 0}, {0, 1}},
+    {{0.5, -0.5, 0.5}, {0, -1, 0}, {1, 1}},
+};
+
+static const u32 kCubeIndices[kNumIndices] = {
+    0,  1,  2,  1,  3,  2,  //
+    4,  5,  6,  5,  7,  6,  //
+    8,  9,  10, 9,  11, 10, //
+    12, 13, 14, 13, 15, 14, //
+    16, 17, 18, 17, 19, 18, //
+    20, 21, 22, 21, 23, 22, //
+};
+
+// Kept on the CPU for the software renderer; all LODs one after another in the index buffer
+std::vector<Vertex> sphereVertices;
+std::vector<u32> sphereLodIndices;
+
+// Everything one frame draws, built once and then submitted to GL or to the software renderer
+struct SceneDraw {
+  u16 mesh;     // MESH_*
+  u16 material; // MATERIAL_*
+  u32 indexOffset;
+  u32 indexCount;
+  glm::mat4 model;
+};
+
+// Lives in the frame arena, sized up front for every draw the list could take
+struct SceneDrawList {
+  SceneDraw *draws;
+  u32 count;
+
+  SceneDraw *begin() const { return draws; }
+  SceneDraw *end() const { return draws + count; }
+  void push(const SceneDraw &draw) { draws[count++] = draw; }
+};
+
+struct SceneFrame {
+  glm::mat4 view;
+  glm::mat4 projection;
+  Lighting lighting;
+  SceneDrawList objects;    // Lit by the materials shader
+  SceneDrawList denseScene; // Lit as well, after the occlusion and LOD passes
+  SceneDrawList lamps;      // Plain white
+};
+
 bool event_on_quit(EventCode eventCode, EventContext eventContext, void *sender, void *listener);
 
 bool event_on_key(EventCode eventCode, EventContext eventContext, void *sender, void *listener);
 
 bool event_on_scroll(EventCode eventCode, EventContext eventContext, void *sender, void *listener);
 
-void init() {
-  glGenVertexArrays(VAO_COUNT, VAOs);
-  glGenBuffers(VBO_COUNT, VBOs);
-  glGenBuffers(EBO_COUNT, EBOs);
-
-  // Build and compile shader programs
-  {
-    auto ok = program_create(&lightingProgram, {{GL_VERTEX_SHADER, "shaders/materials.vert"},
-                                                {GL_FRAGMENT_SHADER, "shaders/materials.frag"}});
-    assert(ok);
+// UV sphere with a duplicated seam column so texture coordinates wrap cleanly
+static void generate_sphere(u32 rings, u32 segments, f32 radius, std::vector<Vertex> *vertices,
+                            std::vector<u32> *indices) {
+  for (u32 r = 0; r <= rings; ++r) {
+    for (u32 s = 0; s <= segments; ++s) {
+      f32 theta = PI * (f32)r / (f32)rings;
+      f32 phi = 2 * PI * (f32)s / (f32)segments;
+      f32 x = sinf(theta) * cosf(phi), y = cosf(theta), z = sinf(theta) * sinf(phi);
+      vertices->push_back({{x * radius, y * radius, z * radius},
+                           {x, y, z},
+                           {(f32)s / (f32)segments, 1.0f - (f32)r / (f32)rings}});
+    }
   }
-  {
-    auto ok = program_create(&lightCubeProgram, {{GL_VERTEX_SHADER, "shaders/light_cube.vert"},
-                                                 {GL_FRAGMENT_SHADER, "shaders/light_cube.frag"}});
-    assert(ok);
+  for (u32 r = 0; r < rings; ++r) {
+    for (u32 s = 0; s < segments; ++s) {
+      u32 a = r * (segments + 1) + s, b = a + segments + 1;
+      if (r != 0) { indices->insert(indices->end(), {a, b, a + 1}); }
+      if (r != rings - 1) { indices->insert(indices->end(), {a + 1, b, b + 1}); }
+    }
   }
+}
 
-  {
-    auto ok = texture_create(&diffuse_map, "images/container2.png");
+// Box occluder matching the cube mesh, 8 shared corners instead of 24 vertices
+static const f32 kBoxCorners[8][3] = {
+    {-0.5, -0.5, -0.5}, {0.5, -0.5, -0.5}, {-0.5, 0.5, -0.5}, {0.5, 0.5, -0.5},
+    {-0.5, -0.5, 0.5},  {0.5, -0.5, 0.5},  {-0.5, 0.5, 0.5},  {0.5, 0.5, 0.5},
+};
+static const u32 kBoxIndices[36] = {
+    0, 2, 3, 0, 3, 1, 4, 5, 7, 4, 7, 6, 0, 4, 6, 0, 6, 2, //
+    1, 3, 7, 1, 7, 5, 0, 1, 5, 0, 5, 4, 2, 6, 7, 2, 7, 3, //
+};
+
+static void build_scene_bvh();
+
+// CPU side of the scene, needed by both renderers; run before the render thread starts
+void init_scene() {
+  generate_sphere(kSphereRings, kSphereSegments, kSphereRadius, &sphereVertices, &sphereLodIndices);
+  { // All LODs share the vertex buffer
+    std::vector<u32> lodIndices;
+    auto ok = lod_build_chain(sphereVertices[0].position, sizeof(Vertex), sphereVertices.size(),
+                              sphereLodIndices.data(), sphereLodIndices.size(), 0.5f, &lodIndices,
+                              &sphereLods);
     assert(ok);
+    sphereLodIndices = std::move(lodIndices);
   }
-  {
-    auto ok = texture_create(&specular_map, "images/container2_specular.png");
-    assert(ok);
+  memory_stats_allocate(MEMORY_TAG_MESH, MEMORY_DOMAIN_CPU, sphereVertices.size() * sizeof(Vertex));
+  memory_stats_allocate(MEMORY_TAG_MESH, MEMORY_DOMAIN_CPU, sphereLodIndices.size() * sizeof(u32));
+
+  // Dense scene: a grid of spheres receding from the camera
+  for (u32 x = 0; x < denseSceneSize; ++x) {
+    for (u32 z = 0; z < denseSceneSize; ++z) {
+      SceneObject object{};
+      object.position = {((f32)x - (f32)(denseSceneSize - 1) * 0.5f) * 2.0f, -1.5f,
+                         -(f32)z * 2.0f - 2.0f};
+      sceneObjects.emplace_back(object);
+    }
+  }
+  // Walls across the grid every few rows, each with a doorway on alternating sides
+  for (u32 row = 5, wall = 0; row + 1 < denseSceneSize; row += 6, ++wall) {
+    auto halfWidth = (f32)denseSceneSize;
+    auto doorX = (wall % 2 ? 0.5f : -0.5f) * halfWidth;
+    f32 segments[2][2] = {{-halfWidth, doorX - 1.5f}, {doorX + 1.5f, halfWidth}};
+    for (auto &segment : segments) {
+      glm::vec3 center = {(segment[0] + segment[1]) * 0.5f, -0.5f, -(f32)row * 2.0f - 3.0f};
+      glm::mat4 model(1.0);
+      model = glm::translate(model, center);
+      model = glm::scale(model, {segment[1] - segment[0], 3.0f, 0.5f});
+      wallModels.push_back(model);
+      if (occlusionState) {
+        occlusion_add_occluder(occlusionState, kBoxCorners[0], sizeof(kBoxCorners[0]), 8,
+                               kBoxIndices, 36, glm::value_ptr(model));
+      }
+    }
   }
+  build_scene_bvh();
+}
 
-  { // Cube
-    glBindVertexArray(VAOs[VAO_CUBE]);
-
-    Vertex vertices[kNumVertices] = {
-        //
-        {{-0.5, -0.5, 0.5}, {0, 0, 1}, {0, 0}},
-        {{0.5, -0.5, 0.5}, {0, 0, 1}, {1, 0}},
-        {{-0.5, 0.5, 0.5}, {0, 0, 1}, {0, 1}},
-        {{0.5, 0.5, 0.5}, {0, 0, 1}, {1, 1}},
-
-        //
-        {{0.5, -0.5, 0.5}, {1, 0, 0}, {0, 0}},
-        {{0.5, -0.5, -0.5}, {1, 0, 0}, {1, 0}},
-        {{0.5, 0.5, 0.5}, {1, 0, 0}, {0, 1}},
-        {{0.5, 0.5, -0.5}, {1, 0, 0}, {1, 1}},
-
-        //
-        {{0.5, -0.5, -0.5}, {0, 0, -1}, {0, 0}},
-        {{-0.5, -0.5, -0.5}, {0, 0, -1}, {1, 0}},
-        {{0.5, 0.5, -0.5}, {0, 0, -1}, {0, 1}},
-        {{-0.5, 0.5, -0.5}, {0, 0, -1}, {1, 1}},
-
-        //
-        {{-0.5, -0.5, -0.5}, {-1, 0, 0}, {0, 0}},
-        {{-0.5, -0.5, 0.5}, {-1, 0, 0}, {1, 0}},
-        {{-0.5, 0.5, -0.5}, {-1, 0, 0}, {0, 1}},
-        {{-0.5, 0.5, 0.5}, {-1, 0, 0}, {1, 1}},
-
-        //
-        {{-0.5, 0.5, 0.5}, {0, 1, 0}, {0, 0}},
-        {{0.5, 0.5, 0.5}, {0, 1, 0}, {1, 0}},
-        {{-0.5, 0.5, -0.5}, {0, 1, 0}, {0, 1}},
-        {{0.5, 0.5, -0.5}, {0, 1, 0}, {1, 1}},
-
-        //
-        {{-0.5, -0.5, -0.5}, {0, -1, 0}, {0, 0}},
-        {{0.5, -0.5, -0.5}, {0, -1, 0}, {1, 0}},
-        {{-0.5, -0.5, 0.5}, {0, -1, 0}, {0, 1}},
-        {{0.5, -0.5, 0.5}, {0, -1, 0}, {1, 1}},
-    };
+// Counterpart of `init_scene`, once no renderer is left to read the meshes
+void shutdown_scene() {
+  bvh_destroy(&sceneBvhState);
+  scenePickables.clear();
+  memory_stats_free(MEMORY_TAG_MESH, MEMORY_DOMAIN_CPU, sphereVertices.size() * sizeof(Vertex));
+  memory_stats_free(MEMORY_TAG_MESH, MEMORY_DOMAIN_CPU, sphereLodIndices.size() * sizeof(u32));
+  std::vector<Vertex>().swap(sphereVertices);
+  std::vector<u32>().swap(sphereLodIndices);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBOs[VBO_CUBE]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+// Hands the dense scene to the GPU when the context can cull it there. Nothing is added to the
+// geometry pool afterwards, so the mesh ranges copied here stay valid.
+static void init_gpu_culling() {
+  if (!gpuCullingEnabled || sceneObjects.empty() || !gpu_cull_supported()) { return; }
+  GpuCullMesh meshes[MESH_COUNT]{};
+  for (u32 i = 0; i < MESH_COUNT; ++i) {
+    auto mesh = geometry_pool_get(geometryPoolState, meshIds[i]);
+    meshes[i].baseVertex = (i32)mesh.baseVertex;
+    meshes[i].lodCount = 1;
+    meshes[i].lods[0] = {mesh.firstIndex, mesh.indexCount, 0.0f};
+  }
+  auto &sphere = meshes[MESH_SPHERE];
+  auto sphereFirstIndex = sphere.lods[0].firstIndex;
+  sphere.lodCount = sphereLods.count;
+  for (u32 i = 0; i < sphereLods.count; ++i) {
+    const auto &lod = sphereLods.lods[i];
+    sphere.lods[i] = {sphereFirstIndex + lod.indexOffset, lod.indexCount, lod.error};
+  }
 
-    u32 indices[kNumIndices] = {
-        0,  1,  2,  1,  3,  2,  //
-        4,  5,  6,  5,  7,  6,  //
-        8,  9,  10, 9,  11, 10, //
-        12, 13, 14, 13, 15, 14, //
-        16, 17, 18, 17, 19, 18, //
-        20, 21, 22, 21, 23, 22, //
-    };
+  std::vector<GpuCullObject> objects;
+  objects.reserve(wallModels.size() + sceneObjects.size());
+  for (const auto &model : wallModels) {
+    GpuCullObject object{};
+    memcpy(object.model, glm::value_ptr(model), sizeof(object.model));
+    memcpy(object.center, glm::value_ptr(model[3]), sizeof(object.center));
+    // Half the diagonal of the stretched unit cube
+    object.radius = 0.5f * sqrtf(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])) +
+                                 glm::dot(glm::vec3(model[1]), glm::vec3(model[1])) +
+                                 glm::dot(glm::vec3(model[2]), glm::vec3(model[2])));
+    object.mesh = MESH_CUBE;
+    objects.push_back(object);
+  }
+  for (const auto &sceneObject : sceneObjects) {
+    GpuCullObject object{};
+    auto model = glm::translate(glm::mat4(1.0), sceneObject.position);
+    memcpy(object.model, glm::value_ptr(model), sizeof(object.model));
+    memcpy(object.center, glm::value_ptr(sceneObject.position), sizeof(object.center));
+    object.radius = kSphereRadius;
+    object.mesh = MESH_SPHERE;
+    objects.push_back(object);
+  }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBOs[EBO_CUBE]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-    // Attribute: position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (any)offsetof(Vertex, position));
-    glEnableVertexAttribArray(0);
-    // Attribute: normal
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (any)offsetof(Vertex, normal));
-    glEnableVertexAttribArray(1);
-    // Attribute: texture coordinate
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (any)offsetof(Vertex, texCoord));
-    glEnableVertexAttribArray(2);
-
-    // The call to glVertexAttribPointer already registered the last bound VBO as the vertex
-    // attribute's bound vertex buffer object
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-  }
-
-  { // Light
-    glBindVertexArray(VAOs[VAO_LIGHT]);
-
-    Vertex vertices[kNumVertices] = {
-        //
-        {{-0.5, -0.5, 0.5}, {0, 0}},
-        {{0.5, -0.5, 0.5}, {1, 0}},
-        {{-0.5, 0.5, 0.5}, {0, 1}},
-        {{0.5, 0.5, 0.5}, {1, 1}},
-
-        //
-        {{0.5, -0.5, 0.5}, {0, 0}},
-        {{0.5, -0.5, -0.5}, {1, 0}},
-        {{0.5, 0.5, 0.5}, {0, 1}},
-        {{0.5, 0.5, -0.5}, {1, 1}},
-
-        //
-        {{0.5, -0.5, -0.5}, {0, 0}},
-        {{-0.5, -0.5, -0.5}, {1, 0}},
-        {{0.5, 0.5, -0.5}, {0, 1}},
-        {{-0.5, 0.5, -0.5}, {1, 1}},
-
-        //
-        {{-0.5, -0.5, -0.5}, {0, 0}},
-        {{-0.5, -0.5, 0.5}, {1, 0}},
-        {{-0.5, 0.5, -0.5}, {0, 1}},
-        {{-0.5, 0.5, 0.5}, {1, 1}},
-
-        //
-        {{-0.5, 0.5, 0.5}, {0, 0}},
-        {{0.5, 0.5, 0.5}, {1, 0}},
-        {{-0.5, 0.5, -0.5}, {0, 1}},
-        {{0.5, 0.5, -0.5}, {1, 1}},
-
-        //
-        {{-0.5, -0.5, -0.5}, {0, 0}},
-        {{0.5, -0.5, -0.5}, {1, 0}},
-        {{-0.5, -0.5, 0.5}, {0, 1}},
-        {{0.5, -0.5, 0.5}, {1, 1}},
-    };
+  if (!material_system_program(materialSystemState, MATERIAL_SHADING_LIT,
+                               MATERIAL_VERTEX_STAGE_INDIRECT)) {
+    LOG_ERROR("error creating the indirect draw program, culling on the CPU");
+    return;
+  }
+  if (!gpu_cull_initialize(&gpuCullState, meshes, MESH_COUNT, objects.data(),
+                           (u32)objects.size())) {
+    LOG_ERROR("error creating the GPU culling pass, culling on the CPU");
+    return;
+  }
+  auto instances = gpu_cull_instance_buffer(gpuCullState);
+  geometry_pool_set_instance_attribute(geometryPoolState, 3, instances); // aObject
+  gpuCullingActive = true;
+}
+
+// Spark fountains around the characters, and embers drifting up from their middle; emitters spawn
+// at the rate that keeps them full, so the scene holds about `particleCapacity` particles
+static void init_particles() {
+  const f32 gravity[3] = {0.0f, -9.8f, 0.0f};
+  particle_system_initialize(&particleState, gravity);
+  const u32 fountainCount = 3;
+  const f32 fountainRadius = 2.5f;
+  const u8 sparkColor[4] = {255, 150, 50, 255};
+  const u8 emberColor[4] = {255, 255, 255, 160};
+  auto sparkCapacity = particleCapacity * 3 / 4 / fountainCount;
+  for (u32 i = 0; i < fountainCount; ++i) {
+    auto angle = 2.0f * PI * (f32)i / (f32)fountainCount;
+    ParticleEmitterDesc desc{};
+    desc.position[0] = kCrowdCenter[0] + fountainRadius * cosf(angle);
+    desc.position[1] = kCrowdCenter[1];
+    desc.position[2] = kCrowdCenter[2] + fountainRadius * sinf(angle);
+    desc.velocity[1] = 6.0f;
+    desc.spread = 1.5f;
+    desc.life[0] = 1.0f;
+    desc.life[1] = 1.4f;
+    desc.drag = 0.1f;
+    desc.size = 0.04f;
+    memcpy(desc.color, sparkColor, sizeof(desc.color));
+    desc.capacity = sparkCapacity;
+    desc.rate = (f32)desc.capacity / (0.5f * (desc.life[0] + desc.life[1]));
+    desc.material = MATERIAL_SPARK;
+    particle_emitter_create(particleState, desc);
+  }
+  ParticleEmitterDesc desc{};
+  memcpy(desc.position, kCrowdCenter, sizeof(desc.position));
+  desc.velocity[1] = 4.0f;
+  desc.spread = 2.0f;
+  desc.life[0] = 1.5f;
+  desc.life[1] = 2.5f;
+  desc.drag = 1.5f;
+  desc.size = 0.03f;
+  memcpy(desc.color, emberColor, sizeof(desc.color));
+  desc.capacity = particleCapacity - sparkCapacity * fountainCount;
+  desc.rate = (f32)desc.capacity / (0.5f * (desc.life[0] + desc.life[1]));
+  desc.material = MATERIAL_EMBER;
+  particle_emitter_create(particleState, desc);
+  particle_system_gpu_initialize(particleState);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBOs[VBO_LIGHT]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+void init() {
+  { // Materials, with their shader programs and textures
+    if (textureBudget > 0) {
+      async_io_initialize(&asyncIoState, kAsyncIoDepth);
+      texture_streamer_initialize(&textureStreamerState, textureBudget, kTextureUploadBytes,
+                                  asyncIoState);
+      memory_stats_set_budget(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_GPU, textureBudget);
+    }
+    auto ok = material_system_initialize(&materialSystemState, textureStreamerState);
+    assert(ok);
+    for (u32 i = 0; i < MATERIAL_COUNT; ++i) {
+      ok = material_create(materialSystemState, kMaterials[i], &materialIds[i]);
+      assert(ok);
+    }
+  }
 
-    u32 indices[kNumIndices] = {
-        0,  1,  2,  1,  3,  2,  //
-        4,  5,  6,  5,  7,  6,  //
-        8,  9,  10, 9,  11, 10, //
-        12, 13, 14, 13, 15, 14, //
-        16, 17, 18, 17, 19, 18, //
-        20, 21, 22, 21, 23, 22, //
+  { // Meshes
+    const VertexAttribute attributes[] = {
+        {0, 3, GL_FLOAT, false, offsetof(Vertex, position)},
+        {1, 3, GL_FLOAT, false, offsetof(Vertex, normal)},
+        {2, 2, GL_FLOAT, false, offsetof(Vertex, texCoord)},
     };
+    auto vertexCount = kNumVertices + (u32)sphereVertices.size();
+    auto indexCount = kNumIndices + (u32)sphereLodIndices.size();
+    auto ok = geometry_pool_create(&geometryPoolState, {attributes, 3, sizeof(Vertex)}, vertexCount,
+                                   indexCount);
+    assert(ok);
+    meshIds[MESH_CUBE] = geometry_pool_add(geometryPoolState, kCubeVertices, kNumVertices,
+                                           kCubeIndices, kNumIndices);
+    // All sphere LODs share its vertices and live one after another in its indices
+    meshIds[MESH_SPHERE] =
+        geometry_pool_add(geometryPoolState, sphereVertices.data(), (u32)sphereVertices.size(),
+                          sphereLodIndices.data(), (u32)sphereLodIndices.size());
+  }
+  init_gpu_culling();
+  if (crowdSize > 0) {
+    if (!material_system_program(materialSystemState, MATERIAL_SHADING_LIT,
+                                 MATERIAL_VERTEX_STAGE_SKINNED)) {
+      LOG_ERROR("error creating the skinned draw program, no characters");
+    } else if (!crowd_initialize(&crowdState, materialSystemState, crowdSize, kCrowdCenter)) {
+      LOG_ERROR("error creating the characters");
+    }
+  }
+  if (particleCapacity > 0) { init_particles(); }
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBOs[EBO_LIGHT]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+// Releases what `init` created, while its context is still current
+void shutdown() {
+  if (particleState) {
+    particle_system_gpu_shutdown(particleState);
+    particle_system_shutdown(&particleState);
+  }
+  if (crowdState) { crowd_shutdown(&crowdState); }
+  if (gpuCullState) { gpu_cull_shutdown(&gpuCullState); }
+  geometry_pool_destroy(&geometryPoolState);
+  material_system_shutdown(&materialSystemState);
+  if (textureStreamerState) { texture_streamer_shutdown(&textureStreamerState); }
+  if (asyncIoState) { async_io_shutdown(&asyncIoState); }
+}
 
-    // Attribute: position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (any)offsetof(Vertex, position));
-    glEnableVertexAttribArray(0);
+// CPU counterparts of the meshes and materials `init` uploads, indexed by MESH_* and MATERIAL_*
+RasterMesh rasterMeshes[MESH_COUNT];
+RasterMaterial rasterMaterialStorage[MATERIAL_COUNT];
+RasterMaterial *rasterMaterials[MATERIAL_COUNT]; // Null for unlit materials, drawn white
+
+void init_software() {
+  for (u32 i = 0; i < MATERIAL_COUNT; ++i) {
+    const auto &desc = kMaterials[i];
+    if (desc.shading != MATERIAL_SHADING_LIT) { continue; }
+    auto &material = rasterMaterialStorage[i];
+    auto ok =
+        raster_texture_create(&material.diffuse, desc.textures[MATERIAL_TEXTURE_DIFFUSE]) &&
+        raster_texture_create(&material.specular, desc.textures[MATERIAL_TEXTURE_SPECULAR]);
+    assert(ok);
+    material.shininess = desc.shininess;
+    rasterMaterials[i] = &material;
+  }
+  rasterMeshes[MESH_CUBE] = {kCubeVertices[0].position, kNumVertices, kCubeIndices, kNumIndices};
+  rasterMeshes[MESH_SPHERE] = {sphereVertices[0].position, (u32)sphereVertices.size(),
+                              sphereLodIndices.data(), (u32)sphereLodIndices.size()};
+  rasterizer_initialize(&rasterizerState, jobSystemState);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+void shutdown_software() {
+  rasterizer_shutdown(&rasterizerState);
+  for (auto material : rasterMaterials) {
+    if (!material) { continue; }
+    raster_texture_destroy(&material->specular);
+    raster_texture_destroy(&material->diffuse);
   }
 }
 
 Camera camera{};
 f32 fov = 60.0f;
+f32 animationTime = 0; // Seconds simulated so far
 
 f32 destPitch = camera.get_pitch();
 f32 destYaw = camera.get_yaw();
@@ -257,12 +559,294 @@ f32 duration = 0.4;
 f32 elapsed = 0;
 
 glm::vec3 lightPosition = {0.25, 0.25, 2};
+const glm::vec3 kContainerPositions[] = {{0, 0, 0}, {0, -6, -3}};
 
 glm::vec3 pointLightPositions[] = {
     {0.7, 0.2, 2.0},
 };
 
-void render(u32 width, u32 height, const f32 *view_matrix) {
+static glm::mat4 lamp_model() {
+  glm::mat4 model(1.0);
+  model = glm::translate(model, lightPosition);
+  model = glm::scale(model, glm::vec3(0.125f));
+  return model;
+}
+
+// World box of the unit cube mesh drawn with `model`
+static BvhBounds cube_bounds(const glm::mat4 &model) {
+  BvhBounds bounds;
+  for (u32 axis = 0; axis < 3; ++axis) {
+    auto extent = 0.5f * (fabsf(model[0][axis]) + fabsf(model[1][axis]) + fabsf(model[2][axis]));
+    bounds.min[axis] = model[3][axis] - extent;
+    bounds.max[axis] = model[3][axis] + extent;
+  }
+  return bounds;
+}
+
+// Indexes everything drawn but the characters, which move, and the particles
+static void build_scene_bvh() {
+  std::vector<BvhBounds> bounds;
+  for (u32 i = 0; i < std::size(kContainerPositions); ++i) {
+    bounds.push_back(cube_bounds(glm::translate(glm::mat4(1.0), kContainerPositions[i])));
+    scenePickables.push_back({"container", i});
+  }
+  bounds.push_back(cube_bounds(lamp_model()));
+  scenePickables.push_back({"lamp", 0});
+  for (u32 i = 0; i < wallModels.size(); ++i) {
+    bounds.push_back(cube_bounds(wallModels[i]));
+    scenePickables.push_back({"wall", i});
+  }
+  for (u32 i = 0; i < sceneObjects.size(); ++i) {
+    const auto &position = sceneObjects[i].position;
+    bounds.push_back({{position.x - kSphereRadius, position.y - kSphereRadius,
+                       position.z - kSphereRadius},
+                      {position.x + kSphereRadius, position.y + kSphereRadius,
+                       position.z + kSphereRadius}});
+    scenePickables.push_back({"sphere", i});
+  }
+  bvh_build(&sceneBvhState, bounds.data(), (u32)bounds.size());
+}
+
+/**
+ * Prints the object whose box is first under a point of the view and how many others are near it
+ * @param x, y the point, from 0 to 1 right and down
+ */
+static void pick_scene_object(const SimulationState &state, f32 aspect, f32 x, f32 y) {
+  auto startTime = Clock::now();
+  auto direction =
+      camera_pose_ray_direction(state.camera, state.fov, aspect, x * 2.0f - 1.0f, 1.0f - y * 2.0f);
+  BvhRay ray{};
+  memcpy(ray.origin, glm::value_ptr(state.camera.position), sizeof(ray.origin));
+  memcpy(ray.direction, glm::value_ptr(direction), sizeof(ray.direction));
+  ray.maxDistance = 100.0f; // The far plane, distances along the ray being depths in the view
+  auto hit = bvh_intersect_ray(sceneBvhState, ray);
+  if (hit.object == BVH_NONE) {
+    LOG_INFO("picked nothing in %.3f ms",
+             std::chrono::duration<f64, std::milli>(Clock::now() - startTime).count());
+    return;
+  }
+  auto point = state.camera.position + direction * hit.distance;
+  std::vector<u32> nearby;
+  bvh_query_sphere(sceneBvhState, glm::value_ptr(point), kPickRadius, &nearby);
+  const auto &pickable = scenePickables[hit.object];
+  LOG_INFO("picked %s %u at depth %.2f in %.3f ms, %zu other objects within %.1f of it",
+           pickable.kind, pickable.index, hit.distance,
+           std::chrono::duration<f64, std::milli>(Clock::now() - startTime).count(),
+           nearby.size() - 1, kPickRadius);
+}
+
+// Occlusion culling and LOD selection of the dense scene on the CPU
+static void cull_dense_scene(u32 height, const SimulationState &state, SceneFrame *frame) {
+  frame->denseScene = {
+      frame_arena_allocate_array<SceneDraw>(wallModels.size() + sceneObjects.size()), 0};
+  if (occlusionState) {
+    auto viewProjection = frame->projection * frame->view;
+    occlusion_begin_frame(occlusionState, glm::value_ptr(viewProjection));
+  }
+  for (const auto &model : wallModels) {
+    frame->denseScene.push({MESH_CUBE, MATERIAL_CONTAINER, 0, kNumIndices, model});
+  }
+  for (auto &object : sceneObjects) {
+    if (occlusionState) {
+      auto boundsMin = object.position - glm::vec3(kSphereRadius);
+      auto boundsMax = object.position + glm::vec3(kSphereRadius);
+      if (!occlusion_test_aabb(occlusionState, glm::value_ptr(boundsMin),
+                               glm::value_ptr(boundsMax))) {
+        continue;
+      }
+    }
+    if (lodEnabled) {
+      auto distance = glm::length(object.position - state.camera.position) - kSphereRadius;
+      object.lod = lod_select(&sphereLods, object.lod, distance, state.fov, height, kLodThreshold);
+    }
+    const auto &lod = sphereLods.lods[object.lod];
+    auto model = glm::translate(glm::mat4(1.0), object.position);
+    frame->denseScene.push(
+        {MESH_SPHERE, MATERIAL_CONTAINER, lod.indexOffset, lod.indexCount, model});
+  }
+  if (occlusionState) {
+    auto stats = occlusion_get_stats(occlusionState);
+    testedObjects += stats.tested;
+    culledObjects += stats.culled;
+  }
+}
+
+// Camera, lights and the draws that survive occlusion culling, with their LODs picked
+static void build_scene_frame(u32 width, u32 height, const SimulationState &state,
+                              SceneFrame *frame) {
+  frame->view = camera_pose_view_matrix(state.camera);
+  frame->projection =
+      glm::perspective(glm::radians(state.fov), (f32)width / (f32)height, 0.1f, 100.0f);
+
+  auto &lighting = frame->lighting;
+  lighting.viewPosition = state.camera.position;
+  lighting.directionalLight = {{-0.2f, -1.0f, -0.3f}, glm::vec3(0.05f), glm::vec3(0.4f),
+                               glm::vec3(0.5f)};
+  lighting.pointLight = {pointLightPositions[0], 1.0f,           0.09f,          0.032f,
+                         glm::vec3(0.05f),       glm::vec3(0.8f), glm::vec3(1.0f)};
+  lighting.spotLight.position = state.camera.position;
+  lighting.spotLight.direction = camera_pose_front(state.camera);
+  lighting.spotLight.cutOff = glm::cos(glm::radians(10.0f));
+  lighting.spotLight.outerCutOff = glm::cos(glm::radians(15.0f));
+  lighting.spotLight.constant = 1.0f;
+  lighting.spotLight.linear = 0.09f;
+  lighting.spotLight.quadratic = 0.032f;
+  lighting.spotLight.ambient = glm::vec3(0.0f);
+  lighting.spotLight.diffuse = glm::vec3(1.0f);
+  lighting.spotLight.specular = glm::vec3(1.0f);
+
+  frame->objects = {frame_arena_allocate_array<SceneDraw>(std::size(kContainerPositions)), 0};
+  frame->denseScene = {};
+  frame->lamps = {frame_arena_allocate_array<SceneDraw>(1), 0};
+
+  for (const auto &position : kContainerPositions) {
+    frame->objects.push({MESH_CUBE, MATERIAL_CONTAINER, 0, kNumIndices,
+                         glm::translate(glm::mat4(1.0), position)});
+  }
+
+  if (!gpuCullState) { cull_dense_scene(height, state, frame); } // Else the GPU does it
+
+  frame->lamps.push({MESH_CUBE, MATERIAL_LAMP, 0, kNumIndices, lamp_model()});
+
+  for (const auto *draws : {&frame->objects, &frame->denseScene, &frame->lamps}) {
+    for (const auto &draw : *draws) {
+      renderedTriangles += draw.indexCount / 3;
+    }
+  }
+  ++renderedFrames;
+}
+
+static void program_set_lighting(GLuint program, const Lighting &lighting) {
+  program_set_vec3(program, "viewPosition", glm::value_ptr(lighting.viewPosition));
+
+  // directional light
+  const auto &directional = lighting.directionalLight;
+  program_set_vec3(program, "directionalLight.direction", glm::value_ptr(directional.direction));
+  program_set_vec3(program, "directionalLight.ambient", glm::value_ptr(directional.ambient));
+  program_set_vec3(program, "directionalLight.diffuse", glm::value_ptr(directional.diffuse));
+  program_set_vec3(program, "directionalLight.specular", glm::value_ptr(directional.specular));
+
+  // point light 1
+  const auto &point = lighting.pointLight;
+  program_set_vec3(program, "pointLights[0].position", glm::value_ptr(point.position));
+  program_set_vec3(program, "pointLights[0].ambient", glm::value_ptr(point.ambient));
+  program_set_vec3(program, "pointLights[0].diffuse", glm::value_ptr(point.diffuse));
+  program_set_vec3(program, "pointLights[0].specular", glm::value_ptr(point.specular));
+  program_set_f32(program, "pointLights[0].constant", point.constant);
+  program_set_f32(program, "pointLights[0].linear", point.linear);
+  program_set_f32(program, "pointLights[0].quadratic", point.quadratic);
+
+  // spotlight
+  const auto &spot = lighting.spotLight;
+  program_set_vec3(program, "spotLight.position", glm::value_ptr(spot.position));
+  program_set_vec3(program, "spotLight.direction", glm::value_ptr(spot.direction));
+  program_set_vec3(program, "spotLight.ambient", glm::value_ptr(spot.ambient));
+  program_set_vec3(program, "spotLight.diffuse", glm::value_ptr(spot.diffuse));
+  program_set_vec3(program, "spotLight.specular", glm::value_ptr(spot.specular));
+  program_set_f32(program, "spotLight.constant", spot.constant);
+  program_set_f32(program, "spotLight.linear", spot.linear);
+  program_set_f32(program, "spotLight.quadratic", spot.quadratic);
+  program_set_f32(program, "spotLight.cutOff", spot.cutOff);
+  program_set_f32(program, "spotLight.outerCutOff", spot.outerCutOff);
+}
+
+// Per-frame uniforms of a shading's program, which must be in use
+static void program_set_scene(GLuint program, MaterialShading shading,
+                              const SceneFrame &sceneFrame) {
+  if (shading == MATERIAL_SHADING_LIT) { program_set_lighting(program, sceneFrame.lighting); }
+  program_set_mat4f(program, "view", glm::value_ptr(sceneFrame.view));
+  program_set_mat4f(program, "projection", glm::value_ptr(sceneFrame.projection));
+}
+
+// Expects the geometry pool to be bound, and the program of the draws' shading in use
+static void draw_scene_list(GLuint program, const SceneDrawList &draws) {
+  u32 boundMaterial = MATERIAL_COUNT;
+  for (const auto &draw : draws) {
+    if (draw.material != boundMaterial) {
+      boundMaterial = draw.material;
+      material_bind(materialSystemState, materialIds[boundMaterial]);
+    }
+    program_set_mat4f(program, "model", glm::value_ptr(draw.model));
+    geometry_pool_draw(geometryPoolState, meshIds[draw.mesh], draw.indexOffset, draw.indexCount);
+  }
+}
+
+// Length in the world of one unit of texture coordinates on each mesh, along the direction the
+// texture is densest in, and the radius of the mesh's bounds
+const f32 kMeshUvLength[MESH_COUNT] = {1.0f, 0.5f * PI * kSphereRadius};
+const f32 kMeshRadius[MESH_COUNT] = {0.87f, kSphereRadius};
+
+// Screen pixels one unit of texture coordinates spans on a draw, where it is nearest the camera
+static f32 draw_pixels_per_uv(u32 height, const SimulationState &state, u32 mesh,
+                              const glm::mat4 &model) {
+  auto minScale = FLT_MAX, maxScale = 0.0f;
+  for (u32 axis = 0; axis < 3; ++axis) {
+    auto scale = glm::length(glm::vec3(model[axis]));
+    minScale = std::min(minScale, scale);
+    maxScale = std::max(maxScale, scale);
+  }
+  auto distance = glm::length(glm::vec3(model[3]) - state.camera.position);
+  distance = std::max(distance - kMeshRadius[mesh] * maxScale, 0.1f); // No closer than near plane
+  auto pixelsPerUnit = (f32)height / (2.0f * tanf(glm::radians(state.fov) * 0.5f) * distance);
+  return pixelsPerUnit * kMeshUvLength[mesh] * minScale;
+}
+
+// Tells the texture streamer the detail the lit draws of the frame need of their materials
+static void request_texture_detail(u32 height, const SimulationState &state,
+                                   const SceneFrame &sceneFrame) {
+  f32 pixelsPerUv[MATERIAL_COUNT] = {};
+  auto request = [&](u32 mesh, u32 material, const glm::mat4 &model) {
+    pixelsPerUv[material] =
+        std::max(pixelsPerUv[material], draw_pixels_per_uv(height, state, mesh, model));
+  };
+  for (const auto *draws : {&sceneFrame.objects, &sceneFrame.denseScene}) {
+    for (const auto &draw : *draws) {
+      request(draw.mesh, draw.material, draw.model);
+    }
+  }
+  if (gpuCullState) { // Only the GPU knows which objects of the dense scene it draws
+    for (const auto &model : wallModels) {
+      request(MESH_CUBE, MATERIAL_CONTAINER, model);
+    }
+    for (const auto &object : sceneObjects) {
+      request(MESH_SPHERE, MATERIAL_CONTAINER, glm::translate(glm::mat4(1.0), object.position));
+    }
+  }
+  for (u32 i = 0; i < MATERIAL_COUNT; ++i) {
+    if (pixelsPerUv[i] > 0.0f) {
+      material_request_detail(materialSystemState, materialIds[i], pixelsPerUv[i]);
+    }
+  }
+}
+
+// The CPU work of a frame and the uploads it feeds, run before the scene pass so that its GPU
+// timing, which drives the resolution scale, only covers the draws
+static void prepare_frame(u32 width, u32 height, const SimulationState &state,
+                          SceneFrame *sceneFrame) {
+  build_scene_frame(width, height, state, sceneFrame);
+  if (textureStreamerState) { // Streams for the previous frame's requests, then makes this one's
+    texture_streamer_update(textureStreamerState);
+    request_texture_detail(height, state, *sceneFrame);
+  }
+  if (crowdState) {
+    crowd_update(crowdState, jobSystemState, state.time);
+    CrowdStats stats{};
+    crowd_get_stats(crowdState, &stats);
+    animationMs += stats.updateMs;
+    renderedTriangles += stats.triangles;
+  }
+  if (particleState) { // Frames may repeat or rewind a time, the particles only go forward
+    particle_system_update(particleState, jobSystemState,
+                           std::clamp(state.time - particleTime, 0.0f, 0.1f));
+    particleTime = state.time;
+    particle_system_upload(particleState);
+    ParticleStats stats{};
+    particle_system_get_stats(particleState, &stats);
+    particleMs += stats.updateMs;
+  }
+}
+
+void render(u32 width, u32 height, const SimulationState &state, const SceneFrame &sceneFrame) {
   glViewport(0, 0, width, height);
   glEnable(GL_CULL_FACE);
   glFrontFace(GL_CCW);
@@ -270,89 +854,351 @@ void render(u32 width, u32 height, const f32 *view_matrix) {
   glEnable(GL_DEPTH_TEST);
   glClearColor(0.25, 0.25, 0.25, 1.0);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  geometry_pool_bind(geometryPoolState); // Every draw of the frame reads from the pool
+
+  if (gpuCullState) { // Cull before any draw, so the GPU can overlap it with the first ones
+    PROFILE_GPU_ZONE("gpu/cull");
+    GpuCullView view{};
+    auto viewProjection = sceneFrame.projection * sceneFrame.view;
+    memcpy(view.viewProjection, glm::value_ptr(viewProjection), sizeof(view.viewProjection));
+    memcpy(view.cameraPosition, glm::value_ptr(sceneFrame.lighting.viewPosition),
+           sizeof(view.cameraPosition));
+    view.fov = state.fov;
+    view.viewportHeight = height;
+    view.lodThreshold = lodEnabled ? kLodThreshold : 0.0f;
+    gpu_cull_dispatch(gpuCullState, view);
+  }
 
-  // Render the cube
+  // Render the cubes
+  auto litProgram = material_system_program(materialSystemState, MATERIAL_SHADING_LIT);
+  program_use(litProgram);
+  program_set_scene(litProgram, MATERIAL_SHADING_LIT, sceneFrame);
+  draw_scene_list(litProgram, sceneFrame.objects);
+
+  if (!sceneObjects.empty()) { // Render the dense scene
+    PROFILE_GPU_ZONE("gpu/dense_scene");
+    if (gpuCullState) {
+      auto program = material_system_program(materialSystemState, MATERIAL_SHADING_LIT,
+                                             MATERIAL_VERTEX_STAGE_INDIRECT);
+      program_use(program);
+      program_set_scene(program, MATERIAL_SHADING_LIT, sceneFrame);
+      material_bind(materialSystemState, materialIds[MATERIAL_CONTAINER]); // Of every object
+      gpu_cull_draw(gpuCullState);
+      GpuCullStats stats{};
+      gpu_cull_get_stats(gpuCullState, &stats);
+      renderedTriangles += stats.visibleTriangles;
+      testedObjects += stats.objects;
+      culledObjects += stats.objects - stats.visibleObjects;
+    } else {
+      draw_scene_list(litProgram, sceneFrame.denseScene);
+    }
+  }
 
-  // Active shader programs before setting uniforms
-  program_use(lightingProgram);
+  { // Render the lamp
+    PROFILE_GPU_ZONE("gpu/lamp");
+    auto program = material_system_program(materialSystemState, MATERIAL_SHADING_UNLIT);
+    program_use(program);
+    program_set_scene(program, MATERIAL_SHADING_UNLIT, sceneFrame);
+    draw_scene_list(program, sceneFrame.lamps);
+  }
 
-  // directional light
-  program_set_vec3(lightingProgram, "directionalLight.direction", -0.2f, -1.0f, -0.3f);
-  program_set_vec3(lightingProgram, "directionalLight.ambient", 0.05, 0.05, 0.05);
-  program_set_vec3(lightingProgram, "directionalLight.diffuse", 0.4, 0.4, 0.4);
-  program_set_vec3(lightingProgram, "directionalLight.specular", 0.5, 0.5, 0.5);
+  if (crowdState) { // Render the characters, from a geometry pool of their own
+    PROFILE_GPU_ZONE("gpu/crowd");
+    auto program = material_system_program(materialSystemState, MATERIAL_SHADING_LIT,
+                                           MATERIAL_VERTEX_STAGE_SKINNED);
+    program_use(program);
+    program_set_scene(program, MATERIAL_SHADING_LIT, sceneFrame);
+    crowd_draw(crowdState, program);
+  }
 
-  // point light 1
-  program_set_vec3(lightingProgram, "pointLights[0].position",
-                   glm::value_ptr(pointLightPositions[0]));
-  program_set_vec3(lightingProgram, "pointLights[0].ambient", 0.05, 0.05, 0.05);
-  program_set_vec3(lightingProgram, "pointLights[0].diffuse", 0.8, 0.8, 0.8);
-  program_set_vec3(lightingProgram, "pointLights[0].specular", 1.0, 1.0, 1.0);
-  program_set_f32(lightingProgram, "pointLights[0].constant", 1.0);
-  program_set_f32(lightingProgram, "pointLights[0].linear", 0.09);
-  program_set_f32(lightingProgram, "pointLights[0].quadratic", 0.032);
+  if (particleState) { // Render the particles last, added onto the scene without writing depth
+    PROFILE_GPU_ZONE("gpu/particles");
+    auto program = material_system_program(materialSystemState, MATERIAL_SHADING_PARTICLE);
+    program_use(program);
+    program_set_scene(program, MATERIAL_SHADING_PARTICLE, sceneFrame);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glDepthMask(GL_FALSE);
+    for (auto material : {MATERIAL_SPARK, MATERIAL_EMBER}) {
+      material_bind(materialSystemState, materialIds[material]);
+      particle_system_draw(particleState, material);
+    }
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+  }
+}
 
-  // spotlight
-  program_set_vec3(lightingProgram, "spotLight.position", glm::value_ptr(camera.get_position()));
-  program_set_vec3(lightingProgram, "spotLight.direction", glm::value_ptr(camera.get_front()));
-  program_set_vec3(lightingProgram, "spotLight.ambient", 0.0f, 0.0f, 0.0f);
-  program_set_vec3(lightingProgram, "spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-  program_set_vec3(lightingProgram, "spotLight.specular", 1.0f, 1.0f, 1.0f);
-  program_set_f32(lightingProgram, "spotLight.constant", 1.0f);
-  program_set_f32(lightingProgram, "spotLight.linear", 0.09f);
-  program_set_f32(lightingProgram, "spotLight.quadratic", 0.032f);
-  program_set_f32(lightingProgram, "spotLight.cutOff", glm::cos(glm::radians(10.0f)));
-  program_set_f32(lightingProgram, "spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
+// The same frame as `render`, drawn on the CPU into the software renderer's framebuffer
+void render_software(u32 width, u32 height, const SimulationState &state) {
+  SceneFrame sceneFrame{};
+  build_scene_frame(width, height, state, &sceneFrame);
+  rasterizer_begin_frame(rasterizerState, width, height, glm::vec3(0.25f), sceneFrame.view,
+                         sceneFrame.projection, sceneFrame.lighting);
+  for (const auto *draws : {&sceneFrame.objects, &sceneFrame.denseScene, &sceneFrame.lamps}) {
+    for (const auto &draw : *draws) {
+      rasterizer_draw(rasterizerState, &rasterMeshes[draw.mesh], draw.indexOffset, draw.indexCount,
+                      draw.model, rasterMaterials[draw.material]);
+    }
+  }
+  rasterizer_end_frame(rasterizerState);
+}
 
-  // Material properties
-  program_set_f32(lightingProgram, "material.shininess", 32.0);
-  program_set_i32(lightingProgram, "material.diffuse", 0);
-  texture_bind(diffuse_map, 0);
-  program_set_i32(lightingProgram, "material.specular", 1);
-  texture_bind(specular_map, 1);
+struct ScenePass {
+  const SimulationState *state;
+  void *frameStatsState;
+  u64 frameNumber;
+  u32 width;
+  u32 height;
+  SceneFrame sceneFrame;
+};
 
-  program_set_mat4f(lightingProgram, "view", view_matrix);
+static void scene_pass(void *graphState, void *userData) {
+  auto pass = (ScenePass *)userData;
+  frame_stats_gpu_begin(pass->frameStatsState, pass->frameNumber);
+  render(pass->width, pass->height, *pass->state, pass->sceneFrame);
+  frame_stats_gpu_end(pass->frameStatsState);
+}
 
-  glm::mat4 projection(1.0);
-  projection = glm::perspective(glm::radians(fov), (f32)width / (f32)height, 0.1f, 100.0f);
+struct OverlayPass {
+  void *overlayState;
+  void *frameStatsState;
+  u32 width;
+  u32 height;
+};
 
-  program_set_mat4f(lightingProgram, "projection", glm::value_ptr(projection));
+static void overlay_pass(void *graphState, void *userData) {
+  auto pass = (OverlayPass *)userData;
+  overlay_draw_frame_graph(pass->overlayState, pass->frameStatsState, pass->width, pass->height,
+                           kFrameBudget);
+}
 
-  {
-    glm::mat4 model(1.0);
-    program_set_mat4f(lightingProgram, "model", glm::value_ptr(model));
+// Records and runs the passes of a frame presented at `width` x `height` into the bound
+// framebuffer; `overlayState` is null when the overlay is hidden
+static void render_frame(void *graphState, void *resolutionState, void *frameStatsState,
+                         void *overlayState, u32 width, u32 height, u64 frameNumber,
+                         const SimulationState &state) {
+  render_graph_begin(graphState);
+  GLint framebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+  auto output = render_graph_import(graphState, "output", framebuffer, width, height);
+
+  ScenePass scene{&state, frameStatsState, frameNumber};
+  auto upscaled =
+      resolution_begin_frame(resolutionState, width, height, &scene.width, &scene.height);
+  prepare_frame(scene.width, scene.height, state, &scene.sceneFrame);
+  auto scenePass = render_graph_add_pass(graphState, "scene", scene_pass, &scene);
+  if (upscaled) {
+    auto color = render_graph_create_texture(graphState, "scene_color",
+                                             {scene.width, scene.height, GL_RGBA8});
+    auto depth = render_graph_create_texture(graphState, "scene_depth",
+                                             {scene.width, scene.height, GL_DEPTH_COMPONENT24});
+    render_graph_write(graphState, scenePass, color);
+    render_graph_write(graphState, scenePass, depth);
+    resolution_add_upscale_pass(resolutionState, graphState, color, output);
+  } else {
+    render_graph_write(graphState, scenePass, output);
+  }
+  OverlayPass overlay{overlayState, frameStatsState, width, height};
+  if (overlayState) {
+    auto overlayPass = render_graph_add_pass(graphState, "overlay", overlay_pass, &overlay);
+    render_graph_write(graphState, overlayPass, output);
+  }
+  render_graph_execute(graphState);
+}
 
-    glBindVertexArray(VAOs[VAO_CUBE]);
-    glDrawElements(GL_TRIANGLES, kNumIndices, GL_UNSIGNED_INT, nullptr);
+static void print_render_summary() {
+  printf("rendered %.0f triangles per frame on average (lod %s)\n",
+         (f64)renderedTriangles / (f64)renderedFrames, lodEnabled ? "on" : "off");
+  if (gpuCullingActive || occlusionState) {
+    printf("%s culled %.0f of %.0f objects per frame on average\n",
+           gpuCullingActive ? "gpu frustum" : "occlusion", (f64)culledObjects / (f64)renderedFrames,
+           (f64)testedObjects / (f64)renderedFrames);
   }
+  if (crowdState) {
+    CrowdStats stats{};
+    crowd_get_stats(crowdState, &stats);
+    printf("animated %u characters of %u joints in %.3f ms per frame on average\n",
+           stats.characters, stats.joints, animationMs / (f64)renderedFrames);
+  }
+  if (particleState) {
+    ParticleStats stats{};
+    particle_system_get_stats(particleState, &stats);
+    printf("simulated %u particles of %u emitters in %.3f ms per frame on average\n",
+           stats.particles, stats.emitters, particleMs / (f64)renderedFrames);
+  }
+  if (textureStreamerState) {
+    TextureStreamerStats stats{};
+    texture_streamer_get_stats(textureStreamerState, &stats);
+    printf("streamed %u textures in %.1f of %.1f MiB, %u loads, %u levels evicted\n",
+           stats.textures, (f64)stats.residentBytes / MiB, (f64)stats.budgetBytes / MiB,
+           stats.loads, stats.evictions);
+  }
+}
 
-  {
-    glm::mat4 model(1.0);
-    model = glm::translate(model, {0, -6, -3});
-    program_set_mat4f(lightingProgram, "model", glm::value_ptr(model));
+// Wakes the main thread from SDL_WaitEventTimeout, callable from any thread
+static void engine_wakeup(Context *context, WakeupCode code) {
+  SDL_Event event{};
+  event.type = context->wakeupEventType;
+  event.user.code = code;
+  SDL_PushEvent(&event);
+}
 
-    glBindVertexArray(VAOs[VAO_CUBE]);
-    glDrawElements(GL_TRIANGLES, kNumIndices, GL_UNSIGNED_INT, nullptr);
-  }
+// Advances the camera by one update; everything it reads comes from the arguments and the camera
+// globals, so the same inputs and ticks reproduce the same frames
+static void simulate(const InputSnapshot *input, const InputSnapshot *previousInput, f32 tick) {
+  PROFILE_ZONE("update/simulate");
+  animationTime += tick;
+  // Reset camera's transform
+  if (input_snapshot_key_down(input, SDL_SCANCODE_SPACE)) {
+    camera.reset();
+    fov = 60.0f;
+    destPitch = 0.0f;
+    destYaw = 0.0f;
+  } else {
+    // Camera rotation
+
+    // Wheel travel accumulated since the previous update
+    auto ix = (i32)(input->wheelX - previousInput->wheelX);
+    auto iy = (i32)(input->wheelY - previousInput->wheelY);
+    auto fx = (f32)(input->preciseWheelX - previousInput->preciseWheelX);
+    auto fy = (f32)(input->preciseWheelY - previousInput->preciseWheelY);
+
+    f32 deltaPitch = 0, deltaYaw = 0;
+
+    /**
+     * Calculate destination rotation;
+     * Lerp from current rotation to the destination rotation
+     */
+
+    if (ix != 0 || iy != 0) {
+      f32 wheel_sensitivity = 180.0f;
+      deltaPitch = fy * tick * wheel_sensitivity;
+      deltaYaw = -fx * tick * wheel_sensitivity;
+
+      destPitch += deltaPitch;
+      destYaw += deltaYaw;
+      elapsed = tick;
+    } else {
+      bool pressed = false;
+      if (input_snapshot_key_down(input, SDL_SCANCODE_UP)) {
+        deltaPitch += camera.get_rotation_speed() * tick;
+        pressed = true;
+      }
+      if (input_snapshot_key_down(input, SDL_SCANCODE_DOWN)) {
+        deltaPitch -= camera.get_rotation_speed() * tick;
+        pressed = true;
+      }
+      if (input_snapshot_key_down(input, SDL_SCANCODE_LEFT)) {
+        deltaYaw += camera.get_rotation_speed() * tick;
+        pressed = true;
+      }
+      if (input_snapshot_key_down(input, SDL_SCANCODE_RIGHT)) {
+        deltaYaw -= camera.get_rotation_speed() * tick;
+        pressed = true;
+      }
 
-  { // Render the lamp
-    program_use(lightCubeProgram);
-    program_set_mat4f(lightCubeProgram, "view", view_matrix);
-    program_set_mat4f(lightCubeProgram, "projection", glm::value_ptr(projection));
+      if (pressed) {
+        destPitch += deltaPitch;
+        destYaw += deltaYaw;
+        elapsed = tick;
+      }
+    }
+
+    // Simply jump to the destination
+    // camera.rotate_to(camera.get_pitch() + deltaPitch, camera.get_yaw() + deltaYaw);
+
+    // Or using lerp
+    f32 currentPitch = camera.get_pitch();
+    f32 currentYaw = camera.get_yaw();
+
+    // Check current and destination values not the duration
+    if (fabs(currentPitch - destPitch) > 0.0001f || fabs(currentYaw - destYaw) > 0.0001f) {
+      elapsed += tick * 1.6f;
+      f32 pitch = lerp(currentPitch, destPitch, ease_out_sine(elapsed));
+      f32 yaw = lerp(currentYaw, destYaw, ease_out_sine(elapsed));
+      // Or linear
+      // f32 pitch = lerp(currentPitch, destPitch, elapsed / duration);
+      // f32 yaw = lerp(currentYaw, destYaw, elapsed / duration);
+      camera.rotate_to(pitch, yaw);
+    }
 
-    glm::mat4 model(1.0);
-    model = glm::translate(model, lightPosition);
-    model = glm::scale(model, glm::vec3(0.125f));
-    program_set_mat4f(lightCubeProgram, "model", glm::value_ptr(model));
+    // Camera movement
+    glm::vec3 offset{};
+    if (input_snapshot_key_down(input, SDL_SCANCODE_W)) {
+      offset += camera.get_movement_speed() * tick * camera.get_front();
+    }
+    if (input_snapshot_key_down(input, SDL_SCANCODE_S)) {
+      offset += camera.get_movement_speed() * tick * camera.get_back();
+    }
+    if (input_snapshot_key_down(input, SDL_SCANCODE_A)) {
+      offset += camera.get_movement_speed() * tick * camera.get_left();
+    }
+    if (input_snapshot_key_down(input, SDL_SCANCODE_D)) {
+      offset += camera.get_movement_speed() * tick * camera.get_right();
+    }
+    if (input_snapshot_key_down(input, SDL_SCANCODE_Q)) {
+      offset += camera.get_movement_speed() * tick * camera.get_up();
+    }
+    if (input_snapshot_key_down(input, SDL_SCANCODE_E)) {
+      offset += camera.get_movement_speed() * tick * camera.get_down();
+    }
 
-    glBindVertexArray(VAOs[VAO_LIGHT]);
-    glDrawElements(GL_TRIANGLES, kNumIndices, GL_UNSIGNED_INT, nullptr);
+    camera.move(offset);
   }
 }
 
+// Rolling frame-interval percentiles in the title bar, main thread only
+static void update_window_title(Context *context) {
+  FrameStatsReport report{};
+  frame_stats_report(context->frameStatsState, false, &report);
+  const auto &interval = report.stats[FRAME_STAT_INTERVAL];
+  const auto &gpu = report.stats[FRAME_STAT_GPU];
+  char title[192];
+  snprintf(title, sizeof(title),
+           "neon | frame p50 %.1f p95 %.1f p99 %.1f max %.1f ms | gpu p95 %.1f ms | %llu hitches"
+           " | scale %.0f%%",
+           interval.p50, interval.p95, interval.p99, interval.max, gpu.p95,
+           (unsigned long long)report.hitches,
+           resolution_get_scale(context->resolutionState) * 100.0f);
+  SDL_SetWindowTitle(context->window, title);
+}
+
+static SimulationState capture_simulation_state() {
+  return {camera.get_pose(), fov, animationTime};
+}
+
+// Shows the simulation one step in the past, blending the two states around that moment
+static SimulationState interpolate_simulation(const SimulationFrame &simulation) {
+  auto sinceStep = std::chrono::duration<f64>(Clock::now() - simulation.time).count();
+  auto alpha = std::clamp(sinceStep / simulationStep, 0.0, 1.0);
+  SimulationState state{};
+  state.camera =
+      camera_pose_interpolate(simulation.previous.camera, simulation.current.camera, (f32)alpha);
+  state.fov = lerp(simulation.previous.fov, simulation.current.fov, (f32)alpha);
+  state.time = lerp(simulation.previous.time, simulation.current.time, (f32)alpha);
+  return state;
+}
+
+// Puts the time of the steps a frame is the first to draw in its CSV row, the steps themselves
+// being numbered apart from the frames
+static void record_update_time(void *frameStatsState, u64 frameNumber,
+                               const SimulationFrame &simulation, SimulationFrame *drawn) {
+  if (simulation.step == drawn->step) { return; }
+  frame_stats_record_csv(frameStatsState, frameNumber, FRAME_STAT_UPDATE,
+                         simulation.updateMs - drawn->updateMs);
+  drawn->step = simulation.step;
+  drawn->updateMs = simulation.updateMs;
+}
+
 void *update_thread_main(void *args) {
   auto context = (Context *)args;
-  auto time = Clock::now();
+  profiler_set_thread_name("update");
+  auto step = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<f64>(simulationStep));
+  auto simulationTime = Clock::now(); // End of the last step, in wall time
+  InputSnapshot previousInput{}; // Snapshot seen by the previous step, to turn totals into deltas
+  u64 stepNumber = 0;
+  f64 updateMs = 0.0;
   bool quit = false;
   while (!quit) {
     Message message;
@@ -363,146 +1209,70 @@ void *update_thread_main(void *args) {
     switch (message.type) {
     case MESSAGE_TYPE_QUIT: quit = true; break;
     case MESSAGE_TYPE_UPDATE: {
-      auto startTime = Clock::now();
-      auto deltaTime =
-          std::chrono::duration_cast<std::chrono::microseconds>(startTime - time).count();
-      time = startTime;
-
-      auto frameIndex = message.u32[0];
-      // printf("[UpdateThread] update frame #%d, delta time %lld microseconds\n", frameIndex,
-      //        deltaTime);
-
-      auto tick = deltaTime * 0.001f * 0.001f; // Seconds
-
-      // Do some updates
+      PROFILE_ZONE("update");
+      auto now = Clock::now();
+      if (now - simulationTime > step * kMaxSimulationSteps) {
+        simulationTime = now - step * kMaxSimulationSteps; // Drop the time we cannot catch up on
+      }
 
-      {
-        // Reset camera's transform
-        if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_SPACE)) {
-          camera.reset();
-          fov = 60.0f;
-          destPitch = 0.0f;
-          destYaw = 0.0f;
-        } else {
-          // Camera rotation
-
-          i32 ix = 0, iy = 0;
-          f32 fx = 0, fy = 0;
-          input_get_mouse_wheel(context->inputSystemState, &ix, &iy, &fx, &fy);
-
-          f32 deltaPitch = 0, deltaYaw = 0;
-
-          /**
-           * Calculate destination rotation;
-           * Lerp from current rotation to the destination rotation
-           */
-
-          if (ix != 0 || iy != 0) {
-            f32 wheel_sensitivity = 180.0f;
-            deltaPitch = fy * tick * wheel_sensitivity;
-            deltaYaw = -fx * tick * wheel_sensitivity;
-
-            destPitch += deltaPitch;
-            destYaw += deltaYaw;
-            elapsed = tick;
+      auto input = input_acquire_snapshot(context->inputSystemState);
+      auto previous = capture_simulation_state();
+      auto replayFinished = false;
+      u32 steps = 0;
+      while (simulationTime + step <= now) {
+        auto startTime = Clock::now();
+        auto tick = (f32)simulationStep;
+        InputSnapshot replayed;
+        auto stepInput = input;
+        if (context->replayState) {
+          if (replay_get_mode(context->replayState) == REPLAY_MODE_RECORD) {
+            replay_write_frame(context->replayState, tick, input);
+          } else if (replay_read_frame(context->replayState, &tick, &replayed)) {
+            stepInput = &replayed;
           } else {
-            bool pressed = false;
-            if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_UP)) {
-              deltaPitch += camera.get_rotation_speed() * tick;
-              pressed = true;
-            }
-            if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_DOWN)) {
-              deltaPitch -= camera.get_rotation_speed() * tick;
-              pressed = true;
-            }
-            if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_LEFT)) {
-              deltaYaw += camera.get_rotation_speed() * tick;
-              pressed = true;
-            }
-            if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_RIGHT)) {
-              deltaYaw -= camera.get_rotation_speed() * tick;
-              pressed = true;
-            }
-
-            if (pressed) {
-              destPitch += deltaPitch;
-              destYaw += deltaYaw;
-              elapsed = tick;
-            }
-          }
-
-          // Simply jump to the destination
-          // camera.rotate_to(camera.get_pitch() + deltaPitch, camera.get_yaw() + deltaYaw);
-
-          // Or using lerp
-          f32 currentPitch = camera.get_pitch();
-          f32 currentYaw = camera.get_yaw();
-
-          // Check current and destination values not the duration
-          if (fabs(currentPitch - destPitch) > 0.0001f || fabs(currentYaw - destYaw) > 0.0001f) {
-            elapsed += tick * 1.6f;
-            f32 pitch = lerp(currentPitch, destPitch, ease_out_sine(elapsed));
-            f32 yaw = lerp(currentYaw, destYaw, ease_out_sine(elapsed));
-            // Or linear
-            // f32 pitch = lerp(currentPitch, destPitch, elapsed / duration);
-            // f32 yaw = lerp(currentYaw, destYaw, elapsed / duration);
-            camera.rotate_to(pitch, yaw);
-          }
-
-          // Camera movement
-          glm::vec3 offset{};
-          if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_W)) {
-            offset += camera.get_movement_speed() * tick * camera.get_front();
-          }
-          if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_S)) {
-            offset += camera.get_movement_speed() * tick * camera.get_back();
-          }
-          if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_A)) {
-            offset += camera.get_movement_speed() * tick * camera.get_left();
-          }
-          if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_D)) {
-            offset += camera.get_movement_speed() * tick * camera.get_right();
-          }
-          if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_Q)) {
-            offset += camera.get_movement_speed() * tick * camera.get_up();
+            replayFinished = true;
+            break;
           }
-          if (input_is_key_down(context->inputSystemState, SDL_SCANCODE_E)) {
-            offset += camera.get_movement_speed() * tick * camera.get_down();
-          }
-
-          camera.move(offset);
         }
 
-        //
+        previous = capture_simulation_state();
+        simulate(stepInput, &previousInput, tick);
+        previousInput = *stepInput;
+        simulationTime += step;
+        ++steps;
+        auto stepTime = std::chrono::duration<f64, std::milli>(Clock::now() - startTime);
+        ++stepNumber;
+        updateMs += stepTime.count();
+        frame_stats_record(context->frameStatsState, FRAME_STATS_NO_FRAME, FRAME_STAT_UPDATE,
+                           stepTime.count());
       }
 
-      Message outgoing{
-          .type = MESSAGE_TYPE_RENDER,
-          .u32[0] = frameIndex,
-      };
-
-      auto view = camera.get_view_matrix();
-      memcpy(outgoing.f32, glm::value_ptr(view), sizeof(f32) * 16);
-
-      context->renderThreadMessageQueue->push(outgoing); // Issue render commands
+      if (steps > 0) { // Hand the last two states to the renderer
+        auto &frame = context->simulation.back();
+        frame.previous = previous;
+        frame.current = capture_simulation_state();
+        frame.time = simulationTime;
+        frame.step = stepNumber;
+        frame.updateMs = updateMs;
+        context->simulation.publish();
+        engine_wakeup(context, WAKEUP_CODE_TICK);
+      }
 
-      if (frameIndex > 0) { // Wait for previous frame to be presented
-        // printf("[UpdateThread] frame #%d is waiting for frame #%d to be presented\n", frameIndex,
-        //        frameIndex - 1);
-        auto &frame = frames[frameIndex - 1];
-        std::unique_lock<std::mutex> lock(frame.mutex);
-        frame.condition.wait(lock, [&]() { return frame.state == FRAME_STATE_PRESENTED; });
+      if (replayFinished) {
+        LOG_INFO("replay finished");
+        event_post(context->eventSystemState, EVENT_CODE_QUIT, nullptr, {});
+        engine_wakeup(context, WAKEUP_CODE_NONE);
+        break; // No further updates, the quit message follows
       }
 
-      auto cost =
-          std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - startTime).count();
-      auto lifespan = (u64)(1 / 60.0f * 1e9); // Nanoseconds
-      if (cost < lifespan) { sleep_for((double)(lifespan - cost) / 1e9); }
+      if (auto remaining = simulationTime + step - Clock::now(); remaining > Clock::duration{}) {
+        PROFILE_ZONE("update/sleep");
+        sleep_for(std::chrono::duration<f64>(remaining).count());
+      }
 
       context->updateThreadMessageQueue->push({
           .type = MESSAGE_TYPE_UPDATE,
-          .u32[0] = (frameIndex + 1) % 3,
-      }); // Start to update next frame
+      }); // Run the steps that are due by then
     } break;
     default: break;
     }
@@ -510,60 +1280,510 @@ void *update_thread_main(void *args) {
   pthread_exit(nullptr);
 }
 
+// Sleeps until the next frame is due at the frame budget, for render loops vsync does not pace. A
+// frame that ran over starts the next one right away instead of trying to catch up
+static void pace_frame(Clock::time_point *nextFrameTime) {
+  auto frameDuration = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<f64, std::milli>(kFrameBudget));
+  *nextFrameTime = std::max(*nextFrameTime + frameDuration, Clock::now());
+  if (auto remaining = *nextFrameTime - Clock::now(); remaining > Clock::duration{}) {
+    PROFILE_ZONE("render/sleep");
+    sleep_for(std::chrono::duration<f64>(remaining).count());
+  }
+}
+
 void *render_thread_main(void *args) {
   auto context = (Context *)args;
   auto glContext = SDL_GL_CreateContext(context->window);
+  if (!glContext) {
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+    glContext = SDL_GL_CreateContext(context->window);
+  }
   SDL_GL_MakeCurrent(context->window, glContext);
+  // The display paces this thread, independently of the simulation rate, or else the frame budget
+  auto vsync = SDL_GL_SetSwapInterval(1) == 0;
+  if (!vsync) { LOG_WARN("vsync unavailable, pacing frames to the budget: %s", SDL_GetError()); }
+  auto nextFrameTime = Clock::now();
+  profiler_set_thread_name("render");
   init();
+  profiler_gpu_initialize();
+  frame_stats_gpu_initialize(context->frameStatsState);
+  if (!resolution_gpu_initialize(context->resolutionState)) {
+    LOG_ERROR("error creating the upscaler, rendering at full resolution");
+  }
+  void *overlayState = nullptr;
+  if (!overlay_initialize(&overlayState)) { LOG_ERROR("error creating the overlay"); }
+  void *renderGraphState = nullptr;
+  render_graph_create(&renderGraphState, renderGraphAliasing);
+  Clock::time_point lastPresentTime{};
+  u64 frameNumber = 0;
+  SimulationFrame drawnSimulation{}; // Step and update time of the last frame drawn
   bool quit = false;
   while (!quit) {
     Message message;
-    if (auto ok = context->renderThreadMessageQueue->pop(&message); !ok) {
-      quit = true;
-      break;
+    auto picked = false;
+    f32 pickPoint[2];
+    while (context->renderThreadMessageQueue->try_pop(&message)) {
+      if (message.type == MESSAGE_TYPE_QUIT) { quit = true; }
+      if (message.type == MESSAGE_TYPE_PICK) {
+        picked = true;
+        memcpy(pickPoint, message.f32, sizeof(pickPoint));
+      }
     }
-    switch (message.type) {
-    case MESSAGE_TYPE_QUIT: quit = true; break;
-    case MESSAGE_TYPE_RENDER: {
-      // printf("[RenderThread] render frame #%d\n", message.u32[0]);
-      int w, h;
-      SDL_GL_GetDrawableSize(context->window, &w, &h);
-      render(w, h, message.f32);
+    if (quit) { break; }
+
+    PROFILE_ZONE("render");
+    const auto &simulation = context->simulation.acquire();
+    auto state = interpolate_simulation(simulation);
+
+    int w, h;
+    SDL_GL_GetDrawableSize(context->window, &w, &h);
+    // Picked in the view of the frame about to be drawn
+    if (picked && w > 0 && h > 0) {
+      pick_scene_object(state, (f32)w / (f32)h, pickPoint[0], pickPoint[1]);
+    }
+    {
+      PROFILE_ZONE("render/submit");
+      PROFILE_GPU_ZONE("gpu/frame");
+      auto startTime = Clock::now();
+      auto overlayVisible = statsOverlayVisible.load(std::memory_order_relaxed);
+      render_frame(renderGraphState, context->resolutionState, context->frameStatsState,
+                   overlayVisible ? overlayState : nullptr, w, h, frameNumber, state);
+      auto submitTime = std::chrono::duration<f64, std::milli>(Clock::now() - startTime);
+      frame_stats_record(context->frameStatsState, frameNumber, FRAME_STAT_SUBMIT,
+                         submitTime.count());
+      record_update_time(context->frameStatsState, frameNumber, simulation, &drawnSimulation);
+    }
+    {
+      PROFILE_ZONE("render/finish");
       glFinish();
-      // printf("[RenderThread] about to present frame #%d\n", message.u32[0]);
+    }
+    {
+      PROFILE_ZONE("render/present");
+      auto startTime = Clock::now();
       SDL_GL_SwapWindow(context->window);
-      // printf("[RenderThread] frame #%d presented\n", message.u32[0]);
+      auto presentTime = Clock::now();
+      frame_stats_record(context->frameStatsState, frameNumber, FRAME_STAT_PRESENT,
+                         std::chrono::duration<f64, std::milli>(presentTime - startTime).count());
+      if (lastPresentTime != Clock::time_point{}) {
+        frame_stats_record(
+            context->frameStatsState, frameNumber, FRAME_STAT_INTERVAL,
+            std::chrono::duration<f64, std::milli>(presentTime - lastPresentTime).count());
+      }
+      lastPresentTime = presentTime;
+    }
+    profiler_gpu_frame();
+    resolution_update(context->resolutionState, context->frameStatsState);
+    frame_arena_reset(); // The frame's draw lists retire with it
+    ++frameNumber;
+    if (!vsync) { pace_frame(&nextFrameTime); }
+  }
+  render_graph_print_stats(renderGraphState);
+  render_graph_destroy(&renderGraphState);
+  if (overlayState) { overlay_shutdown(&overlayState); }
+  resolution_gpu_shutdown(context->resolutionState);
+  frame_stats_gpu_shutdown(context->frameStatsState);
+  profiler_gpu_shutdown();
+  shutdown();
+  pthread_exit(nullptr);
+}
+
+// Software counterpart of `render_thread_main`: renders at the size of the window surface and
+// copies each frame into it. Nothing waits for vsync here, so frames are paced to the budget.
+void *software_render_thread_main(void *args) {
+  auto context = (Context *)args;
+  profiler_set_thread_name("render");
+  init_software();
+  std::vector<u8> pixels;
+  auto nextFrameTime = Clock::now();
+  Clock::time_point lastPresentTime{};
+  u64 frameNumber = 0;
+  SimulationFrame drawnSimulation{}; // Step and update time of the last frame drawn
+  bool quit = false;
+  while (!quit) {
+    Message message;
+    auto picked = false;
+    f32 pickPoint[2];
+    while (context->renderThreadMessageQueue->try_pop(&message)) {
+      if (message.type == MESSAGE_TYPE_QUIT) { quit = true; }
+      if (message.type == MESSAGE_TYPE_PICK) {
+        picked = true;
+        memcpy(pickPoint, message.f32, sizeof(pickPoint));
+      }
+    }
+    if (quit) { break; }
+
+    PROFILE_ZONE("render");
+    const auto &simulation = context->simulation.acquire();
+    auto state = interpolate_simulation(simulation);
+    // Fetched every frame, resizing the window replaces the surface
+    auto surface = SDL_GetWindowSurface(context->window);
+    if (!surface) {
+      LOG_ERROR("error getting the window surface: %s", SDL_GetError());
+      break;
+    }
+    if (surface->w > 0 && surface->h > 0) {
+      u32 width = surface->w, height = surface->h;
+      if (picked) {
+        pick_scene_object(state, (f32)width / (f32)height, pickPoint[0], pickPoint[1]);
+      }
       {
-        auto &frame = frames[message.u32[0]];
-        std::lock_guard<std::mutex> lock(frame.mutex);
-        frame.state = FRAME_STATE_PRESENTED;
-        frame.condition.notify_one();
+        PROFILE_ZONE("render/submit");
+        auto startTime = Clock::now();
+        render_software(width, height, state);
+        auto submitTime = std::chrono::duration<f64, std::milli>(Clock::now() - startTime);
+        frame_stats_record(context->frameStatsState, frameNumber, FRAME_STAT_SUBMIT,
+                           submitTime.count());
+        record_update_time(context->frameStatsState, frameNumber, simulation, &drawnSimulation);
       }
-    } break;
-    default: break;
+      {
+        PROFILE_ZONE("render/present");
+        auto startTime = Clock::now();
+        pixels.resize((size_t)width * height * 4);
+        rasterizer_read_pixels(rasterizerState, pixels.data(), width * 4);
+        // The blit converts to whatever format the window surface has
+        auto frame = SDL_CreateRGBSurfaceWithFormatFrom(pixels.data(), width, height, 32,
+                                                        width * 4, SDL_PIXELFORMAT_RGBA32);
+        SDL_BlitSurface(frame, nullptr, surface, nullptr);
+        SDL_FreeSurface(frame);
+        SDL_UpdateWindowSurface(context->window);
+        auto presentTime = Clock::now();
+        frame_stats_record(
+            context->frameStatsState, frameNumber, FRAME_STAT_PRESENT,
+            std::chrono::duration<f64, std::milli>(presentTime - startTime).count());
+        if (lastPresentTime != Clock::time_point{}) {
+          frame_stats_record(
+              context->frameStatsState, frameNumber, FRAME_STAT_INTERVAL,
+              std::chrono::duration<f64, std::milli>(presentTime - lastPresentTime).count());
+        }
+        lastPresentTime = presentTime;
+      }
+      ++frameNumber;
     }
+    frame_arena_reset();
+    pace_frame(&nextFrameTime);
   }
+  shutdown_software();
   pthread_exit(nullptr);
 }
 
+struct HeadlessOptions {
+  bool enabled = false;
+  u32 width = 1280;
+  u32 height = 720;
+  u32 frames = 300;
+  const char *capturePath = nullptr; // PNG of the final frame
+  i32 pickX = -1; // Pixel of the final frame to pick the object under, none when negative
+  i32 pickY = -1;
+};
+
+// Moves the camera for headless frame `i`, along the replay when there is one
+static void headless_advance(void *replayState, u32 i, u32 frameCount, InputSnapshot *input,
+                             InputSnapshot *previousInput) {
+  if (replayState) {
+    f32 tick = 0;
+    replay_read_frame(replayState, &tick, input);
+    simulate(input, previousInput, tick);
+    *previousInput = *input;
+  } else {
+    // Turn once around on the spot over the run, so every machine renders the same frames
+    camera.rotate_to(0.0f, 360.0f * (f32)i / (f32)frameCount);
+    animationTime = (f32)(i * simulationStep);
+  }
+}
+
+static void headless_print_summary(const HeadlessOptions &options, u32 frameCount, f64 runTime) {
+  printf("headless: %u frames at %ux%u in %.3f s (%.1f fps)\n", frameCount, options.width,
+         options.height, runTime, frameCount / runTime);
+  print_render_summary();
+  if (options.pickX >= 0) {
+    pick_scene_object(capture_simulation_state(), (f32)options.width / (f32)options.height,
+                      ((f32)options.pickX + 0.5f) / (f32)options.width,
+                      ((f32)options.pickY + 0.5f) / (f32)options.height);
+    logger_flush(); // Before anything printed after the summary
+  }
+}
+
+// Headless run through the software renderer, which needs neither a GPU nor EGL
+static int software_headless_main(const HeadlessOptions &options) {
+  void *replayState = nullptr;
+  if (replayPath && !replay_create(&replayState, replayPath, REPLAY_MODE_PLAYBACK)) {
+    return EXIT_FAILURE;
+  }
+  auto frameCount = replayState ? (u32)replay_frame_count(replayState) : options.frames;
+
+  init_software();
+  void *frameStatsState = nullptr;
+  frame_stats_initialize(&frameStatsState, kFrameBudget);
+  if (statsCsvPath) { frame_stats_open_csv(frameStatsState, statsCsvPath); }
+
+  InputSnapshot input{}, previousInput{};
+  auto runStartTime = Clock::now();
+  auto lastFrameTime = runStartTime;
+  for (u32 i = 0; i < frameCount; ++i) {
+    headless_advance(replayState, i, frameCount, &input, &previousInput);
+    PROFILE_ZONE("render");
+    {
+      PROFILE_ZONE("render/submit");
+      auto startTime = Clock::now();
+      render_software(options.width, options.height, capture_simulation_state());
+      frame_stats_record(frameStatsState, i, FRAME_STAT_SUBMIT,
+                         std::chrono::duration<f64, std::milli>(Clock::now() - startTime).count());
+    }
+    // The frame is complete once submitted, nothing runs behind it
+    auto frameTime = Clock::now();
+    frame_stats_record(frameStatsState, i, FRAME_STAT_INTERVAL,
+                       std::chrono::duration<f64, std::milli>(frameTime - lastFrameTime).count());
+    lastFrameTime = frameTime;
+    frame_arena_reset();
+  }
+  auto runTime = std::chrono::duration<f64>(Clock::now() - runStartTime).count();
+  if (frameCount > 0) { headless_print_summary(options, frameCount, runTime); }
+
+  auto ok = true;
+  if (options.capturePath && frameCount > 0) {
+    std::vector<u8> pixels((size_t)options.width * options.height * 4);
+    rasterizer_read_pixels(rasterizerState, pixels.data(), options.width * 4);
+    ok = image_write_png(options.capturePath, options.width, options.height, 4, pixels.data(),
+                         options.width * 4, false);
+  }
+  if (tracePath) { profiler_dump(tracePath); }
+  frame_stats_print(frameStatsState);
+  allocator_print_stats();
+  memory_stats_print();
+  frame_stats_shutdown(&frameStatsState);
+  shutdown_software();
+  if (replayState) { replay_destroy(&replayState); }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#if defined(NEON_HEADLESS)
+// Renders a fixed number of frames offscreen along a scripted camera path and reports timings
+static int headless_main(const HeadlessOptions &options) {
+  void *replayState = nullptr;
+  if (replayPath && !replay_create(&replayState, replayPath, REPLAY_MODE_PLAYBACK)) {
+    return EXIT_FAILURE;
+  }
+  // A replay runs to its end, otherwise the scripted camera runs for the requested frames
+  auto frameCount = replayState ? (u32)replay_frame_count(replayState) : options.frames;
+
+  HeadlessContext *headless = nullptr;
+  if (!headless_context_create(&headless, options.width, options.height)) {
+    if (replayState) { replay_destroy(&replayState); }
+    return EXIT_FAILURE;
+  }
+  init();
+  profiler_gpu_initialize();
+  void *frameStatsState = nullptr;
+  frame_stats_initialize(&frameStatsState, kFrameBudget);
+  if (statsCsvPath) { frame_stats_open_csv(frameStatsState, statsCsvPath); }
+  frame_stats_gpu_initialize(frameStatsState);
+  void *resolutionState = nullptr;
+  resolution_system_initialize(&resolutionState, resolutionOptions);
+  if (!resolution_gpu_initialize(resolutionState)) {
+    LOG_ERROR("error creating the upscaler, rendering at full resolution");
+  }
+  void *overlayState = nullptr;
+  if (statsOverlayVisible && !overlay_initialize(&overlayState)) {
+    LOG_ERROR("error creating the overlay");
+  }
+  void *renderGraphState = nullptr;
+  render_graph_create(&renderGraphState, renderGraphAliasing);
+
+  InputSnapshot input{}, previousInput{};
+  auto runStartTime = Clock::now();
+  auto lastFrameTime = runStartTime;
+  for (u32 i = 0; i < frameCount; ++i) {
+    headless_advance(replayState, i, frameCount, &input, &previousInput);
+    PROFILE_ZONE("render");
+    auto startTime = Clock::now();
+    headless_context_bind(headless);
+    // Every frame sees the loads of the one before, whatever the speed of the loader
+    if (textureStreamerState) { texture_streamer_finish(textureStreamerState); }
+    {
+      PROFILE_ZONE("render/submit");
+      PROFILE_GPU_ZONE("gpu/frame");
+      render_frame(renderGraphState, resolutionState, frameStatsState, overlayState,
+                   options.width, options.height, i, capture_simulation_state());
+      frame_stats_record(frameStatsState, i, FRAME_STAT_SUBMIT,
+                         std::chrono::duration<f64, std::milli>(Clock::now() - startTime).count());
+    }
+    {
+      PROFILE_ZONE("render/finish");
+      glFinish();
+    }
+    // No swap offscreen, so the interval is from one finished frame to the next
+    auto frameTime = Clock::now();
+    frame_stats_record(frameStatsState, i, FRAME_STAT_INTERVAL,
+                       std::chrono::duration<f64, std::milli>(frameTime - lastFrameTime).count());
+    lastFrameTime = frameTime;
+    profiler_gpu_frame();
+    resolution_update(resolutionState, frameStatsState);
+    frame_arena_reset();
+  }
+  auto runTime = std::chrono::duration<f64>(Clock::now() - runStartTime).count();
+
+  if (frameCount > 0) {
+    headless_print_summary(options, frameCount, runTime);
+    printf("final resolution scale %.0f%%\n", resolution_get_scale(resolutionState) * 100.0f);
+    render_graph_print_stats(renderGraphState);
+  }
+
+  auto ok = true;
+  if (options.capturePath) { ok = headless_capture_png(headless, options.capturePath); }
+  if (tracePath) { profiler_dump(tracePath); }
+  render_graph_destroy(&renderGraphState);
+  if (overlayState) { overlay_shutdown(&overlayState); }
+  resolution_gpu_shutdown(resolutionState);
+  resolution_system_shutdown(&resolutionState);
+  frame_stats_gpu_shutdown(frameStatsState);
+  frame_stats_print(frameStatsState);
+  allocator_print_stats();
+  memory_stats_print();
+  frame_stats_shutdown(&frameStatsState);
+  profiler_gpu_shutdown();
+  shutdown();
+  headless_context_destroy(&headless);
+  if (replayState) { replay_destroy(&replayState); }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
+
 int main(int argc, char **argv) {
+  HeadlessOptions headlessOptions{};
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--dense") == 0 && i + 1 < argc) {
+      denseSceneSize = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--characters") == 0 && i + 1 < argc) {
+      crowdSize = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+      particleCapacity = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--no-lod") == 0) {
+      lodEnabled = false;
+    } else if (strcmp(argv[i], "--no-occlusion") == 0) {
+      occlusionEnabled = false;
+    } else if (strcmp(argv[i], "--no-gpu-culling") == 0) {
+      gpuCullingEnabled = false;
+    } else if (strcmp(argv[i], "--no-aliasing") == 0) {
+      renderGraphAliasing = false;
+    } else if (strcmp(argv[i], "--software") == 0) {
+      softwareRendering = true;
+    } else if (strcmp(argv[i], "--headless") == 0) {
+      headlessOptions.enabled = true;
+    } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%ux%u", &headlessOptions.width, &headlessOptions.height) != 2) {
+        fprintf(stderr, "invalid size '%s', expected WIDTHxHEIGHT\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      headlessOptions.frames = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      headlessOptions.capturePath = argv[++i];
+    } else if (strcmp(argv[i], "--pick") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%d,%d", &headlessOptions.pickX, &headlessOptions.pickY) != 2) {
+        fprintf(stderr, "invalid pick '%s', expected X,Y\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--stats-csv") == 0 && i + 1 < argc) {
+      statsCsvPath = argv[++i];
+    } else if (strcmp(argv[i], "--stats-overlay") == 0) {
+      statsOverlayVisible = true;
+    } else if (strcmp(argv[i], "--resolution-scale") == 0 && i + 1 < argc) {
+      resolutionOptions.scale = (f32)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--dynamic-resolution") == 0) {
+      resolutionOptions.dynamic = true;
+    } else if (strcmp(argv[i], "--gpu-target") == 0 && i + 1 < argc) {
+      resolutionOptions.targetGpuMs = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc) {
+      textureBudget = (u64)(atof(argv[++i]) * MiB);
+    } else if (strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc) {
+      memory_stats_set_total_budget(MEMORY_DOMAIN_GPU, (u64)(atof(argv[++i]) * MiB));
+    } else if (strcmp(argv[i], "--sim-hz") == 0 && i + 1 < argc) {
+      simulationStep = 1.0 / std::max(1.0, atof(argv[++i]));
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordPath = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replayPath = argv[++i];
+    }
+  }
+  if (resolutionOptions.targetGpuMs <= 0) {
+    resolutionOptions.targetGpuMs = kFrameBudget * 0.85; // Leave room for the CPU side and present
+  }
+  if (recordPath && (replayPath || headlessOptions.enabled)) {
+    fprintf(stderr, "--record needs live input, it cannot be combined with --replay or "
+                    "--headless\n");
+    return EXIT_FAILURE;
+  }
+
+  logger_system_initialize();
+  profiler_system_initialize();
+  profiler_set_thread_name("main");
+  auto occlusionActive = occlusionEnabled && denseSceneSize > 0;
+  if (softwareRendering && crowdSize > 0) {
+    LOG_WARN("characters are only drawn by the GL renderer");
+  }
+  if (softwareRendering && particleCapacity > 0) {
+    LOG_WARN("particles are only drawn by the GL renderer");
+  }
+  if (occlusionActive || softwareRendering || crowdSize > 0 || particleCapacity > 0) {
+    // The render thread dispatches to the pool, the other engine threads mostly sleep
+    job_system_initialize(&jobSystemState, 0);
+  }
+  if (occlusionActive) { occlusion_system_initialize(&occlusionState, jobSystemState); }
+  init_scene();
+
+  if (headlessOptions.enabled && softwareRendering) {
+    auto result = software_headless_main(headlessOptions);
+    if (occlusionState) { occlusion_system_shutdown(&occlusionState); }
+    if (jobSystemState) { job_system_shutdown(&jobSystemState); }
+    shutdown_scene();
+    profiler_system_shutdown();
+    logger_system_shutdown();
+    memory_stats_check_leaks();
+    return result;
+  }
+  if (headlessOptions.enabled) {
+#if defined(NEON_HEADLESS)
+    auto result = headless_main(headlessOptions);
+    if (occlusionState) { occlusion_system_shutdown(&occlusionState); }
+    if (jobSystemState) { job_system_shutdown(&jobSystemState); }
+    shutdown_scene();
+    profiler_system_shutdown();
+    logger_system_shutdown();
+    memory_stats_check_leaks();
+    return result;
+#else
+    LOG_ERROR("headless mode is not available in this build");
+    profiler_system_shutdown();
+    logger_system_shutdown();
+    return EXIT_FAILURE;
+#endif
+  }
+
   Context context{};
   event_system_initialize(&context.eventSystemState);
   event_register(context.eventSystemState, EVENT_CODE_KEYBOARD_PRESSED, &context, event_on_key);
   event_register(context.eventSystemState, EVENT_CODE_KEYBOARD_RELEASED, &context, event_on_key);
   event_register(context.eventSystemState, EVENT_CODE_QUIT, &context, event_on_quit);
   event_register(context.eventSystemState, EVENT_CODE_MOUSE_WHEEL, &context, event_on_scroll);
+  event_set_coalescing(context.eventSystemState, EVENT_CODE_RESIZED, true);
+  event_set_coalescing(context.eventSystemState, EVENT_CODE_MOUSE_MOVED, true);
   if (SDL_Init(SDL_INIT_EVERYTHING)) {
     fprintf(stderr, "error initializing SDL: %s\n", SDL_GetError());
     return EXIT_FAILURE;
   }
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+  // 4.3 enables GPU culling; the render thread falls back to 4.1, all the renderer needs
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
   SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-  auto window = SDL_CreateWindow(
-      "neon", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1024, 360,
-      SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+  // The software renderer presents through the window surface, which a GL window cannot have
+  u32 windowFlags = SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN;
+  if (!softwareRendering) { windowFlags |= SDL_WINDOW_OPENGL; }
+  auto window = SDL_CreateWindow("neon", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1024,
+                                 360, windowFlags);
   if (!window) {
     fprintf(stderr, "error creating window: %s\n", SDL_GetError());
     SDL_Quit();
@@ -575,32 +1795,65 @@ int main(int argc, char **argv) {
         if (event->type == SDL_WINDOWEVENT && event->window.event == SDL_WINDOWEVENT_RESIZED) {
           auto window = SDL_GetWindowFromID(event->window.windowID);
           auto context = (Context *)SDL_GetWindowData(window, "EngineContext");
-          // context->renderThreadMessageQueue->push({
-          //     .type = MESSAGE_TYPE_RENDER,
-          // });
+          // The watch may run on whichever thread resizes the window, so only post
+          EventContext eventContext{};
+          eventContext.u32[0] = event->window.data1;
+          eventContext.u32[1] = event->window.data2;
+          event_post(context->eventSystemState, EVENT_CODE_RESIZED, nullptr, eventContext);
         }
         return 0;
       },
       window);
   context.window = window;
-  pthread_t renderThread;
-  pthread_create(&renderThread, nullptr, render_thread_main, &context);
+  context.wakeupEventType = SDL_RegisterEvents(1);
+  input_system_initialize(&context.inputSystemState, context.eventSystemState);
+  frame_stats_initialize(&context.frameStatsState, kFrameBudget);
+  if (statsCsvPath) { frame_stats_open_csv(context.frameStatsState, statsCsvPath); }
+  resolution_system_initialize(&context.resolutionState, resolutionOptions);
+  if ((recordPath && !replay_create(&context.replayState, recordPath, REPLAY_MODE_RECORD)) ||
+      (replayPath && !replay_create(&context.replayState, replayPath, REPLAY_MODE_PLAYBACK))) {
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return EXIT_FAILURE;
+  }
   context.renderThreadMessageQueue = std::make_unique<MessageQueue>();
+  context.updateThreadMessageQueue = std::make_unique<MessageQueue>();
+  { // Nothing to blend before the first step
+    auto &frame = context.simulation.back();
+    frame.previous = frame.current = capture_simulation_state();
+    frame.time = Clock::now();
+    context.simulation.publish();
+  }
+  pthread_t renderThread;
+  pthread_create(&renderThread, nullptr,
+                 softwareRendering ? software_render_thread_main : render_thread_main, &context);
   pthread_t updateThread;
   pthread_create(&updateThread, nullptr, update_thread_main, &context);
-  context.updateThreadMessageQueue = std::make_unique<MessageQueue>();
   context.updateThreadMessageQueue->push({
       .type = MESSAGE_TYPE_UPDATE,
-      .u32[0] = 0, // Starts from frame #0
   });
-  input_system_initialize(&context.inputSystemState, context.eventSystemState);
   bool is_mouse_button_down = false;
+  auto titleTime = Clock::now();
   SDL_Event event;
   while (!context.quit) {
-    while (SDL_PollEvent(&event)) {
+    // Sleep until the OS or an engine thread has something for us; the timeout is only a safety net
+    if (!SDL_WaitEventTimeout(&event, 250)) { continue; }
+    PROFILE_ZONE("main/events");
+    do {
+      if (event.type == context.wakeupEventType) {
+        if (event.user.code == WAKEUP_CODE_TICK) {
+          // Held keys repeat at the update rate rather than at the rate events arrive
+          input_system_update(context.inputSystemState);
+          if (Clock::now() - titleTime > std::chrono::milliseconds(500)) {
+            update_window_title(&context);
+            titleTime = Clock::now();
+          }
+        }
+        continue;
+      }
       switch (event.type) {
       case SDL_QUIT: {
-        event_fire(context.eventSystemState, EVENT_CODE_QUIT, nullptr, {});
+        event_post(context.eventSystemState, EVENT_CODE_QUIT, nullptr, {});
         break;
       }
       case SDL_KEYDOWN:
@@ -613,38 +1866,75 @@ int main(int argc, char **argv) {
                                          event.wheel.preciseX, event.wheel.preciseY);
       } break;
       case SDL_MOUSEBUTTONDOWN: {
-        printf("mouse button down\n");
         is_mouse_button_down = true;
+        if (event.button.button == SDL_BUTTON_LEFT) { // The render thread knows what is on screen
+          int width, height;
+          SDL_GetWindowSize(window, &width, &height);
+          Message message{.type = MESSAGE_TYPE_PICK};
+          message.f32[0] = (f32)event.button.x / (f32)std::max(width, 1);
+          message.f32[1] = (f32)event.button.y / (f32)std::max(height, 1);
+          context.renderThreadMessageQueue->push(message);
+        }
       } break;
       case SDL_MOUSEBUTTONUP: {
-        printf("mouse button up\n");
+        LOG_TRACE("mouse button up");
         is_mouse_button_down = false;
       } break;
       case SDL_MOUSEMOTION: {
-        if (is_mouse_button_down) { printf("mouse motion\n"); }
+        if (is_mouse_button_down) { LOG_TRACE("mouse motion"); }
+        input_system_process_mouse_motion(context.inputSystemState, event.motion.x, event.motion.y,
+                                          event.motion.xrel, event.motion.yrel);
+        EventContext eventContext{};
+        eventContext.i32[0] = event.motion.x;
+        eventContext.i32[1] = event.motion.y;
+        event_post(context.eventSystemState, EVENT_CODE_MOUSE_MOVED, nullptr, eventContext);
       } break;
       default: break;
       }
-    }
-    if (context.quit) { break; }
-    input_system_update(context.inputSystemState);
+    } while (SDL_PollEvent(&event));
+    input_system_publish(context.inputSystemState); // Visible to the next update tick
+    // Listeners run here, once per loop, with the events of this batch in posting order
+    event_dispatch_deferred(context.eventSystemState);
   }
-  input_system_shutdown(&context.inputSystemState);
+  // High priority, so that a backlog neither delays nor drops them
   context.renderThreadMessageQueue->push({
       .type = MESSAGE_TYPE_QUIT,
+      .priority = MESSAGE_PRIORITY_HIGH,
   }); // Quit render thread
   pthread_join(renderThread, nullptr);
   context.updateThreadMessageQueue->push({
       .type = MESSAGE_TYPE_QUIT,
+      .priority = MESSAGE_PRIORITY_HIGH,
   }); // Quit update thread
   pthread_join(updateThread, nullptr);
+  input_system_shutdown(&context.inputSystemState); // The update thread reads its snapshots
+  if (auto dropped = context.renderThreadMessageQueue->dropped(); dropped > 0) {
+    LOG_WARN("%llu messages to the render thread dropped", (unsigned long long)dropped);
+  }
+  if (auto dropped = context.updateThreadMessageQueue->dropped(); dropped > 0) {
+    LOG_WARN("%llu messages to the update thread dropped", (unsigned long long)dropped);
+  }
+  if (context.replayState) { replay_destroy(&context.replayState); }
   SDL_DestroyWindow(window);
   SDL_Quit();
+  if (renderedFrames > 0) { print_render_summary(); }
+  frame_stats_print(context.frameStatsState);
+  allocator_print_stats();
+  memory_stats_print();
+  frame_stats_shutdown(&context.frameStatsState);
+  resolution_system_shutdown(&context.resolutionState);
   event_deregister(context.eventSystemState, EVENT_CODE_MOUSE_WHEEL, &context, event_on_scroll);
   event_deregister(context.eventSystemState, EVENT_CODE_QUIT, &context, event_on_quit);
   event_deregister(context.eventSystemState, EVENT_CODE_KEYBOARD_RELEASED, &context, event_on_key);
   event_deregister(context.eventSystemState, EVENT_CODE_KEYBOARD_PRESSED, &context, event_on_key);
   event_system_shutdown(&context.eventSystemState);
+  if (occlusionState) { occlusion_system_shutdown(&occlusionState); }
+  if (jobSystemState) { job_system_shutdown(&jobSystemState); }
+  if (tracePath) { profiler_dump(tracePath); }
+  shutdown_scene();
+  profiler_system_shutdown();
+  logger_system_shutdown();
+  memory_stats_check_leaks();
   return EXIT_SUCCESS;
 }
 
@@ -659,6 +1949,12 @@ bool event_on_key(EventCode eventCode, EventContext eventContext, void *sender,
     if (eventContext.u16[0] == SDL_SCANCODE_ESCAPE) {
       auto context = (Context *)listener;
       event_fire(context->eventSystemState, EVENT_CODE_QUIT, nullptr, {});
+    } else if (eventContext.u16[0] == SDL_SCANCODE_F1) {
+      profiler_dump(tracePath ? tracePath : "neon_trace.json");
+    } else if (eventContext.u16[0] == SDL_SCANCODE_F2) {
+      statsOverlayVisible = !statsOverlayVisible;
+    } else if (eventContext.u16[0] == SDL_SCANCODE_F3) {
+      memory_stats_print();
     }
   }
   return true;
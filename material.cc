@@ -0,0 +1,258 @@
+#include "material.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include "program.h"
+#include "texture.h"
+#include "texture_streamer.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+static const u32 MATERIAL_BLOCK_BINDING = 1;
+static const u32 MATERIAL_INITIAL_CAPACITY = 16; // Parameter blocks, doubled when full
+
+// std140 MaterialBlock of the fragment shaders
+struct MaterialParameters {
+  f32 color[4];
+  f32 shininess;
+  f32 pad[3];
+};
+
+struct MaterialEntry {
+  MaterialShading shading;
+  Texture *textures[MATERIAL_TEXTURE_COUNT];
+  bool live;
+};
+
+struct MaterialSystemState {
+  void *textureStreamerState; // Null when textures are fully resident
+  GLuint programs[MATERIAL_VERTEX_STAGE_COUNT][MATERIAL_SHADING_COUNT];
+  bool failed[MATERIAL_VERTEX_STAGE_COUNT][MATERIAL_SHADING_COUNT]; // Not retried every frame
+  GLuint whiteTexture; // Stands in for the maps a lit material has none of
+  GLuint buffer;
+  u32 stride; // Bytes between blocks, to the offset alignment of uniform buffer ranges
+  u32 capacity;
+  std::vector<MaterialParameters> parameters; // By id, the CPU copy of the buffer
+  std::vector<MaterialEntry> materials;
+  std::vector<u32> freeIds;
+  u32 dirtyBegin; // Ids of the blocks edited since the last upload
+  u32 dirtyEnd;
+};
+
+static const char *const MATERIAL_FRAGMENT_SHADERS[MATERIAL_SHADING_COUNT] = {
+    "shaders/materials.frag",
+    "shaders/light_cube.frag",
+    "shaders/particle.frag",
+};
+static const char *const
+    MATERIAL_VERTEX_SHADERS[MATERIAL_VERTEX_STAGE_COUNT][MATERIAL_SHADING_COUNT] = {
+        {"shaders/materials.vert", "shaders/light_cube.vert", "shaders/particle.vert"},
+        {"shaders/materials_indirect.vert", nullptr, nullptr},
+        {"shaders/materials_skinned.vert", nullptr, nullptr},
+};
+
+// Sampler units and the block binding are program state, so they are set once here
+static bool create_program(GLuint *program, const char *vertexPath, const char *fragmentPath) {
+  if (!program_create(program, {{GL_VERTEX_SHADER, vertexPath},
+                                {GL_FRAGMENT_SHADER, fragmentPath}})) {
+    return false;
+  }
+  auto block = glGetUniformBlockIndex(*program, "MaterialBlock");
+  if (block != GL_INVALID_INDEX) { glUniformBlockBinding(*program, block, MATERIAL_BLOCK_BINDING); }
+  program_use(*program);
+  program_set_i32(*program, "materialDiffuse", MATERIAL_TEXTURE_DIFFUSE);
+  program_set_i32(*program, "materialSpecular", MATERIAL_TEXTURE_SPECULAR);
+  return true;
+}
+
+static u64 buffer_bytes(const MaterialSystemState *s) { return (u64)s->stride * s->capacity; }
+
+// Reallocates the buffer for `capacity` blocks with every block uploaded
+static void resize_buffer(MaterialSystemState *s, u32 capacity) {
+  if (s->capacity > 0) { memory_stats_free(MEMORY_TAG_SHADER, MEMORY_DOMAIN_GPU, buffer_bytes(s)); }
+  s->capacity = capacity;
+  std::vector<u8> blocks(buffer_bytes(s));
+  for (u32 i = 0; i < s->parameters.size(); ++i) {
+    memcpy(&blocks[(u64)i * s->stride], &s->parameters[i], sizeof(MaterialParameters));
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, s->buffer);
+  glBufferData(GL_UNIFORM_BUFFER, blocks.size(), blocks.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  memory_stats_allocate(MEMORY_TAG_SHADER, MEMORY_DOMAIN_GPU, buffer_bytes(s));
+  s->dirtyBegin = s->dirtyEnd = 0;
+}
+
+static bool create_texture(MaterialSystemState *s, const char *path, Texture **texture) {
+  if (s->textureStreamerState) {
+    return texture_streamer_create(s->textureStreamerState, path, texture);
+  }
+  return texture_create(texture, path);
+}
+
+static void destroy_texture(MaterialSystemState *s, Texture **texture) {
+  if (s->textureStreamerState) {
+    texture_streamer_destroy(s->textureStreamerState, texture);
+  } else {
+    texture_destroy(texture);
+  }
+}
+
+static void mark_dirty(MaterialSystemState *s, u32 material) {
+  if (s->dirtyBegin == s->dirtyEnd) {
+    s->dirtyBegin = material;
+    s->dirtyEnd = material + 1;
+  } else {
+    s->dirtyBegin = std::min(s->dirtyBegin, material);
+    s->dirtyEnd = std::max(s->dirtyEnd, material + 1);
+  }
+}
+
+bool material_system_initialize(void **state, void *textureStreamerState) {
+  auto s = new MaterialSystemState();
+  s->textureStreamerState = textureStreamerState;
+  for (u32 i = 0; i < MATERIAL_SHADING_COUNT; ++i) {
+    auto &program = s->programs[MATERIAL_VERTEX_STAGE_DEFAULT][i];
+    if (!create_program(&program, MATERIAL_VERTEX_SHADERS[MATERIAL_VERTEX_STAGE_DEFAULT][i],
+                        MATERIAL_FRAGMENT_SHADERS[i])) {
+      for (u32 j = 0; j < i; ++j) {
+        program_destroy(s->programs[MATERIAL_VERTEX_STAGE_DEFAULT][j]);
+      }
+      DELETE(s);
+      return false;
+    }
+  }
+
+  const u8 white[4] = {255, 255, 255, 255};
+  glGenTextures(1, &s->whiteTexture);
+  glBindTexture(GL_TEXTURE_2D, s->whiteTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  memory_stats_allocate(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_GPU, sizeof(white));
+
+  GLint alignment = 1;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  s->stride = (u32)((sizeof(MaterialParameters) + alignment - 1) / alignment * alignment);
+  glGenBuffers(1, &s->buffer);
+  resize_buffer(s, MATERIAL_INITIAL_CAPACITY);
+  *state = s;
+  return true;
+}
+
+void material_system_shutdown(void **state) {
+  auto s = (MaterialSystemState *)*state;
+  for (u32 i = 0; i < s->materials.size(); ++i) {
+    if (s->materials[i].live) { material_destroy(s, i); }
+  }
+  memory_stats_free(MEMORY_TAG_SHADER, MEMORY_DOMAIN_GPU, buffer_bytes(s));
+  glDeleteBuffers(1, &s->buffer);
+  memory_stats_free(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_GPU, 4);
+  glDeleteTextures(1, &s->whiteTexture);
+  for (auto &programs : s->programs) {
+    for (auto program : programs) {
+      if (program) { program_destroy(program); }
+    }
+  }
+  DELETE(s);
+  *state = nullptr;
+}
+
+GLuint material_system_program(void *state, MaterialShading shading, MaterialVertexStage stage) {
+  auto s = (MaterialSystemState *)state;
+  auto &program = s->programs[stage][shading];
+  if (!program && !s->failed[stage][shading]) {
+    auto vertexPath = MATERIAL_VERTEX_SHADERS[stage][shading];
+    if (!vertexPath || !create_program(&program, vertexPath, MATERIAL_FRAGMENT_SHADERS[shading])) {
+      program = 0;
+      s->failed[stage][shading] = true;
+    }
+  }
+  return program;
+}
+
+bool material_create(void *state, const MaterialDesc &desc, u32 *outMaterial) {
+  auto s = (MaterialSystemState *)state;
+  MaterialEntry entry{desc.shading, {}, true};
+  for (u32 i = 0; i < MATERIAL_TEXTURE_COUNT; ++i) {
+    if (desc.textures[i] && !create_texture(s, desc.textures[i], &entry.textures[i])) {
+      LOG_ERROR("error loading material texture '%s'", desc.textures[i]);
+      for (u32 j = 0; j < i; ++j) {
+        if (entry.textures[j]) { destroy_texture(s, &entry.textures[j]); }
+      }
+      return false;
+    }
+  }
+
+  u32 id;
+  if (!s->freeIds.empty()) {
+    id = s->freeIds.back();
+    s->freeIds.pop_back();
+  } else {
+    id = (u32)s->materials.size();
+    s->materials.emplace_back();
+    s->parameters.emplace_back();
+  }
+  s->materials[id] = entry;
+  auto &parameters = s->parameters[id];
+  memcpy(parameters.color, desc.color, sizeof(parameters.color));
+  parameters.shininess = desc.shininess;
+  if (s->parameters.size() > s->capacity) {
+    resize_buffer(s, s->capacity * 2);
+  } else {
+    mark_dirty(s, id);
+  }
+  *outMaterial = id;
+  return true;
+}
+
+void material_destroy(void *state, u32 material) {
+  auto s = (MaterialSystemState *)state;
+  auto &entry = s->materials[material];
+  for (auto &texture : entry.textures) {
+    if (texture) { destroy_texture(s, &texture); }
+  }
+  entry = {};
+  s->freeIds.push_back(material);
+}
+
+void material_set_color(void *state, u32 material, const f32 *color) {
+  auto s = (MaterialSystemState *)state;
+  memcpy(s->parameters[material].color, color, sizeof(MaterialParameters::color));
+  mark_dirty(s, material);
+}
+
+void material_set_shininess(void *state, u32 material, f32 shininess) {
+  auto s = (MaterialSystemState *)state;
+  s->parameters[material].shininess = shininess;
+  mark_dirty(s, material);
+}
+
+void material_request_detail(void *state, u32 material, f32 pixelsPerUv) {
+  auto s = (MaterialSystemState *)state;
+  if (!s->textureStreamerState) { return; }
+  for (auto texture : s->materials[material].textures) {
+    if (texture) { texture_streamer_request(s->textureStreamerState, texture, pixelsPerUv); }
+  }
+}
+
+void material_bind(void *state, u32 material) {
+  auto s = (MaterialSystemState *)state;
+  if (s->dirtyBegin != s->dirtyEnd) { // Edits since the last bind
+    glBindBuffer(GL_UNIFORM_BUFFER, s->buffer);
+    for (auto i = s->dirtyBegin; i < s->dirtyEnd; ++i) {
+      glBufferSubData(GL_UNIFORM_BUFFER, (u64)i * s->stride, sizeof(MaterialParameters),
+                      &s->parameters[i]);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    s->dirtyBegin = s->dirtyEnd = 0;
+  }
+  glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, s->buffer, (u64)material * s->stride,
+                    sizeof(MaterialParameters));
+  const auto &entry = s->materials[material];
+  if (entry.shading != MATERIAL_SHADING_LIT) { return; }
+  for (u32 i = 0; i < MATERIAL_TEXTURE_COUNT; ++i) {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, entry.textures[i] ? entry.textures[i]->id : s->whiteTexture);
+  }
+}
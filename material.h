@@ -0,0 +1,67 @@
+#pragma once
+
+#include "defines.h"
+#include "opengl.h"
+
+/**
+ * Materials: a shading, the texture set it samples and a parameter block. Parameters of every
+ * material live in one uniform buffer, uploaded when a material is created or edited, so binding a
+ * material is a range bind and its texture binds. Each shading has one program per vertex stage,
+ * shared by its materials, with its sampler units and block binding set once at creation. Draws
+ * reference materials by id.
+ */
+
+enum MaterialShading {
+  MATERIAL_SHADING_LIT = 0x0, // shaders/materials.frag
+  MATERIAL_SHADING_UNLIT,     // shaders/light_cube.frag, a flat color
+  MATERIAL_SHADING_PARTICLE,  // shaders/particle.frag, soft discs tinted by the color
+
+  MATERIAL_SHADING_COUNT,
+};
+
+enum MaterialVertexStage {
+  MATERIAL_VERTEX_STAGE_DEFAULT = 0x0, // A model matrix per draw
+  MATERIAL_VERTEX_STAGE_INDIRECT,      // Draws from gpu_cull, needs GL 4.3
+  MATERIAL_VERTEX_STAGE_SKINNED,       // Instanced skinned meshes, see crowd.h
+
+  MATERIAL_VERTEX_STAGE_COUNT,
+};
+
+enum MaterialTexture {
+  MATERIAL_TEXTURE_DIFFUSE = 0x0,
+  MATERIAL_TEXTURE_SPECULAR,
+
+  MATERIAL_TEXTURE_COUNT,
+};
+
+struct MaterialDesc {
+  MaterialShading shading;
+  const char *textures[MATERIAL_TEXTURE_COUNT]; // Paths; lit materials sample white without one
+  f32 color[4]; // Tint of the diffuse map when lit, the color when unlit
+  f32 shininess;
+};
+
+/**
+ * Needs a current GL context, as do all the other calls
+ * @param textureStreamerState streams the mips of the textures in and out when not null, see
+ * texture_streamer.h; otherwise they are fully resident
+ */
+bool material_system_initialize(void **state, void *textureStreamerState = nullptr);
+void material_system_shutdown(void **state);
+/**
+ * Program of a shading, to set the per-frame uniforms of before binding its materials. Stages
+ * besides the default one are built on first use; 0 when the shading has none or it fails to build.
+ * Texture units from MATERIAL_TEXTURE_COUNT on are free for the vertex stage.
+ */
+GLuint material_system_program(void *state, MaterialShading shading,
+                               MaterialVertexStage stage = MATERIAL_VERTEX_STAGE_DEFAULT);
+
+bool material_create(void *state, const MaterialDesc &desc, u32 *outMaterial);
+void material_destroy(void *state, u32 material);
+// Edits reach the GPU at the next bind of any material
+void material_set_color(void *state, u32 material, const f32 *color);
+void material_set_shininess(void *state, u32 material, f32 shininess);
+// Asks for the texture detail a draw with the material needs, see `texture_streamer_request`
+void material_request_detail(void *state, u32 material, f32 pixelsPerUv);
+// Binds the textures and parameters of the material, for the program of its shading in use
+void material_bind(void *state, u32 material);
@@ -0,0 +1,121 @@
+#include "memory_stats.h"
+#include "logger.h"
+#include <atomic>
+#include <cstdio>
+
+struct MemoryCounter {
+  std::atomic<u64> current{0};
+  std::atomic<u64> peak{0};
+  std::atomic<u64> allocations{0};
+  std::atomic<u64> budget{0};
+};
+
+static const char *memoryTagNames[MEMORY_TAG_COUNT] = {
+    "texture", "mesh", "shader", "render target", "event", "input", "frame", "file", "animation",
+    "particles", "bvh",
+};
+static const char *memoryDomainNames[MEMORY_DOMAIN_COUNT] = {"cpu", "gpu"};
+
+static MemoryCounter counters[MEMORY_DOMAIN_COUNT][MEMORY_TAG_COUNT];
+static MemoryCounter totals[MEMORY_DOMAIN_COUNT];
+
+const char *memory_tag_name(MemoryTag tag) { return memoryTagNames[tag]; }
+
+// Returns whether this allocation crossed the counter's budget
+static bool counter_add(MemoryCounter *counter, u64 size) {
+  auto previous = counter->current.fetch_add(size, std::memory_order_relaxed);
+  auto current = previous + size;
+  auto peak = counter->peak.load(std::memory_order_relaxed);
+  while (peak < current &&
+         !counter->peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {
+  }
+  counter->allocations.fetch_add(1, std::memory_order_relaxed);
+  auto budget = counter->budget.load(std::memory_order_relaxed);
+  return budget > 0 && previous <= budget && current > budget;
+}
+
+static void counter_sub(MemoryCounter *counter, u64 size) {
+  counter->current.fetch_sub(size, std::memory_order_relaxed);
+  counter->allocations.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static MemoryUsage counter_get(const MemoryCounter &counter) {
+  return {counter.current.load(std::memory_order_relaxed),
+          counter.peak.load(std::memory_order_relaxed),
+          counter.allocations.load(std::memory_order_relaxed)};
+}
+
+void memory_stats_allocate(MemoryTag tag, MemoryDomain domain, u64 size) {
+  if (counter_add(&counters[domain][tag], size)) {
+    LOG_WARN("%s %s memory over budget: %.1f of %.1f MiB", memoryTagNames[tag],
+             memoryDomainNames[domain],
+             (f64)counters[domain][tag].current.load(std::memory_order_relaxed) / MiB,
+             (f64)counters[domain][tag].budget.load(std::memory_order_relaxed) / MiB);
+  }
+  if (counter_add(&totals[domain], size)) {
+    LOG_WARN("%s memory over budget: %.1f of %.1f MiB", memoryDomainNames[domain],
+             (f64)totals[domain].current.load(std::memory_order_relaxed) / MiB,
+             (f64)totals[domain].budget.load(std::memory_order_relaxed) / MiB);
+  }
+}
+
+void memory_stats_free(MemoryTag tag, MemoryDomain domain, u64 size) {
+  counter_sub(&counters[domain][tag], size);
+  counter_sub(&totals[domain], size);
+}
+
+MemoryUsage memory_stats_get(MemoryTag tag, MemoryDomain domain) {
+  return counter_get(counters[domain][tag]);
+}
+
+MemoryUsage memory_stats_get_total(MemoryDomain domain) { return counter_get(totals[domain]); }
+
+void memory_stats_set_budget(MemoryTag tag, MemoryDomain domain, u64 size) {
+  counters[domain][tag].budget.store(size, std::memory_order_relaxed);
+}
+
+void memory_stats_set_total_budget(MemoryDomain domain, u64 size) {
+  totals[domain].budget.store(size, std::memory_order_relaxed);
+}
+
+static void print_usage_row(const char *name, MemoryUsage cpu, MemoryUsage gpu) {
+  printf("  %-14s %10.1f %10.1f %7llu %10.1f %10.1f %7llu\n", name, (f64)cpu.current / KiB,
+         (f64)cpu.peak / KiB, (unsigned long long)cpu.allocations, (f64)gpu.current / KiB,
+         (f64)gpu.peak / KiB, (unsigned long long)gpu.allocations);
+}
+
+void memory_stats_print() {
+  printf("memory (KiB)          cpu       peak  allocs        gpu       peak  allocs\n");
+  for (u32 tag = 0; tag < MEMORY_TAG_COUNT; ++tag) {
+    print_usage_row(memoryTagNames[tag], memory_stats_get((MemoryTag)tag, MEMORY_DOMAIN_CPU),
+                    memory_stats_get((MemoryTag)tag, MEMORY_DOMAIN_GPU));
+  }
+  print_usage_row("total", memory_stats_get_total(MEMORY_DOMAIN_CPU),
+                  memory_stats_get_total(MEMORY_DOMAIN_GPU));
+}
+
+bool memory_stats_check_leaks() {
+  auto clean = true;
+  for (u32 domain = 0; domain < MEMORY_DOMAIN_COUNT; ++domain) {
+    for (u32 tag = 0; tag < MEMORY_TAG_COUNT; ++tag) {
+      if (tag == MEMORY_TAG_FRAME) { continue; } // Arenas are released as their threads exit
+      auto usage = counter_get(counters[domain][tag]);
+      if (usage.allocations == 0) { continue; }
+      fprintf(stderr, "leaked %llu %s %s allocations, %.1f KiB\n",
+              (unsigned long long)usage.allocations, memoryTagNames[tag],
+              memoryDomainNames[domain], (f64)usage.current / KiB);
+      clean = false;
+    }
+  }
+  return clean;
+}
+
+u64 memory_stats_image_size(u32 width, u32 height, u32 bytesPerTexel, bool mipmapped) {
+  u64 size = (u64)width * height * bytesPerTexel;
+  while (mipmapped && (width > 1 || height > 1)) {
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    size += (u64)width * height * bytesPerTexel;
+  }
+  return size;
+}
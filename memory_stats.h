@@ -0,0 +1,56 @@
+#pragma once
+
+#include "defines.h"
+
+/**
+ * Memory accounting by subsystem. Allocations report their size under a tag, separately for the
+ * CPU heap and for GPU memory. GPU sizes are estimates from formats, dimensions, mip chains and
+ * buffer sizes; drivers add alignment and padding of their own. The counters are atomics that
+ * need no setup, so any thread and static objects can report.
+ */
+
+enum MemoryTag {
+  MEMORY_TAG_TEXTURE = 0x0,
+  MEMORY_TAG_MESH,
+  MEMORY_TAG_SHADER,
+  MEMORY_TAG_RENDER_TARGET,
+  MEMORY_TAG_EVENT,
+  MEMORY_TAG_INPUT,
+  MEMORY_TAG_FRAME, // Frame arena blocks, kept until their thread exits
+  MEMORY_TAG_FILE,
+  MEMORY_TAG_ANIMATION, // Skeletons, clips and skinning matrices
+  MEMORY_TAG_PARTICLE,  // Particle streams and instances
+  MEMORY_TAG_BVH,       // Spatial indices of the scene
+
+  MEMORY_TAG_COUNT,
+};
+
+enum MemoryDomain {
+  MEMORY_DOMAIN_CPU = 0x0,
+  MEMORY_DOMAIN_GPU,
+
+  MEMORY_DOMAIN_COUNT,
+};
+
+struct MemoryUsage {
+  u64 current; // Bytes
+  u64 peak;
+  u64 allocations; // Live
+};
+
+const char *memory_tag_name(MemoryTag tag);
+
+void memory_stats_allocate(MemoryTag tag, MemoryDomain domain, u64 size);
+void memory_stats_free(MemoryTag tag, MemoryDomain domain, u64 size);
+MemoryUsage memory_stats_get(MemoryTag tag, MemoryDomain domain);
+// The peak is that of the sum over all tags, not the sum of their peaks
+MemoryUsage memory_stats_get_total(MemoryDomain domain);
+// Warns each time an allocation takes the usage over `size` bytes; 0 removes the budget
+void memory_stats_set_budget(MemoryTag tag, MemoryDomain domain, u64 size);
+void memory_stats_set_total_budget(MemoryDomain domain, u64 size);
+void memory_stats_print();
+// Reports what is still allocated; call once everything has been shut down
+bool memory_stats_check_leaks();
+
+// Bytes of a 2D image, including its mip chain down to 1x1 when `mipmapped`
+u64 memory_stats_image_size(u32 width, u32 height, u32 bytesPerTexel, bool mipmapped);
@@ -1,8 +1,9 @@
 #pragma once
 
 #include "defines.h"
+#include <condition_variable>
+#include <memory>
 #include <mutex>
-#include <queue>
 
 enum MessageType {
   MESSAGE_TYPE_NONE = 0x0,
@@ -11,12 +12,14 @@ enum MessageType {
   MESSAGE_TYPE_RESIZED,
   MESSAGE_TYPE_RENDER,
   MESSAGE_TYPE_PRESENT,
+  MESSAGE_TYPE_PICK, // f32[0..1] is a point of the window, from 0 to 1 down and right
 };
 
 enum MessagePriority {
   MESSAGE_PRIORITY_LOW = 0x0,
   MESSAGE_PRIORITY_NORMAL,
   MESSAGE_PRIORITY_HIGH,
+  MESSAGE_PRIORITY_COUNT,
 };
 
 struct Message {
@@ -25,41 +28,88 @@ struct Message {
   u64 u64 = 0;
   u32 u32[2] = {};
   f32 f32[16];
-
-  bool operator<(const Message &rhs) const { return priority < rhs.priority; }
 };
 
+/**
+ * Higher priorities are popped first, messages of the same priority in the order they were pushed.
+ * Each priority has a ring of `capacity` messages allocated up front, so pushing never allocates
+ * nor waits: a push into a full ring drops the message and counts it, as the consumer may be gone.
+ */
 class MessageQueue {
 public:
-  explicit MessageQueue(u32 capacity = 65536) : _capacity{capacity} {}
+  explicit MessageQueue(u32 capacity = 1024) : _capacity{capacity} {
+    for (auto &ring : _rings) {
+      ring.messages.reset(new Message[capacity]);
+    }
+  }
 
   ~MessageQueue() {
     std::unique_lock<std::mutex> lock(_mutex);
     _closeFlag = true;
   }
 
+  // Returns false if the message was dropped, the queue being closed or its ring full
   bool push(Message message) {
     std::unique_lock<std::mutex> lock(_mutex);
+    auto &ring = _rings[message.priority];
     if (_closeFlag) { return false; }
-    // if (_queue.size() >= _capacity) { return false; }
-    _queue.push(message);
+    if (ring.count == _capacity) {
+      ++_dropped;
+      return false;
+    }
+    ring.messages[(ring.head + ring.count) % _capacity] = message;
+    ++ring.count;
+    ++_count;
     _condition.notify_one(); // Notify one thread that is waiting
     return true;
   }
 
   bool pop(Message *message) {
     std::unique_lock<std::mutex> lock(_mutex);
-    _condition.wait(lock, [this]() { return !_closeFlag && !_queue.empty(); });
+    _condition.wait(lock, [this]() { return !_closeFlag && _count > 0; });
     if (_closeFlag) { return false; }
-    *message = _queue.top();
-    _queue.pop();
+    take(message);
+    return true;
+  }
+
+  // Returns false instead of waiting when the queue is empty
+  bool try_pop(Message *message) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_closeFlag || _count == 0) { return false; }
+    take(message);
     return true;
   }
 
+  // Messages dropped so far for want of room
+  u64 dropped() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _dropped;
+  }
+
 private:
-  std::priority_queue<Message> _queue;
+  struct Ring {
+    std::unique_ptr<Message[]> messages;
+    u32 head = 0;
+    u32 count = 0;
+  };
+
+  void take(Message *message) {
+    for (u32 priority = MESSAGE_PRIORITY_COUNT; priority-- > 0;) {
+      if (auto &ring = _rings[priority]; ring.count > 0) {
+        *message = ring.messages[ring.head];
+        ring.head = (ring.head + 1) % _capacity;
+        --ring.count;
+        --_count;
+        return;
+      }
+    }
+  }
+
+  Ring _rings[MESSAGE_PRIORITY_COUNT];
+  u32 _count = 0;
   u32 _capacity;
+  u64 _dropped = 0;
   std::mutex _mutex;
   std::condition_variable _condition;
-  bool _closeFlag;
+  bool _closeFlag = false;
 };
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "defines.h"
+#include <atomic>
+
+/**
+ * Bounded lock-free multi-producer single-consumer queue. Every slot carries a sequence number
+ * telling producers whether it is free and the consumer whether it has been published, so pushes
+ * only contend on one atomic increment and never block.
+ */
+template <typename T, u32 Capacity> class MpscQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+public:
+  MpscQueue() {
+    for (u32 i = 0; i < Capacity; ++i) {
+      _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Callable from any thread, returns false if the queue is full
+  bool push(const T &value) {
+    auto position = _head.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &slot = _slots[position & (Capacity - 1)];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      auto diff = (i64)sequence - (i64)position;
+      if (diff == 0) {
+        if (_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          slot.value = value;
+          slot.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        position = _head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer thread only
+  bool pop(T *value) {
+    auto &slot = _slots[_tail & (Capacity - 1)];
+    auto sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence != _tail + 1) { return false; } // Empty, or the producer is still writing
+    *value = slot.value;
+    slot.sequence.store(_tail + Capacity, std::memory_order_release);
+    ++_tail;
+    return true;
+  }
+
+private:
+  struct Slot {
+    std::atomic<u64> sequence;
+    T value;
+  };
+
+  alignas(64) std::atomic<u64> _head{0};
+  alignas(64) u64 _tail = 0;
+  Slot _slots[Capacity];
+};
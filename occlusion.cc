@@ -0,0 +1,370 @@
+#include "occlusion.h"
+#include "job_system.h"
+#include "logger.h"
+#include "profiler.h"
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const u32 OCCLUSION_TILE_WIDTH = 32; // A multiple of the 8 pixels rasterized at once
+static const u32 OCCLUSION_TILE_HEIGHT = 16;
+static const u32 OCCLUSION_TILES_X = OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH;
+static const u32 OCCLUSION_TILES_Y = OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT;
+static const u32 OCCLUSION_TILE_COUNT = OCCLUSION_TILES_X * OCCLUSION_TILES_Y;
+static const u32 OCCLUSION_BLOCK = 8; // Pixels per side of a level 0 hierarchy texel
+static const u32 OCCLUSION_LEVEL_MAX = 8;
+static const i32 OCCLUSION_TEST_SPAN = 4; // Texels per side a test reads at most
+
+// Screen-space triangle ready to rasterize: inside where all three edge functions are positive
+struct OcclusionTriangle {
+  f32 edgeA[3], edgeB[3], edgeC[3]; // e(x, y) = a * x + b * y + c
+  f32 depthA, depthB, depthC;       // Depth plane, same form
+  i32 minX, minY, maxX, maxY;       // Pixel bounds, inclusive and clamped to the buffer
+};
+
+struct OcclusionLevel {
+  u32 offset; // Into `hierarchy`
+  u32 width;
+  u32 height;
+};
+
+struct OcclusionState {
+  void *jobSystemState;
+  std::vector<glm::vec3> occluderVertices; // World space, three per triangle
+  glm::mat4 viewProjection;
+  std::vector<OcclusionTriangle> triangles; // This frame's
+  std::vector<u32> bins[OCCLUSION_TILE_COUNT];
+  std::vector<f32> depth; // Depth in [0, 1], 1 where no occluder is
+  std::vector<f32> hierarchy; // Farthest depth of each texel, all levels
+  OcclusionLevel levels[OCCLUSION_LEVEL_MAX];
+  u32 levelCount;
+  OcclusionStats stats;
+};
+
+void occlusion_system_initialize(void **state, void *jobSystemState) {
+  auto s = new OcclusionState();
+  s->jobSystemState = jobSystemState;
+  s->depth.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f);
+
+  u32 width = OCCLUSION_WIDTH / OCCLUSION_BLOCK, height = OCCLUSION_HEIGHT / OCCLUSION_BLOCK;
+  u32 offset = 0;
+  for (;;) {
+    s->levels[s->levelCount++] = {offset, width, height};
+    offset += width * height;
+    if ((width == 1 && height == 1) || s->levelCount == OCCLUSION_LEVEL_MAX) { break; }
+    width = std::max(1u, width / 2);
+    height = std::max(1u, height / 2);
+  }
+  s->hierarchy.assign(offset, 1.0f);
+  *state = s;
+}
+
+void occlusion_system_shutdown(void **state) {
+  auto s = (OcclusionState *)*state;
+  DELETE(s);
+  *state = nullptr;
+}
+
+void occlusion_add_occluder(void *state, const f32 *positions, u32 stride, u32 vertexCount,
+                            const u32 *indices, u32 indexCount, const f32 *model) {
+  auto s = (OcclusionState *)state;
+  auto transform = glm::make_mat4(model);
+  for (u32 i = 0; i < indexCount; ++i) {
+    if (indices[i] >= vertexCount) {
+      LOG_ERROR("occluder index %u out of range (%u vertices)", indices[i], vertexCount);
+      return;
+    }
+  }
+  for (u32 i = 0; i + 2 < indexCount; i += 3) {
+    for (u32 j = 0; j < 3; ++j) {
+      auto p = (const f32 *)((const u8 *)positions + (size_t)indices[i + j] * stride);
+      s->occluderVertices.emplace_back(transform * glm::vec4(p[0], p[1], p[2], 1.0f));
+    }
+  }
+}
+
+// Projects a triangle to the buffer, false if it faces away, crosses the near plane or misses
+static bool setup_triangle(const glm::vec4 clip[3], OcclusionTriangle *out) {
+  f32 x[3], y[3], z[3];
+  for (u32 i = 0; i < 3; ++i) {
+    // Clipping would only recover a little occlusion, dropping the triangle stays conservative
+    if (clip[i].z < -clip[i].w || clip[i].w <= 0.0f) { return false; }
+    auto w = 1.0f / clip[i].w;
+    x[i] = (clip[i].x * w * 0.5f + 0.5f) * (f32)OCCLUSION_WIDTH;
+    y[i] = (clip[i].y * w * 0.5f + 0.5f) * (f32)OCCLUSION_HEIGHT;
+    z[i] = clip[i].z * w * 0.5f + 0.5f;
+  }
+  auto area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (area <= 0.0f) { return false; } // Back-facing or degenerate, counter-clockwise is front
+
+  // Pixel centers sit at +0.5
+  out->minX = std::max(0, (i32)std::floor(std::min({x[0], x[1], x[2]}) - 0.5f));
+  out->minY = std::max(0, (i32)std::floor(std::min({y[0], y[1], y[2]}) - 0.5f));
+  out->maxX = std::min((i32)OCCLUSION_WIDTH - 1, (i32)std::ceil(std::max({x[0], x[1], x[2]})));
+  out->maxY = std::min((i32)OCCLUSION_HEIGHT - 1, (i32)std::ceil(std::max({y[0], y[1], y[2]})));
+  if (out->minX > out->maxX || out->minY > out->maxY) { return false; }
+
+  for (u32 i = 0; i < 3; ++i) {
+    auto j = (i + 1) % 3;
+    out->edgeA[i] = y[i] - y[j];
+    out->edgeB[i] = x[j] - x[i];
+    out->edgeC[i] = -(out->edgeA[i] * x[i] + out->edgeB[i] * y[i]);
+  }
+  out->depthA = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+  out->depthB = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) / area;
+  out->depthC = z[0] - out->depthA * x[0] - out->depthB * y[0];
+  return true;
+}
+
+// Keeps the nearest depth of `triangle` over the pixels of a tile
+static void rasterize_triangle(f32 *depth, const OcclusionTriangle &triangle, i32 tileX,
+                               i32 tileY) {
+  // Whole groups of 8 from the tile's left edge, the edge functions mask the overhang
+  auto x0 = std::max(triangle.minX, tileX) & ~7;
+  auto x1 = std::min(triangle.maxX, tileX + (i32)OCCLUSION_TILE_WIDTH - 1);
+  auto y0 = std::max(triangle.minY, tileY);
+  auto y1 = std::min(triangle.maxY, tileY + (i32)OCCLUSION_TILE_HEIGHT - 1);
+  if (x0 > x1 || y0 > y1) { return; }
+
+#if defined(__AVX2__)
+  auto lanes = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+  auto zero = _mm256_setzero_ps();
+  __m256 a[3], step[3];
+  for (u32 i = 0; i < 3; ++i) {
+    a[i] = _mm256_set1_ps(triangle.edgeA[i]);
+    step[i] = _mm256_set1_ps(triangle.edgeA[i] * 8.0f);
+  }
+  auto depthA = _mm256_set1_ps(triangle.depthA);
+  auto depthStep = _mm256_set1_ps(triangle.depthA * 8.0f);
+  for (auto y = y0; y <= y1; ++y) {
+    auto py = (f32)y + 0.5f;
+    auto px = _mm256_add_ps(_mm256_set1_ps((f32)x0), lanes);
+    __m256 e[3];
+    for (u32 i = 0; i < 3; ++i) {
+      auto row = _mm256_set1_ps(triangle.edgeB[i] * py + triangle.edgeC[i]);
+      e[i] = _mm256_add_ps(_mm256_mul_ps(a[i], px), row);
+    }
+    auto z = _mm256_add_ps(_mm256_mul_ps(depthA, px),
+                           _mm256_set1_ps(triangle.depthB * py + triangle.depthC));
+    auto out = depth + (size_t)y * OCCLUSION_WIDTH;
+    for (auto x = x0; x <= x1; x += 8) {
+      auto inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e[0], zero, _CMP_GT_OQ),
+                                                _mm256_cmp_ps(e[1], zero, _CMP_GT_OQ)),
+                                  _mm256_cmp_ps(e[2], zero, _CMP_GT_OQ));
+      if (!_mm256_testz_ps(inside, inside)) {
+        auto stored = _mm256_loadu_ps(out + x);
+        auto nearest = _mm256_blendv_ps(stored, _mm256_min_ps(stored, z), inside);
+        _mm256_storeu_ps(out + x, nearest);
+      }
+      for (u32 i = 0; i < 3; ++i) {
+        e[i] = _mm256_add_ps(e[i], step[i]);
+      }
+      z = _mm256_add_ps(z, depthStep);
+    }
+  }
+#elif defined(__SSE2__)
+  // Baseline x86-64: the same loop 4 pixels wide, with masks in place of blends
+  auto lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  auto zero = _mm_setzero_ps();
+  __m128 a[3], step[3];
+  for (u32 i = 0; i < 3; ++i) {
+    a[i] = _mm_set1_ps(triangle.edgeA[i]);
+    step[i] = _mm_set1_ps(triangle.edgeA[i] * 4.0f);
+  }
+  auto depthA = _mm_set1_ps(triangle.depthA);
+  auto depthStep = _mm_set1_ps(triangle.depthA * 4.0f);
+  for (auto y = y0; y <= y1; ++y) {
+    auto py = (f32)y + 0.5f;
+    auto px = _mm_add_ps(_mm_set1_ps((f32)x0), lanes);
+    __m128 e[3];
+    for (u32 i = 0; i < 3; ++i) {
+      e[i] = _mm_add_ps(_mm_mul_ps(a[i], px),
+                        _mm_set1_ps(triangle.edgeB[i] * py + triangle.edgeC[i]));
+    }
+    auto z = _mm_add_ps(_mm_mul_ps(depthA, px),
+                        _mm_set1_ps(triangle.depthB * py + triangle.depthC));
+    auto out = depth + (size_t)y * OCCLUSION_WIDTH;
+    for (auto x = x0; x <= x1; x += 4) {
+      auto inside = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(e[0], zero), _mm_cmpgt_ps(e[1], zero)),
+                               _mm_cmpgt_ps(e[2], zero));
+      if (_mm_movemask_ps(inside)) {
+        auto stored = _mm_loadu_ps(out + x);
+        auto nearest = _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(stored, z)),
+                                 _mm_andnot_ps(inside, stored));
+        _mm_storeu_ps(out + x, nearest);
+      }
+      for (u32 i = 0; i < 3; ++i) {
+        e[i] = _mm_add_ps(e[i], step[i]);
+      }
+      z = _mm_add_ps(z, depthStep);
+    }
+  }
+#else
+  for (auto y = y0; y <= y1; ++y) {
+    auto py = (f32)y + 0.5f;
+    auto out = depth + (size_t)y * OCCLUSION_WIDTH;
+    for (auto x = x0; x <= x1; ++x) {
+      auto px = (f32)x + 0.5f;
+      auto inside = true;
+      for (u32 i = 0; i < 3; ++i) {
+        inside &= triangle.edgeA[i] * px + triangle.edgeB[i] * py + triangle.edgeC[i] > 0.0f;
+      }
+      if (inside) {
+        auto z = triangle.depthA * px + triangle.depthB * py + triangle.depthC;
+        out[x] = std::min(out[x], z);
+      }
+    }
+  }
+#endif
+}
+
+// Clears and fills one tile, then reduces it into the finest hierarchy level
+static void rasterize_tile(u32 tile, u32 worker, void *userData) {
+  auto s = (OcclusionState *)userData;
+  auto tileX = (i32)((tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_WIDTH);
+  auto tileY = (i32)((tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_HEIGHT);
+  auto depth = s->depth.data();
+  for (u32 y = 0; y < OCCLUSION_TILE_HEIGHT; ++y) {
+    auto row = depth + (size_t)(tileY + y) * OCCLUSION_WIDTH + tileX;
+    std::fill(row, row + OCCLUSION_TILE_WIDTH, 1.0f);
+  }
+  for (auto index : s->bins[tile]) {
+    rasterize_triangle(depth, s->triangles[index], tileX, tileY);
+  }
+
+  const auto &level = s->levels[0];
+  for (u32 by = 0; by < OCCLUSION_TILE_HEIGHT / OCCLUSION_BLOCK; ++by) {
+    for (u32 bx = 0; bx < OCCLUSION_TILE_WIDTH / OCCLUSION_BLOCK; ++bx) {
+      auto farthest = 0.0f;
+      for (u32 y = 0; y < OCCLUSION_BLOCK; ++y) {
+        auto row = depth + (size_t)(tileY + by * OCCLUSION_BLOCK + y) * OCCLUSION_WIDTH + tileX +
+                   bx * OCCLUSION_BLOCK;
+        for (u32 x = 0; x < OCCLUSION_BLOCK; ++x) {
+          farthest = std::max(farthest, row[x]);
+        }
+      }
+      auto texelX = tileX / OCCLUSION_BLOCK + bx, texelY = tileY / OCCLUSION_BLOCK + by;
+      s->hierarchy[level.offset + texelY * level.width + texelX] = farthest;
+    }
+  }
+}
+
+void occlusion_begin_frame(void *state, const f32 *viewProjection) {
+  PROFILE_ZONE("occlusion/rasterize");
+  auto s = (OcclusionState *)state;
+  s->viewProjection = glm::make_mat4(viewProjection);
+  s->stats = {};
+
+  s->triangles.clear();
+  for (auto &bin : s->bins) {
+    bin.clear();
+  }
+  for (size_t i = 0; i + 2 < s->occluderVertices.size(); i += 3) {
+    glm::vec4 clip[3];
+    for (u32 j = 0; j < 3; ++j) {
+      clip[j] = s->viewProjection * glm::vec4(s->occluderVertices[i + j], 1.0f);
+    }
+    OcclusionTriangle triangle;
+    if (!setup_triangle(clip, &triangle)) { continue; }
+    auto index = (u32)s->triangles.size();
+    s->triangles.push_back(triangle);
+    // Bin by bounding box, the tiles a triangle only grazes reject it on the edge functions
+    for (auto ty = triangle.minY / (i32)OCCLUSION_TILE_HEIGHT;
+         ty <= triangle.maxY / (i32)OCCLUSION_TILE_HEIGHT; ++ty) {
+      for (auto tx = triangle.minX / (i32)OCCLUSION_TILE_WIDTH;
+           tx <= triangle.maxX / (i32)OCCLUSION_TILE_WIDTH; ++tx) {
+        s->bins[ty * OCCLUSION_TILES_X + tx].push_back(index);
+      }
+    }
+  }
+  s->stats.occluderTriangles = (u32)s->triangles.size();
+
+  job_system_parallel_for(s->jobSystemState, OCCLUSION_TILE_COUNT, rasterize_tile, s);
+
+  for (u32 l = 1; l < s->levelCount; ++l) {
+    const auto &source = s->levels[l - 1];
+    const auto &level = s->levels[l];
+    for (u32 y = 0; y < level.height; ++y) {
+      for (u32 x = 0; x < level.width; ++x) {
+        // Odd sizes fold the last row or column into the texel before it
+        auto x0 = x * 2, x1 = std::min(x * 2 + 1, source.width - 1);
+        auto y0 = y * 2, y1 = std::min(y * 2 + 1, source.height - 1);
+        if (x == level.width - 1) { x1 = source.width - 1; }
+        if (y == level.height - 1) { y1 = source.height - 1; }
+        auto farthest = 0.0f;
+        for (auto sy = y0; sy <= y1; ++sy) {
+          for (auto sx = x0; sx <= x1; ++sx) {
+            farthest = std::max(farthest, s->hierarchy[source.offset + sy * source.width + sx]);
+          }
+        }
+        s->hierarchy[level.offset + y * level.width + x] = farthest;
+      }
+    }
+  }
+}
+
+bool occlusion_test_aabb(void *state, const f32 *boundsMin, const f32 *boundsMax) {
+  auto s = (OcclusionState *)state;
+  ++s->stats.tested;
+
+  // The corners are the min corner plus any combination of the three scaled axes
+  const auto &m = s->viewProjection;
+  auto base = m * glm::vec4(boundsMin[0], boundsMin[1], boundsMin[2], 1.0f);
+  glm::vec4 axes[3] = {m[0] * (boundsMax[0] - boundsMin[0]), m[1] * (boundsMax[1] - boundsMin[1]),
+                       m[2] * (boundsMax[2] - boundsMin[2])};
+  glm::vec3 ndcMin(1e30f), ndcMax(-1e30f);
+  u32 behind = 0; // Corners on the camera side of the near plane, they do not project
+  for (u32 i = 0; i < 8; ++i) {
+    auto clip = base;
+    for (u32 axis = 0; axis < 3; ++axis) {
+      if (i & (1u << axis)) { clip += axes[axis]; }
+    }
+    if (clip.z < -clip.w || clip.w <= 0.0f) {
+      ++behind;
+      continue;
+    }
+    auto ndc = glm::vec3(clip) / clip.w;
+    ndcMin = glm::min(ndcMin, ndc);
+    ndcMax = glm::max(ndcMax, ndc);
+  }
+  if (behind > 0 && behind < 8) { return true; } // Reaches the camera
+  if (behind == 8 || ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f ||
+      ndcMin.z > 1.0f) {
+    ++s->stats.culled;
+    return false;
+  }
+
+  // Nearest depth of the box against the farthest occluder depth over its rectangle
+  auto nearest = ndcMin.z * 0.5f + 0.5f;
+  auto toPixel = [](f32 ndc, u32 size) {
+    return std::clamp((i32)std::floor((ndc * 0.5f + 0.5f) * (f32)size), 0, (i32)size - 1);
+  };
+  auto x0 = toPixel(ndcMin.x, OCCLUSION_WIDTH) / (i32)OCCLUSION_BLOCK;
+  auto x1 = toPixel(ndcMax.x, OCCLUSION_WIDTH) / (i32)OCCLUSION_BLOCK;
+  auto y0 = toPixel(ndcMin.y, OCCLUSION_HEIGHT) / (i32)OCCLUSION_BLOCK;
+  auto y1 = toPixel(ndcMax.y, OCCLUSION_HEIGHT) / (i32)OCCLUSION_BLOCK;
+  u32 l = 0;
+  while (l + 1 < s->levelCount &&
+         (x1 - x0 >= OCCLUSION_TEST_SPAN || y1 - y0 >= OCCLUSION_TEST_SPAN)) {
+    ++l;
+    x0 >>= 1, x1 >>= 1, y0 >>= 1, y1 >>= 1;
+  }
+  const auto &level = s->levels[l];
+  x0 = std::min(x0, (i32)level.width - 1), x1 = std::min(x1, (i32)level.width - 1);
+  y0 = std::min(y0, (i32)level.height - 1), y1 = std::min(y1, (i32)level.height - 1);
+  for (auto y = y0; y <= y1; ++y) {
+    for (auto x = x0; x <= x1; ++x) {
+      if (s->hierarchy[level.offset + y * level.width + x] >= nearest) { return true; }
+    }
+  }
+  ++s->stats.culled;
+  return false;
+}
+
+OcclusionStats occlusion_get_stats(void *state) { return ((OcclusionState *)state)->stats; }
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "defines.h"
+
+/**
+ * Software occlusion culling. A few designated occluder meshes are rasterized on the CPU into a
+ * small depth buffer, split in tiles that the job system fills in parallel, then reduced to a
+ * hierarchy of farthest depths. Objects are tested by the screen rectangle and nearest depth of
+ * their bounding box against the level where that rectangle spans a handful of texels, so a test
+ * costs the same whatever the object's size. Occluders should be closed, counter-clockwise meshes
+ * that sit inside the geometry they stand for, never outside it.
+ */
+
+static const u32 OCCLUSION_WIDTH = 256; // Depth buffer size, independent of the viewport
+static const u32 OCCLUSION_HEIGHT = 128;
+
+struct OcclusionStats {
+  u32 occluderTriangles; // Rasterized this frame, after back-face and near-plane rejection
+  u32 tested;
+  u32 culled; // Hidden or outside the view
+};
+
+void occlusion_system_initialize(void **state, void *jobSystemState);
+void occlusion_system_shutdown(void **state);
+/**
+ * Adds an occluder, kept in world space
+ * @param positions first position, 3 floats
+ * @param stride distance in bytes between two positions
+ * @param model column-major matrix applied to the positions
+ */
+void occlusion_add_occluder(void *state, const f32 *positions, u32 stride, u32 vertexCount,
+                            const u32 *indices, u32 indexCount, const f32 *model);
+// Rasterizes the occluders seen through `viewProjection` (column-major), once per frame
+void occlusion_begin_frame(void *state, const f32 *viewProjection);
+// @return false when the world-space box is fully hidden or outside the view
+bool occlusion_test_aabb(void *state, const f32 *boundsMin, const f32 *boundsMax);
+// Counts since the last `occlusion_begin_frame`
+OcclusionStats occlusion_get_stats(void *state);
@@ -0,0 +1,125 @@
+#include "overlay.h"
+#include "frame_stats.h"
+#include "memory_stats.h"
+#include "program.h"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+static const u32 OVERLAY_GRAPH_SAMPLES = 240;
+static const f32 OVERLAY_BAR_WIDTH = 2.0f;   // Pixels
+static const f32 OVERLAY_GRAPH_HEIGHT = 120; // Pixels, twice the budget
+static const f32 OVERLAY_MARGIN = 8.0f;
+
+struct OverlayVertex {
+  f32 position[2];
+  u8 color[4];
+};
+
+struct OverlayState {
+  GLuint program;
+  GLuint vao;
+  GLuint vbo;
+  u64 vboSize; // Bytes
+  std::vector<OverlayVertex> vertices;
+  f32 samples[OVERLAY_GRAPH_SAMPLES];
+};
+
+static void push_quad(OverlayState *s, f32 x0, f32 y0, f32 x1, f32 y1, u32 rgba) {
+  OverlayVertex a{{x0, y0}}, b{{x1, y0}}, c{{x0, y1}}, d{{x1, y1}};
+  for (auto vertex : {&a, &b, &c, &d}) {
+    for (u32 i = 0; i < 4; ++i) {
+      vertex->color[i] = (u8)(rgba >> (24 - i * 8));
+    }
+  }
+  s->vertices.insert(s->vertices.end(), {a, b, c, b, d, c});
+}
+
+bool overlay_initialize(void **state) {
+  auto s = new OverlayState();
+  if (!program_create(&s->program, {{GL_VERTEX_SHADER, "shaders/overlay.vert"},
+                                    {GL_FRAGMENT_SHADER, "shaders/overlay.frag"}})) {
+    DELETE(s);
+    return false;
+  }
+  glGenVertexArrays(1, &s->vao);
+  glGenBuffers(1, &s->vbo);
+  glBindVertexArray(s->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, s->vbo);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex),
+                        (any)offsetof(OverlayVertex, position));
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(OverlayVertex),
+                        (any)offsetof(OverlayVertex, color));
+  glEnableVertexAttribArray(1);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+  *state = s;
+  return true;
+}
+
+void overlay_shutdown(void **state) {
+  auto s = (OverlayState *)*state;
+  glDeleteBuffers(1, &s->vbo);
+  if (s->vboSize > 0) { memory_stats_free(MEMORY_TAG_MESH, MEMORY_DOMAIN_GPU, s->vboSize); }
+  glDeleteVertexArrays(1, &s->vao);
+  program_destroy(s->program);
+  DELETE(s);
+  *state = nullptr;
+}
+
+void overlay_draw_frame_graph(void *state, void *frameStatsState, u32 width, u32 height,
+                              f64 budgetMs) {
+  auto s = (OverlayState *)state;
+  auto count =
+      frame_stats_history(frameStatsState, FRAME_STAT_INTERVAL, s->samples, OVERLAY_GRAPH_SAMPLES);
+  FrameStatsReport report{};
+  frame_stats_report(frameStatsState, false, &report);
+
+  auto scale = OVERLAY_GRAPH_HEIGHT / (f32)(budgetMs * 2); // Pixels per millisecond
+  auto x0 = OVERLAY_MARGIN, y0 = OVERLAY_MARGIN;
+  auto x1 = x0 + OVERLAY_GRAPH_SAMPLES * OVERLAY_BAR_WIDTH, y1 = y0 + OVERLAY_GRAPH_HEIGHT;
+
+  s->vertices.clear();
+  push_quad(s, x0, y0, x1, y1, 0x000000a0);
+  for (u32 i = 0; i < count; ++i) {
+    auto ms = s->samples[i];
+    auto color = ms <= budgetMs ? 0x40d040ff : ms <= budgetMs * 1.5 ? 0xe0c040ff : 0xe04040ff;
+    auto x = x0 + (OVERLAY_GRAPH_SAMPLES - count + i) * OVERLAY_BAR_WIDTH;
+    auto y = y0 + std::min(ms * scale, OVERLAY_GRAPH_HEIGHT);
+    push_quad(s, x, y0, x + OVERLAY_BAR_WIDTH - 0.5f, y, color);
+  }
+  const auto &interval = report.stats[FRAME_STAT_INTERVAL];
+  for (auto ms : {interval.p50, interval.p95, interval.p99}) {
+    if (interval.count == 0) { break; }
+    auto y = y0 + std::min((f32)ms * scale, OVERLAY_GRAPH_HEIGHT);
+    push_quad(s, x0, y, x1, y + 1, 0x60a0ffc0);
+  }
+  auto budgetY = y0 + (f32)budgetMs * scale;
+  push_quad(s, x0, budgetY, x1, budgetY + 1, 0xffffffc0);
+
+  glViewport(0, 0, width, height);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  program_use(s->program);
+  program_set_vec2(s->program, "viewport", (f32)width, (f32)height);
+  glBindVertexArray(s->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, s->vbo);
+  auto vboSize = s->vertices.size() * sizeof(OverlayVertex);
+  // Orphan last frame's storage instead of waiting for it
+  glBufferData(GL_ARRAY_BUFFER, vboSize, nullptr, GL_STREAM_DRAW);
+  if (vboSize != s->vboSize) {
+    if (s->vboSize > 0) { memory_stats_free(MEMORY_TAG_MESH, MEMORY_DOMAIN_GPU, s->vboSize); }
+    memory_stats_allocate(MEMORY_TAG_MESH, MEMORY_DOMAIN_GPU, vboSize);
+    s->vboSize = vboSize;
+  }
+  glBufferSubData(GL_ARRAY_BUFFER, 0, vboSize, s->vertices.data());
+  glDrawArrays(GL_TRIANGLES, 0, (GLsizei)s->vertices.size());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+
+  glDisable(GL_BLEND);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "defines.h"
+
+/**
+ * Debug overlay drawn on top of the frame. Everything is built on the CPU as colored quads in
+ * pixel coordinates and streamed in one draw call.
+ */
+
+bool overlay_initialize(void **state);
+void overlay_shutdown(void **state);
+/**
+ * Bar graph of the recent frame intervals in the bottom-left corner: green within the budget,
+ * yellow up to a hitch, red beyond. The white line marks the budget, the blue lines the rolling
+ * p50, p95 and p99.
+ */
+void overlay_draw_frame_graph(void *state, void *frameStatsState, u32 width, u32 height,
+                              f64 budgetMs);
@@ -0,0 +1,443 @@
+#include "particles.h"
+#include "job_system.h"
+#include "memory_stats.h"
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+static const u32 PARTICLE_LANES = 8;
+#elif defined(__SSE2__)
+static const u32 PARTICLE_LANES = 4;
+#else
+static const u32 PARTICLE_LANES = 1;
+#endif
+static const u32 PARTICLE_CHUNK = 4096; // Particles per job, a multiple of the lanes
+
+enum ParticleStream {
+  PARTICLE_STREAM_POSITION_X = 0x0,
+  PARTICLE_STREAM_POSITION_Y,
+  PARTICLE_STREAM_POSITION_Z,
+  PARTICLE_STREAM_VELOCITY_X,
+  PARTICLE_STREAM_VELOCITY_Y,
+  PARTICLE_STREAM_VELOCITY_Z,
+  PARTICLE_STREAM_AGE,
+  PARTICLE_STREAM_LIFE, // Dead once the age reaches it
+  PARTICLE_STREAM_COLOR, // RGBA8 bits, moved around as floats
+
+  PARTICLE_STREAM_COUNT,
+};
+
+struct ParticleEmitter {
+  ParticleEmitterDesc desc;
+  u32 stride; // Floats per stream, the capacity rounded up to the lanes
+  // Two sets of streams: the live one, and the one the next update packs the survivors into.
+  // Slots past `count` up to the next lane boundary have no life, so whole lanes can be processed.
+  std::vector<f32> streams[2];
+  u32 current;
+  u32 count;
+  f32 spawnDebt; // Fraction of a particle owed to the next update
+  u32 random;
+};
+
+// A job's range of an emitter's particles
+struct ParticleChunk {
+  u32 emitter;
+  u32 begin;
+  u32 end;
+  u32 alive;    // Survivors of the integration
+  u32 offset;   // Where they go in the emitter's packed streams
+  u32 instance; // And in the instances
+};
+
+struct ParticleBatch {
+  u32 material;
+  u32 firstInstance;
+  u32 instanceCount;
+};
+
+struct ParticleSystemState {
+  f32 gravity[3];
+  f32 dt;
+  std::vector<ParticleEmitter> emitters;
+  std::vector<u32> order; // Emitters by material
+  std::vector<ParticleChunk> chunks;
+  std::vector<ParticleInstance> instances; // Sized for every emitter at capacity
+  u32 instanceCount;
+  std::vector<ParticleBatch> batches;
+  ParticleStats stats;
+  GLuint vao;
+  GLuint buffer;
+  u64 bufferBytes;
+};
+
+#if defined(__AVX2__)
+// Lane indices that move the lanes set in a mask to the front, for _mm256_permutevar8x32_ps
+struct ParticlePackTable {
+  u32 lanes[256][8];
+  ParticlePackTable() {
+    for (u32 mask = 0; mask < 256; ++mask) {
+      u32 n = 0;
+      for (u32 lane = 0; lane < 8; ++lane) {
+        if (mask & (1u << lane)) { lanes[mask][n++] = lane; }
+      }
+      std::fill(lanes[mask] + n, lanes[mask] + 8, 0);
+    }
+  }
+};
+static const ParticlePackTable PARTICLE_PACK_TABLE;
+#endif
+
+static u32 round_up_to_lanes(u32 count) {
+  return (count + PARTICLE_LANES - 1) / PARTICLE_LANES * PARTICLE_LANES;
+}
+
+static f32 *stream(ParticleEmitter &emitter, u32 set, u32 stream) {
+  return emitter.streams[set].data() + (u64)stream * emitter.stride;
+}
+
+// Of its streams and its share of the instances
+static u64 emitter_bytes(const ParticleEmitter &emitter) {
+  return 2ull * PARTICLE_STREAM_COUNT * emitter.stride * sizeof(f32) +
+         (u64)emitter.desc.capacity * sizeof(ParticleInstance);
+}
+
+// Xorshift, in [0, 1)
+static f32 random_unit(u32 *random) {
+  auto x = *random;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *random = x;
+  return (f32)(x >> 8) / (f32)(1 << 24);
+}
+
+static void run_jobs(void *jobSystemState, u32 count, PFN_job fn, void *userData) {
+  if (jobSystemState) {
+    job_system_parallel_for(jobSystemState, count, fn, userData);
+  } else {
+    for (u32 i = 0; i < count; ++i) {
+      fn(i, 0, userData);
+    }
+  }
+}
+
+static u32 spawn(ParticleEmitter &emitter, f32 dt) {
+  const auto &desc = emitter.desc;
+  emitter.spawnDebt += desc.rate * dt;
+  auto owed = (u32)emitter.spawnDebt;
+  emitter.spawnDebt -= (f32)owed; // What does not fit is dropped
+  auto n = std::min(owed, desc.capacity - emitter.count);
+  f32 *streams[PARTICLE_STREAM_COUNT];
+  for (u32 i = 0; i < PARTICLE_STREAM_COUNT; ++i) {
+    streams[i] = stream(emitter, emitter.current, i);
+  }
+  f32 color;
+  memcpy(&color, desc.color, sizeof(color));
+  for (auto i = emitter.count; i < emitter.count + n; ++i) {
+    for (u32 c = 0; c < 3; ++c) {
+      streams[PARTICLE_STREAM_POSITION_X + c][i] = desc.position[c];
+      streams[PARTICLE_STREAM_VELOCITY_X + c][i] =
+          desc.velocity[c] + (random_unit(&emitter.random) * 2.0f - 1.0f) * desc.spread;
+    }
+    streams[PARTICLE_STREAM_AGE][i] = 0.0f;
+    streams[PARTICLE_STREAM_LIFE][i] =
+        desc.life[0] + (desc.life[1] - desc.life[0]) * random_unit(&emitter.random);
+    streams[PARTICLE_STREAM_COLOR][i] = color;
+  }
+  emitter.count += n;
+  std::fill(streams[PARTICLE_STREAM_LIFE] + emitter.count,
+            streams[PARTICLE_STREAM_LIFE] + round_up_to_lanes(emitter.count), 0.0f);
+  return n;
+}
+
+// Integrates velocities and positions, ages the particles and counts the survivors
+static void integrate_chunk(u32 index, u32 worker, void *userData) {
+  auto s = (ParticleSystemState *)userData;
+  auto &chunk = s->chunks[index];
+  auto &emitter = s->emitters[chunk.emitter];
+  f32 *p[3], *v[3];
+  for (u32 c = 0; c < 3; ++c) {
+    p[c] = stream(emitter, emitter.current, PARTICLE_STREAM_POSITION_X + c);
+    v[c] = stream(emitter, emitter.current, PARTICLE_STREAM_VELOCITY_X + c);
+  }
+  auto age = stream(emitter, emitter.current, PARTICLE_STREAM_AGE);
+  auto life = stream(emitter, emitter.current, PARTICLE_STREAM_LIFE);
+  auto dt = s->dt;
+  auto damping = std::max(0.0f, 1.0f - emitter.desc.drag * dt);
+  u32 alive = 0;
+#if defined(__AVX2__)
+  auto dtLanes = _mm256_set1_ps(dt), dampingLanes = _mm256_set1_ps(damping);
+  __m256 impulse[3];
+  for (u32 c = 0; c < 3; ++c) {
+    impulse[c] = _mm256_set1_ps(s->gravity[c] * dt);
+  }
+  for (auto i = chunk.begin; i < chunk.end; i += PARTICLE_LANES) {
+    for (u32 c = 0; c < 3; ++c) {
+      auto velocity = _mm256_loadu_ps(v[c] + i);
+      velocity = _mm256_mul_ps(_mm256_add_ps(velocity, impulse[c]), dampingLanes);
+      _mm256_storeu_ps(v[c] + i, velocity);
+      _mm256_storeu_ps(p[c] + i, _mm256_add_ps(_mm256_loadu_ps(p[c] + i),
+                                               _mm256_mul_ps(velocity, dtLanes)));
+    }
+    auto ages = _mm256_add_ps(_mm256_loadu_ps(age + i), dtLanes);
+    _mm256_storeu_ps(age + i, ages);
+    auto living = _mm256_cmp_ps(ages, _mm256_loadu_ps(life + i), _CMP_LT_OQ);
+    alive += __builtin_popcount(_mm256_movemask_ps(living));
+  }
+#elif defined(__SSE2__)
+  auto dtLanes = _mm_set1_ps(dt), dampingLanes = _mm_set1_ps(damping);
+  __m128 impulse[3];
+  for (u32 c = 0; c < 3; ++c) {
+    impulse[c] = _mm_set1_ps(s->gravity[c] * dt);
+  }
+  for (auto i = chunk.begin; i < chunk.end; i += PARTICLE_LANES) {
+    for (u32 c = 0; c < 3; ++c) {
+      auto velocity = _mm_loadu_ps(v[c] + i);
+      velocity = _mm_mul_ps(_mm_add_ps(velocity, impulse[c]), dampingLanes);
+      _mm_storeu_ps(v[c] + i, velocity);
+      _mm_storeu_ps(p[c] + i, _mm_add_ps(_mm_loadu_ps(p[c] + i), _mm_mul_ps(velocity, dtLanes)));
+    }
+    auto ages = _mm_add_ps(_mm_loadu_ps(age + i), dtLanes);
+    _mm_storeu_ps(age + i, ages);
+    alive += __builtin_popcount(_mm_movemask_ps(_mm_cmplt_ps(ages, _mm_loadu_ps(life + i))));
+  }
+#else
+  for (auto i = chunk.begin; i < chunk.end; ++i) {
+    for (u32 c = 0; c < 3; ++c) {
+      v[c][i] = (v[c][i] + s->gravity[c] * dt) * damping;
+      p[c][i] += v[c][i] * dt;
+    }
+    age[i] += dt;
+    alive += age[i] < life[i];
+  }
+#endif
+  chunk.alive = alive;
+}
+
+// Packs the survivors into the emitter's other streams and writes their instances
+static void pack_chunk(u32 index, u32 worker, void *userData) {
+  auto s = (ParticleSystemState *)userData;
+  const auto &chunk = s->chunks[index];
+  auto &emitter = s->emitters[chunk.emitter];
+  auto next = 1 - emitter.current;
+  f32 *source[PARTICLE_STREAM_COUNT], *destination[PARTICLE_STREAM_COUNT];
+  for (u32 i = 0; i < PARTICLE_STREAM_COUNT; ++i) {
+    source[i] = stream(emitter, emitter.current, i);
+    destination[i] = stream(emitter, next, i) + chunk.offset;
+  }
+  auto age = source[PARTICLE_STREAM_AGE], life = source[PARTICLE_STREAM_LIFE];
+  u32 written = 0;
+#if defined(__AVX2__)
+  for (auto i = chunk.begin; i < chunk.end; i += PARTICLE_LANES) {
+    auto living = _mm256_cmp_ps(_mm256_loadu_ps(age + i), _mm256_loadu_ps(life + i), _CMP_LT_OQ);
+    auto mask = (u32)_mm256_movemask_ps(living);
+    if (!mask) { continue; }
+    auto lanes = _mm256_loadu_si256((const __m256i *)PARTICLE_PACK_TABLE.lanes[mask]);
+    auto n = (u32)__builtin_popcount(mask);
+    // Whole vectors while they stay inside this chunk's range, the next chunk's job writes after it
+    auto whole = written + PARTICLE_LANES <= chunk.alive;
+    for (u32 j = 0; j < PARTICLE_STREAM_COUNT; ++j) {
+      auto packed = _mm256_permutevar8x32_ps(_mm256_loadu_ps(source[j] + i), lanes);
+      if (whole) {
+        _mm256_storeu_ps(destination[j] + written, packed);
+      } else {
+        alignas(32) f32 values[PARTICLE_LANES];
+        _mm256_store_ps(values, packed);
+        memcpy(destination[j] + written, values, n * sizeof(f32));
+      }
+    }
+    written += n;
+  }
+#else
+  for (auto i = chunk.begin; i < chunk.end; ++i) {
+    if (!(age[i] < life[i])) { continue; }
+    for (u32 j = 0; j < PARTICLE_STREAM_COUNT; ++j) {
+      destination[j][written] = source[j][i];
+    }
+    ++written;
+  }
+#endif
+
+  auto size = emitter.desc.size;
+  auto instances = s->instances.data() + chunk.instance;
+  for (u32 i = 0; i < written; ++i) {
+    auto &instance = instances[i];
+    instance.position[0] = destination[PARTICLE_STREAM_POSITION_X][i];
+    instance.position[1] = destination[PARTICLE_STREAM_POSITION_Y][i];
+    instance.position[2] = destination[PARTICLE_STREAM_POSITION_Z][i];
+    instance.size = size;
+    memcpy(instance.color, &destination[PARTICLE_STREAM_COLOR][i], sizeof(instance.color));
+    auto fade = 1.0f - destination[PARTICLE_STREAM_AGE][i] / destination[PARTICLE_STREAM_LIFE][i];
+    instance.color[3] = (u8)((f32)instance.color[3] * fade);
+  }
+}
+
+void particle_system_initialize(void **state, const f32 *gravity) {
+  auto s = new ParticleSystemState();
+  memcpy(s->gravity, gravity, sizeof(s->gravity));
+  *state = s;
+}
+
+void particle_system_shutdown(void **state) {
+  auto s = (ParticleSystemState *)*state;
+  for (const auto &emitter : s->emitters) {
+    memory_stats_free(MEMORY_TAG_PARTICLE, MEMORY_DOMAIN_CPU, emitter_bytes(emitter));
+  }
+  DELETE(s);
+  *state = nullptr;
+}
+
+u32 particle_emitter_create(void *state, const ParticleEmitterDesc &desc) {
+  auto s = (ParticleSystemState *)state;
+  auto id = (u32)s->emitters.size();
+  s->emitters.emplace_back();
+  auto &emitter = s->emitters.back();
+  emitter.desc = desc;
+  emitter.stride = round_up_to_lanes(desc.capacity);
+  for (auto &streams : emitter.streams) {
+    streams.assign((u64)PARTICLE_STREAM_COUNT * emitter.stride, 0.0f);
+  }
+  emitter.random = id * 0x9e3779b9u + 1;
+  s->instances.resize(s->instances.size() + desc.capacity);
+  memory_stats_allocate(MEMORY_TAG_PARTICLE, MEMORY_DOMAIN_CPU, emitter_bytes(emitter));
+
+  s->order.push_back(id);
+  std::stable_sort(s->order.begin(), s->order.end(), [s](u32 a, u32 b) {
+    return s->emitters[a].desc.material < s->emitters[b].desc.material;
+  });
+  return id;
+}
+
+void particle_system_update(void *state, void *jobSystemState, f32 dt) {
+  PROFILE_ZONE("particles/update");
+  auto s = (ParticleSystemState *)state;
+  auto startTime = std::chrono::steady_clock::now();
+  s->dt = dt;
+  s->stats.spawned = 0;
+  s->chunks.clear();
+  for (auto id : s->order) {
+    auto &emitter = s->emitters[id];
+    s->stats.spawned += spawn(emitter, dt);
+    auto end = round_up_to_lanes(emitter.count);
+    for (u32 begin = 0; begin < end; begin += PARTICLE_CHUNK) {
+      s->chunks.push_back({id, begin, std::min(begin + PARTICLE_CHUNK, end)});
+    }
+  }
+  run_jobs(jobSystemState, (u32)s->chunks.size(), integrate_chunk, s);
+
+  // Survivors keep their order, the chunks of an emitter follow each other
+  s->batches.clear();
+  u32 instance = 0;
+  auto chunk = s->chunks.begin();
+  for (auto id : s->order) {
+    auto &emitter = s->emitters[id];
+    if (s->batches.empty() || s->batches.back().material != emitter.desc.material) {
+      s->batches.push_back({emitter.desc.material, instance, 0});
+    }
+    u32 count = 0;
+    for (; chunk != s->chunks.end() && chunk->emitter == id; ++chunk) {
+      chunk->offset = count;
+      chunk->instance = instance;
+      count += chunk->alive;
+      instance += chunk->alive;
+    }
+    emitter.count = count;
+    s->batches.back().instanceCount += count;
+  }
+  run_jobs(jobSystemState, (u32)s->chunks.size(), pack_chunk, s);
+
+  for (auto &emitter : s->emitters) {
+    emitter.current = 1 - emitter.current;
+    auto life = stream(emitter, emitter.current, PARTICLE_STREAM_LIFE);
+    std::fill(life + emitter.count, life + round_up_to_lanes(emitter.count), 0.0f);
+  }
+  s->instanceCount = instance;
+  s->stats.emitters = (u32)s->emitters.size();
+  s->stats.particles = instance;
+  s->stats.updateMs =
+      std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+const ParticleInstance *particle_system_instances(void *state, u32 *outCount) {
+  auto s = (ParticleSystemState *)state;
+  *outCount = s->instanceCount;
+  return s->instances.data();
+}
+
+void particle_system_get_stats(void *state, ParticleStats *outStats) {
+  *outStats = ((ParticleSystemState *)state)->stats;
+}
+
+// Points the per-instance attributes at the instances from `firstInstance` on
+static void set_instance_attributes(u32 firstInstance) {
+  auto offset = (u64)firstInstance * sizeof(ParticleInstance);
+  glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (any)offset);
+  glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ParticleInstance),
+                        (any)(offset + offsetof(ParticleInstance, color)));
+}
+
+void particle_system_gpu_initialize(void *state) {
+  auto s = (ParticleSystemState *)state;
+  glGenVertexArrays(1, &s->vao);
+  glGenBuffers(1, &s->buffer);
+  glBindVertexArray(s->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+  set_instance_attributes(0);
+  for (u32 location = 0; location < 2; ++location) {
+    glVertexAttribDivisor(location, 1);
+    glEnableVertexAttribArray(location);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void particle_system_gpu_shutdown(void *state) {
+  auto s = (ParticleSystemState *)state;
+  if (s->bufferBytes) { memory_stats_free(MEMORY_TAG_PARTICLE, MEMORY_DOMAIN_GPU, s->bufferBytes); }
+  s->bufferBytes = 0;
+  glDeleteBuffers(1, &s->buffer);
+  glDeleteVertexArrays(1, &s->vao);
+  s->buffer = s->vao = 0;
+}
+
+void particle_system_upload(void *state) {
+  PROFILE_ZONE("particles/upload");
+  auto s = (ParticleSystemState *)state;
+  auto bytes = s->instances.size() * sizeof(ParticleInstance);
+  if (bytes != s->bufferBytes) { // Emitters were added
+    if (s->bufferBytes) {
+      memory_stats_free(MEMORY_TAG_PARTICLE, MEMORY_DOMAIN_GPU, s->bufferBytes);
+    }
+    memory_stats_allocate(MEMORY_TAG_PARTICLE, MEMORY_DOMAIN_GPU, bytes);
+    s->bufferBytes = bytes;
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+  // Orphans the storage the previous frame's draws may still read
+  glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, (u64)s->instanceCount * sizeof(ParticleInstance),
+                  s->instances.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void particle_system_draw(void *state, u32 material) {
+  auto s = (ParticleSystemState *)state;
+  for (const auto &batch : s->batches) {
+    if (batch.material != material || batch.instanceCount == 0) { continue; }
+    glBindVertexArray(s->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, s->buffer);
+    set_instance_attributes(batch.firstInstance); // GL 4.1 has no base instance
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batch.instanceCount);
+    glBindVertexArray(0);
+  }
+}
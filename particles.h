@@ -0,0 +1,58 @@
+#pragma once
+
+#include "defines.h"
+#include "opengl.h"
+
+/**
+ * CPU particles. Each emitter keeps its particles as structures of arrays, one stream per
+ * component, and the update runs in chunks spread over the job system: a first pass integrates
+ * forces and velocities and counts the survivors of every chunk with SIMD, a second one packs the
+ * survivors into the emitter's other set of streams and writes them as instances. Emitters of the
+ * same material are laid out next to each other in the instance buffer, so drawing them is a
+ * single instanced call of camera-facing quads, see shaders/particle.vert.
+ */
+
+struct ParticleEmitterDesc {
+  f32 position[3];
+  f32 velocity[3]; // Mean initial velocity
+  f32 spread;      // Largest random change of each velocity component
+  f32 rate;        // Particles spawned per second
+  f32 life[2];     // Range of lifetimes, in seconds
+  f32 drag;        // Fraction of the velocity lost per second
+  f32 size;        // Edge length of the quads
+  u8 color[4];     // Alpha fades out over a particle's life
+  u32 capacity;    // Particles alive at once at most
+  u32 material;    // Any id of the caller's, see `particle_system_draw`
+};
+
+struct ParticleStats {
+  u32 emitters;
+  u32 particles; // Alive after the last update
+  u32 spawned;   // By the last update
+  f64 updateMs;
+};
+
+// Instances the draws read, one per particle
+struct ParticleInstance {
+  f32 position[3];
+  f32 size;
+  u8 color[4];
+};
+
+void particle_system_initialize(void **state, const f32 *gravity);
+void particle_system_shutdown(void **state);
+u32 particle_emitter_create(void *state, const ParticleEmitterDesc &desc);
+// Spawns, simulates `dt` seconds and writes the instances; `jobSystemState` may be null
+void particle_system_update(void *state, void *jobSystemState, f32 dt);
+// Instances of the last update, grouped by material
+const ParticleInstance *particle_system_instances(void *state, u32 *outCount);
+void particle_system_get_stats(void *state, ParticleStats *outStats);
+
+// Needs a current GL context, as do the draws
+void particle_system_gpu_initialize(void *state);
+void particle_system_gpu_shutdown(void *state);
+// Uploads the instances of the last update, once per update before any draw
+void particle_system_upload(void *state);
+// Draws the particles of every emitter with `material` in one call, with the program of the
+// particle shading in use and blending set up
+void particle_system_draw(void *state, u32 material);
@@ -0,0 +1,247 @@
+#include "profiler.h"
+#include "filesystem.h"
+#include "opengl.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+static const u32 PROFILER_MAX_THREADS = 32;
+static const u32 PROFILER_RING_CAPACITY = 1 << 16; // Most recent zones kept per thread
+static const u32 PROFILER_GPU_LATENCY = 4;         // Frames in flight before queries are read
+static const u32 PROFILER_GPU_ZONES_PER_FRAME = 64;
+static const u32 PROFILER_GPU_RESYNC_FRAMES = 256;
+static const u32 PROFILER_INVALID_ZONE = 0xffffffff;
+
+struct ProfilerEvent {
+  const char *name;
+  u64 start;
+  u64 end;
+};
+
+// Single-producer single-consumer ring: the owning thread appends, `profiler_dump` consumes
+struct ProfilerThread {
+  u32 id;
+  char name[32];
+  std::atomic<u64> head;
+  std::atomic<u64> tail;
+  std::atomic<u64> dropped;
+  ProfilerEvent events[PROFILER_RING_CAPACITY];
+};
+
+struct ProfilerGpuFrame {
+  GLuint queries[PROFILER_GPU_ZONES_PER_FRAME * 2]; // Begin and end timestamp per zone
+  const char *names[PROFILER_GPU_ZONES_PER_FRAME];
+  u32 count;
+  u32 lastQuery; // Queries complete in issue order, so this one finishing means all did
+};
+
+struct ProfilerGpuState {
+  bool initialized;
+  ProfilerGpuFrame frames[PROFILER_GPU_LATENCY];
+  u32 current;
+  u32 framesSinceSync;
+  i64 offset; // CPU minus GPU clock, nanoseconds
+  ProfilerThread *track;
+};
+
+struct ProfilerState {
+  u64 baseTime;
+  std::atomic<ProfilerThread *> threads[PROFILER_MAX_THREADS]; // Null until published
+  std::atomic<u32> threadCount;
+  ProfilerGpuState gpu;
+};
+
+static ProfilerState *profiler = nullptr;
+static thread_local ProfilerThread *currentThread = nullptr;
+static thread_local bool threadRefused = false; // Came past PROFILER_MAX_THREADS, not retried
+
+// Gives the calling thread a ring, unless PROFILER_MAX_THREADS already have one
+static ProfilerThread *register_thread(const char *name) {
+  auto index = profiler->threadCount.load();
+  do {
+    if (index >= PROFILER_MAX_THREADS) {
+      threadRefused = true;
+      return nullptr;
+    }
+  } while (!profiler->threadCount.compare_exchange_weak(index, index + 1));
+  auto thread = new ProfilerThread();
+  thread->id = index + 1;
+  snprintf(thread->name, sizeof(thread->name), "%s", name);
+  profiler->threads[index].store(thread, std::memory_order_release);
+  return thread;
+}
+
+static ProfilerThread *get_current_thread() {
+  if (!currentThread && !threadRefused) {
+    char name[32];
+    snprintf(name, sizeof(name), "thread %u", profiler->threadCount.load() + 1);
+    currentThread = register_thread(name);
+  }
+  return currentThread;
+}
+
+static void push_event(ProfilerThread *thread, const char *name, u64 start, u64 end) {
+  auto head = thread->head.load(std::memory_order_relaxed);
+  if (head - thread->tail.load(std::memory_order_acquire) >= PROFILER_RING_CAPACITY) {
+    thread->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  thread->events[head & (PROFILER_RING_CAPACITY - 1)] = {name, start, end};
+  thread->head.store(head + 1, std::memory_order_release);
+}
+
+u64 profiler_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void profiler_system_initialize() {
+  profiler = new ProfilerState();
+  profiler->baseTime = profiler_now();
+}
+
+void profiler_system_shutdown() {
+  auto count = std::min(profiler->threadCount.load(), PROFILER_MAX_THREADS);
+  for (u32 i = 0; i < count; ++i) {
+    auto thread = profiler->threads[i].load(std::memory_order_acquire);
+    DELETE(thread)
+  }
+  DELETE(profiler)
+}
+
+void profiler_set_thread_name(const char *name) {
+  if (!profiler) { return; }
+  if (currentThread) {
+    snprintf(currentThread->name, sizeof(currentThread->name), "%s", name);
+  } else if (!threadRefused) {
+    currentThread = register_thread(name);
+  }
+}
+
+void profiler_record(const char *name, u64 start, u64 end) {
+  if (!profiler) { return; }
+  if (auto thread = get_current_thread(); thread) { push_event(thread, name, start, end); }
+}
+
+bool profiler_dump(const char *path) {
+  if (!profiler) { return false; }
+  File *file = nullptr;
+  if (!filesystem_open(&file, path, FILE_MODE_WRITE, false)) { return false; }
+
+  auto ok = filesystem_write_line(file, "{\"traceEvents\": [");
+  char line[256];
+  u64 written = 0, dropped = 0;
+  auto count = std::min(profiler->threadCount.load(), PROFILER_MAX_THREADS);
+  for (u32 i = 0; ok && i < count; ++i) {
+    auto thread = profiler->threads[i].load(std::memory_order_acquire);
+    if (!thread) { continue; } // Still being registered
+    snprintf(line, sizeof(line),
+             "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+             "\"args\": {\"name\": \"%s\"}},",
+             thread->id, thread->name);
+    ok = filesystem_write_line(file, line);
+
+    auto head = thread->head.load(std::memory_order_acquire);
+    auto tail = thread->tail.load(std::memory_order_relaxed);
+    for (auto at = tail; ok && at != head; ++at) {
+      const auto &event = thread->events[at & (PROFILER_RING_CAPACITY - 1)];
+      auto start = event.start > profiler->baseTime ? event.start - profiler->baseTime : 0;
+      auto duration = event.end > event.start ? event.end - event.start : 0;
+      snprintf(line, sizeof(line),
+               "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+               "\"dur\": %.3f},",
+               event.name, thread->id, start / 1000.0, duration / 1000.0);
+      ok = filesystem_write_line(file, line);
+      ++written;
+    }
+    thread->tail.store(head, std::memory_order_release);
+    dropped += thread->dropped.exchange(0, std::memory_order_relaxed);
+  }
+  // Metadata entry last, so every event line above can end with a comma
+  ok = ok && filesystem_write_line(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+                                         "\"args\": {\"name\": \"neon\"}}");
+  ok = ok && filesystem_write_line(file, "]}");
+  filesystem_close(&file);
+
+  printf("profiler: wrote %llu zones to '%s' (%llu dropped)\n", (unsigned long long)written, path,
+         (unsigned long long)dropped);
+  return ok;
+}
+
+static void gpu_sync_clock(ProfilerGpuState *gpu) {
+  GLint64 gpuTime = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+  gpu->offset = (i64)profiler_now() - gpuTime;
+  gpu->framesSinceSync = 0;
+}
+
+void profiler_gpu_initialize() {
+  if (!profiler) { return; }
+  auto &gpu = profiler->gpu;
+  for (auto &frame : gpu.frames) {
+    glGenQueries(PROFILER_GPU_ZONES_PER_FRAME * 2, frame.queries);
+    frame.count = 0;
+  }
+  gpu.current = 0;
+  gpu.track = register_thread("gpu");
+  gpu_sync_clock(&gpu);
+  gpu.initialized = gpu.track != nullptr;
+}
+
+void profiler_gpu_shutdown() {
+  if (!profiler || !profiler->gpu.initialized) { return; }
+  for (auto &frame : profiler->gpu.frames) {
+    glDeleteQueries(PROFILER_GPU_ZONES_PER_FRAME * 2, frame.queries);
+  }
+  profiler->gpu.initialized = false;
+}
+
+u32 profiler_gpu_begin(const char *name) {
+  if (!profiler || !profiler->gpu.initialized) { return PROFILER_INVALID_ZONE; }
+  auto &frame = profiler->gpu.frames[profiler->gpu.current];
+  if (frame.count >= PROFILER_GPU_ZONES_PER_FRAME) { return PROFILER_INVALID_ZONE; }
+  auto zone = frame.count++;
+  frame.names[zone] = name;
+  frame.lastQuery = zone * 2;
+  glQueryCounter(frame.queries[zone * 2], GL_TIMESTAMP);
+  return zone;
+}
+
+void profiler_gpu_end(u32 zone) {
+  if (zone == PROFILER_INVALID_ZONE) { return; }
+  auto &frame = profiler->gpu.frames[profiler->gpu.current];
+  frame.lastQuery = zone * 2 + 1;
+  glQueryCounter(frame.queries[zone * 2 + 1], GL_TIMESTAMP);
+}
+
+void profiler_gpu_frame() {
+  if (!profiler || !profiler->gpu.initialized) { return; }
+  auto &gpu = profiler->gpu;
+  gpu.current = (gpu.current + 1) % PROFILER_GPU_LATENCY;
+
+  // The slot about to be reused was submitted PROFILER_GPU_LATENCY frames ago; if the GPU is
+  // still behind, drop its zones rather than wait
+  auto &frame = gpu.frames[gpu.current];
+  if (frame.count > 0) {
+    GLint available = 0;
+    glGetQueryObjectiv(frame.queries[frame.lastQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      for (u32 i = 0; i < frame.count; ++i) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(frame.queries[i * 2], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+        push_event(gpu.track, frame.names[i], (u64)((i64)begin + gpu.offset),
+                   (u64)((i64)end + gpu.offset));
+      }
+    } else {
+      gpu.track->dropped.fetch_add(frame.count, std::memory_order_relaxed);
+    }
+    frame.count = 0;
+  }
+
+  // The two clocks drift apart over long sessions
+  if (++gpu.framesSinceSync >= PROFILER_GPU_RESYNC_FRAMES) { gpu_sync_clock(&gpu); }
+}
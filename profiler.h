@@ -0,0 +1,60 @@
+#pragma once
+
+#include "defines.h"
+
+/**
+ * Scoped CPU and GPU timing zones. Every thread records into its own lock-free ring, so a zone
+ * costs two clock reads and a store; GPU zones are resolved from timestamp queries a few frames
+ * later to avoid stalling the pipeline. `profiler_dump` writes whatever the rings currently hold
+ * as Chrome trace_event JSON (chrome://tracing, Perfetto).
+ *
+ * Zone names must be string literals or otherwise outlive the profiler.
+ */
+
+void profiler_system_initialize();
+void profiler_system_shutdown();
+// Names the calling thread's track in the trace
+void profiler_set_thread_name(const char *name);
+u64 profiler_now(); // Nanoseconds, steady clock
+void profiler_record(const char *name, u64 start, u64 end);
+bool profiler_dump(const char *path);
+
+// GPU zones, render thread only, with its GL context current
+void profiler_gpu_initialize();
+void profiler_gpu_shutdown();
+u32 profiler_gpu_begin(const char *name);
+void profiler_gpu_end(u32 zone);
+// Call once per frame after submitting it: collects the zones of older frames that completed
+void profiler_gpu_frame();
+
+class ProfilerScope {
+public:
+  explicit ProfilerScope(const char *name) : _name{name}, _start{profiler_now()} {}
+
+  ~ProfilerScope() { profiler_record(_name, _start, profiler_now()); }
+
+private:
+  const char *_name;
+  u64 _start;
+};
+
+class ProfilerGpuScope {
+public:
+  explicit ProfilerGpuScope(const char *name) : _zone{profiler_gpu_begin(name)} {}
+
+  ~ProfilerGpuScope() { profiler_gpu_end(_zone); }
+
+private:
+  u32 _zone;
+};
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+#if defined(NEON_PROFILER)
+#define PROFILE_ZONE(name) ProfilerScope PROFILER_CONCAT(profilerZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) ProfilerGpuScope PROFILER_CONCAT(profilerGpuZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_GPU_ZONE(name)
+#endif
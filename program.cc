@@ -1,10 +1,13 @@
 #include "program.h"
+#include "allocator.h"
+#include "logger.h"
+#include "memory_stats.h"
 #include "filesystem.h"
 
 bool shader_create(GLuint *shader, GLuint type, const char *path);
 void shader_destroy(GLuint shader);
 
-bool program_create(GLuint *program, const std::vector<GLuint> &shaders);
+bool program_create(GLuint *program, const GLuint *shaders, u32 shaderCount);
 
 bool shader_create(GLuint *shader, GLuint type, const char *path) {
   // Read from file
@@ -12,13 +15,15 @@ bool shader_create(GLuint *shader, GLuint type, const char *path) {
   if (!filesystem_open(&file, path, FILE_MODE_READ, false)) { return false; }
   u64 size = 0;
   if (!filesystem_size(file, &size)) { return false; }
-  auto buffer = (GLchar *)calloc(size, sizeof(GLchar));
+  auto mark = frame_arena_mark(); // The source is only needed until it is compiled
+  auto buffer = frame_arena_allocate_array<GLchar>(size + 1);
   u64 read = 0;
   if (!filesystem_read(file, buffer, &read)) {
-    free(buffer);
+    frame_arena_release(mark);
     filesystem_close(&file);
     return false;
   }
+  buffer[size] = '\0'; // Zero-terminated for glShaderSource
 
   // Create shader
   auto handle = glCreateShader(type);
@@ -32,38 +37,54 @@ bool shader_create(GLuint *shader, GLuint type, const char *path) {
 
     auto log = new GLchar[len];
     glGetShaderInfoLog(handle, len, &len, log);
-    fprintf(stderr, "shader compilation failed: %s\n", log);
+    LOG_ERROR("shader compilation failed: %s", log);
     delete[] log;
   }
   *shader = handle;
 
-  free(buffer);
+  frame_arena_release(mark);
   filesystem_close(&file);
   return true;
 }
 
 void shader_destroy(GLuint shader) { glDeleteShader(shader); }
 
-bool program_create(GLuint *program, const std::vector<std::pair<GLuint, const char *>> &files) {
-  std::vector<GLuint> shaders;
+bool program_create(GLuint *program,
+                    std::initializer_list<std::pair<GLuint, const char *>> files) {
+  GLuint shaders[PROGRAM_MAX_SHADERS];
+  u32 shaderCount = 0;
   for (const auto &it : files) {
     const auto &type = it.first;
     const auto &path = it.second;
+    if (shaderCount == PROGRAM_MAX_SHADERS) {
+      LOG_ERROR("too many shaders for one program: '%s'", path);
+      return false;
+    }
     GLuint shader;
     if (!shader_create(&shader, type, path)) { return false; }
-    shaders.emplace_back(shader);
+    shaders[shaderCount++] = shader;
   }
-  return program_create(program, shaders);
+  return program_create(program, shaders, shaderCount);
 }
 
 void program_use(GLuint program) { glUseProgram(program); }
 
-void program_destroy(GLuint program) { glDeleteProgram(program); }
+// The linked binary stands in for the driver's footprint, which GL does not expose
+static u64 program_gpu_size(GLuint program) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  return (u64)length;
+}
+
+void program_destroy(GLuint program) {
+  memory_stats_free(MEMORY_TAG_SHADER, MEMORY_DOMAIN_GPU, program_gpu_size(program));
+  glDeleteProgram(program);
+}
 
-bool program_create(GLuint *program, const std::vector<GLuint> &shaders) {
+bool program_create(GLuint *program, const GLuint *shaders, u32 shaderCount) {
   auto handle = glCreateProgram();
-  for (const auto &it : shaders) {
-    glAttachShader(handle, it);
+  for (u32 i = 0; i < shaderCount; ++i) {
+    glAttachShader(handle, shaders[i]);
   }
   glLinkProgram(handle);
   GLint linked;
@@ -74,13 +95,14 @@ bool program_create(GLuint *program, const std::vector<GLuint> &shaders) {
 
     auto log = new GLchar[len];
     glGetProgramInfoLog(handle, len, &len, log);
-    fprintf(stderr, "program linking failed: %s\n", log);
+    LOG_ERROR("program linking failed: %s", log);
     delete[] log;
     return false;
   }
-  for (const auto &it : shaders) {
-    shader_destroy(it);
+  for (u32 i = 0; i < shaderCount; ++i) {
+    shader_destroy(shaders[i]);
   }
+  memory_stats_allocate(MEMORY_TAG_SHADER, MEMORY_DOMAIN_GPU, program_gpu_size(handle));
   *program = handle;
   return true;
 }
@@ -105,6 +127,10 @@ void program_set_bool(GLuint program, const char *name, bool a) {
   glUniform1i(program_get_uniform_location(program, name), a);
 }
 
+void program_set_vec2(GLuint program, const char *name, GLfloat x, GLfloat y) {
+  glUniform2f(program_get_uniform_location(program, name), x, y);
+}
+
 void program_set_vec3(GLuint program, const char *name, const GLfloat *a) {
   glUniform3fv(program_get_uniform_location(program, name), 1, a);
 }
@@ -113,6 +139,10 @@ void program_set_vec3(GLuint program, const char *name, GLfloat x, GLfloat y, GL
   glUniform3f(program_get_uniform_location(program, name), x, y, z);
 }
 
+void program_set_vec4(GLuint program, const char *name, const GLfloat *a, u32 count) {
+  glUniform4fv(program_get_uniform_location(program, name), count, a);
+}
+
 void program_set_mat4f(GLuint program, const char *name, const GLfloat *a) {
   glUniformMatrix4fv(program_get_uniform_location(program, name), 1, GL_FALSE, a);
 }
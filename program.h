@@ -1,10 +1,14 @@
 #pragma once
 
 #include "defines.h"
-#include <OpenGL/gl3.h>
-#include <vector>
+#include "opengl.h"
+#include <initializer_list>
+#include <utility>
 
-bool program_create(GLuint *program, const std::vector<std::pair<GLuint, const char *>> &files);
+static const u32 PROGRAM_MAX_SHADERS = 5; // One per stage
+
+bool program_create(GLuint *program,
+                    std::initializer_list<std::pair<GLuint, const char *>> files);
 void program_use(GLuint program);
 void program_destroy(GLuint program);
 GLint program_get_uniform_location(GLuint program, const char *name);
@@ -12,6 +16,8 @@ void program_set_i32(GLuint program, const char *name, i32 a);
 void program_set_f32(GLuint program, const char *name, f32 a);
 void program_set_f64(GLuint program, const char *name, f64 a);
 void program_set_bool(GLuint program, const char *name, bool a);
+void program_set_vec2(GLuint program, const char *name, GLfloat x, GLfloat y);
 void program_set_vec3(GLuint program, const char *name, const GLfloat *a);
 void program_set_vec3(GLuint program, const char *name, GLfloat x, GLfloat y, GLfloat z);
+void program_set_vec4(GLuint program, const char *name, const GLfloat *a, u32 count = 1);
 void program_set_mat4f(GLuint program, const char *name, const GLfloat *a);
@@ -0,0 +1,503 @@
+#include "rasterizer.h"
+#include "job_system.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stb_image.h>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const u32 RASTER_TILE_SIZE = 64; // A multiple of the pixels tested at once
+#if defined(__AVX2__)
+static const u32 RASTER_LANES = 8;
+#elif defined(__SSE2__)
+static const u32 RASTER_LANES = 4;
+#else
+static const u32 RASTER_LANES = 1;
+#endif
+static const u32 RASTER_CHUNKS_PER_THREAD = 4; // Setup jobs, small enough to balance
+
+struct RasterVertexOut {
+  glm::vec4 clip;
+  glm::vec3 position; // World space
+  glm::vec3 normal;
+  glm::vec2 texCoord;
+};
+
+// Screen-space triangle: inside where all three edge functions are positive
+struct RasterTriangle {
+  f32 edgeA[3], edgeB[3], edgeC[3]; // e(x, y) = a * x + b * y + c
+  bool inclusive[3];                // Pixels exactly on the edge belong to this triangle
+  f32 depthA, depthB, depthC;       // Depth plane, same form
+  f32 invW[3];
+  glm::vec3 position[3]; // Attributes divided by w, to interpolate in screen space
+  glm::vec3 normal[3];
+  glm::vec2 texCoord[3];
+  i32 minX, minY, maxX, maxY; // Pixel bounds, inclusive and clamped to the framebuffer
+  u32 draw;
+};
+
+struct RasterDraw {
+  const RasterMesh *mesh;
+  u32 indexOffset;
+  u32 indexCount;
+  glm::mat4 model;
+  glm::mat3 normalMatrix;
+  const RasterMaterial *material;
+};
+
+// A run of consecutive draws set up by one job; the tiles walk the chunks in order, so triangles
+// keep their submission order whichever thread set them up
+struct RasterChunk {
+  u32 firstDraw;
+  u32 drawCount;
+  std::vector<RasterTriangle> triangles;
+  std::vector<std::vector<u32>> bins; // Triangle indices per tile
+};
+
+struct RasterTileQueue {
+  std::vector<u32> tiles;
+  std::atomic<u32> next;
+};
+
+struct RasterizerState {
+  void *jobSystemState;
+  u32 width;
+  u32 height;
+  u32 stride; // Pixels per row, whole tiles so a group of lanes never leaves its row
+  u32 tilesX;
+  u32 tilesY;
+  std::vector<u32> color; // RGBA8, bottom row first
+  std::vector<f32> depth;
+  u32 clearColor;
+  glm::mat4 viewProjection;
+  Lighting lighting;
+  std::vector<RasterDraw> draws;
+  std::vector<RasterChunk> chunks;
+  u32 chunkCount;
+  u32 queueCount; // One per thread
+  std::unique_ptr<RasterTileQueue[]> queues;
+};
+
+bool raster_texture_create(RasterTexture **texture, const char *filepath) {
+  stbi_set_flip_vertically_on_load(true); // Like texture_create, texture coordinates start low
+  int width, height, channels;
+  auto texels = stbi_load(filepath, &width, &height, &channels, 4);
+  if (!texels) {
+    LOG_ERROR("error loading image: '%s'", filepath);
+    return false;
+  }
+  auto handle = new RasterTexture();
+  handle->width = width;
+  handle->height = height;
+  handle->texels = texels;
+  memory_stats_allocate(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_CPU, (u64)width * height * 4);
+  *texture = handle;
+  return true;
+}
+
+void raster_texture_destroy(RasterTexture **texture) {
+  memory_stats_free(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_CPU,
+                    (u64)(*texture)->width * (*texture)->height * 4);
+  stbi_image_free((*texture)->texels);
+  DELETE(*texture)
+}
+
+static u64 framebuffer_size(const RasterizerState *s) {
+  return s->color.size() * sizeof(u32) + s->depth.size() * sizeof(f32);
+}
+
+static u32 pack_color(const glm::vec3 &color) {
+  auto c = glm::clamp(color, glm::vec3(0.0f), glm::vec3(1.0f)) * 255.0f + 0.5f;
+  return (u32)c.x | (u32)c.y << 8 | (u32)c.z << 16 | 0xFFu << 24;
+}
+
+void rasterizer_initialize(void **state, void *jobSystemState) {
+  auto s = new RasterizerState();
+  s->jobSystemState = jobSystemState;
+  s->queueCount = job_system_thread_count(jobSystemState);
+  s->queues.reset(new RasterTileQueue[s->queueCount]);
+  s->chunks.resize(s->queueCount * RASTER_CHUNKS_PER_THREAD);
+  *state = s;
+}
+
+void rasterizer_shutdown(void **state) {
+  auto s = (RasterizerState *)*state;
+  if (!s->color.empty()) {
+    memory_stats_free(MEMORY_TAG_RENDER_TARGET, MEMORY_DOMAIN_CPU, framebuffer_size(s));
+  }
+  DELETE(s);
+  *state = nullptr;
+}
+
+void rasterizer_begin_frame(void *state, u32 width, u32 height, const glm::vec3 &clearColor,
+                            const glm::mat4 &view, const glm::mat4 &projection,
+                            const Lighting &lighting) {
+  auto s = (RasterizerState *)state;
+  if (width != s->width || height != s->height) {
+    if (!s->color.empty()) {
+      memory_stats_free(MEMORY_TAG_RENDER_TARGET, MEMORY_DOMAIN_CPU, framebuffer_size(s));
+    }
+    s->width = width;
+    s->height = height;
+    s->tilesX = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    s->tilesY = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    s->stride = s->tilesX * RASTER_TILE_SIZE;
+    s->color.assign((size_t)s->stride * s->tilesY * RASTER_TILE_SIZE, 0);
+    s->depth.assign(s->color.size(), 1.0f);
+    memory_stats_allocate(MEMORY_TAG_RENDER_TARGET, MEMORY_DOMAIN_CPU, framebuffer_size(s));
+    for (auto &chunk : s->chunks) {
+      chunk.bins.assign(s->tilesX * s->tilesY, {});
+    }
+  }
+  s->clearColor = pack_color(clearColor);
+  s->viewProjection = projection * view;
+  s->lighting = lighting;
+  s->draws.clear();
+}
+
+void rasterizer_draw(void *state, const RasterMesh *mesh, u32 indexOffset, u32 indexCount,
+                     const glm::mat4 &model, const RasterMaterial *material) {
+  auto s = (RasterizerState *)state;
+  if (indexOffset + indexCount > mesh->indexCount) {
+    LOG_ERROR("draw of indices [%u, %u) out of range (%u indices)", indexOffset,
+              indexOffset + indexCount, mesh->indexCount);
+    return;
+  }
+  // As materials.vert does it
+  auto normalMatrix = glm::mat3(glm::transpose(glm::inverse(model)));
+  s->draws.push_back({mesh, indexOffset, indexCount, model, normalMatrix, material});
+}
+
+static RasterVertexOut lerp_vertex(const RasterVertexOut &a, const RasterVertexOut &b, f32 t) {
+  return {a.clip + (b.clip - a.clip) * t, glm::mix(a.position, b.position, t),
+          glm::mix(a.normal, b.normal, t), a.texCoord + (b.texCoord - a.texCoord) * t};
+}
+
+// Projects a triangle to the framebuffer and bins it, unless it faces away or misses
+static void setup_triangle(RasterizerState *s, RasterChunk *chunk, u32 draw,
+                           const RasterVertexOut *v0, const RasterVertexOut *v1,
+                           const RasterVertexOut *v2) {
+  const RasterVertexOut *v[3] = {v0, v1, v2};
+  f32 x[3], y[3], z[3];
+  RasterTriangle t;
+  for (u32 i = 0; i < 3; ++i) {
+    auto invW = 1.0f / v[i]->clip.w;
+    x[i] = (v[i]->clip.x * invW * 0.5f + 0.5f) * (f32)s->width;
+    y[i] = (v[i]->clip.y * invW * 0.5f + 0.5f) * (f32)s->height;
+    z[i] = v[i]->clip.z * invW * 0.5f + 0.5f;
+    t.invW[i] = invW;
+    t.position[i] = v[i]->position * invW;
+    t.normal[i] = v[i]->normal * invW;
+    t.texCoord[i] = v[i]->texCoord * invW;
+  }
+  auto area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (area <= 0.0f) { return; } // Back-facing or degenerate, counter-clockwise is front
+
+  t.minX = std::max(0, (i32)std::floor(std::min({x[0], x[1], x[2]})));
+  t.minY = std::max(0, (i32)std::floor(std::min({y[0], y[1], y[2]})));
+  t.maxX = std::min((i32)s->width - 1, (i32)std::ceil(std::max({x[0], x[1], x[2]})));
+  t.maxY = std::min((i32)s->height - 1, (i32)std::ceil(std::max({y[0], y[1], y[2]})));
+  if (t.minX > t.maxX || t.minY > t.maxY) { return; }
+
+  for (u32 i = 0; i < 3; ++i) {
+    auto j = (i + 1) % 3;
+    t.edgeA[i] = y[i] - y[j];
+    t.edgeB[i] = x[j] - x[i];
+    t.edgeC[i] = -(t.edgeA[i] * x[i] + t.edgeB[i] * y[i]);
+    // A shared edge runs the other way in the neighbouring triangle, so exactly one of the two
+    // owns the pixels on it: no gaps and no double shading
+    t.inclusive[i] = t.edgeA[i] > 0.0f || (t.edgeA[i] == 0.0f && t.edgeB[i] > 0.0f);
+  }
+  t.depthA = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+  t.depthB = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) / area;
+  t.depthC = z[0] - t.depthA * x[0] - t.depthB * y[0];
+  t.draw = draw;
+
+  auto index = (u32)chunk->triangles.size();
+  chunk->triangles.push_back(t);
+  for (auto ty = t.minY / (i32)RASTER_TILE_SIZE; ty <= t.maxY / (i32)RASTER_TILE_SIZE; ++ty) {
+    for (auto tx = t.minX / (i32)RASTER_TILE_SIZE; tx <= t.maxX / (i32)RASTER_TILE_SIZE; ++tx) {
+      chunk->bins[ty * s->tilesX + tx].push_back(index);
+    }
+  }
+}
+
+static void setup_chunk(u32 index, u32 worker, void *userData) {
+  auto s = (RasterizerState *)userData;
+  auto &chunk = s->chunks[index];
+  chunk.triangles.clear();
+  for (auto &bin : chunk.bins) {
+    bin.clear();
+  }
+  for (auto d = chunk.firstDraw; d < chunk.firstDraw + chunk.drawCount; ++d) {
+    const auto &draw = s->draws[d];
+    auto mvp = s->viewProjection * draw.model;
+    const auto *indices = draw.mesh->indices + draw.indexOffset;
+    for (u32 i = 0; i + 2 < draw.indexCount; i += 3) {
+      RasterVertexOut in[3];
+      for (u32 j = 0; j < 3; ++j) {
+        const auto *vertex = draw.mesh->vertices + (size_t)indices[i + j] * 8;
+        auto position = glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+        in[j].clip = mvp * position;
+        in[j].position = glm::vec3(draw.model * position);
+        in[j].normal = draw.normalMatrix * glm::vec3(vertex[3], vertex[4], vertex[5]);
+        in[j].texCoord = glm::vec2(vertex[6], vertex[7]);
+      }
+
+      // Clip against the near plane (z >= -w); the other planes are left to the bounds
+      RasterVertexOut polygon[4];
+      u32 count = 0;
+      for (u32 j = 0; j < 3; ++j) {
+        const auto &a = in[j], &b = in[(j + 1) % 3];
+        auto da = a.clip.z + a.clip.w, db = b.clip.z + b.clip.w;
+        if (da >= 0.0f) { polygon[count++] = a; }
+        if ((da >= 0.0f) != (db >= 0.0f)) { polygon[count++] = lerp_vertex(a, b, da / (da - db)); }
+      }
+      for (u32 j = 1; j + 1 < count; ++j) {
+        setup_triangle(s, &chunk, d, &polygon[0], &polygon[j], &polygon[j + 1]);
+      }
+    }
+  }
+}
+
+static glm::vec3 sample(const RasterTexture *texture, const glm::vec2 &texCoord) {
+  if (!texture) { return glm::vec3(1.0f); }
+  // GL_REPEAT and GL_NEAREST
+  auto u = texCoord.x - std::floor(texCoord.x), v = texCoord.y - std::floor(texCoord.y);
+  auto x = std::min((u32)(u * (f32)texture->width), texture->width - 1);
+  auto y = std::min((u32)(v * (f32)texture->height), texture->height - 1);
+  const auto *texel = texture->texels + ((size_t)y * texture->width + x) * 4;
+  return glm::vec3(texel[0], texel[1], texel[2]) * (1.0f / 255.0f);
+}
+
+static glm::vec3 reflect(const glm::vec3 &incident, const glm::vec3 &normal) {
+  return incident - 2.0f * glm::dot(normal, incident) * normal;
+}
+
+// calculateDirectionalLight, calculatePointLight and calculateSpotLight of materials.frag
+static glm::vec3 shade_material(const Lighting &lighting, const RasterMaterial &material,
+                                const glm::vec3 &fragPosition, const glm::vec3 &vertexNormal,
+                                const glm::vec2 &texCoord) {
+  auto normal = glm::normalize(vertexNormal);
+  auto viewDirection = glm::normalize(lighting.viewPosition - fragPosition);
+  auto diffuseTexel = sample(material.diffuse, texCoord);
+  auto specularTexel = sample(material.specular, texCoord);
+  auto specularFactor = [&](const glm::vec3 &lightDirection) {
+    auto reflectDirection = reflect(-lightDirection, normal);
+    return std::pow(std::max(glm::dot(viewDirection, reflectDirection), 0.0f),
+                    material.shininess);
+  };
+
+  glm::vec3 result;
+  {
+    const auto &light = lighting.directionalLight;
+    auto lightDirection = glm::normalize(-light.direction);
+    auto diff = std::max(glm::dot(normal, lightDirection), 0.0f);
+    auto spec = specularFactor(lightDirection);
+    result = light.ambient * diffuseTexel + light.diffuse * diff * diffuseTexel +
+             light.specular * spec * specularTexel;
+  }
+  {
+    const auto &light = lighting.pointLight;
+    auto lightDirection = glm::normalize(light.position - fragPosition);
+    auto diff = std::max(glm::dot(normal, lightDirection), 0.0f);
+    auto spec = specularFactor(lightDirection);
+    auto distance = glm::length(light.position - fragPosition);
+    auto attenuation =
+        1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    result += (light.ambient * diffuseTexel + light.diffuse * diff * diffuseTexel +
+               light.specular * spec * specularTexel) *
+              attenuation;
+  }
+  {
+    const auto &light = lighting.spotLight;
+    auto lightDirection = glm::normalize(light.position - fragPosition);
+    auto diff = std::max(glm::dot(normal, lightDirection), 0.0f);
+    auto spec = specularFactor(lightDirection);
+    auto distance = glm::length(light.position - fragPosition);
+    auto attenuation =
+        1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    auto theta = glm::dot(lightDirection, glm::normalize(-light.direction));
+    auto epsilon = light.cutOff - light.outerCutOff;
+    auto intensity = glm::clamp((theta - light.outerCutOff) / epsilon, 0.0f, 1.0f);
+    result += (light.ambient * diffuseTexel + light.diffuse * diff * diffuseTexel +
+               light.specular * spec * specularTexel) *
+              (attenuation * intensity);
+  }
+  return result;
+}
+
+/**
+ * Tests the lanes of pixels from `x` on one row against the edges and the depth buffer
+ * @param rowEdge, rowDepth the edge functions and depth at x = 0 of the row
+ * @return a bit per lane that is covered and nearer than what is stored
+ */
+static u32 cover_lanes(const RasterTriangle &t, i32 x, const f32 *rowEdge, f32 rowDepth,
+                       const f32 *depth) {
+#if defined(__AVX2__)
+  auto px = _mm256_add_ps(_mm256_set1_ps((f32)x),
+                          _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f));
+  auto zero = _mm256_setzero_ps();
+  auto inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  for (u32 i = 0; i < 3; ++i) {
+    auto e = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.edgeA[i]), px),
+                           _mm256_set1_ps(rowEdge[i]));
+    auto onSide = t.inclusive[i] ? _mm256_cmp_ps(e, zero, _CMP_GE_OQ)
+                                 : _mm256_cmp_ps(e, zero, _CMP_GT_OQ);
+    inside = _mm256_and_ps(inside, onSide);
+  }
+  auto z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.depthA), px), _mm256_set1_ps(rowDepth));
+  auto nearer = _mm256_cmp_ps(z, _mm256_loadu_ps(depth), _CMP_LT_OQ);
+  return (u32)_mm256_movemask_ps(_mm256_and_ps(inside, nearer));
+#elif defined(__SSE2__)
+  auto px = _mm_add_ps(_mm_set1_ps((f32)x), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+  auto zero = _mm_setzero_ps();
+  auto inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  for (u32 i = 0; i < 3; ++i) {
+    auto e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.edgeA[i]), px), _mm_set1_ps(rowEdge[i]));
+    inside = _mm_and_ps(inside, t.inclusive[i] ? _mm_cmpge_ps(e, zero) : _mm_cmpgt_ps(e, zero));
+  }
+  auto z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.depthA), px), _mm_set1_ps(rowDepth));
+  auto nearer = _mm_cmplt_ps(z, _mm_loadu_ps(depth));
+  return (u32)_mm_movemask_ps(_mm_and_ps(inside, nearer));
+#else
+  auto px = (f32)x + 0.5f;
+  for (u32 i = 0; i < 3; ++i) {
+    auto e = t.edgeA[i] * px + rowEdge[i];
+    if (t.inclusive[i] ? e < 0.0f : e <= 0.0f) { return 0; }
+  }
+  return t.depthA * px + rowDepth < depth[0] ? 1u : 0u;
+#endif
+}
+
+static void rasterize_triangle(RasterizerState *s, const RasterTriangle &t, i32 tileX,
+                               i32 tileY) {
+  // Whole groups of lanes from the tile's left edge, the edge functions mask the overhang
+  auto x0 = std::max(t.minX, tileX) & ~(i32)(RASTER_LANES - 1);
+  auto x1 = std::min(t.maxX, tileX + (i32)RASTER_TILE_SIZE - 1);
+  auto y0 = std::max(t.minY, tileY);
+  auto y1 = std::min(t.maxY, tileY + (i32)RASTER_TILE_SIZE - 1);
+  const auto &draw = s->draws[t.draw];
+  for (auto y = y0; y <= y1; ++y) {
+    auto py = (f32)y + 0.5f;
+    f32 rowEdge[3];
+    for (u32 i = 0; i < 3; ++i) {
+      rowEdge[i] = t.edgeB[i] * py + t.edgeC[i];
+    }
+    auto rowDepth = t.depthB * py + t.depthC;
+    auto depthRow = s->depth.data() + (size_t)y * s->stride;
+    auto colorRow = s->color.data() + (size_t)y * s->stride;
+    for (auto x = x0; x <= x1; x += RASTER_LANES) {
+      auto lanes = cover_lanes(t, x, rowEdge, rowDepth, depthRow + x);
+      while (lanes) {
+        auto px = x + __builtin_ctz(lanes);
+        lanes &= lanes - 1;
+        auto fx = (f32)px + 0.5f;
+        depthRow[px] = t.depthA * fx + rowDepth;
+        if (!draw.material) {
+          colorRow[px] = pack_color(glm::vec3(1.0f));
+          continue;
+        }
+        // Each vertex weighs the edge function opposite to it, over w for perspective
+        auto w0 = t.edgeA[1] * fx + rowEdge[1], w1 = t.edgeA[2] * fx + rowEdge[2],
+             w2 = t.edgeA[0] * fx + rowEdge[0];
+        auto q = 1.0f / (w0 * t.invW[0] + w1 * t.invW[1] + w2 * t.invW[2]);
+        auto position = (t.position[0] * w0 + t.position[1] * w1 + t.position[2] * w2) * q;
+        auto normal = (t.normal[0] * w0 + t.normal[1] * w1 + t.normal[2] * w2) * q;
+        auto texCoord = (t.texCoord[0] * w0 + t.texCoord[1] * w1 + t.texCoord[2] * w2) * q;
+        colorRow[px] =
+            pack_color(shade_material(s->lighting, *draw.material, position, normal, texCoord));
+      }
+    }
+  }
+}
+
+static void render_tile(RasterizerState *s, u32 tile) {
+  auto tileX = (i32)((tile % s->tilesX) * RASTER_TILE_SIZE);
+  auto tileY = (i32)((tile / s->tilesX) * RASTER_TILE_SIZE);
+  for (u32 y = 0; y < RASTER_TILE_SIZE; ++y) {
+    auto offset = (size_t)(tileY + y) * s->stride + tileX;
+    std::fill_n(s->color.data() + offset, RASTER_TILE_SIZE, s->clearColor);
+    std::fill_n(s->depth.data() + offset, RASTER_TILE_SIZE, 1.0f);
+  }
+  for (u32 c = 0; c < s->chunkCount; ++c) {
+    const auto &chunk = s->chunks[c];
+    for (auto index : chunk.bins[tile]) {
+      rasterize_triangle(s, chunk.triangles[index], tileX, tileY);
+    }
+  }
+}
+
+// Drains the queue of one thread, then helps the others
+static void drain_tiles(u32 index, u32 worker, void *userData) {
+  auto s = (RasterizerState *)userData;
+  for (u32 i = 0; i < s->queueCount; ++i) {
+    auto &queue = s->queues[(index + i) % s->queueCount];
+    for (;;) {
+      auto next = queue.next.fetch_add(1, std::memory_order_relaxed);
+      if (next >= queue.tiles.size()) { break; }
+      render_tile(s, queue.tiles[next]);
+    }
+  }
+}
+
+void rasterizer_end_frame(void *state) {
+  auto s = (RasterizerState *)state;
+  {
+    PROFILE_ZONE("raster/setup");
+    // Split the draws into runs of about the same number of indices
+    u64 totalIndices = 0;
+    for (const auto &draw : s->draws) {
+      totalIndices += draw.indexCount;
+    }
+    auto maxChunks = (u32)s->chunks.size();
+    auto perChunk = std::max<u64>(1, (totalIndices + maxChunks - 1) / maxChunks);
+    s->chunkCount = 0;
+    u64 chunkIndices = 0;
+    for (u32 d = 0; d < s->draws.size(); ++d) {
+      if (s->chunkCount == 0 || (chunkIndices >= perChunk && s->chunkCount < maxChunks)) {
+        auto &chunk = s->chunks[s->chunkCount++];
+        chunk.firstDraw = d;
+        chunk.drawCount = 0;
+        chunkIndices = 0;
+      }
+      s->chunks[s->chunkCount - 1].drawCount += 1;
+      chunkIndices += s->draws[d].indexCount;
+    }
+    job_system_parallel_for(s->jobSystemState, s->chunkCount, setup_chunk, s);
+  }
+  {
+    PROFILE_ZONE("raster/tiles");
+    // Neighbouring tiles go to different threads, a dense area of the screen is then shared
+    for (u32 q = 0; q < s->queueCount; ++q) {
+      s->queues[q].tiles.clear();
+      s->queues[q].next.store(0, std::memory_order_relaxed);
+    }
+    for (u32 tile = 0; tile < s->tilesX * s->tilesY; ++tile) {
+      s->queues[tile % s->queueCount].tiles.push_back(tile);
+    }
+    job_system_parallel_for(s->jobSystemState, s->queueCount, drain_tiles, s);
+  }
+}
+
+void rasterizer_get_size(void *state, u32 *outWidth, u32 *outHeight) {
+  auto s = (RasterizerState *)state;
+  *outWidth = s->width;
+  *outHeight = s->height;
+}
+
+void rasterizer_read_pixels(void *state, u8 *outPixels, u32 stride) {
+  auto s = (RasterizerState *)state;
+  for (u32 y = 0; y < s->height; ++y) {
+    const auto *row = s->color.data() + (size_t)(s->height - 1 - y) * s->stride;
+    std::copy_n((const u8 *)row, (size_t)s->width * 4, outPixels + (size_t)y * stride);
+  }
+}
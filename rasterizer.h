@@ -0,0 +1,57 @@
+#pragma once
+
+#include "defines.h"
+#include "lighting.h"
+#include <glm/glm.hpp>
+
+/**
+ * Software renderer for the lit scene, for machines without a GPU or GL driver. Draws are recorded
+ * between `rasterizer_begin_frame` and `rasterizer_end_frame`. At the end, their triangles are
+ * transformed, clipped against the near plane and binned into 64x64 tiles by the job system; then
+ * every thread drains its own queue of tiles and steals from the others once it runs dry. As in
+ * the GL path, back faces are culled and the depth test passes strictly nearer fragments, so of
+ * two at equal depth the earlier draw wins. Lit draws are shaded by a port of
+ * shaders/materials.frag, the others are white like shaders/light_cube.frag.
+ */
+
+// Interleaved like the GL vertex buffers: position, normal, texture coordinate
+struct RasterMesh {
+  const f32 *vertices; // 8 floats per vertex
+  u32 vertexCount;
+  const u32 *indices;
+  u32 indexCount;
+};
+
+// CPU copy of an image, sampled like the GL textures: nearest texel, repeating
+struct RasterTexture {
+  u32 width;
+  u32 height;
+  u8 *texels; // RGBA, bottom row first
+};
+
+bool raster_texture_create(RasterTexture **texture, const char *filepath);
+void raster_texture_destroy(RasterTexture **texture);
+
+struct RasterMaterial {
+  RasterTexture *diffuse;
+  RasterTexture *specular;
+  f32 shininess;
+};
+
+void rasterizer_initialize(void **state, void *jobSystemState);
+void rasterizer_shutdown(void **state);
+// Starts recording a frame, the framebuffer is resized to `width` x `height` when needed
+void rasterizer_begin_frame(void *state, u32 width, u32 height, const glm::vec3 &clearColor,
+                            const glm::mat4 &view, const glm::mat4 &projection,
+                            const Lighting &lighting);
+/**
+ * Records a draw of indexed triangles; the mesh and material must outlive the frame
+ * @param material null for plain white
+ */
+void rasterizer_draw(void *state, const RasterMesh *mesh, u32 indexOffset, u32 indexCount,
+                     const glm::mat4 &model, const RasterMaterial *material);
+// Renders everything recorded since `rasterizer_begin_frame`
+void rasterizer_end_frame(void *state);
+void rasterizer_get_size(void *state, u32 *outWidth, u32 *outHeight);
+// Copies the last frame as RGBA, top row first
+void rasterizer_read_pixels(void *state, u8 *outPixels, u32 stride);
@@ -0,0 +1,483 @@
+#include "render_graph.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static const u32 RENDER_GRAPH_MAX_COLOR_ATTACHMENTS = 4;
+// Pool textures and framebuffers unused for this many frames are released, e.g. after a resize
+static const u64 RENDER_GRAPH_EVICT_FRAMES = 8;
+static const u32 RENDER_GRAPH_NONE = ~0u;
+
+struct RenderGraphFormat {
+  GLenum internalFormat;
+  GLenum format; // Of the null upload that allocates the storage
+  GLenum type;
+  u32 bytesPerTexel;
+  GLenum attachment;
+};
+
+static const RenderGraphFormat RENDER_GRAPH_FORMATS[] = {
+    {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, GL_COLOR_ATTACHMENT0},
+    {GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8, GL_COLOR_ATTACHMENT0},
+    {GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT, 4, GL_COLOR_ATTACHMENT0},
+    {GL_RG16F, GL_RG, GL_HALF_FLOAT, 4, GL_COLOR_ATTACHMENT0},
+    {GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, GL_COLOR_ATTACHMENT0},
+    {GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 4, GL_DEPTH_ATTACHMENT},
+    {GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, 4, GL_DEPTH_ATTACHMENT},
+    {GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 4, GL_DEPTH_STENCIL_ATTACHMENT},
+};
+
+struct RenderGraphResource {
+  const char *name;
+  RenderGraphTextureDesc desc;
+  const RenderGraphFormat *format; // Transient only
+  GLuint framebuffer;              // Imported only
+  bool imported;
+  u32 lastWriter; // Pass, to chain writers in the order they were added
+  u32 firstUse;   // Positions in the execution order
+  u32 lastUse;
+  u32 physical; // Pool texture
+};
+
+struct RenderGraphPass {
+  const char *name;
+  PFN_render_pass fn;
+  void *userData;
+  u32 colors[RENDER_GRAPH_MAX_COLOR_ATTACHMENTS];
+  u32 colorCount;
+  u32 depth;
+  u32 imported;        // Written framebuffer owned outside of the graph
+  u32 dependencyCount; // Passes left to run before this one, while ordering
+  u32 position;        // In the execution order
+  bool needed;
+};
+
+struct RenderGraphRead {
+  u32 pass;
+  u32 resource;
+};
+
+struct RenderGraphEdge { // `to` runs after `from`
+  u32 from;
+  u32 to;
+};
+
+struct RenderGraphTexture {
+  RenderGraphTextureDesc desc;
+  GLuint texture;
+  u64 size;
+  u64 lastFrame;
+  u32 busyUntil; // Execution position of its last use this frame
+};
+
+struct RenderGraphFramebuffer {
+  GLuint framebuffer;
+  GLuint textures[RENDER_GRAPH_MAX_COLOR_ATTACHMENTS + 1]; // Colors, then depth
+  u64 lastFrame;
+};
+
+struct RenderGraphState {
+  bool aliasing;
+  u64 frame;
+  // Recorded this frame
+  std::vector<RenderGraphResource> resources;
+  std::vector<RenderGraphPass> passes;
+  std::vector<RenderGraphRead> reads;
+  std::vector<RenderGraphEdge> edges;
+  std::vector<u32> order;   // Passes to run
+  std::vector<u32> scratch; // Passes to visit when culling, textures to place
+  // Kept across frames
+  std::vector<RenderGraphTexture> textures;
+  std::vector<RenderGraphFramebuffer> framebuffers;
+  RenderGraphStats stats;
+};
+
+static const RenderGraphFormat *find_format(GLenum internalFormat) {
+  for (const auto &format : RENDER_GRAPH_FORMATS) {
+    if (format.internalFormat == internalFormat) { return &format; }
+  }
+  return nullptr;
+}
+
+static bool same_desc(const RenderGraphTextureDesc &a, const RenderGraphTextureDesc &b) {
+  return a.width == b.width && a.height == b.height && a.format == b.format;
+}
+
+void render_graph_create(void **state, bool aliasing) {
+  auto s = new RenderGraphState();
+  s->aliasing = aliasing;
+  *state = s;
+}
+
+static void release_texture(RenderGraphTexture *texture) {
+  memory_stats_free(MEMORY_TAG_RENDER_TARGET, MEMORY_DOMAIN_GPU, texture->size);
+  glDeleteTextures(1, &texture->texture);
+}
+
+void render_graph_destroy(void **state) {
+  auto s = (RenderGraphState *)*state;
+  for (const auto &framebuffer : s->framebuffers) {
+    glDeleteFramebuffers(1, &framebuffer.framebuffer);
+  }
+  for (auto &texture : s->textures) {
+    release_texture(&texture);
+  }
+  DELETE(s);
+  *state = nullptr;
+}
+
+void render_graph_begin(void *state) {
+  auto s = (RenderGraphState *)state;
+  s->resources.clear();
+  s->passes.clear();
+  s->reads.clear();
+  s->edges.clear();
+  s->order.clear();
+  ++s->frame;
+}
+
+u32 render_graph_import(void *state, const char *name, GLuint framebuffer, u32 width, u32 height) {
+  auto s = (RenderGraphState *)state;
+  RenderGraphResource resource{};
+  resource.name = name;
+  resource.desc = {width, height, GL_NONE};
+  resource.framebuffer = framebuffer;
+  resource.imported = true;
+  resource.lastWriter = RENDER_GRAPH_NONE;
+  s->resources.push_back(resource);
+  return (u32)s->resources.size() - 1;
+}
+
+u32 render_graph_create_texture(void *state, const char *name, const RenderGraphTextureDesc &desc) {
+  auto s = (RenderGraphState *)state;
+  RenderGraphResource resource{};
+  resource.name = name;
+  resource.desc = desc;
+  resource.format = find_format(desc.format);
+  if (!resource.format) {
+    LOG_ERROR("unsupported render target format 0x%x for '%s'", desc.format, name);
+  }
+  resource.lastWriter = RENDER_GRAPH_NONE;
+  resource.physical = RENDER_GRAPH_NONE;
+  s->resources.push_back(resource);
+  return (u32)s->resources.size() - 1;
+}
+
+u32 render_graph_add_pass(void *state, const char *name, PFN_render_pass fn, void *userData) {
+  auto s = (RenderGraphState *)state;
+  RenderGraphPass pass{};
+  pass.name = name;
+  pass.fn = fn;
+  pass.userData = userData;
+  pass.depth = RENDER_GRAPH_NONE;
+  pass.imported = RENDER_GRAPH_NONE;
+  s->passes.push_back(pass);
+  return (u32)s->passes.size() - 1;
+}
+
+void render_graph_read(void *state, u32 pass, u32 resource) {
+  auto s = (RenderGraphState *)state;
+  s->reads.push_back({pass, resource}); // Writers may still be added, they are matched later
+}
+
+void render_graph_write(void *state, u32 pass, u32 resource) {
+  auto s = (RenderGraphState *)state;
+  auto &p = s->passes[pass];
+  auto &r = s->resources[resource];
+  auto attachments = p.colorCount + (p.depth != RENDER_GRAPH_NONE ? 1 : 0);
+  if (r.imported) {
+    if (attachments > 0 || p.imported != RENDER_GRAPH_NONE) {
+      LOG_ERROR("pass '%s' writes '%s' next to other targets", p.name, r.name);
+      return;
+    }
+    p.imported = resource;
+  } else {
+    if (!r.format) { return; }
+    if (p.imported != RENDER_GRAPH_NONE) {
+      LOG_ERROR("pass '%s' writes '%s' next to other targets", p.name, r.name);
+      return;
+    }
+    if (attachments > 0) {
+      const auto &desc = s->resources[p.colorCount > 0 ? p.colors[0] : p.depth].desc;
+      if (r.desc.width != desc.width || r.desc.height != desc.height) {
+        LOG_ERROR("pass '%s' writes '%s' at another size than its other targets", p.name, r.name);
+        return;
+      }
+    }
+    if (r.format->attachment == GL_COLOR_ATTACHMENT0) {
+      if (p.colorCount == RENDER_GRAPH_MAX_COLOR_ATTACHMENTS) {
+        LOG_ERROR("pass '%s' writes too many color targets", p.name);
+        return;
+      }
+      p.colors[p.colorCount++] = resource;
+    } else if (p.depth == RENDER_GRAPH_NONE) {
+      p.depth = resource;
+    } else {
+      LOG_ERROR("pass '%s' writes two depth targets", p.name);
+      return;
+    }
+  }
+  if (r.lastWriter != RENDER_GRAPH_NONE) { s->edges.push_back({r.lastWriter, pass}); }
+  r.lastWriter = pass;
+}
+
+// Keeps the passes the imported writes depend on, directly or not
+static void cull_passes(RenderGraphState *s) {
+  auto &stack = s->scratch;
+  stack.clear();
+  for (u32 i = 0; i < s->passes.size(); ++i) {
+    if (s->passes[i].imported != RENDER_GRAPH_NONE) {
+      s->passes[i].needed = true;
+      stack.push_back(i);
+    }
+  }
+  while (!stack.empty()) {
+    auto pass = stack.back();
+    stack.pop_back();
+    for (const auto &edge : s->edges) {
+      if (edge.to != pass || s->passes[edge.from].needed) { continue; }
+      s->passes[edge.from].needed = true;
+      stack.push_back(edge.from);
+    }
+  }
+}
+
+// Topological order of the needed passes, the earliest added first among those ready to run
+static bool order_passes(RenderGraphState *s) {
+  for (const auto &edge : s->edges) {
+    if (s->passes[edge.to].needed) { ++s->passes[edge.to].dependencyCount; }
+  }
+  auto needed = (u32)std::count_if(s->passes.begin(), s->passes.end(),
+                                   [](const RenderGraphPass &pass) { return pass.needed; });
+  while (s->order.size() < needed) {
+    u32 next = RENDER_GRAPH_NONE;
+    for (u32 i = 0; i < s->passes.size() && next == RENDER_GRAPH_NONE; ++i) {
+      if (s->passes[i].needed && s->passes[i].dependencyCount == 0) { next = i; }
+    }
+    if (next == RENDER_GRAPH_NONE) {
+      LOG_ERROR("render graph has a cycle, skipping the frame");
+      return false;
+    }
+    s->passes[next].dependencyCount = RENDER_GRAPH_NONE; // Scheduled
+    s->passes[next].position = (u32)s->order.size();
+    s->order.push_back(next);
+    for (const auto &edge : s->edges) {
+      if (edge.from == next) { --s->passes[edge.to].dependencyCount; }
+    }
+  }
+  return true;
+}
+
+static void note_use(RenderGraphResource *resource, u32 position) {
+  resource->firstUse = std::min(resource->firstUse, position);
+  resource->lastUse = std::max(resource->lastUse, position);
+}
+
+// Gives every used transient texture a pool texture, shared with the ones used before it when
+// aliasing
+static void place_textures(RenderGraphState *s) {
+  for (auto &resource : s->resources) {
+    resource.firstUse = RENDER_GRAPH_NONE;
+    resource.lastUse = 0;
+  }
+  for (auto pass : s->order) {
+    const auto &p = s->passes[pass];
+    for (u32 i = 0; i < p.colorCount; ++i) {
+      note_use(&s->resources[p.colors[i]], p.position);
+    }
+    if (p.depth != RENDER_GRAPH_NONE) { note_use(&s->resources[p.depth], p.position); }
+  }
+  for (const auto &read : s->reads) {
+    if (s->passes[read.pass].needed) {
+      note_use(&s->resources[read.resource], s->passes[read.pass].position);
+    }
+  }
+
+  auto &placing = s->scratch;
+  placing.clear();
+  for (u32 i = 0; i < s->resources.size(); ++i) {
+    const auto &resource = s->resources[i];
+    if (!resource.imported && resource.format && resource.firstUse != RENDER_GRAPH_NONE) {
+      placing.push_back(i);
+    }
+  }
+  std::sort(placing.begin(), placing.end(), [s](u32 a, u32 b) {
+    return s->resources[a].firstUse < s->resources[b].firstUse;
+  });
+
+  auto &stats = s->stats;
+  stats.transientTextures = (u32)placing.size();
+  stats.physicalTextures = 0;
+  stats.transientBytes = 0;
+  stats.aliasedBytes = 0;
+  for (auto index : placing) {
+    auto &resource = s->resources[index];
+    resource.physical = RENDER_GRAPH_NONE;
+    for (u32 i = 0; i < s->textures.size(); ++i) {
+      const auto &texture = s->textures[i];
+      auto free = texture.lastFrame != s->frame ||
+                  (s->aliasing && texture.busyUntil < resource.firstUse);
+      if (free && same_desc(texture.desc, resource.desc)) {
+        resource.physical = i;
+        break;
+      }
+    }
+    if (resource.physical == RENDER_GRAPH_NONE) {
+      const auto &desc = resource.desc;
+      RenderGraphTexture texture{};
+      texture.desc = desc;
+      texture.size = memory_stats_image_size(desc.width, desc.height,
+                                             resource.format->bytesPerTexel, false);
+      glGenTextures(1, &texture.texture);
+      glBindTexture(GL_TEXTURE_2D, texture.texture);
+      glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0,
+                   resource.format->format, resource.format->type, nullptr);
+      auto filter = resource.format->attachment == GL_COLOR_ATTACHMENT0 ? GL_LINEAR : GL_NEAREST;
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      memory_stats_allocate(MEMORY_TAG_RENDER_TARGET, MEMORY_DOMAIN_GPU, texture.size);
+      resource.physical = (u32)s->textures.size();
+      s->textures.push_back(texture);
+    }
+    auto &texture = s->textures[resource.physical];
+    if (texture.lastFrame != s->frame) {
+      texture.lastFrame = s->frame;
+      ++stats.physicalTextures;
+      stats.aliasedBytes += texture.size;
+    }
+    texture.busyUntil = resource.lastUse;
+    stats.transientBytes += texture.size;
+  }
+  stats.peakTransientBytes = std::max(stats.peakTransientBytes, stats.transientBytes);
+  stats.peakAliasedBytes = std::max(stats.peakAliasedBytes, stats.aliasedBytes);
+}
+
+static void bind_targets(RenderGraphState *s, const RenderGraphPass &pass) {
+  if (pass.imported != RENDER_GRAPH_NONE) {
+    const auto &resource = s->resources[pass.imported];
+    glBindFramebuffer(GL_FRAMEBUFFER, resource.framebuffer);
+    glViewport(0, 0, resource.desc.width, resource.desc.height);
+    return;
+  }
+  GLuint textures[RENDER_GRAPH_MAX_COLOR_ATTACHMENTS + 1] = {};
+  for (u32 i = 0; i < pass.colorCount; ++i) {
+    textures[i] = s->textures[s->resources[pass.colors[i]].physical].texture;
+  }
+  if (pass.depth != RENDER_GRAPH_NONE) {
+    textures[RENDER_GRAPH_MAX_COLOR_ATTACHMENTS] =
+        s->textures[s->resources[pass.depth].physical].texture;
+  }
+  if (pass.colorCount == 0 && pass.depth == RENDER_GRAPH_NONE) { return; } // Nothing to draw to
+
+  RenderGraphFramebuffer *framebuffer = nullptr;
+  for (auto &cached : s->framebuffers) {
+    if (std::equal(textures, textures + RENDER_GRAPH_MAX_COLOR_ATTACHMENTS + 1, cached.textures)) {
+      framebuffer = &cached;
+      break;
+    }
+  }
+  if (!framebuffer) {
+    RenderGraphFramebuffer created{};
+    std::copy(textures, textures + RENDER_GRAPH_MAX_COLOR_ATTACHMENTS + 1, created.textures);
+    glGenFramebuffers(1, &created.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, created.framebuffer);
+    GLenum drawBuffers[RENDER_GRAPH_MAX_COLOR_ATTACHMENTS];
+    for (u32 i = 0; i < pass.colorCount; ++i) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textures[i],
+                             0);
+      drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+    }
+    if (pass.depth != RENDER_GRAPH_NONE) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, s->resources[pass.depth].format->attachment,
+                             GL_TEXTURE_2D, textures[RENDER_GRAPH_MAX_COLOR_ATTACHMENTS], 0);
+    }
+    if (pass.colorCount > 0) {
+      glDrawBuffers(pass.colorCount, drawBuffers);
+    } else { // Depth only
+      glDrawBuffer(GL_NONE);
+      glReadBuffer(GL_NONE);
+    }
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      LOG_ERROR("error creating the framebuffer of pass '%s'", pass.name);
+    }
+    s->framebuffers.push_back(created);
+    framebuffer = &s->framebuffers.back();
+  }
+  framebuffer->lastFrame = s->frame;
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer->framebuffer);
+  const auto &desc = s->resources[pass.colorCount > 0 ? pass.colors[0] : pass.depth].desc;
+  glViewport(0, 0, desc.width, desc.height);
+}
+
+// Releases what the last frames did not use. Framebuffers go first: any using an old texture was
+// not used since either.
+static void evict(RenderGraphState *s) {
+  auto old = [s](u64 lastFrame) { return lastFrame + RENDER_GRAPH_EVICT_FRAMES <= s->frame; };
+  auto framebuffers = std::remove_if(s->framebuffers.begin(), s->framebuffers.end(),
+                                     [&](const RenderGraphFramebuffer &framebuffer) {
+                                       if (!old(framebuffer.lastFrame)) { return false; }
+                                       glDeleteFramebuffers(1, &framebuffer.framebuffer);
+                                       return true;
+                                     });
+  s->framebuffers.erase(framebuffers, s->framebuffers.end());
+  auto textures =
+      std::remove_if(s->textures.begin(), s->textures.end(), [&](RenderGraphTexture &texture) {
+        if (!old(texture.lastFrame)) { return false; }
+        release_texture(&texture);
+        return true;
+      });
+  s->textures.erase(textures, s->textures.end());
+}
+
+void render_graph_execute(void *state) {
+  auto s = (RenderGraphState *)state;
+  for (const auto &read : s->reads) {
+    const auto &resource = s->resources[read.resource];
+    if (resource.lastWriter != RENDER_GRAPH_NONE) {
+      s->edges.push_back({resource.lastWriter, read.pass});
+    } else if (!resource.imported) {
+      LOG_ERROR("pass '%s' reads '%s', which no pass writes", s->passes[read.pass].name,
+                resource.name);
+    }
+  }
+  cull_passes(s);
+  auto &stats = s->stats;
+  stats.passes = (u32)s->passes.size();
+  if (!order_passes(s)) { return; }
+  stats.culledPasses = stats.passes - (u32)s->order.size();
+  place_textures(s);
+
+  GLint previousFramebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+  for (auto pass : s->order) {
+    const auto &p = s->passes[pass];
+    bind_targets(s, p);
+    p.fn(s, p.userData);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+  evict(s);
+}
+
+GLuint render_graph_get_texture(void *state, u32 resource) {
+  auto s = (RenderGraphState *)state;
+  return s->textures[s->resources[resource].physical].texture;
+}
+
+void render_graph_get_stats(void *state, RenderGraphStats *outStats) {
+  *outStats = ((RenderGraphState *)state)->stats;
+}
+
+void render_graph_print_stats(void *state) {
+  auto s = (RenderGraphState *)state;
+  const auto &stats = s->stats;
+  printf("render graph: %u passes, %u culled; peak transient memory %.2f MiB with aliasing %s, "
+         "%.2f MiB with a texture per resource (last frame %u textures in %u)\n",
+         stats.passes, stats.culledPasses, (f64)stats.peakAliasedBytes / MiB,
+         s->aliasing ? "on" : "off", (f64)stats.peakTransientBytes / MiB, stats.transientTextures,
+         stats.physicalTextures);
+}
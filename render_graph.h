@@ -0,0 +1,57 @@
+#pragma once
+
+#include "defines.h"
+#include "opengl.h"
+
+/**
+ * Frame graph: each frame, passes are recorded with the resources they read and write, then the
+ * graph drops the passes nothing visible depends on, orders the rest by their dependencies and
+ * gives every transient texture storage from a pool that persists across frames. With aliasing,
+ * transient textures of the same size and format whose lifetimes do not overlap share one GL
+ * texture. Passes run with a framebuffer of the textures they write already bound.
+ *
+ * A resource is read once all of its writers ran; several writers run in the order they were
+ * added. Passes writing an imported resource, e.g. the window, are what the frame is for and are
+ * never dropped.
+ */
+
+typedef void (*PFN_render_pass)(void *graph, void *userData);
+
+struct RenderGraphTextureDesc {
+  u32 width;
+  u32 height;
+  GLenum format; // Sized internal format, e.g. GL_RGBA8 or GL_DEPTH_COMPONENT24
+};
+
+struct RenderGraphStats {
+  u32 passes; // Of the last frame, the dropped ones included
+  u32 culledPasses;
+  u32 transientTextures;
+  u32 physicalTextures; // Pool textures the transient ones were placed in
+  u64 transientBytes;   // What the transient textures would take with a texture each
+  u64 aliasedBytes;     // What their pool textures take
+  u64 peakTransientBytes; // Largest of the above over all frames so far
+  u64 peakAliasedBytes;
+};
+
+// GL calls happen in `render_graph_execute` and `render_graph_destroy` only
+void render_graph_create(void **state, bool aliasing);
+void render_graph_destroy(void **state);
+
+// Starts recording a frame; the handles of the previous one are no longer valid
+void render_graph_begin(void *state);
+// A framebuffer owned outside of the graph, 0 for the window
+u32 render_graph_import(void *state, const char *name, GLuint framebuffer, u32 width, u32 height);
+u32 render_graph_create_texture(void *state, const char *name, const RenderGraphTextureDesc &desc);
+u32 render_graph_add_pass(void *state, const char *name, PFN_render_pass fn, void *userData);
+void render_graph_read(void *state, u32 pass, u32 resource);
+// Writes of a pass are its attachments: up to 4 color textures and a depth one of the same size,
+// or a single imported framebuffer
+void render_graph_write(void *state, u32 pass, u32 resource);
+// Culls, orders, places and runs the recorded passes, then rebinds the framebuffer bound before
+void render_graph_execute(void *state);
+// Storage of a transient texture, for the passes reading it
+GLuint render_graph_get_texture(void *state, u32 resource);
+
+void render_graph_get_stats(void *state, RenderGraphStats *outStats);
+void render_graph_print_stats(void *state);
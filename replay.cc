@@ -0,0 +1,231 @@
+#include "replay.h"
+#include "filesystem.h"
+#include "logger.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const char REPLAY_MAGIC[4] = {'N', 'R', 'P', 'L'};
+static const u32 REPLAY_VERSION = 1;
+static const u64 REPLAY_FLUSH_SIZE = 64 * KiB;
+
+// Which parts of the snapshot follow the frame's flag byte; the rest repeat the previous frame
+enum ReplayFrameFlags {
+  REPLAY_FRAME_TICK = 0x1,
+  REPLAY_FRAME_KEYS = 0x2,
+  REPLAY_FRAME_WHEEL = 0x4,
+  REPLAY_FRAME_MOUSE = 0x8,
+};
+
+struct ReplayState {
+  ReplayMode mode;
+  File *file;
+  std::vector<u8> buffer; // Pending bytes when recording, the whole file when playing back
+  u64 cursor;
+  u64 frameCount;
+  f32 tick;
+  InputSnapshot previous;
+};
+
+static void put(std::vector<u8> *buffer, const void *data, u64 size) {
+  auto bytes = (const u8 *)data;
+  buffer->insert(buffer->end(), bytes, bytes + size);
+}
+
+static void put_varint(std::vector<u8> *buffer, u64 value) {
+  while (value >= 0x80) {
+    buffer->push_back((u8)(value | 0x80));
+    value >>= 7;
+  }
+  buffer->push_back((u8)value);
+}
+
+static bool get(ReplayState *s, void *data, u64 size) {
+  if (s->cursor + size > s->buffer.size()) { return false; }
+  memcpy(data, &s->buffer[s->cursor], size);
+  s->cursor += size;
+  return true;
+}
+
+static bool get_varint(ReplayState *s, u64 *value) {
+  *value = 0;
+  for (u32 shift = 0; shift < 64; shift += 7) {
+    u8 byte;
+    if (!get(s, &byte, 1)) { return false; }
+    *value |= (u64)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) { return true; }
+  }
+  return false;
+}
+
+static bool flush(ReplayState *s) {
+  if (s->buffer.empty()) { return true; }
+  u64 written = 0;
+  auto ok = filesystem_write(s->file, s->buffer.size(), s->buffer.data(), &written);
+  s->buffer.clear();
+  return ok;
+}
+
+// Decodes the frame at the cursor on top of `previous`
+static bool decode_frame(ReplayState *s, f32 *tick, InputSnapshot *snapshot) {
+  u8 flags;
+  if (!get(s, &flags, 1)) { return false; }
+  if ((flags & REPLAY_FRAME_TICK) && !get(s, tick, sizeof(*tick))) { return false; }
+  if (flags & REPLAY_FRAME_KEYS) {
+    u8 words;
+    if (!get(s, &words, 1)) { return false; }
+    for (u32 i = 0; i < INPUT_KEY_WORDS; ++i) {
+      if ((words & (1u << i)) && !get(s, &snapshot->keys[i], sizeof(u64))) { return false; }
+    }
+  }
+  if (flags & REPLAY_FRAME_WHEEL) {
+    if (!get(s, &snapshot->wheelX, sizeof(i64)) || !get(s, &snapshot->wheelY, sizeof(i64)) ||
+        !get(s, &snapshot->preciseWheelX, sizeof(f64)) ||
+        !get(s, &snapshot->preciseWheelY, sizeof(f64))) {
+      return false;
+    }
+  }
+  if (flags & REPLAY_FRAME_MOUSE) {
+    if (!get(s, &snapshot->mouseX, sizeof(i32)) || !get(s, &snapshot->mouseY, sizeof(i32)) ||
+        !get(s, &snapshot->mouseMotionX, sizeof(i64)) ||
+        !get(s, &snapshot->mouseMotionY, sizeof(i64))) {
+      return false;
+    }
+  }
+  u64 sequence, timestamp;
+  if (!get_varint(s, &sequence) || !get_varint(s, &timestamp)) { return false; }
+  snapshot->sequence += sequence;
+  snapshot->timestamp += timestamp;
+  return true;
+}
+
+bool replay_create(void **state, const char *path, ReplayMode mode) {
+  auto s = new ReplayState();
+  s->mode = mode;
+  auto fileMode = mode == REPLAY_MODE_RECORD ? FILE_MODE_WRITE : FILE_MODE_READ;
+  if (!filesystem_open(&s->file, path, fileMode, true)) {
+    LOG_ERROR("error opening replay: '%s'", path);
+    DELETE(s);
+    return false;
+  }
+
+  if (mode == REPLAY_MODE_RECORD) {
+    put(&s->buffer, REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+    put(&s->buffer, &REPLAY_VERSION, sizeof(REPLAY_VERSION));
+    *state = s;
+    return true;
+  }
+
+  u64 size = 0;
+  auto ok = filesystem_size(s->file, &size);
+  if (ok) {
+    s->buffer.resize(size);
+    ok = filesystem_read(s->file, s->buffer.data(), &size);
+  }
+  char magic[4];
+  u32 version = 0;
+  if (!ok || !get(s, magic, sizeof(magic)) || memcmp(magic, REPLAY_MAGIC, sizeof(magic)) != 0 ||
+      !get(s, &version, sizeof(version)) || version != REPLAY_VERSION) {
+    LOG_ERROR("not a replay, or recorded by another version: '%s'", path);
+    filesystem_close(&s->file);
+    DELETE(s);
+    return false;
+  }
+
+  // Validate and count every frame up front, so playback never stops on a truncated file
+  auto start = s->cursor;
+  InputSnapshot snapshot{};
+  f32 tick = 0;
+  while (s->cursor < s->buffer.size()) {
+    if (!decode_frame(s, &tick, &snapshot)) {
+      LOG_ERROR("replay truncated after %llu frames: '%s'", (unsigned long long)s->frameCount,
+                path);
+      break;
+    }
+    s->frameCount += 1;
+  }
+  s->buffer.resize(s->cursor);
+  s->cursor = start;
+  *state = s;
+  return true;
+}
+
+void replay_destroy(void **state) {
+  auto s = (ReplayState *)*state;
+  if (s->mode == REPLAY_MODE_RECORD) {
+    if (!flush(s)) { LOG_ERROR("error writing replay"); }
+    printf("replay: recorded %llu frames\n", (unsigned long long)s->frameCount);
+  }
+  filesystem_close(&s->file);
+  DELETE(s);
+  *state = nullptr;
+}
+
+ReplayMode replay_get_mode(void *state) { return ((ReplayState *)state)->mode; }
+
+bool replay_write_frame(void *state, f32 tick, const InputSnapshot *snapshot) {
+  auto s = (ReplayState *)state;
+  const auto &previous = s->previous;
+  auto &buffer = s->buffer;
+
+  u8 words = 0;
+  for (u32 i = 0; i < INPUT_KEY_WORDS; ++i) {
+    words |= (u8)(snapshot->keys[i] != previous.keys[i]) << i;
+  }
+  u8 flags = 0;
+  // Compare bit patterns, the replayed simulation has to see exactly the same values
+  if (memcmp(&tick, &s->tick, sizeof(tick)) != 0 || s->frameCount == 0) {
+    flags |= REPLAY_FRAME_TICK;
+  }
+  if (words) { flags |= REPLAY_FRAME_KEYS; }
+  if (snapshot->wheelX != previous.wheelX || snapshot->wheelY != previous.wheelY ||
+      memcmp(&snapshot->preciseWheelX, &previous.preciseWheelX, sizeof(f64)) != 0 ||
+      memcmp(&snapshot->preciseWheelY, &previous.preciseWheelY, sizeof(f64)) != 0) {
+    flags |= REPLAY_FRAME_WHEEL;
+  }
+  if (snapshot->mouseX != previous.mouseX || snapshot->mouseY != previous.mouseY ||
+      snapshot->mouseMotionX != previous.mouseMotionX ||
+      snapshot->mouseMotionY != previous.mouseMotionY) {
+    flags |= REPLAY_FRAME_MOUSE;
+  }
+
+  put(&buffer, &flags, 1);
+  if (flags & REPLAY_FRAME_TICK) { put(&buffer, &tick, sizeof(tick)); }
+  if (flags & REPLAY_FRAME_KEYS) {
+    put(&buffer, &words, 1);
+    for (u32 i = 0; i < INPUT_KEY_WORDS; ++i) {
+      if (words & (1u << i)) { put(&buffer, &snapshot->keys[i], sizeof(u64)); }
+    }
+  }
+  if (flags & REPLAY_FRAME_WHEEL) {
+    put(&buffer, &snapshot->wheelX, sizeof(i64));
+    put(&buffer, &snapshot->wheelY, sizeof(i64));
+    put(&buffer, &snapshot->preciseWheelX, sizeof(f64));
+    put(&buffer, &snapshot->preciseWheelY, sizeof(f64));
+  }
+  if (flags & REPLAY_FRAME_MOUSE) {
+    put(&buffer, &snapshot->mouseX, sizeof(i32));
+    put(&buffer, &snapshot->mouseY, sizeof(i32));
+    put(&buffer, &snapshot->mouseMotionX, sizeof(i64));
+    put(&buffer, &snapshot->mouseMotionY, sizeof(i64));
+  }
+  // Both only ever grow; the same snapshot may be consumed by consecutive updates
+  put_varint(&buffer, snapshot->sequence - previous.sequence);
+  put_varint(&buffer, snapshot->timestamp - previous.timestamp);
+
+  s->tick = tick;
+  s->previous = *snapshot;
+  s->frameCount += 1;
+  return buffer.size() < REPLAY_FLUSH_SIZE || flush(s);
+}
+
+bool replay_read_frame(void *state, f32 *outTick, InputSnapshot *outSnapshot) {
+  auto s = (ReplayState *)state;
+  if (s->cursor >= s->buffer.size()) { return false; }
+  if (!decode_frame(s, &s->tick, &s->previous)) { return false; }
+  *outTick = s->tick;
+  *outSnapshot = s->previous;
+  return true;
+}
+
+u64 replay_frame_count(void *state) { return ((ReplayState *)state)->frameCount; }
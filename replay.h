@@ -0,0 +1,27 @@
+#pragma once
+
+#include "defines.h"
+#include "input.h"
+
+/**
+ * Input recordings: the snapshot each update consumed together with that update's time step.
+ * Feeding them back through the same simulation reproduces a session exactly, independently of
+ * the machine's frame rate.
+ *
+ * Frames are delta-encoded against the previous one, so an idle frame costs a few bytes.
+ */
+
+enum ReplayMode {
+  REPLAY_MODE_RECORD = 0x0,
+  REPLAY_MODE_PLAYBACK,
+};
+
+bool replay_create(void **state, const char *path, ReplayMode mode);
+// Flushes a recording to disk
+void replay_destroy(void **state);
+ReplayMode replay_get_mode(void *state);
+
+bool replay_write_frame(void *state, f32 tick, const InputSnapshot *snapshot);
+// @return false once every recorded frame was read
+bool replay_read_frame(void *state, f32 *outTick, InputSnapshot *outSnapshot);
+u64 replay_frame_count(void *state);
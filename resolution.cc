@@ -0,0 +1,145 @@
+#include "resolution.h"
+#include "frame_stats.h"
+#include "program.h"
+#include "render_graph.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+static const f32 RESOLUTION_MIN_SCALE = 0.25f;
+static const f32 RESOLUTION_STEP = 1.0f / 16; // Scales are multiples of this
+static const u32 RESOLUTION_SAMPLES = 8;      // GPU times each decision looks at
+// Frames to wait after a change: the GPU timings lag by a few frames, then a full window is needed
+// at the new size
+static const u32 RESOLUTION_SETTLE_FRAMES = 12;
+static const f64 RESOLUTION_HEADROOM = 0.8; // Only grow below this fraction of the target
+
+struct ResolutionState {
+  ResolutionOptions options;
+  std::atomic<f32> scale;
+  u32 framesSinceChange;
+
+  bool gpuInitialized;
+  GLuint program;
+  GLuint vao; // Empty, the upscale triangle is generated in the vertex shader
+  u32 targetWidth; // Size the scene renders at this frame
+  u32 targetHeight;
+  u32 outputWidth;
+  u32 outputHeight;
+  u32 source; // Render graph texture of the scene
+};
+
+static f32 quantize(f32 scale) {
+  scale = std::floor(scale / RESOLUTION_STEP) * RESOLUTION_STEP;
+  return std::clamp(scale, RESOLUTION_MIN_SCALE, 1.0f);
+}
+
+static bool is_active(ResolutionState *s) {
+  return s->gpuInitialized && (s->options.dynamic || s->options.scale < 1.0f);
+}
+
+void resolution_system_initialize(void **state, const ResolutionOptions &options) {
+  auto s = new ResolutionState();
+  s->options = options;
+  s->scale.store(options.dynamic ? quantize(options.scale) : std::clamp(options.scale, 0.1f, 1.0f));
+  *state = s;
+}
+
+void resolution_system_shutdown(void **state) {
+  auto s = (ResolutionState *)*state;
+  DELETE(s);
+  *state = nullptr;
+}
+
+f32 resolution_get_scale(void *state) {
+  return ((ResolutionState *)state)->scale.load(std::memory_order_relaxed);
+}
+
+bool resolution_gpu_initialize(void *state) {
+  auto s = (ResolutionState *)state;
+  if (!program_create(&s->program, {{GL_VERTEX_SHADER, "shaders/upscale.vert"},
+                                    {GL_FRAGMENT_SHADER, "shaders/upscale.frag"}})) {
+    return false;
+  }
+  glGenVertexArrays(1, &s->vao);
+  s->gpuInitialized = true;
+  return true;
+}
+
+void resolution_gpu_shutdown(void *state) {
+  auto s = (ResolutionState *)state;
+  if (!s->gpuInitialized) { return; }
+  glDeleteVertexArrays(1, &s->vao);
+  program_destroy(s->program);
+  s->gpuInitialized = false;
+}
+
+bool resolution_begin_frame(void *state, u32 width, u32 height, u32 *outWidth, u32 *outHeight) {
+  auto s = (ResolutionState *)state;
+  *outWidth = width;
+  *outHeight = height;
+  if (!is_active(s)) { return false; }
+
+  auto scale = s->scale.load(std::memory_order_relaxed);
+  s->targetWidth = std::max(1u, (u32)((f32)width * scale + 0.5f));
+  s->targetHeight = std::max(1u, (u32)((f32)height * scale + 0.5f));
+  s->outputWidth = width;
+  s->outputHeight = height;
+  *outWidth = s->targetWidth;
+  *outHeight = s->targetHeight;
+  return true;
+}
+
+static void upscale_pass(void *graphState, void *userData) {
+  auto s = (ResolutionState *)userData;
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_BLEND);
+
+  program_use(s->program);
+  program_set_i32(s->program, "source", 0);
+  // At full size this is a plain copy, sharpening would only add halos
+  auto upscaled = s->targetWidth < s->outputWidth || s->targetHeight < s->outputHeight;
+  program_set_f32(s->program, "sharpness", upscaled ? s->options.sharpness : 0.0f);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, render_graph_get_texture(graphState, s->source));
+  glBindVertexArray(s->vao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void resolution_add_upscale_pass(void *state, void *graphState, u32 source, u32 output) {
+  auto s = (ResolutionState *)state;
+  s->source = source;
+  auto pass = render_graph_add_pass(graphState, "upscale", upscale_pass, s);
+  render_graph_read(graphState, pass, source);
+  render_graph_write(graphState, pass, output);
+}
+
+void resolution_update(void *state, void *frameStatsState) {
+  auto s = (ResolutionState *)state;
+  if (!s->options.dynamic || ++s->framesSinceChange < RESOLUTION_SETTLE_FRAMES) { return; }
+
+  f32 samples[RESOLUTION_SAMPLES];
+  auto count = frame_stats_history(frameStatsState, FRAME_STAT_GPU, samples, RESOLUTION_SAMPLES);
+  if (count < RESOLUTION_SAMPLES) { return; }
+  // Upper quartile: reacts to sustained load, not to a single slow frame
+  std::sort(samples, samples + count);
+  auto gpuMs = (f64)samples[count * 3 / 4];
+
+  auto scale = s->scale.load(std::memory_order_relaxed);
+  // GPU time is roughly proportional to the pixel count, so to the square of the scale
+  auto fitting = scale * (f32)std::sqrt(s->options.targetGpuMs / std::max(gpuMs, 0.001));
+  auto next = scale;
+  if (gpuMs > s->options.targetGpuMs) {
+    next = std::min(quantize(fitting), quantize(scale - RESOLUTION_STEP));
+  } else if (gpuMs < s->options.targetGpuMs * RESOLUTION_HEADROOM) {
+    next = std::min(quantize(fitting), quantize(scale + RESOLUTION_STEP)); // One step at a time
+    next = std::max(next, scale);
+  }
+  if (next != scale) {
+    s->scale.store(next, std::memory_order_relaxed);
+    s->framesSinceChange = 0;
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "defines.h"
+
+/**
+ * Dynamic resolution: the scene renders into a render graph texture at a fraction of the output
+ * size and a pass upscales it onto the output, with light sharpening. In dynamic mode a controller
+ * picks the fraction from measured GPU time, moving between a few fixed steps so the graph's
+ * texture pool sees few sizes.
+ */
+
+struct ResolutionOptions {
+  f32 scale = 1.0f;     // Fixed scale, or the starting one in dynamic mode
+  bool dynamic = false; // Adjust the scale to keep GPU time under `targetGpuMs`
+  f64 targetGpuMs = 0;
+  f32 sharpness = 0.3f; // 0 for plain bilinear
+};
+
+void resolution_system_initialize(void **state, const ResolutionOptions &options);
+void resolution_system_shutdown(void **state);
+f32 resolution_get_scale(void *state); // Any thread
+
+// Render thread only, with its GL context current
+bool resolution_gpu_initialize(void *state);
+void resolution_gpu_shutdown(void *state);
+/**
+ * Picks the size to render a frame presented at `width` x `height` at.
+ * @param outWidth, outHeight the size to render the scene at
+ * @return whether the scene goes through `resolution_add_upscale_pass`, else it renders straight
+ * into the output
+ */
+bool resolution_begin_frame(void *state, u32 width, u32 height, u32 *outWidth, u32 *outHeight);
+// Adds the pass drawing `source`, a texture of the picked size, onto `output` of the frame's size
+void resolution_add_upscale_pass(void *state, void *graphState, u32 source, u32 output);
+// Reads recent GPU times and steps the scale, once per frame
+void resolution_update(void *state, void *frameStatsState);
@@ -1,7 +1,12 @@
 #version 410 core
 
+layout(std140) uniform MaterialBlock {
+    vec4 color;
+    float shininess;
+} material;
+
 out vec4 fragColor;
 
 void main() {
-    fragColor = vec4(1.0);
+    fragColor = material.color;
 }
@@ -1,9 +1,10 @@
 #version 410 core
 
-struct Material {
-    sampler2D diffuse;
-    sampler2D specular;
-    float shininess;
+// The material's inputs at the fragment, each map fetched once
+struct Surface {
+    vec3 normal;
+    vec3 diffuse;
+    vec3 specular;
 };
 
 struct DirectionalLight {
@@ -46,78 +47,87 @@ in vec2 vTexCoord;
 
 #define POINT_LIGHTS_NUM 1
 
+layout(std140) uniform MaterialBlock {
+    vec4 color; // Tints the diffuse map
+    float shininess;
+} material;
+
+uniform sampler2D materialDiffuse;
+uniform sampler2D materialSpecular;
 uniform vec3 viewPosition;
-uniform Material material;
 uniform DirectionalLight directionalLight;
 uniform PointLight pointLights[POINT_LIGHTS_NUM];
 uniform SpotLight spotLight;
 
-vec3 calculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDirection);
-vec3 calculatePointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDirection);
-vec3 calculateSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDirection);
+vec3 calculateDirectionalLight(DirectionalLight light, Surface surface, vec3 viewDirection);
+vec3 calculatePointLight(PointLight light, Surface surface, vec3 fragPos, vec3 viewDirection);
+vec3 calculateSpotLight(SpotLight light, Surface surface, vec3 fragPos, vec3 viewDirection);
 
 void main() {
-    vec3 normal = normalize(vNormal);
+    Surface surface;
+    surface.normal = normalize(vNormal);
+    surface.diffuse = texture(materialDiffuse, vTexCoord).rgb * material.color.rgb;
+    surface.specular = texture(materialSpecular, vTexCoord).rgb;
     vec3 viewDirection = normalize(viewPosition - vFragPosition);
 
-    vec3 result = calculateDirectionalLight(directionalLight, normal, viewDirection);
+    vec3 result = calculateDirectionalLight(directionalLight, surface, viewDirection);
 
     for (int i = 0; i < POINT_LIGHTS_NUM; ++i) {
-        result += calculatePointLight(pointLights[i], normal, vFragPosition, viewDirection);
+        result += calculatePointLight(pointLights[i], surface, vFragPosition, viewDirection);
     }
 
-    result += calculateSpotLight(spotLight, normal, vFragPosition, viewDirection);
+    result += calculateSpotLight(spotLight, surface, vFragPosition, viewDirection);
 
     fragColor = vec4(result, 1.0);
 }
 
-vec3 calculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 viewDirection) {
+vec3 calculateDirectionalLight(DirectionalLight light, Surface surface, vec3 viewDirection) {
     vec3 lightDirection = normalize(-light.direction);
 
     // diffuse
-    float diff = max(dot(normal, lightDirection), 0.0);
+    float diff = max(dot(surface.normal, lightDirection), 0.0);
 
     // specular
-    vec3 reflectDirection = reflect(-lightDirection, normal);
+    vec3 reflectDirection = reflect(-lightDirection, surface.normal);
     float spec = pow(max(dot(viewDirection, reflectDirection), 0.0), material.shininess);
 
-    vec3 ambient = light.ambient * texture(material.diffuse, vTexCoord).rgb;
-    vec3 diffuse = light.diffuse * diff * texture(material.diffuse, vTexCoord).rgb;
-    vec3 specular = light.specular * spec * texture(material.specular, vTexCoord).rgb;
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
     return ambient + diffuse + specular;
 }
 
-vec3 calculatePointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDirection) {
+vec3 calculatePointLight(PointLight light, Surface surface, vec3 fragPos, vec3 viewDirection) {
     vec3 lightDirection = normalize(light.position - fragPos);
 
     // diffuse
-    float diff = max(dot(normal, lightDirection), 0.0);
+    float diff = max(dot(surface.normal, lightDirection), 0.0);
 
     // specular
-    vec3 reflectDirection = reflect(-lightDirection, normal);
+    vec3 reflectDirection = reflect(-lightDirection, surface.normal);
     float spec = pow(max(dot(viewDirection, reflectDirection), 0.0), material.shininess);
 
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
 
-    vec3 ambient = light.ambient * texture(material.diffuse, vTexCoord).rgb;
-    vec3 diffuse = light.diffuse * diff * texture(material.diffuse, vTexCoord).rgb;
-    vec3 specular = light.specular * spec * texture(material.specular, vTexCoord).rgb;
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
     return ambient + diffuse + specular;
 }
 
-vec3 calculateSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDirection) {
+vec3 calculateSpotLight(SpotLight light, Surface surface, vec3 fragPos, vec3 viewDirection) {
     vec3 lightDirection = normalize(light.position - fragPos);
 
     // diffuse
-    float diff = max(dot(normal, lightDirection), 0.0);
+    float diff = max(dot(surface.normal, lightDirection), 0.0);
 
     // specular
-    vec3 reflectDirection = reflect(-lightDirection, normal);
+    vec3 reflectDirection = reflect(-lightDirection, surface.normal);
     float spec = pow(max(dot(viewDirection, reflectDirection), 0.0), material.shininess);
 
     // attenuation
@@ -129,9 +139,9 @@ vec3 calculateSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
 
-    vec3 ambient = light.ambient * texture(material.diffuse, vTexCoord).rgb;
-    vec3 diffuse = light.diffuse * diff * texture(material.diffuse, vTexCoord).rgb;
-    vec3 specular = light.specular * spec * texture(material.specular, vTexCoord).rgb;
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
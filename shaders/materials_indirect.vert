@@ -0,0 +1,36 @@
+#version 430 core
+
+// materials.vert for indirect draws: the model matrix comes from the object the draw's base
+// instance points at
+
+struct Object {
+    mat4 model;
+    vec4 sphere;
+    uint mesh;
+    uint lod;
+    uint pad0;
+    uint pad1;
+};
+
+layout(std430, binding = 0) readonly buffer Objects { Object objects[]; };
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in uint aObject; // One per instance, offset by the base instance
+
+out vec3 vFragPosition;
+out vec3 vNormal;
+out vec2 vTexCoord;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() {
+    mat4 model = objects[aObject].model;
+    vFragPosition = vec3(model * vec4(aPosition, 1.0));
+    vNormal = mat3(transpose(inverse(model))) * aNormal;
+    vTexCoord = aTexCoord;
+
+    gl_Position = projection * view * vec4(vFragPosition, 1.0);
+}
@@ -0,0 +1,36 @@
+#version 410 core
+
+// materials.vert for skinned meshes drawn instanced: every instance has `jointCount` skinning
+// matrices in the buffer texture, three texels of rows each, which also place it in the world
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec4 aJoints; // Indices, converted to floats
+layout(location = 4) in vec4 aWeights;
+
+out vec3 vFragPosition;
+out vec3 vNormal;
+out vec2 vTexCoord;
+
+uniform samplerBuffer jointMatrices;
+uniform int jointCount;
+uniform mat4 view;
+uniform mat4 projection;
+
+mat4 joint_matrix(float joint) {
+    int texel = (gl_InstanceID * jointCount + int(joint)) * 3;
+    return transpose(mat4(texelFetch(jointMatrices, texel), texelFetch(jointMatrices, texel + 1),
+                          texelFetch(jointMatrices, texel + 2), vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+void main() {
+    mat4 skin = aWeights.x * joint_matrix(aJoints.x) + aWeights.y * joint_matrix(aJoints.y) +
+                aWeights.z * joint_matrix(aJoints.z) + aWeights.w * joint_matrix(aJoints.w);
+    vFragPosition = vec3(skin * vec4(aPosition, 1.0));
+    // Joints only rotate and translate, so the blend of their rotations is close to rigid
+    vNormal = normalize(mat3(skin) * aNormal);
+    vTexCoord = aTexCoord;
+
+    gl_Position = projection * view * vec4(vFragPosition, 1.0);
+}
@@ -0,0 +1,9 @@
+#version 410 core
+
+in vec4 color;
+
+out vec4 fragColor;
+
+void main() {
+    fragColor = color;
+}
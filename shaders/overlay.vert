@@ -0,0 +1,13 @@
+#version 410 core
+
+layout(location = 0) in vec2 aPosition; // Pixels from the bottom-left corner
+layout(location = 1) in vec4 aColor;
+
+uniform vec2 viewport;
+
+out vec4 color;
+
+void main() {
+    gl_Position = vec4(aPosition / viewport * 2.0 - 1.0, 0.0, 1.0);
+    color = aColor;
+}
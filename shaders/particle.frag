@@ -0,0 +1,21 @@
+#version 410 core
+
+layout(std140) uniform MaterialBlock {
+    vec4 color;
+    float shininess;
+} material;
+
+in vec2 vCorner;
+in vec4 vColor;
+
+out vec4 fragColor;
+
+void main() {
+    // A disc fading out to its edge, premultiplied for additive or over blending alike
+    float falloff = 1.0 - dot(vCorner, vCorner);
+    if (falloff <= 0.0) {
+        discard;
+    }
+    vec4 color = vColor * material.color;
+    fragColor = vec4(color.rgb * color.a * falloff * falloff, color.a * falloff * falloff);
+}
@@ -0,0 +1,24 @@
+#version 410 core
+
+// Camera-facing quads drawn instanced from particles.h, the corners from the vertex id of a
+// four-vertex strip
+
+layout(location = 0) in vec4 aCenter; // Position, and the edge length in w
+layout(location = 1) in vec4 aColor;
+
+out vec2 vCorner;
+out vec4 vColor;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() {
+    vCorner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vColor = aColor;
+
+    // The rows of the view rotation are the camera's axes in the world
+    vec3 right = vec3(view[0][0], view[1][0], view[2][0]);
+    vec3 up = vec3(view[0][1], view[1][1], view[2][1]);
+    vec3 position = aCenter.xyz + (right * vCorner.x + up * vCorner.y) * (aCenter.w * 0.5);
+    gl_Position = projection * view * vec4(position, 1.0);
+}
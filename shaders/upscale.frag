@@ -0,0 +1,27 @@
+#version 410 core
+
+in vec2 texCoord;
+
+uniform sampler2D source;
+uniform float sharpness;
+
+out vec4 fragColor;
+
+void main() {
+    vec3 center = texture(source, texCoord).rgb;
+    if (sharpness <= 0.0) {
+        fragColor = vec4(center, 1.0);
+        return;
+    }
+
+    // Unsharp mask over the source texels, limited to the local range so edges do not ring
+    vec2 texel = 1.0 / vec2(textureSize(source, 0));
+    vec3 north = texture(source, texCoord + vec2(0.0, texel.y)).rgb;
+    vec3 south = texture(source, texCoord - vec2(0.0, texel.y)).rgb;
+    vec3 east = texture(source, texCoord + vec2(texel.x, 0.0)).rgb;
+    vec3 west = texture(source, texCoord - vec2(texel.x, 0.0)).rgb;
+    vec3 low = min(center, min(min(north, south), min(east, west)));
+    vec3 high = max(center, max(max(north, south), max(east, west)));
+    vec3 sharpened = center + (4.0 * center - north - south - east - west) * sharpness * 0.25;
+    fragColor = vec4(clamp(sharpened, low, high), 1.0);
+}
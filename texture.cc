@@ -1,20 +1,52 @@
 #include "texture.h"
+#include "allocator.h"
+#include "memory_stats.h"
 #include <stb_image.h>
 
-bool texture_create(Texture **texture, const char *filepath) {
-  stbi_set_flip_vertically_on_load(true);
-  int width, height, channels;
-  auto buffer = stbi_load(filepath, &width, &height, &channels, 0);
-  if (!buffer) { return false; }
+// One allocation per level, as streaming defines and releases them one at a time. Drivers pad RGB
+// texels to four bytes.
+static void allocate_levels(const Texture *texture) {
+  for (auto level = texture->definedLevel; level < texture->levels; ++level) {
+    auto bytes = texture_level_bytes(texture, level);
+    memory_stats_allocate(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_GPU, bytes);
+  }
+}
+
+static void free_levels(const Texture *texture) {
+  for (auto level = texture->definedLevel; level < texture->levels; ++level) {
+    memory_stats_free(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_GPU, texture_level_bytes(texture, level));
+  }
+}
+
+static u32 mip_count(u32 width, u32 height) {
+  u32 levels = 1;
+  while ((width | height) >> levels) { ++levels; }
+  return levels;
+}
 
+static ObjectPool<Texture> texturePool("Texture", MEMORY_TAG_TEXTURE);
+
+static GLuint create_texture_object(u32 levels, u32 baseLevel) {
   GLuint id;
   glGenTextures(1, &id);
-
   glBindTexture(GL_TEXTURE_2D, id);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  return id;
+}
+
+bool texture_create(Texture **texture, const char *filepath) {
+  stbi_set_flip_vertically_on_load(true);
+  int width, height, channels;
+  auto buffer = stbi_load(filepath, &width, &height, &channels, 0);
+  if (!buffer) { return false; }
+
+  auto levels = mip_count(width, height);
+  auto id = create_texture_object(levels, 0);
   GLint internalFormat = GL_RGBA;
   GLenum format = GL_RGBA;
   if (channels == 3) {
@@ -32,20 +64,64 @@ bool texture_create(Texture **texture, const char *filepath) {
 
   stbi_image_free(buffer);
 
-  auto handle = new Texture();
-  handle->id = id;
-  handle->width = width;
-  handle->height = height;
+  auto handle = texturePool.create();
+  *handle = {id, (u32)width, (u32)height, levels, 0, 0};
+  allocate_levels(handle);
   *texture = handle;
   return true;
 }
 
+void texture_create_partial(Texture **texture, u32 width, u32 height, u32 baseLevel,
+                            const u8 *const *levelTexels) {
+  auto handle = texturePool.create();
+  auto levels = mip_count(width, height);
+  *handle = {create_texture_object(levels, baseLevel), width, height, levels, baseLevel,
+             baseLevel};
+  for (auto level = baseLevel; level < levels; ++level) {
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, texture_level_width(handle, level),
+                 texture_level_height(handle, level), 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 levelTexels[level]);
+  }
+  allocate_levels(handle);
+  *texture = handle;
+}
+
 void texture_destroy(Texture **texture) {
   glDeleteTextures(1, &(*texture)->id);
-  DELETE(*texture)
+  free_levels(*texture);
+  texturePool.destroy(*texture);
+  *texture = nullptr;
 }
 
 void texture_bind(Texture *texture, u8 slot) {
   glActiveTexture(GL_TEXTURE0 + slot);
   glBindTexture(GL_TEXTURE_2D, texture->id);
 }
+
+void texture_define_level(Texture *texture) {
+  auto level = --texture->definedLevel;
+  glBindTexture(GL_TEXTURE_2D, texture->id);
+  glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, texture_level_width(texture, level),
+               texture_level_height(texture, level), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  memory_stats_allocate(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_GPU, texture_level_bytes(texture, level));
+}
+
+void texture_upload_rows(Texture *texture, u32 level, u32 firstRow, u32 rowCount,
+                         const u8 *texels) {
+  glBindTexture(GL_TEXTURE_2D, texture->id);
+  glTexSubImage2D(GL_TEXTURE_2D, level, 0, firstRow, texture_level_width(texture, level), rowCount,
+                  GL_RGBA, GL_UNSIGNED_BYTE, texels);
+}
+
+void texture_set_base_level(Texture *texture, u32 level) {
+  glBindTexture(GL_TEXTURE_2D, texture->id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+  texture->baseLevel = level;
+  // Empty images give the storage of the released levels back
+  for (; texture->definedLevel < level; ++texture->definedLevel) {
+    glTexImage2D(GL_TEXTURE_2D, texture->definedLevel, GL_RGBA8, 0, 0, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    memory_stats_free(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_GPU,
+                      texture_level_bytes(texture, texture->definedLevel));
+  }
+}
@@ -1,14 +1,42 @@
 #pragma once
 
 #include "defines.h"
-#include <OpenGL/gl3.h>
+#include "opengl.h"
+#include <algorithm>
 
 struct Texture {
   GLuint id;
   u32 width;
   u32 height;
+  u32 levels;       // Of the full mip chain
+  u32 baseLevel;    // Finest level sampled
+  u32 definedLevel; // Finest level with storage, at most `baseLevel` while finer ones upload
 };
 
 bool texture_create(Texture **texture, const char *filepath);
+/**
+ * RGBA texture of which only the levels from `baseLevel` on are resident, the finer ones to be
+ * streamed in with `texture_define_level` and `texture_upload_rows`, see texture_streamer.h
+ * @param levelTexels tightly packed texels of each level, only read from `baseLevel` on
+ */
+void texture_create_partial(Texture **texture, u32 width, u32 height, u32 baseLevel,
+                            const u8 *const *levelTexels);
 void texture_destroy(Texture **texture);
 void texture_bind(Texture *texture, u8 slot = 0);
+
+inline u32 texture_level_width(const Texture *texture, u32 level) {
+  return std::max(texture->width >> level, 1u);
+}
+inline u32 texture_level_height(const Texture *texture, u32 level) {
+  return std::max(texture->height >> level, 1u);
+}
+inline u64 texture_level_bytes(const Texture *texture, u32 level) {
+  return (u64)texture_level_width(texture, level) * texture_level_height(texture, level) * 4;
+}
+
+// Allocates the level just finer than the defined ones, still not sampled
+void texture_define_level(Texture *texture);
+void texture_upload_rows(Texture *texture, u32 level, u32 firstRow, u32 rowCount,
+                         const u8 *texels);
+// Samples from `level` on, which must be defined; levels finer than it are released
+void texture_set_base_level(Texture *texture, u32 level);
@@ -0,0 +1,509 @@
+#include "texture_streamer.h"
+#include "async_io.h"
+#include "logger.h"
+#include "memory_stats.h"
+#include "opengl.h"
+#include "profiler.h"
+#include "texture.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stb_image.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+static const u32 TEXTURE_STREAMER_TAIL_SIZE = 64; // Levels this small or smaller never leave
+static const u32 TEXTURE_STREAMER_MAX_LEVELS = 32;
+
+struct StreamedTexture {
+  Texture *texture; // Null for a free slot
+  std::string path;
+  u32 generation; // Tells the loads of a destroyed texture from those of the slot's next one
+  u32 tailLevel;
+  u32 wantedLevel;
+  u32 loadLevel;   // Finest level of the load in flight
+  bool loading;    // A load is in flight, or its upload
+  bool failed;     // The file could not be read again, not retried
+  bool requested;  // Since the last update
+  f32 pixelsPerUv; // Largest requested since the last update
+  f32 priority;    // Of the last update, 0 when nothing asked for the texture
+  u64 lastUsed;    // Update that last saw a request
+};
+
+struct TextureLoad {
+  u32 slot;
+  u32 generation;
+  u32 firstLevel;
+  u32 lastLevel; // Exclusive, the finest level resident
+  std::string path;
+  std::vector<u8> file; // Its bytes, when read through async I/O
+};
+
+// Texels of a finished load, uploaded coarsest level first
+struct TextureUpload {
+  TextureLoad load;
+  bool failed;
+  std::vector<u8> texels;
+  u64 offsets[TEXTURE_STREAMER_MAX_LEVELS]; // Of each level in `texels`
+  u32 level;                                // Being uploaded
+  u32 row;
+};
+
+struct TextureStreamerState {
+  void *asyncIoState;
+  u64 budgetBytes;
+  u64 uploadBytesPerFrame;
+  u64 residentBytes; // Levels defined, plus those reserved for the loads in flight
+  u64 updates;
+  std::vector<StreamedTexture> textures;
+  std::vector<u32> freeSlots;
+  std::unordered_map<Texture *, u32> slots;
+  std::deque<TextureUpload> uploads;
+  TextureStreamerStats stats;
+
+  std::thread loader;
+  std::mutex mutex;
+  std::condition_variable wake;     // A load was posted, or shutdown
+  std::condition_variable finished; // A load finished
+  std::deque<TextureLoad> loads;    // Read, to decode; guarded by `mutex` from here on
+  std::vector<TextureUpload> loaded;
+  u32 pendingLoads; // Posted and not yet in `loaded`
+  bool quit;
+};
+
+// A file read in flight for a load
+struct TextureRead {
+  TextureStreamerState *state;
+  TextureLoad load;
+  AsyncFile file;
+};
+
+// Box filter of 2x2 texels, clamped at the odd edge of a level; `destination` may be `source`
+static void downsample(const u8 *source, u32 width, u32 height, u8 *destination) {
+  auto outWidth = std::max(width / 2, 1u), outHeight = std::max(height / 2, 1u);
+  for (u32 y = 0; y < outHeight; ++y) {
+    const u8 *rows[2] = {source + (u64)std::min(2 * y, height - 1) * width * 4,
+                         source + (u64)std::min(2 * y + 1, height - 1) * width * 4};
+    for (u32 x = 0; x < outWidth; ++x) {
+      auto x0 = std::min(2 * x, width - 1) * 4, x1 = std::min(2 * x + 1, width - 1) * 4;
+      for (u32 c = 0; c < 4; ++c) {
+        auto sum = rows[0][x0 + c] + rows[0][x1 + c] + rows[1][x0 + c] + rows[1][x1 + c];
+        *destination++ = (u8)((sum + 2) >> 2);
+      }
+    }
+  }
+}
+
+/**
+ * Decodes the file to RGBA texels, to be freed with stbi_image_free
+ * @param file the bytes of the file when already read, null to read `path`
+ */
+static u8 *decode(const char *path, const std::vector<u8> *file, u32 *outWidth, u32 *outHeight) {
+  stbi_set_flip_vertically_on_load(true); // Like texture_create, texture coordinates start low
+  int width, height, channels;
+  auto texels = file ? stbi_load_from_memory(file->data(), (int)file->size(), &width, &height,
+                                             &channels, 4)
+                     : stbi_load(path, &width, &height, &channels, 4);
+  *outWidth = width;
+  *outHeight = height;
+  return texels;
+}
+
+/**
+ * Downsamples the decoded texels into levels [firstLevel, lastLevel), or to the end of the chain
+ * if shorter. The finer levels are only steps towards the first one, made over the decoded texels.
+ * @param outOffsets where each level from `firstLevel` on starts in `outTexels`
+ */
+static void build_levels(u8 *texels, u32 width, u32 height, u32 firstLevel, u32 lastLevel,
+                         std::vector<u8> *outTexels, u64 *outOffsets) {
+  u32 levels = 1;
+  while ((width | height) >> levels) { ++levels; }
+  lastLevel = std::min(lastLevel, levels);
+  for (u32 level = 0; level < firstLevel; ++level) {
+    downsample(texels, std::max(width >> level, 1u), std::max(height >> level, 1u), texels);
+  }
+  u64 bytes = 0;
+  for (auto level = firstLevel; level < lastLevel; ++level) {
+    outOffsets[level] = bytes;
+    bytes += (u64)std::max(width >> level, 1u) * std::max(height >> level, 1u) * 4;
+  }
+  outTexels->resize(bytes);
+  memcpy(outTexels->data(), texels, (u64)std::max(width >> firstLevel, 1u) *
+                                        std::max(height >> firstLevel, 1u) * 4);
+  for (auto level = firstLevel + 1; level < lastLevel; ++level) {
+    downsample(outTexels->data() + outOffsets[level - 1], std::max(width >> (level - 1), 1u),
+               std::max(height >> (level - 1), 1u), outTexels->data() + outOffsets[level]);
+  }
+}
+
+static void release_file(TextureLoad *load) {
+  if (load->file.empty()) { return; }
+  memory_stats_free(MEMORY_TAG_FILE, MEMORY_DOMAIN_CPU, load->file.size());
+  load->file = {};
+}
+
+static void loader_main(TextureStreamerState *s) {
+  for (;;) {
+    TextureLoad load;
+    {
+      std::unique_lock<std::mutex> lock(s->mutex);
+      s->wake.wait(lock, [s] { return s->quit || !s->loads.empty(); });
+      if (s->quit) { return; }
+      load = std::move(s->loads.front());
+      s->loads.pop_front();
+    }
+    PROFILE_ZONE("texture_streamer/load");
+    TextureUpload upload{};
+    u32 width, height;
+    auto texels = decode(load.path.c_str(), s->asyncIoState ? &load.file : nullptr, &width,
+                         &height);
+    release_file(&load);
+    upload.load = load;
+    upload.failed = !texels;
+    if (texels) {
+      build_levels(texels, width, height, load.firstLevel, load.lastLevel, &upload.texels,
+                   upload.offsets);
+      stbi_image_free(texels);
+      memory_stats_allocate(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_CPU, upload.texels.size());
+    }
+    upload.level = load.lastLevel - 1;
+    {
+      std::lock_guard<std::mutex> lock(s->mutex);
+      s->loaded.push_back(std::move(upload));
+      --s->pendingLoads;
+    }
+    s->finished.notify_all();
+  }
+}
+
+static u64 chain_bytes(const Texture *texture, u32 first, u32 last) {
+  u64 bytes = 0;
+  for (auto level = first; level < last; ++level) {
+    bytes += texture_level_bytes(texture, level);
+  }
+  return bytes;
+}
+
+// Lower priority first: smaller on screen, then asked for longer ago
+static bool lower_priority(const StreamedTexture &a, const StreamedTexture &b) {
+  if (a.priority != b.priority) { return a.priority < b.priority; }
+  return a.lastUsed < b.lastUsed;
+}
+
+// Whether `t` has streamed levels it may give up for `candidate`: levels finer than it wants, or
+// any once it matters less
+static bool can_evict(const StreamedTexture &t, const StreamedTexture &candidate) {
+  if (!t.texture || t.loading || &t == &candidate) { return false; }
+  if (t.texture->baseLevel >= t.tailLevel) { return false; }
+  return t.texture->baseLevel < t.wantedLevel || lower_priority(t, candidate);
+}
+
+static u64 evictable_bytes(const TextureStreamerState *s, const StreamedTexture &candidate) {
+  u64 bytes = 0;
+  for (const auto &t : s->textures) {
+    if (!can_evict(t, candidate)) { continue; }
+    auto keep = lower_priority(t, candidate) ? t.tailLevel : t.wantedLevel;
+    bytes += chain_bytes(t.texture, t.texture->baseLevel, std::max(keep, t.texture->baseLevel));
+  }
+  return bytes;
+}
+
+// Releases the finest level of a texture that can give one up, surplus levels first
+static bool evict_one(TextureStreamerState *s, const StreamedTexture &candidate) {
+  StreamedTexture *victim = nullptr;
+  auto victimSurplus = false;
+  for (auto &t : s->textures) {
+    if (!can_evict(t, candidate)) { continue; }
+    auto surplus = t.texture->baseLevel < t.wantedLevel;
+    if (!victim || (surplus && !victimSurplus) ||
+        (surplus == victimSurplus && lower_priority(t, *victim))) {
+      victim = &t;
+      victimSurplus = surplus;
+    }
+  }
+  if (!victim) { return false; }
+  auto level = victim->texture->baseLevel;
+  texture_set_base_level(victim->texture, level + 1);
+  s->residentBytes -= texture_level_bytes(victim->texture, level);
+  ++s->stats.evictions;
+  return true;
+}
+
+static void release_upload(TextureUpload *upload) {
+  if (!upload->failed) {
+    memory_stats_free(MEMORY_TAG_TEXTURE, MEMORY_DOMAIN_CPU, upload->texels.size());
+  }
+}
+
+// The texture the upload is for, null once it was destroyed
+static StreamedTexture *upload_target(TextureStreamerState *s, const TextureUpload &upload) {
+  auto &t = s->textures[upload.load.slot];
+  return t.texture && t.generation == upload.load.generation ? &t : nullptr;
+}
+
+// Uploads rows of the finished loads until `budget` bytes went to the GPU
+static void upload_loaded(TextureStreamerState *s, u64 budget) {
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    for (auto &upload : s->loaded) {
+      s->uploads.push_back(std::move(upload));
+    }
+    s->loaded.clear();
+  }
+  while (!s->uploads.empty()) {
+    auto &upload = s->uploads.front();
+    auto t = upload_target(s, upload);
+    if (t && upload.failed) {
+      LOG_ERROR("error streaming texture '%s'", t->path.c_str());
+      s->residentBytes -= chain_bytes(t->texture, upload.load.firstLevel, upload.load.lastLevel);
+      t->failed = true;
+    }
+    if (!t || upload.failed) {
+      if (t) { t->loading = false; }
+      release_upload(&upload);
+      s->uploads.pop_front();
+      continue;
+    }
+    if (budget == 0) { break; }
+
+    auto texture = t->texture;
+    if (upload.row == 0) { texture_define_level(texture); }
+    auto rowBytes = (u64)texture_level_width(texture, upload.level) * 4;
+    auto height = texture_level_height(texture, upload.level);
+    auto rows = (u32)std::clamp<u64>(budget / rowBytes, 1, height - upload.row);
+    auto texels = upload.texels.data() + upload.offsets[upload.level] + upload.row * rowBytes;
+    texture_upload_rows(texture, upload.level, upload.row, rows, texels);
+    upload.row += rows;
+    budget -= std::min(budget, rows * rowBytes);
+    s->stats.uploadedBytes += rows * rowBytes;
+    if (upload.row < height) { continue; }
+
+    // Finer levels show as soon as they are complete
+    texture_set_base_level(texture, upload.level);
+    upload.row = 0;
+    if (upload.level-- == upload.load.firstLevel) {
+      t->loading = false;
+      release_upload(&upload);
+      s->uploads.pop_front();
+    }
+  }
+}
+
+// Hands a load whose file could not be read to the next update
+static void post_failed(TextureStreamerState *s, TextureLoad *load) {
+  TextureUpload upload{};
+  upload.load = std::move(*load);
+  upload.failed = true;
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->loaded.push_back(std::move(upload));
+    --s->pendingLoads;
+  }
+  s->finished.notify_all();
+}
+
+static void on_file_read(void *userData, i64 result) {
+  auto read = (TextureRead *)userData;
+  auto s = read->state;
+  async_io_close(&read->file);
+  if (result != (i64)read->load.file.size()) {
+    release_file(&read->load);
+    post_failed(s, &read->load);
+  } else {
+    {
+      std::lock_guard<std::mutex> lock(s->mutex);
+      s->loads.push_back(std::move(read->load));
+    }
+    s->wake.notify_one();
+  }
+  DELETE(read);
+}
+
+// Queues the load for the loader thread, after a read of its file when streaming through async I/O
+static void post_load(TextureStreamerState *s, TextureLoad load) {
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    ++s->pendingLoads;
+    if (!s->asyncIoState) { s->loads.push_back(std::move(load)); }
+  }
+  if (!s->asyncIoState) {
+    s->wake.notify_one();
+    return;
+  }
+  auto read = new TextureRead{s, std::move(load)};
+  if (!async_io_open(&read->file, read->load.path.c_str(), FILE_MODE_READ)) {
+    post_failed(s, &read->load);
+    DELETE(read);
+    return;
+  }
+  read->load.file.resize(read->file.size);
+  memory_stats_allocate(MEMORY_TAG_FILE, MEMORY_DOMAIN_CPU, read->file.size);
+  async_io_read(s->asyncIoState, &read->file, 0, read->file.size, read->load.file.data(),
+                on_file_read, read);
+}
+
+void texture_streamer_initialize(void **state, u64 budgetBytes, u64 uploadBytesPerFrame,
+                                 void *asyncIoState) {
+  auto s = new TextureStreamerState();
+  s->asyncIoState = asyncIoState;
+  s->budgetBytes = budgetBytes;
+  s->uploadBytesPerFrame = uploadBytesPerFrame;
+  s->loader = std::thread(loader_main, s);
+  *state = s;
+}
+
+void texture_streamer_shutdown(void **state) {
+  auto s = (TextureStreamerState *)*state;
+  if (s->asyncIoState) { async_io_wait_idle(s->asyncIoState); } // Reads post to the loader
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->quit = true;
+  }
+  s->wake.notify_one();
+  s->loader.join();
+  for (auto &load : s->loads) {
+    release_file(&load);
+  }
+  for (auto &upload : s->loaded) {
+    release_upload(&upload);
+  }
+  for (auto &upload : s->uploads) {
+    release_upload(&upload);
+  }
+  for (auto &t : s->textures) {
+    if (t.texture) { texture_streamer_destroy(s, &t.texture); }
+  }
+  DELETE(s);
+  *state = nullptr;
+}
+
+bool texture_streamer_create(void *state, const char *filepath, Texture **outTexture) {
+  auto s = (TextureStreamerState *)state;
+  // Only the tail is built, the finer levels are left to the loads that stream them in
+  u32 width, height;
+  auto decoded = decode(filepath, nullptr, &width, &height);
+  if (!decoded) { return false; }
+  u32 tailLevel = 0;
+  while (std::max(width >> tailLevel, height >> tailLevel) > TEXTURE_STREAMER_TAIL_SIZE) {
+    ++tailLevel;
+  }
+  std::vector<u8> texels;
+  u64 offsets[TEXTURE_STREAMER_MAX_LEVELS];
+  build_levels(decoded, width, height, tailLevel, TEXTURE_STREAMER_MAX_LEVELS, &texels, offsets);
+  stbi_image_free(decoded);
+  const u8 *levelTexels[TEXTURE_STREAMER_MAX_LEVELS] = {};
+  for (auto level = tailLevel; (width | height) >> level; ++level) {
+    levelTexels[level] = texels.data() + offsets[level];
+  }
+  Texture *texture;
+  texture_create_partial(&texture, width, height, tailLevel, levelTexels);
+
+  u32 slot;
+  if (!s->freeSlots.empty()) {
+    slot = s->freeSlots.back();
+    s->freeSlots.pop_back();
+  } else {
+    slot = (u32)s->textures.size();
+    s->textures.emplace_back();
+  }
+  auto &t = s->textures[slot];
+  t = {texture, filepath, t.generation + 1, tailLevel, tailLevel};
+  s->slots[texture] = slot;
+  s->residentBytes += chain_bytes(texture, tailLevel, texture->levels);
+  ++s->stats.textures;
+  *outTexture = texture;
+  return true;
+}
+
+void texture_streamer_destroy(void *state, Texture **texture) {
+  auto s = (TextureStreamerState *)state;
+  auto found = s->slots.find(*texture);
+  auto &t = s->textures[found->second];
+  // Uploads of a load in flight find the slot's generation changed and are dropped
+  auto first = t.loading ? t.loadLevel : (*texture)->definedLevel;
+  s->residentBytes -= chain_bytes(*texture, first, (*texture)->levels);
+  s->freeSlots.push_back(found->second);
+  s->slots.erase(found);
+  t.texture = nullptr;
+  --s->stats.textures;
+  texture_destroy(texture);
+}
+
+void texture_streamer_request(void *state, Texture *texture, f32 pixelsPerUv) {
+  auto s = (TextureStreamerState *)state;
+  auto &t = s->textures[s->slots.at(texture)];
+  t.requested = true;
+  t.pixelsPerUv = std::max(t.pixelsPerUv, pixelsPerUv);
+}
+
+void texture_streamer_update(void *state) {
+  PROFILE_ZONE("texture_streamer/update");
+  auto s = (TextureStreamerState *)state;
+  ++s->updates;
+  upload_loaded(s, s->uploadBytesPerFrame);
+
+  // Wanted levels from the requests; textures nobody asked for keep theirs until room is needed
+  std::vector<u32> candidates;
+  for (u32 slot = 0; slot < s->textures.size(); ++slot) {
+    auto &t = s->textures[slot];
+    if (!t.texture) { continue; }
+    if (t.requested) {
+      auto size = (f32)std::max(t.texture->width, t.texture->height);
+      auto texelsPerPixel = size / std::max(t.pixelsPerUv, 1e-6f);
+      auto level = texelsPerPixel > 1.0f ? (u32)log2f(texelsPerPixel) : 0;
+      t.wantedLevel = std::min(level, t.tailLevel);
+      t.priority = t.pixelsPerUv;
+      t.lastUsed = s->updates;
+    } else {
+      t.wantedLevel = t.tailLevel;
+      t.priority = 0.0f;
+    }
+    t.requested = false;
+    t.pixelsPerUv = 0.0f;
+    if (!t.loading && !t.failed && t.wantedLevel < t.texture->baseLevel) {
+      candidates.push_back(slot);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [s](u32 a, u32 b) {
+    return lower_priority(s->textures[b], s->textures[a]);
+  });
+
+  // Each candidate gets the finest level the budget has room for once lower priority levels go
+  for (auto slot : candidates) {
+    auto &t = s->textures[slot];
+    auto resident = t.texture->baseLevel;
+    auto freeBytes = s->budgetBytes - std::min(s->budgetBytes, s->residentBytes);
+    auto room = freeBytes + evictable_bytes(s, t);
+    auto level = t.wantedLevel;
+    while (level < resident && chain_bytes(t.texture, level, resident) > room) { ++level; }
+    if (level == resident) { continue; }
+    auto bytes = chain_bytes(t.texture, level, resident);
+    while (s->residentBytes + bytes > s->budgetBytes && evict_one(s, t)) {}
+    s->residentBytes += bytes;
+    t.loading = true;
+    t.loadLevel = level;
+    ++s->stats.loads;
+    post_load(s, {slot, t.generation, level, resident, t.path});
+  }
+  if (s->asyncIoState) { async_io_submit(s->asyncIoState); } // The reads of all loads at once
+}
+
+void texture_streamer_finish(void *state) {
+  auto s = (TextureStreamerState *)state;
+  {
+    std::unique_lock<std::mutex> lock(s->mutex);
+    s->finished.wait(lock, [s] { return s->pendingLoads == 0; });
+  }
+  upload_loaded(s, UINT64_MAX);
+}
+
+void texture_streamer_get_stats(void *state, TextureStreamerStats *outStats) {
+  auto s = (TextureStreamerState *)state;
+  *outStats = s->stats;
+  outStats->residentBytes = s->residentBytes;
+  outStats->budgetBytes = s->budgetBytes;
+}
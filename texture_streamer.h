@@ -0,0 +1,43 @@
+#pragma once
+
+#include "defines.h"
+
+struct Texture;
+
+/**
+ * Mip residency of textures under a GPU memory budget. A streamed texture keeps the coarse tail of
+ * its mip chain resident; finer levels are decoded and downsampled on a loader thread when draws
+ * ask for them, then uploaded a few rows at a time within a per-frame byte budget, and sampled
+ * from once complete by lowering GL_TEXTURE_BASE_LEVEL. When a load does not fit the budget,
+ * levels of lower priority textures, those nobody asked for in longest first, are released.
+ * Given an async I/O state, the files of the loads are read through it, several at a time, and
+ * the loader thread only decodes them.
+ */
+
+struct TextureStreamerStats {
+  u32 textures;
+  u64 residentBytes; // With the levels of loads in flight
+  u64 budgetBytes;
+  u32 loads;         // Issued so far
+  u32 evictions;     // Levels released to make room
+  u64 uploadedBytes; // So far
+};
+
+// Needs a current GL context, as do all the other calls but `texture_streamer_request`
+void texture_streamer_initialize(void **state, u64 budgetBytes, u64 uploadBytesPerFrame,
+                                 void *asyncIoState = nullptr);
+void texture_streamer_shutdown(void **state);
+// Loads the file and creates the texture with its coarse levels resident
+bool texture_streamer_create(void *state, const char *filepath, Texture **outTexture);
+void texture_streamer_destroy(void *state, Texture **texture);
+/**
+ * Asks for the detail a draw needs of a texture until the next update. The level kept resident
+ * has at least one texel per pixel where the texture is magnified the least.
+ * @param pixelsPerUv screen pixels one unit of texture coordinates spans on the draw
+ */
+void texture_streamer_request(void *state, Texture *texture, f32 pixelsPerUv);
+// Uploads what the loader finished and starts the loads the requests since the last call need
+void texture_streamer_update(void *state);
+// Waits for the loads in flight and uploads them whole, e.g. for reproducible headless frames
+void texture_streamer_finish(void *state);
+void texture_streamer_get_stats(void *state, TextureStreamerStats *outStats);
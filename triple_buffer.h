@@ -0,0 +1,39 @@
+#pragma once
+
+#include "defines.h"
+#include <atomic>
+
+/**
+ * Lock-free single-producer single-consumer latest-value channel. The producer owns one slot, the
+ * consumer another and they trade the third through an atomic index, so neither side ever waits
+ * and the consumer always sees the most recent complete value.
+ */
+template <typename T> class TripleBuffer {
+public:
+  // Producer only: the slot to fill before `publish`
+  T &back() { return _slots[_back]; }
+
+  // Producer only
+  void publish() {
+    auto previous = _shared.exchange(_back | FRESH, std::memory_order_acq_rel);
+    _back = previous & ~FRESH;
+  }
+
+  // Consumer only: the latest published value, valid until the next call
+  const T &acquire() {
+    if (_shared.load(std::memory_order_relaxed) & FRESH) {
+      auto previous = _shared.exchange(_front, std::memory_order_acq_rel);
+      _front = previous & ~FRESH;
+    }
+    return _slots[_front];
+  }
+
+private:
+  // Set on the shared index when it holds a value the consumer has not picked up yet
+  static const u8 FRESH = 0x4;
+
+  T _slots[3] = {};
+  u8 _back = 0;
+  alignas(64) std::atomic<u8> _shared{1};
+  alignas(64) u8 _front = 2;
+};